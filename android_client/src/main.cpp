@@ -52,6 +52,37 @@ std::unique_ptr<EglData> egl_data;
 
 my_client_state my_state = {};
 
+/// Readable whenever the stream client has a new decoded frame, -1 while not registered on the looper.
+///
+/// The fd is level-triggered and only drained by taking a sample, so it must only be registered while we can render,
+/// otherwise every poll returns immediately.
+int sample_fd = -1;
+
+/// Looper timeout while rendering without a sample fd, so that we neither spin nor miss frames for long.
+constexpr int SAMPLE_POLL_TIMEOUT_MS = 5;
+
+bool can_render(struct android_app *app) {
+    return app->window && app->activityState == APP_CMD_RESUME && egl_data && renderer && my_state.stream_client;
+}
+
+void register_sample_fd(struct android_app *app) {
+    if (sample_fd >= 0 || !can_render(app)) {
+        return;
+    }
+    sample_fd = my_stream_client_get_sample_fd(my_state.stream_client);
+    if (sample_fd >= 0) {
+        ALooper_addFd(app->looper, sample_fd, LOOPER_ID_USER, ALOOPER_EVENT_INPUT, NULL, NULL);
+    }
+}
+
+void unregister_sample_fd(struct android_app *app) {
+    if (sample_fd < 0) {
+        return;
+    }
+    ALooper_removeFd(app->looper, sample_fd);
+    sample_fd = -1;
+}
+
 void connected_cb(MyConnection *connection, struct my_client_state *state) {
     ALOGI("%s: Got signal that we are connected!", __FUNCTION__);
 
@@ -65,9 +96,11 @@ void onAppCmd(struct android_app *app, int32_t cmd) {
             break;
         case APP_CMD_RESUME:
             ALOGI("APP_CMD_RESUME");
+            register_sample_fd(app);
             break;
         case APP_CMD_PAUSE:
             ALOGI("APP_CMD_PAUSE");
+            unregister_sample_fd(app);
             break;
         case APP_CMD_STOP:
             ALOGE("APP_CMD_STOP - shutting down connection");
@@ -110,9 +143,12 @@ void onAppCmd(struct android_app *app, int32_t cmd) {
                 renderer->reset();
                 abort();
             }
+
+            register_sample_fd(app);
         } break;
         case APP_CMD_TERM_WINDOW:
             ALOGI("APP_CMD_TERM_WINDOW - shutting down connection");
+            unregister_sample_fd(app);
             my_connection_disconnect(my_state.connection);
             my_state.connected = false;
             break;
@@ -120,7 +156,10 @@ void onAppCmd(struct android_app *app, int32_t cmd) {
 }
 
 /**
- * Poll for Android and OpenXR events, and handle them
+ * Poll for Android events, and handle them
+ *
+ * Blocks until either an Android event or a new decoded frame arrives, as the stream client's sample fd is
+ * registered on the looper while we can render. Without it, wakes up every SAMPLE_POLL_TIMEOUT_MS instead.
  *
  * @param state app state
  *
@@ -131,22 +170,31 @@ bool poll_events(struct android_app *app) {
     for (;;) {
         int events;
         struct android_poll_source *source;
-        bool wait = !app->window || app->activityState != APP_CMD_RESUME;
-        int timeout = wait ? -1 : 0;
-        if (ALooper_pollAll(timeout, NULL, &events, (void **)&source) >= 0) {
-            if (source) {
-                source->process(app, source);
+        // Without the sample fd there is nothing to wake us up for a new frame, so fall back to polling.
+        int timeout = (can_render(app) && sample_fd < 0) ? SAMPLE_POLL_TIMEOUT_MS : -1;
+        int ident = ALooper_pollAll(timeout, NULL, &events, (void **)&source);
+        if (ident == LOOPER_ID_USER) {
+            // A new frame has been decoded
+            if (can_render(app)) {
+                return true;
             }
+            // We would not take it, so the fd would stay readable
+            unregister_sample_fd(app);
+            continue;
+        }
+        if (ident < 0) {
+            // Timed out
+            return true;
+        }
 
-            if (timeout == 0 && (!app->window || app->activityState != APP_CMD_RESUME)) {
-                break;
-            }
-        } else {
-            break;
+        if (source) {
+            source->process(app, source);
         }
-    }
 
-    return true;
+        if (app->destroyRequested) {
+            return false;
+        }
+    }
 }
 
 } // namespace
@@ -198,7 +246,8 @@ void android_main(struct android_app *app) {
             continue;
         }
 
-        if (!egl_data || !renderer || !my_state.stream_client) {
+        if (!can_render(app)) {
+            unregister_sample_fd(app);
             continue;
         }
 
@@ -234,6 +283,8 @@ void android_main(struct android_app *app) {
 
     ALOGI("DEBUG: Exited main loop, cleaning up");
 
+    unregister_sample_fd(app);
+
     //
     // Clean up
     //
@@ -0,0 +1,175 @@
+#include <glib.h>
+#include <gst/gst.h>
+#include <stdlib.h>
+
+#ifdef G_OS_UNIX
+    #include <glib-unix.h>
+    #include <signal.h>
+#endif
+
+#include "../src/client/load_client.h"
+
+/// Clients are started this far apart rather than all at once, which would measure the signaling burst instead
+#define RAMP_INTERVAL_MS 50
+/// How often the aggregate is printed
+#define REPORT_INTERVAL_S 5
+
+struct load_generator {
+    GMainLoop *loop;
+    GPtrArray *clients;
+    guint n_clients;
+    const gchar *websocket_uri;
+    const gchar *video_codecs;
+    enum load_client_mode mode;
+
+    gint64 started_us;
+    /// Frames received by all clients at the previous report, for the frame rate
+    guint64 reported_frames;
+    gint64 reported_us;
+};
+
+static gboolean ramp_cb(struct load_generator *gen) {
+    struct load_client *client = load_client_new(gen->websocket_uri, gen->video_codecs, gen->mode);
+    g_ptr_array_add(gen->clients, client);
+    load_client_start(client);
+
+    return gen->clients->len < gen->n_clients ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void print_report(struct load_generator *gen, const gboolean final) {
+    guint connected = 0;
+    guint64 frames = 0;
+    guint64 packets = 0;
+    guint64 bytes = 0;
+    guint seq_gaps = 0;
+    gdouble bitrate_total = 0;
+    gdouble bitrate_min = G_MAXDOUBLE;
+    gdouble bitrate_max = 0;
+    gdouble loss_total = 0;
+    gdouble loss_max = 0;
+    gdouble rtt_total = 0;
+    gdouble rtt_max = 0;
+    guint n_rtt = 0;
+    gint64 connect_total_us = 0;
+    gint64 connect_max_us = 0;
+    guint n_connect = 0;
+
+    for (guint i = 0; i < gen->clients->len; i++) {
+        struct load_client_stats stats;
+        load_client_get_stats(g_ptr_array_index(gen->clients, i), &stats);
+
+        frames += stats.frames;
+        packets += stats.packets;
+        bytes += stats.bytes;
+        seq_gaps += stats.seq_gaps;
+        if (stats.connect_us > 0) {
+            connect_total_us += stats.connect_us;
+            connect_max_us = MAX(connect_max_us, stats.connect_us);
+            n_connect++;
+        }
+        if (!stats.connected) {
+            continue;
+        }
+        connected++;
+        bitrate_total += stats.recv_bitrate;
+        bitrate_min = MIN(bitrate_min, stats.recv_bitrate);
+        bitrate_max = MAX(bitrate_max, stats.recv_bitrate);
+        loss_total += stats.recv_loss_percent;
+        loss_max = MAX(loss_max, stats.recv_loss_percent);
+        if (stats.rtt_ms > 0) {
+            rtt_total += stats.rtt_ms;
+            rtt_max = MAX(rtt_max, stats.rtt_ms);
+            n_rtt++;
+        }
+    }
+
+    const gint64 now_us = g_get_monotonic_time();
+    const gdouble interval = (gdouble)(now_us - gen->reported_us) / G_USEC_PER_SEC;
+    const gdouble fps = connected && interval > 0 ? (gdouble)(frames - gen->reported_frames) / interval / connected : 0;
+    gen->reported_frames = frames;
+    gen->reported_us = now_us;
+
+    g_print("[%5.0f s] %u/%u connected, %.1f Mbit/s, per client %.2f/%.2f/%.2f Mbit/s min/avg/max, %.1f fps, "
+            "loss %.2f/%.2f %% avg/max, RTT %.1f/%.1f ms avg/max, %u sequence gaps\n",
+            (gdouble)(now_us - gen->started_us) / G_USEC_PER_SEC,
+            connected,
+            gen->n_clients,
+            bitrate_total / 1e6,
+            connected ? bitrate_min / 1e6 : 0,
+            connected ? bitrate_total / connected / 1e6 : 0,
+            bitrate_max / 1e6,
+            fps,
+            connected ? loss_total / connected : 0,
+            loss_max,
+            n_rtt ? rtt_total / n_rtt : 0,
+            rtt_max,
+            seq_gaps);
+
+    if (final) {
+        g_print("%u/%u clients connected at least once, in %.1f/%.1f ms avg/max. "
+                "Received %" G_GUINT64_FORMAT " packets, %.1f MB, %" G_GUINT64_FORMAT " frames.\n",
+                n_connect,
+                gen->n_clients,
+                n_connect ? (gdouble)connect_total_us / n_connect / 1000 : 0,
+                (gdouble)connect_max_us / 1000,
+                packets,
+                (gdouble)bytes / 1e6,
+                frames);
+    }
+}
+
+static gboolean report_cb(struct load_generator *gen) {
+    print_report(gen, FALSE);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean quit_cb(struct load_generator *gen) {
+    g_main_loop_quit(gen->loop);
+    return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char *argv[]) {
+    const gint n_clients = argc > 1 ? atoi(argv[1]) : 0;
+    const gchar *mode = argc > 2 ? argv[2] : "count";
+    if (argc < 2 || argc > 6 || n_clients <= 0 || (g_strcmp0(mode, "count") != 0 && g_strcmp0(mode, "depay") != 0)) {
+        g_printerr("Usage: %s <clients> [count|depay] [seconds] [websocket-uri] [video-codecs]\n", argv[0]);
+        g_printerr("Connects that many viewers that never decode, to find how many a server can serve.\n");
+        g_printerr("count only counts the received RTP, depay depayloads it too. Runs until interrupted if seconds "
+                   "is 0 or missing.\n");
+        return 2;
+    }
+    const gint seconds = argc > 3 ? atoi(argv[3]) : 0;
+
+    gst_init(NULL, NULL);
+
+    struct load_generator gen = {
+        .loop = g_main_loop_new(NULL, FALSE),
+        .clients = g_ptr_array_new_with_free_func((GDestroyNotify)load_client_free),
+        .n_clients = n_clients,
+        .websocket_uri = argc > 4 ? argv[4] : NULL,
+        .video_codecs = argc > 5 ? argv[5] : NULL,
+        .mode = g_str_equal(mode, "depay") ? LOAD_CLIENT_DEPAYLOAD : LOAD_CLIENT_COUNT,
+        .started_us = g_get_monotonic_time(),
+    };
+    gen.reported_us = gen.started_us;
+
+    if (ramp_cb(&gen) == G_SOURCE_CONTINUE) {
+        g_timeout_add(RAMP_INTERVAL_MS, G_SOURCE_FUNC(ramp_cb), &gen);
+    }
+    g_timeout_add_seconds(REPORT_INTERVAL_S, G_SOURCE_FUNC(report_cb), &gen);
+    if (seconds > 0) {
+        g_timeout_add_seconds(seconds, G_SOURCE_FUNC(quit_cb), &gen);
+    }
+#ifdef G_OS_UNIX
+    g_unix_signal_add(SIGINT, G_SOURCE_FUNC(quit_cb), &gen);
+#endif
+
+    g_main_loop_run(gen.loop);
+
+    print_report(&gen, TRUE);
+
+    g_ptr_array_unref(gen.clients);
+    g_main_loop_unref(gen.loop);
+
+    return 0;
+}
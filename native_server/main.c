@@ -1,6 +1,64 @@
 #include <glib.h>
 
+#ifdef G_OS_UNIX
+    #include <glib-unix.h>
+#endif
+
 #include "../src/server/server_pipeline.h"
+#include "../src/utils/logger.h"
+
+/// "<bytes>@<hz>" broadcasts a message of that size to every client at that rate, e.g. 1024@100 for a load test
+#define BROADCAST_ENV "GWD_BROADCAST"
+
+/*!
+ * BROADCAST_ENV's periodic message, sent from the main loop.
+ */
+struct broadcaster {
+    struct MyGstData *mgd;
+    GBytes *message;
+};
+
+#ifdef G_OS_UNIX
+static gboolean quit_cb(gpointer user_data) {
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+#endif
+
+static gboolean broadcast_cb(gpointer user_data) {
+    const struct broadcaster *b = user_data;
+    server_pipeline_broadcast(b->mgd, b->message);
+    return G_SOURCE_CONTINUE;
+}
+
+static void broadcaster_free(gpointer data) {
+    struct broadcaster *b = data;
+    g_bytes_unref(b->message);
+    g_free(b);
+}
+
+/// Start BROADCAST_ENV's broadcasts on the default main context, if set and valid
+static void broadcast_start(struct MyGstData *mgd) {
+    const gchar *value = g_getenv(BROADCAST_ENV);
+    if (value == NULL) {
+        return;
+    }
+
+    gchar *end = NULL;
+    const guint64 size = g_ascii_strtoull(value, &end, 10);
+    const guint64 hz = *end == '@' ? g_ascii_strtoull(end + 1, &end, 10) : 0;
+    if (*end != '\0' || size == 0 || size > BULK_TRANSFER_MAX_SIZE || hz == 0 || hz > 1000) {
+        ALOGE("Ignoring %s=%s, expected <bytes>@<hz>", BROADCAST_ENV, value);
+        return;
+    }
+
+    struct broadcaster *b = g_new0(struct broadcaster, 1);
+    b->mgd = mgd;
+    // Zeroes, what is sent does not matter, only how much and how often
+    b->message = g_bytes_new_take(g_malloc0(size), size);
+    g_timeout_add_full(G_PRIORITY_DEFAULT, 1000 / hz, broadcast_cb, b, broadcaster_free);
+    ALOGI("Broadcasting %" G_GUINT64_FORMAT " bytes at %" G_GUINT64_FORMAT " Hz", size, hz);
+}
 
 int main(int argc, char *argv[]) {
     struct MyGstData *mgd = NULL;
@@ -8,8 +66,16 @@ int main(int argc, char *argv[]) {
 
     server_pipeline_play(mgd);
 
+    // Signaling and pipeline control have their own threads, this loop only waits to be told to quit
     GMainLoop *loop = g_main_loop_new(NULL, FALSE);
 
+#ifdef G_OS_UNIX
+    g_unix_signal_add(SIGINT, quit_cb, loop);
+    g_unix_signal_add(SIGTERM, quit_cb, loop);
+#endif
+
+    broadcast_start(mgd);
+
     g_main_loop_run(loop);
 
     g_main_loop_unref(loop);
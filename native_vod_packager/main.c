@@ -0,0 +1,20 @@
+#include <glib.h>
+
+#include "../src/server/vod_packager.h"
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        g_printerr("Usage: %s <input.mp4> <output.gwdv>\n", argv[0]);
+        g_printerr("Serve the output with GWD_VOD_CACHE=<output.gwdv> webrtc_server_native\n");
+        return 2;
+    }
+
+    GError *error = NULL;
+    if (!vod_packager_run(argv[1], argv[2], &error)) {
+        g_printerr("Cannot package %s: %s\n", argv[1], error ? error->message : "unknown error");
+        g_clear_error(&error);
+        return 1;
+    }
+
+    return 0;
+}
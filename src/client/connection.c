@@ -5,6 +5,9 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "../common/bulk_transfer.h"
+#include "../common/input_event.h"
+#include "../common/signaling_protocol.h"
 #include "../utils/logger.h"
 #include "status.h"
 
@@ -12,12 +15,19 @@
 #include <gst/webrtc/webrtc.h>
 #undef GST_USE_UNSTABLE_API
 
-#include <json-glib/json-glib.h>
 #include <libsoup/soup-message.h>
 #include <libsoup/soup-session.h>
 
 #define DEFAULT_WEBSOCKET_URI "ws://127.0.0.1:52356/ws"
 
+/// ICE often gets back on its own after a short blip, so wait this long in DISCONNECTED before asking for a restart
+#define ICE_RESTART_GRACE_MS 1000
+/// Websocket reconnect backoff, doubling from the minimum
+#define RECONNECT_BACKOFF_MIN_MS 250
+#define RECONNECT_BACKOFF_MAX_MS 8000
+/// Give up on resuming the session after this many failed reconnects
+#define RECONNECT_MAX_ATTEMPTS 8
+
 /*!
  * Data required for the handshake to complete and to maintain the connection.
  */
@@ -25,14 +35,40 @@ struct _MyConnection {
     GObject parent;
     SoupSession *soup_session;
     gchar *websocket_uri;
+    /// Video codecs we can decode in order of preference, passed to the server in SIGNALING_CODECS_QUERY
+    gchar *video_codecs;
 
     /// Cancellable for websocket connection process
     GCancellable *ws_cancel;
     SoupWebsocketConnection *ws;
 
+    /// Signaling encoder/decoder state, reused for every message
+    struct signaling_codec *codec;
+    /// Batches our ICE candidates while the server speaks SIGNALING_PROTOCOL_V2, NULL otherwise
+    struct signaling_candidate_batcher *batcher;
+
+    /// Session to resume after losing the websocket, as announced by the server
+    gchar *session_id;
+    /// Reconnected with a live pipeline, waiting for the server to tell whether the session was resumed
+    gboolean resume_pending;
+
+    /// Monotonic time connectivity was lost, 0 while connected
+    gint64 lost_us;
+    guint timeout_src_id_ice_restart;
+    guint timeout_src_id_reconnect;
+    guint reconnect_attempts;
+
     GstPipeline *pipeline;
     GstElement *webrtcbin;
     GstWebRTCDataChannel *data_channel;
+    /// Chunked, flow-controlled transfers over the data channel
+    struct bulk_transfer *bulk;
+    /// Negotiated with the server as soon as its offer is in, see input_event.h. Written from the main context only,
+    /// under input_mutex, as my_connection_send_input() may be called from any thread.
+    GstWebRTCDataChannel *input_channel;
+    GMutex input_mutex;
+    /// Sequence number of the next input event, restarting with every input channel
+    guint input_seq;
 
     enum my_status status;
 };
@@ -51,6 +87,8 @@ enum {
     SIGNAL_STATUS_CHANGE,
     SIGNAL_ON_NEED_PIPELINE,
     SIGNAL_ON_DROP_PIPELINE,
+    SIGNAL_BULK_RECEIVED,
+    SIGNAL_DATA_RECEIVED,
     N_SIGNALS
 };
 
@@ -58,6 +96,7 @@ static guint signals[N_SIGNALS];
 
 typedef enum {
     PROP_WEBSOCKET_URI = 1,
+    PROP_VIDEO_CODECS,
     // PROP_STATUS,
     N_PROPERTIES
 } MyConnectionProperty;
@@ -77,6 +116,10 @@ static void my_connection_set_property(GObject *object, guint property_id, const
             self->websocket_uri = g_value_dup_string(value);
             ALOGI("Websocket URI assigned: %s", self->websocket_uri);
             break;
+        case PROP_VIDEO_CODECS:
+            g_free(self->video_codecs);
+            self->video_codecs = g_value_dup_string(value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -90,6 +133,9 @@ static void my_connection_get_property(GObject *object, guint property_id, GValu
         case PROP_WEBSOCKET_URI:
             g_value_set_string(value, self->websocket_uri);
             break;
+        case PROP_VIDEO_CODECS:
+            g_value_set_string(value, self->video_codecs);
+            break;
 
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
@@ -101,6 +147,8 @@ static void my_connection_init(MyConnection *conn) {
     conn->ws_cancel = g_cancellable_new();
     conn->soup_session = soup_session_new();
     conn->websocket_uri = g_strdup(DEFAULT_WEBSOCKET_URI);
+    conn->codec = signaling_codec_new();
+    g_mutex_init(&conn->input_mutex);
 }
 
 static void my_connection_dispose(GObject *object) {
@@ -116,6 +164,12 @@ static void my_connection_finalize(GObject *object) {
     MyConnection *self = MY_CONNECTION(object);
 
     g_free(self->websocket_uri);
+    g_free(self->video_codecs);
+    g_free(self->session_id);
+    signaling_codec_free(self->codec);
+    g_mutex_clear(&self->input_mutex);
+
+    G_OBJECT_CLASS(my_connection_parent_class)->finalize(object);
 }
 
 static void my_connection_class_init(MyConnectionClass *klass) {
@@ -142,6 +196,20 @@ static void my_connection_class_init(MyConnectionClass *klass) {
                             DEFAULT_WEBSOCKET_URI /* default value */,
                             G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+    /**
+     * MyConnection:video-codecs:
+     *
+     * Comma separated RTP encoding names of the video codecs we can decode, preferred first, e.g. "VP8,H264". The
+     * server falls back to H264 if it has none of them. Read when connecting.
+     */
+    g_object_class_install_property(gobject_class,
+                                    PROP_VIDEO_CODECS,
+                                    g_param_spec_string("video-codecs",
+                                                        "Video codecs",
+                                                        "Video codecs to ask the server for, preferred first.",
+                                                        NULL /* default value */,
+                                                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
     /**
      * MyConnection::connect
      * @object: the #MyConnection
@@ -256,6 +324,10 @@ static void my_connection_class_init(MyConnectionClass *klass) {
      *
      * If you store any references in your handler for @on-need-pipeline you must make a handler for this signal to
      * drop them.
+     *
+     * The handler takes over stopping the pipeline: when it returns, its webrtcbin must not be running anymore, but
+     * the rest of the pipeline may be kept warm for the next @on-need-pipeline. Without a handler, the pipeline is set
+     * to NULL.
      */
     signals[SIGNAL_ON_DROP_PIPELINE] = g_signal_new("on-drop-pipeline",
                                                     G_OBJECT_CLASS_TYPE(klass),
@@ -266,6 +338,44 @@ static void my_connection_class_init(MyConnectionClass *klass) {
                                                     NULL,
                                                     G_TYPE_NONE,
                                                     0);
+
+    /**
+     * MyConnection::on-bulk-received
+     * @object: the #MyConnection
+     * @transfer_id: ID the server gave the transfer
+     * @data: A #GBytes with the reassembled payload
+     *
+     * A transfer sent by the server with its bulk transfer API has been received completely.
+     */
+    signals[SIGNAL_BULK_RECEIVED] = g_signal_new("on-bulk-received",
+                                                 G_OBJECT_CLASS_TYPE(klass),
+                                                 G_SIGNAL_RUN_LAST,
+                                                 0,
+                                                 NULL,
+                                                 NULL,
+                                                 NULL,
+                                                 G_TYPE_NONE,
+                                                 2,
+                                                 G_TYPE_UINT,
+                                                 G_TYPE_BYTES);
+
+    /**
+     * MyConnection::on-data-received
+     * @object: the #MyConnection
+     * @data: A #GBytes with the message
+     *
+     * A binary message from the server, e.g. a broadcast to all clients. Emitted from the data channel's thread.
+     */
+    signals[SIGNAL_DATA_RECEIVED] = g_signal_new("on-data-received",
+                                                 G_OBJECT_CLASS_TYPE(klass),
+                                                 G_SIGNAL_RUN_LAST,
+                                                 0,
+                                                 NULL,
+                                                 NULL,
+                                                 NULL,
+                                                 G_TYPE_NONE,
+                                                 1,
+                                                 G_TYPE_BYTES);
     ALOGI("%s: End", __FUNCTION__);
 }
 
@@ -319,24 +429,63 @@ static void conn_update_status_from_peer_connection_state(MyConnection *conn, Gs
     }
 }
 
-static void conn_disconnect_internal(MyConnection *conn, enum my_status status) {
-    if (conn->ws_cancel != NULL) {
-        g_cancellable_cancel(conn->ws_cancel);
-        gst_clear_object(&conn->ws_cancel);
-    }
-    // Stop the pipeline, if it exists
-    if (conn->pipeline != NULL) {
-        gst_element_set_state(GST_ELEMENT(conn->pipeline), GST_STATE_NULL);
-        g_signal_emit(conn, signals[SIGNAL_ON_DROP_PIPELINE], 0);
-    }
+/// Drop the websocket without touching the pipeline
+static void conn_drop_websocket(MyConnection *conn) {
+    g_clear_pointer(&conn->batcher, signaling_candidate_batcher_free);
     if (conn->ws) {
-        soup_websocket_connection_close(conn->ws, 0, "");
+        g_signal_handlers_disconnect_by_data(conn->ws, conn);
+        if (soup_websocket_connection_get_state(conn->ws) == SOUP_WEBSOCKET_STATE_OPEN) {
+            soup_websocket_connection_close(conn->ws, 0, "");
+        }
     }
     g_clear_object(&conn->ws);
+}
+
+/// Hand the pipeline back to its owner, which stops it, see @on-drop-pipeline.
+static void conn_release_pipeline(MyConnection *conn) {
+    if (conn->pipeline == NULL) {
+        return;
+    }
+
+    g_clear_pointer(&conn->bulk, bulk_transfer_free);
+
+    // The owner may keep the pipeline around, make sure nothing from it reaches us anymore
+    if (conn->webrtcbin) {
+        g_signal_handlers_disconnect_by_data(conn->webrtcbin, conn);
+    }
+    if (conn->data_channel) {
+        g_signal_handlers_disconnect_by_data(conn->data_channel, conn);
+    }
+    g_mutex_lock(&conn->input_mutex);
+    gst_clear_object(&conn->input_channel);
+    g_mutex_unlock(&conn->input_mutex);
+
+    if (g_signal_has_handler_pending(conn, signals[SIGNAL_ON_DROP_PIPELINE], 0, FALSE)) {
+        g_signal_emit(conn, signals[SIGNAL_ON_DROP_PIPELINE], 0);
+    } else {
+        gst_element_set_state(GST_ELEMENT(conn->pipeline), GST_STATE_NULL);
+    }
 
     gst_clear_object(&conn->webrtcbin);
     gst_clear_object(&conn->data_channel);
     gst_clear_object(&conn->pipeline);
+}
+
+static void conn_disconnect_internal(MyConnection *conn, enum my_status status) {
+    g_clear_handle_id(&conn->timeout_src_id_ice_restart, g_source_remove);
+    g_clear_handle_id(&conn->timeout_src_id_reconnect, g_source_remove);
+    conn->reconnect_attempts = 0;
+    conn->lost_us = 0;
+    conn->resume_pending = FALSE;
+    g_clear_pointer(&conn->session_id, g_free);
+
+    if (conn->ws_cancel != NULL) {
+        g_cancellable_cancel(conn->ws_cancel);
+        gst_clear_object(&conn->ws_cancel);
+    }
+    conn_release_pipeline(conn);
+    conn_drop_websocket(conn);
+
     conn_update_status(conn, status);
 }
 
@@ -355,6 +504,20 @@ static void conn_data_channel_message_string_cb(GstWebRTCDataChannel *datachanne
     ALOGI("%s: Received data channel message: %s", __FUNCTION__, str);
 }
 
+static void conn_data_channel_message_data_cb(GstWebRTCDataChannel *datachannel, GBytes *data, MyConnection *conn) {
+    // Handled by conn->bulk
+    if (bulk_transfer_is_chunk(data)) {
+        return;
+    }
+    ALOGD("%s: Received data channel message, size: %zu", __FUNCTION__, g_bytes_get_size(data));
+    g_signal_emit(conn, signals[SIGNAL_DATA_RECEIVED], 0, data);
+}
+
+static void conn_on_bulk_received(gpointer user_data, const guint32 transfer_id, GBytes *data) {
+    MyConnection *conn = user_data;
+    g_signal_emit(conn, signals[SIGNAL_BULK_RECEIVED], 0, transfer_id, data);
+}
+
 static void conn_connect_internal(MyConnection *conn, enum my_status status);
 
 static void conn_webrtc_deep_notify_callback(GstObject *self,
@@ -372,6 +535,16 @@ static void conn_webrtc_prepare_data_channel_cb(GstElement *webrtc,
                                                 GObject *data_channel,
                                                 gboolean is_local,
                                                 MyConnection *conn) {
+    gchar *label = NULL;
+    g_object_get(data_channel, "label", &label, NULL);
+    const gboolean is_input = g_strcmp0(label, INPUT_EVENT_CHANNEL_LABEL) == 0;
+    g_free(label);
+
+    // Losing the input channel alone is not worth dropping the connection for
+    if (is_input) {
+        return;
+    }
+
     ALOGI("Preparing data channel");
 
     g_signal_connect(data_channel, "on-close", G_CALLBACK(conn_data_channel_close_cb), conn);
@@ -388,69 +561,97 @@ static void conn_webrtc_on_data_channel_cb(GstElement *webrtcbin,
 
     conn->data_channel = GST_WEBRTC_DATA_CHANNEL(data_channel);
 
+    // Chunks are sent and reassembled transfers reported from the same context as everything else here
+    conn->bulk = bulk_transfer_new(g_main_context_default(), conn->data_channel, conn_on_bulk_received, conn);
+    g_signal_connect(data_channel, "on-message-data", G_CALLBACK(conn_data_channel_message_data_cb), conn);
+
     conn_update_status(conn, MY_STATUS_CONNECTED);
     g_signal_emit(conn, signals[SIGNAL_WEBRTC_CONNECTED], 0);
 }
 
-void conn_send_sdp_answer(MyConnection *conn, const gchar *sdp) {
-    JsonBuilder *builder;
-    JsonNode *root;
-    gchar *msg_str;
+static void conn_ws_send(gpointer user_data, const gchar *message) {
+    MyConnection *conn = user_data;
+
+    if (conn->ws == NULL) {
+        return;
+    }
+    soup_websocket_connection_send_text(conn->ws, message);
+}
 
+void conn_send_sdp_answer(MyConnection *conn, const gchar *sdp) {
     // ALOGI("Send SDP answer: %s", sdp);
 
-    builder = json_builder_new();
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "msg");
-    json_builder_add_string_value(builder, "answer");
+    gchar *msg_str = signaling_codec_encode_sdp(conn->codec, "answer", sdp);
+    conn_ws_send(conn, msg_str);
+    g_free(msg_str);
+}
+
+/// A local candidate, or the end of them when NULL, on its way from webrtcbin's threads to the main context
+struct conn_local_candidate {
+    MyConnection *conn;
+    guint mlineindex;
+    gchar *candidate;
+};
 
-    json_builder_set_member_name(builder, "sdp");
-    json_builder_add_string_value(builder, sdp);
-    json_builder_end_object(builder);
+static void conn_local_candidate_free(gpointer data) {
+    struct conn_local_candidate *c = data;
 
-    root = json_builder_get_root(builder);
+    g_object_unref(c->conn);
+    g_free(c->candidate);
+    g_free(c);
+}
 
-    msg_str = json_to_string(root, TRUE);
-    soup_websocket_connection_send_text(conn->ws, msg_str);
-    g_clear_pointer(&msg_str, g_free);
+/// Main context side, where the websocket and the batcher are replaced on reconnects
+static gboolean conn_send_local_candidate(gpointer data) {
+    const struct conn_local_candidate *c = data;
+    MyConnection *conn = c->conn;
 
-    json_node_unref(root);
-    g_object_unref(builder);
+    if (c->candidate == NULL) {
+        if (conn->batcher != NULL) {
+            signaling_candidate_batcher_end(conn->batcher);
+        }
+        return G_SOURCE_REMOVE;
+    }
+
+    // ALOGI("Send candidate: line %u: %s", c->mlineindex, c->candidate);
+
+    if (conn->batcher != NULL) {
+        signaling_candidate_batcher_add(conn->batcher, c->mlineindex, c->candidate);
+        return G_SOURCE_REMOVE;
+    }
+
+    gchar *msg_str = signaling_codec_encode_candidate(conn->codec, c->mlineindex, c->candidate);
+    conn_ws_send(conn, msg_str);
+    g_free(msg_str);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void conn_queue_local_candidate(MyConnection *conn, const guint mlineindex, const gchar *candidate) {
+    struct conn_local_candidate *c = g_new0(struct conn_local_candidate, 1);
+    c->conn = g_object_ref(conn);
+    c->mlineindex = mlineindex;
+    c->candidate = g_strdup(candidate);
+
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, conn_send_local_candidate, c, conn_local_candidate_free);
 }
 
+/// Called from webrtcbin's threads
 static void conn_webrtc_on_ice_candidate_cb(GstElement *webrtcbin,
                                             guint mlineindex,
                                             gchar *candidate,
                                             MyConnection *conn) {
-    JsonBuilder *builder;
-    JsonNode *root;
-    gchar *msg_str;
-
-    // ALOGI("Send candidate: line %u: %s", mlineindex, candidate);
-
-    builder = json_builder_new();
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "msg");
-    json_builder_add_string_value(builder, "candidate");
-
-    json_builder_set_member_name(builder, "candidate");
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "candidate");
-    json_builder_add_string_value(builder, candidate);
-    json_builder_set_member_name(builder, "sdpMLineIndex");
-    json_builder_add_int_value(builder, mlineindex);
-    json_builder_end_object(builder);
-    json_builder_end_object(builder);
-
-    root = json_builder_get_root(builder);
+    conn_queue_local_candidate(conn, mlineindex, candidate);
+}
 
-    msg_str = json_to_string(root, TRUE);
-    // ALOGD("%s: candidate message: %s", __FUNCTION__, msg_str);
-    soup_websocket_connection_send_text(conn->ws, msg_str);
-    g_clear_pointer(&msg_str, g_free);
+/// Called from webrtcbin's threads
+static void conn_webrtc_on_ice_gathering_state_cb(GstElement *webrtcbin, GParamSpec *pspec, MyConnection *conn) {
+    GstWebRTCICEGatheringState state;
+    g_object_get(webrtcbin, "ice-gathering-state", &state, NULL);
 
-    json_node_unref(root);
-    g_object_unref(builder);
+    if (state == GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE) {
+        conn_queue_local_candidate(conn, 0, NULL);
+    }
 }
 
 static void conn_webrtc_on_answer_created(GstPromise *promise, MyConnection *conn) {
@@ -499,6 +700,23 @@ static void conn_webrtc_process_sdp_offer(MyConnection *conn, const gchar *sdp)
         gst_promise_wait(promise);
         gst_promise_unref(promise);
 
+        // Now that the offer brought the SCTP association. Restart offers keep the one we have.
+        if (conn->input_channel == NULL) {
+            GstWebRTCDataChannel *input_channel = NULL;
+            GstStructure *input_options = input_event_channel_options();
+            g_signal_emit_by_name(conn->webrtcbin,
+                                  "create-data-channel",
+                                  INPUT_EVENT_CHANNEL_LABEL,
+                                  input_options,
+                                  &input_channel);
+            gst_structure_free(input_options);
+
+            g_mutex_lock(&conn->input_mutex);
+            conn->input_channel = input_channel;
+            g_atomic_int_set(&conn->input_seq, 0);
+            g_mutex_unlock(&conn->input_mutex);
+        }
+
         g_signal_emit_by_name(
             conn->webrtcbin,
             "create-answer",
@@ -518,46 +736,147 @@ static void conn_webrtc_process_candidate(MyConnection *conn, guint mlineindex,
     g_signal_emit_by_name(conn->webrtcbin, "add-ice-candidate", mlineindex, candidate);
 }
 
+static void conn_websocket_connect(MyConnection *conn);
+
+/// Ask for the pipeline and start it, on a fresh websocket connection
+static void conn_start_pipeline(MyConnection *conn) {
+    ALOGI("Creating pipeline");
+    g_assert_null(conn->pipeline);
+    g_signal_emit(conn, signals[SIGNAL_ON_NEED_PIPELINE], 0);
+    if (conn->pipeline == NULL) {
+        ALOGE("on-need-pipeline signal did not return a pipeline!");
+        my_connection_disconnect(conn);
+        return;
+    }
+
+    // OK, if we get here, we have a websocket connection, and a pipeline fully configured
+    // so we can start the pipeline playing
+
+    ALOGI("Setting pipeline state to PLAYING");
+    gst_element_set_state(GST_ELEMENT(conn->pipeline), GST_STATE_PLAYING);
+}
+
+/// The server could not resume our session, so the old webrtcbin is useless: start over with a new pipeline.
+static void conn_rebuild_pipeline(MyConnection *conn) {
+    ALOGW("Session not resumed, rebuilding the pipeline");
+
+    conn->resume_pending = FALSE;
+
+    conn_release_pipeline(conn);
+    conn_start_pipeline(conn);
+}
+
+static void conn_on_signaling_sdp(gpointer user_data, const gchar *type, const gchar *sdp) {
+    MyConnection *conn = user_data;
+
+    if (!g_str_equal(type, "offer")) {
+        return;
+    }
+
+    // An offer before any session message means a server without resumption
+    if (conn->resume_pending) {
+        conn_rebuild_pipeline(conn);
+        if (conn->pipeline == NULL) {
+            return;
+        }
+    }
+
+    conn_webrtc_process_sdp_offer(conn, sdp);
+}
+
+static void conn_on_signaling_candidate(gpointer user_data, const guint mlineindex, const gchar *candidate) {
+    conn_webrtc_process_candidate(user_data, mlineindex, candidate);
+}
+
+static void conn_on_signaling_end_of_candidates(gpointer user_data) {
+    MyConnection *conn = user_data;
+
+    // webrtcbin takes a NULL candidate as the end of them
+    if (conn->webrtcbin) {
+        g_signal_emit_by_name(conn->webrtcbin, "add-ice-candidate", 0, NULL);
+    }
+}
+
+static void conn_on_signaling_session(gpointer user_data, const gchar *id, const gboolean resumed) {
+    MyConnection *conn = user_data;
+
+    g_free(conn->session_id);
+    conn->session_id = g_strdup(id);
+
+    if (!conn->resume_pending) {
+        ALOGI("Signaling session %s", id);
+        return;
+    }
+
+    if (resumed) {
+        conn->resume_pending = FALSE;
+        ALOGI("Session %s resumed %.1f ms after losing connectivity, waiting for the ICE restart",
+              id,
+              (gdouble)(g_get_monotonic_time() - conn->lost_us) / 1000.0);
+    } else {
+        conn_rebuild_pipeline(conn);
+    }
+}
+
+static const struct signaling_handlers conn_signaling_handlers = {
+    .sdp = conn_on_signaling_sdp,
+    .candidate = conn_on_signaling_candidate,
+    .end_of_candidates = conn_on_signaling_end_of_candidates,
+    .session = conn_on_signaling_session,
+    // Only ever sent by us
+    .restart = NULL,
+};
+
 static void conn_on_ws_message_cb(SoupWebsocketConnection *connection, gint type, GBytes *message, MyConnection *conn) {
     // ALOGD("%s", __FUNCTION__);
     gsize length = 0;
     const gchar *msg_data = g_bytes_get_data(message, &length);
-    JsonParser *parser = json_parser_new();
-    GError *error = NULL;
 
-    // TODO convert gsize to gssize after range check
+    if (!signaling_codec_decode(conn->codec, msg_data, length, &conn_signaling_handlers, conn)) {
+        g_debug("Error parsing signaling message");
+    }
+}
 
-    if (json_parser_load_from_data(parser, msg_data, length, &error)) {
-        JsonObject *msg = json_node_get_object(json_parser_get_root(parser));
-        const gchar *msg_type;
+static gboolean conn_reconnect_cb(MyConnection *conn) {
+    conn->timeout_src_id_reconnect = 0;
+    conn_websocket_connect(conn);
+    return G_SOURCE_REMOVE;
+}
 
-        if (!json_object_has_member(msg, "msg")) {
-            // Invalid message
-            goto out;
-        }
+/// Reconnect the websocket with exponential backoff, keeping the pipeline so the session can be resumed.
+static void conn_schedule_reconnect(MyConnection *conn) {
+    if (conn->timeout_src_id_reconnect != 0) {
+        return;
+    }
 
-        msg_type = json_object_get_string_member(msg, "msg");
-        // ALOGI("Websocket message received: %s", msg_type);
+    if (conn->reconnect_attempts >= RECONNECT_MAX_ATTEMPTS) {
+        ALOGE("Giving up reconnecting after %u attempts", conn->reconnect_attempts);
+        conn_disconnect_internal(conn, MY_STATUS_DISCONNECTED_ERROR);
+        return;
+    }
 
-        if (g_str_equal(msg_type, "offer")) {
-            const gchar *offer_sdp = json_object_get_string_member(msg, "sdp");
-            conn_webrtc_process_sdp_offer(conn, offer_sdp);
-        } else if (g_str_equal(msg_type, "candidate")) {
-            JsonObject *candidate;
+    const guint delay_ms = MIN(RECONNECT_BACKOFF_MIN_MS << MIN(conn->reconnect_attempts, 16), RECONNECT_BACKOFF_MAX_MS);
+    conn->reconnect_attempts++;
 
-            candidate = json_object_get_object_member(msg, "candidate");
+    ALOGI("Reconnecting in %u ms (attempt %u)", delay_ms, conn->reconnect_attempts);
+    conn->timeout_src_id_reconnect = g_timeout_add(delay_ms, G_SOURCE_FUNC(conn_reconnect_cb), conn);
+}
 
-            conn_webrtc_process_candidate(conn,
-                                          json_object_get_int_member(candidate, "sdpMLineIndex"),
-                                          json_object_get_string_member(candidate, "candidate"));
-        }
-    } else {
-        g_debug("Error parsing message: %s", error->message);
-        g_clear_error(&error);
+static void conn_on_ws_closed_cb(SoupWebsocketConnection *connection, MyConnection *conn) {
+    ALOGW("WebSocket closed by the remote");
+
+    conn_drop_websocket(conn);
+
+    if (conn->pipeline == NULL) {
+        conn_disconnect_internal(conn, MY_STATUS_DISCONNECTED_REMOTE_CLOSE);
+        return;
     }
 
-out:
-    g_object_unref(parser);
+    if (conn->lost_us == 0) {
+        conn->lost_us = g_get_monotonic_time();
+    }
+    conn_update_status(conn, MY_STATUS_RECOVERING);
+    conn_schedule_reconnect(conn);
 }
 
 static void conn_websocket_connected_cb(GObject *session, GAsyncResult *res, MyConnection *conn) {
@@ -569,34 +888,131 @@ static void conn_websocket_connected_cb(GObject *session, GAsyncResult *res, MyC
 
     if (error) {
         ALOGE("Websocket connection failed, error: '%s'", error->message);
+        const gboolean cancelled = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_clear_error(&error);
+
+        // Keep trying as long as there is a session to resume
+        if (conn->pipeline != NULL && !cancelled) {
+            conn_schedule_reconnect(conn);
+            return;
+        }
+
         g_signal_emit(conn, signals[SIGNAL_WEBSOCKET_FAILED], 0);
         conn_update_status(conn, MY_STATUS_WEBSOCKET_FAILED);
         return;
     }
-    g_assert_no_error(error);
-    GstBus *bus;
 
-    ALOGI("WebSocket connected");
+    const gchar *protocol = soup_websocket_connection_get_protocol(conn->ws);
+    const gboolean v2 = protocol != NULL && g_str_equal(protocol, SIGNALING_PROTOCOL_V2);
+    ALOGI("WebSocket connected, signaling %s", v2 ? "v2" : "v1");
+    if (v2) {
+        conn->batcher = signaling_candidate_batcher_new(NULL, conn->codec, conn_ws_send, conn);
+    }
+
     g_signal_connect(conn->ws, "message", G_CALLBACK(conn_on_ws_message_cb), conn);
+    g_signal_connect(conn->ws, "closed", G_CALLBACK(conn_on_ws_closed_cb), conn);
     g_signal_emit(conn, signals[SIGNAL_WEBSOCKET_CONNECTED], 0);
 
-    ALOGI("Creating pipeline");
-    g_assert_null(conn->pipeline);
-    g_signal_emit(conn, signals[SIGNAL_ON_NEED_PIPELINE], 0);
-    if (conn->pipeline == NULL) {
-        ALOGE("on-need-pipeline signal did not return a pipeline!");
-        my_connection_disconnect(conn);
+    conn->reconnect_attempts = 0;
+
+    if (conn->pipeline != NULL) {
+        // Reconnected: keep the pipeline and decoders, the server tells us next whether it still has our session
+        ALOGI("Reconnected %.1f ms after losing connectivity, resuming session %s",
+              (gdouble)(g_get_monotonic_time() - conn->lost_us) / 1000.0,
+              conn->session_id ? conn->session_id : "(none)");
+        conn->resume_pending = TRUE;
         return;
     }
 
-    // OK, if we get here, we have a websocket connection, and a pipeline fully configured
-    // so we can start the pipeline playing
-
-    ALOGI("Setting pipeline state to PLAYING");
-    gst_element_set_state(GST_ELEMENT(conn->pipeline), GST_STATE_PLAYING);
+    conn_start_pipeline(conn);
     ALOGI("%s: Done with function", __FUNCTION__);
 }
 
+static gboolean conn_send_ice_restart_request(MyConnection *conn) {
+    conn->timeout_src_id_ice_restart = 0;
+
+    // Without a websocket, the reconnect asks for the restart by resuming the session
+    if (conn->ws == NULL || soup_websocket_connection_get_state(conn->ws) != SOUP_WEBSOCKET_STATE_OPEN) {
+        return G_SOURCE_REMOVE;
+    }
+
+    ALOGI("Requesting an ICE restart");
+
+    gchar *msg_str = signaling_codec_encode_restart(conn->codec);
+    conn_ws_send(conn, msg_str);
+    g_free(msg_str);
+
+    return G_SOURCE_REMOVE;
+}
+
+struct conn_ice_state_change {
+    MyConnection *conn;
+    GstWebRTCICEConnectionState state;
+};
+
+static void conn_ice_state_change_free(gpointer data) {
+    struct conn_ice_state_change *change = data;
+
+    g_object_unref(change->conn);
+    g_free(change);
+}
+
+/// Main context side of ICE connection state changes
+static gboolean conn_on_ice_state_change(gpointer data) {
+    const struct conn_ice_state_change *change = data;
+    MyConnection *conn = change->conn;
+
+    if (conn->pipeline == NULL) {
+        return G_SOURCE_REMOVE;
+    }
+
+    switch (change->state) {
+        case GST_WEBRTC_ICE_CONNECTION_STATE_DISCONNECTED:
+            ALOGW("ICE disconnected");
+            if (conn->lost_us == 0) {
+                conn->lost_us = g_get_monotonic_time();
+            }
+            conn_update_status(conn, MY_STATUS_RECOVERING);
+            if (conn->timeout_src_id_ice_restart == 0) {
+                conn->timeout_src_id_ice_restart =
+                    g_timeout_add(ICE_RESTART_GRACE_MS, G_SOURCE_FUNC(conn_send_ice_restart_request), conn);
+            }
+            break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_FAILED:
+            ALOGW("ICE failed");
+            if (conn->lost_us == 0) {
+                conn->lost_us = g_get_monotonic_time();
+            }
+            conn_update_status(conn, MY_STATUS_RECOVERING);
+            g_clear_handle_id(&conn->timeout_src_id_ice_restart, g_source_remove);
+            conn_send_ice_restart_request(conn);
+            break;
+        case GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED:
+        case GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED:
+            g_clear_handle_id(&conn->timeout_src_id_ice_restart, g_source_remove);
+            if (conn->lost_us != 0) {
+                ALOGI("Connectivity recovered in %.1f ms, pipeline kept",
+                      (gdouble)(g_get_monotonic_time() - conn->lost_us) / 1000.0);
+                conn->lost_us = 0;
+                conn_update_status(conn, conn->data_channel ? MY_STATUS_CONNECTED : MY_STATUS_CONNECTED_NO_DATA);
+            }
+            break;
+        default:
+            break;
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/// Called from webrtcbin's threads
+static void conn_webrtc_on_ice_connection_state_cb(GstElement *webrtcbin, GParamSpec *pspec, MyConnection *conn) {
+    struct conn_ice_state_change *change = g_new0(struct conn_ice_state_change, 1);
+    change->conn = g_object_ref(conn);
+    g_object_get(webrtcbin, "ice-connection-state", &change->state, NULL);
+
+    g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, conn_on_ice_state_change, change, conn_ice_state_change_free);
+}
+
 static void on_ice_connection_state_change(GstElement *webrtcbin, GParamSpec *pspec, gpointer user_data) {
     GstWebRTCICEConnectionState state;
     g_object_get(webrtcbin, "ice-connection-state", &state, NULL);
@@ -633,8 +1049,16 @@ void my_connection_set_pipeline(MyConnection *conn, GstPipeline *pipeline) {
     g_assert_nonnull(conn->webrtcbin);
     g_assert(G_IS_OBJECT(conn->webrtcbin));
     g_signal_connect(conn->webrtcbin, "on-ice-candidate", G_CALLBACK(conn_webrtc_on_ice_candidate_cb), conn);
+    g_signal_connect(conn->webrtcbin,
+                     "notify::ice-gathering-state",
+                     G_CALLBACK(conn_webrtc_on_ice_gathering_state_cb),
+                     conn);
     g_signal_connect(conn->webrtcbin, "prepare-data-channel", G_CALLBACK(conn_webrtc_prepare_data_channel_cb), conn);
     g_signal_connect(conn->webrtcbin, "on-data-channel", G_CALLBACK(conn_webrtc_on_data_channel_cb), conn);
+    g_signal_connect(conn->webrtcbin,
+                     "notify::ice-connection-state",
+                     G_CALLBACK(conn_webrtc_on_ice_connection_state_cb),
+                     conn);
     g_signal_connect(conn->webrtcbin,
                      "deep-notify::connection-state",
                      G_CALLBACK(conn_webrtc_deep_notify_callback),
@@ -645,35 +1069,63 @@ void my_connection_set_pipeline(MyConnection *conn, GstPipeline *pipeline) {
     //                     NULL);
 }
 
-static void conn_connect_internal(MyConnection *conn, enum my_status status) {
-    my_connection_disconnect(conn);
+/// Open the websocket, resuming our session if we have one
+static void conn_websocket_connect(MyConnection *conn) {
     if (!conn->ws_cancel) {
         conn->ws_cancel = g_cancellable_new();
     }
     g_cancellable_reset(conn->ws_cancel);
 
-    ALOGI("calling soup_session_websocket_connect_async. websocket_uri = %s", conn->websocket_uri);
+    GString *uri_str = g_string_new(conn->websocket_uri);
+    const struct {
+        const gchar *name;
+        const gchar *value;
+    } params[] = {
+        {SIGNALING_SESSION_QUERY, conn->session_id},
+        {SIGNALING_CODECS_QUERY, conn->video_codecs},
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(params); i++) {
+        if (params[i].value == NULL) {
+            continue;
+        }
+        g_string_append_c(uri_str, strchr(uri_str->str, '?') ? '&' : '?');
+        g_string_append_printf(uri_str, "%s=", params[i].name);
+        // Keep the commas of the codec list readable in the logs, they are allowed in a query
+        g_string_append_uri_escaped(uri_str, params[i].value, ",", FALSE);
+    }
+    gchar *uri = g_string_free(uri_str, FALSE);
+
+    ALOGI("calling soup_session_websocket_connect_async. websocket_uri = %s", uri);
+
+    // Servers that do not know v2 ignore it, and we stay on v1
+    static const char *protocols[] = {SIGNALING_PROTOCOL_V2, NULL};
 
 #if SOUP_MAJOR_VERSION == 2
-    soup_session_websocket_connect_async(conn->soup_session,                                     // session
-                                         soup_message_new(SOUP_METHOD_GET, conn->websocket_uri), // message
-                                         NULL,                                                   // origin
-                                         NULL,                                                   // protocols
-                                         conn->ws_cancel,                                        // cancellable
-                                         (GAsyncReadyCallback)conn_websocket_connected_cb,       // callback
-                                         conn);                                                  // user_data
+    soup_session_websocket_connect_async(conn->soup_session,                               // session
+                                         soup_message_new(SOUP_METHOD_GET, uri),           // message
+                                         NULL,                                             // origin
+                                         (char **)protocols,                               // protocols
+                                         conn->ws_cancel,                                  // cancellable
+                                         (GAsyncReadyCallback)conn_websocket_connected_cb, // callback
+                                         conn);                                            // user_data
 
 #else
-    soup_session_websocket_connect_async(conn->soup_session,                                     // session
-                                         soup_message_new(SOUP_METHOD_GET, conn->websocket_uri), // message
-                                         NULL,                                                   // origin
-                                         NULL,                                                   // protocols
-                                         0,                                                      // io_prority
-                                         conn->ws_cancel,                                        // cancellable
-                                         (GAsyncReadyCallback)conn_websocket_connected_cb,       // callback
-                                         conn);                                                  // user_data
+    soup_session_websocket_connect_async(conn->soup_session,                               // session
+                                         soup_message_new(SOUP_METHOD_GET, uri),           // message
+                                         NULL,                                             // origin
+                                         (char **)protocols,                               // protocols
+                                         0,                                                // io_prority
+                                         conn->ws_cancel,                                  // cancellable
+                                         (GAsyncReadyCallback)conn_websocket_connected_cb, // callback
+                                         conn);                                            // user_data
 
 #endif
+    g_free(uri);
+}
+
+static void conn_connect_internal(MyConnection *conn, enum my_status status) {
+    my_connection_disconnect(conn);
+    conn_websocket_connect(conn);
     conn_update_status(conn, status);
 }
 
@@ -707,3 +1159,57 @@ bool my_connection_send_bytes(MyConnection *conn, GBytes *bytes) {
 
     return success == TRUE;
 }
+
+guint32 my_connection_send_bulk(MyConnection *conn, GBytes *bytes, MyBulkDoneFunc done, gpointer user_data) {
+    if (conn->status != MY_STATUS_CONNECTED || conn->bulk == NULL) {
+        ALOGW("Cannot send bulk data when status is %s", my_status_to_string(conn->status));
+        return 0;
+    }
+
+    return bulk_transfer_send(conn->bulk, bytes, done, user_data);
+}
+
+bool my_connection_send_input(MyConnection *conn, const guint16 type, gconstpointer data, const gsize size) {
+    if (size > INPUT_EVENT_DATA_SIZE) {
+        return false;
+    }
+
+    // Our own reference, the main context may drop the channel meanwhile
+    g_mutex_lock(&conn->input_mutex);
+    GstWebRTCDataChannel *channel = conn->input_channel ? gst_object_ref(conn->input_channel) : NULL;
+    g_mutex_unlock(&conn->input_mutex);
+    if (channel == NULL) {
+        return false;
+    }
+
+    struct input_event event = {
+        .type = type,
+        .seq = (guint32)g_atomic_int_add(&conn->input_seq, 1),
+        .sent_us = g_get_real_time(),
+    };
+    if (data) {
+        memcpy(event.data, data, size);
+    }
+
+    guint8 packed[INPUT_EVENT_SIZE];
+    input_event_pack(&event, packed);
+
+    GBytes *bytes = g_bytes_new(packed, sizeof(packed));
+    // Fails until the channel is open, and the event is just lost then, as it would be on the wire
+    const gboolean success = gst_webrtc_data_channel_send_data_full(channel, bytes, NULL);
+    g_bytes_unref(bytes);
+    gst_object_unref(channel);
+
+    return success == TRUE;
+}
+
+bool my_connection_send_string(MyConnection *conn, const gchar *str) {
+    if (conn->status != MY_STATUS_CONNECTED) {
+        ALOGW("Cannot send string when status is %s", my_status_to_string(conn->status));
+        return false;
+    }
+
+    gboolean success = gst_webrtc_data_channel_send_string_full(conn->data_channel, str, NULL);
+
+    return success == TRUE;
+}
@@ -21,6 +21,9 @@ MyConnection *my_connection_new_localhost();
 
 /*!
  * Actually start connecting to the server
+ *
+ * Once connected, a lost connection is recovered without dropping the pipeline: ICE is restarted when it stays
+ * disconnected, and a closed websocket is reconnected with backoff, resuming the server-side session.
  */
 void my_connection_connect(MyConnection *conn);
 
@@ -34,6 +37,37 @@ void my_connection_disconnect(MyConnection *conn);
  */
 bool my_connection_send_bytes(MyConnection *conn, GBytes *bytes);
 
+/*!
+ * Called once per bulk transfer, with FALSE if it was dropped before all of it could be handed to the data channel.
+ */
+typedef void (*MyBulkDoneFunc)(gpointer user_data, guint32 transfer_id, gboolean success);
+
+/*!
+ * Send a large message to the server over data channel, split into chunks paced by the channel's send buffer so that
+ * it neither floods SCTP nor gets dropped. The server reassembles it.
+ *
+ * May be called from any thread. @p done is called from the default main context.
+ *
+ * @return The transfer ID, or 0 if the transfer could not be queued.
+ */
+guint32 my_connection_send_bulk(MyConnection *conn, GBytes *bytes, MyBulkDoneFunc done, gpointer user_data);
+
+/*!
+ * Send a time-critical input event (controller, pose, ...) on the unordered, unreliable input channel. It is stamped
+ * with a sequence number and the send time, so the server can tell its latency and losses.
+ *
+ * @param type Application defined
+ * @param data Up to 16 bytes, zero-padded. May be NULL.
+ *
+ * @return false if the input channel is not up, or @p data is too large.
+ */
+bool my_connection_send_input(MyConnection *conn, guint16 type, gconstpointer data, gsize size);
+
+/*!
+ * Send a text message to the server over data channel
+ */
+bool my_connection_send_string(MyConnection *conn, const gchar *str);
+
 /*!
  * Assign a pipeline for use.
  *
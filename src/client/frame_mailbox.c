@@ -0,0 +1,177 @@
+#include "frame_mailbox.h"
+
+#include <string.h>
+
+#ifdef __linux__
+    #include <stdint.h>
+    #include <sys/eventfd.h>
+    #include <unistd.h>
+#endif
+
+// Set on the shared index while the shared slot holds a frame the consumer has not taken yet.
+#define MY_FRAME_MAILBOX_FRESH 0x4
+#define MY_FRAME_MAILBOX_INDEX_MASK 0x3
+
+void my_frame_mailbox_init(struct my_frame_mailbox *mb, const GDestroyNotify frame_free) {
+    g_assert_nonnull(mb);
+    memset(mb, 0, sizeof(struct my_frame_mailbox));
+
+    mb->back = 0;
+    mb->shared = 1;
+    mb->front = 2;
+    mb->frame_free = frame_free;
+    mb->event_fd = -1;
+
+    g_mutex_init(&mb->wait_mutex);
+    g_cond_init(&mb->wait_cond);
+}
+
+void my_frame_mailbox_clear(struct my_frame_mailbox *mb) {
+    for (int i = 0; i < 3; i++) {
+        struct my_frame_mailbox_slot *slot = &mb->slots[i];
+        if (slot->frame != NULL && mb->frame_free != NULL) {
+            mb->frame_free(slot->frame);
+        }
+        slot->frame = NULL;
+    }
+
+    g_atomic_int_set(&mb->shared, g_atomic_int_get(&mb->shared) & MY_FRAME_MAILBOX_INDEX_MASK);
+
+#ifdef __linux__
+    if (mb->event_fd >= 0) {
+        close(mb->event_fd);
+        mb->event_fd = -1;
+    }
+#endif
+
+    g_mutex_clear(&mb->wait_mutex);
+    g_cond_clear(&mb->wait_cond);
+}
+
+static void my_frame_mailbox_notify(struct my_frame_mailbox *mb) {
+#ifdef __linux__
+    const gint fd = g_atomic_int_get(&mb->event_fd);
+    if (fd >= 0) {
+        const uint64_t one = 1;
+        // Can only fail if the counter would overflow, which means the consumer is long gone.
+        (void)!write(fd, &one, sizeof(one));
+    }
+#endif
+
+    // The waiter registers itself before checking for a fresh frame, so either it sees our frame or we see it.
+    if (g_atomic_int_get(&mb->waiters) > 0) {
+        g_mutex_lock(&mb->wait_mutex);
+        g_cond_broadcast(&mb->wait_cond);
+        g_mutex_unlock(&mb->wait_mutex);
+    }
+}
+
+void my_frame_mailbox_publish(struct my_frame_mailbox *mb, const gpointer frame, const struct timespec *decode_end) {
+    struct my_frame_mailbox_slot *slot = &mb->slots[mb->back];
+    slot->frame = frame;
+    if (decode_end != NULL) {
+        slot->decode_end = *decode_end;
+    }
+
+    // Hand our slot over and get the previously shared one back.
+    const gint prev = g_atomic_int_exchange(&mb->shared, mb->back | MY_FRAME_MAILBOX_FRESH);
+    mb->back = prev & MY_FRAME_MAILBOX_INDEX_MASK;
+
+    g_atomic_int_inc(&mb->produced);
+
+    // The consumer never saw that frame, so it is ours to drop.
+    if (prev & MY_FRAME_MAILBOX_FRESH) {
+        struct my_frame_mailbox_slot *stale = &mb->slots[mb->back];
+        if (stale->frame != NULL && mb->frame_free != NULL) {
+            mb->frame_free(stale->frame);
+        }
+        stale->frame = NULL;
+        g_atomic_int_inc(&mb->dropped);
+    }
+
+    my_frame_mailbox_notify(mb);
+}
+
+gpointer my_frame_mailbox_take(struct my_frame_mailbox *mb, struct timespec *out_decode_end) {
+#ifdef __linux__
+    // Drain before looking at the shared slot: a frame published after this point signals the fd again.
+    if (mb->event_fd >= 0) {
+        uint64_t count;
+        (void)!read(mb->event_fd, &count, sizeof(count));
+    }
+#endif
+
+    if (!(g_atomic_int_get(&mb->shared) & MY_FRAME_MAILBOX_FRESH)) {
+        return NULL;
+    }
+
+    // Only the consumer clears the fresh flag, so it is still set here.
+    const gint prev = g_atomic_int_exchange(&mb->shared, mb->front);
+    mb->front = prev & MY_FRAME_MAILBOX_INDEX_MASK;
+
+    struct my_frame_mailbox_slot *slot = &mb->slots[mb->front];
+    const gpointer frame = slot->frame;
+    slot->frame = NULL;
+
+    if (out_decode_end != NULL) {
+        *out_decode_end = slot->decode_end;
+    }
+
+    g_atomic_int_inc(&mb->consumed);
+
+    return frame;
+}
+
+gboolean my_frame_mailbox_wait(struct my_frame_mailbox *mb, const gint64 timeout_us) {
+    if (g_atomic_int_get(&mb->shared) & MY_FRAME_MAILBOX_FRESH) {
+        return TRUE;
+    }
+    if (timeout_us == 0) {
+        return FALSE;
+    }
+
+    const gint64 end_time = timeout_us > 0 ? g_get_monotonic_time() + timeout_us : -1;
+    gboolean ready;
+
+    g_atomic_int_inc(&mb->waiters);
+    g_mutex_lock(&mb->wait_mutex);
+    while (!(ready = (g_atomic_int_get(&mb->shared) & MY_FRAME_MAILBOX_FRESH) != 0)) {
+        if (end_time < 0) {
+            g_cond_wait(&mb->wait_cond, &mb->wait_mutex);
+        } else if (!g_cond_wait_until(&mb->wait_cond, &mb->wait_mutex, end_time)) {
+            ready = (g_atomic_int_get(&mb->shared) & MY_FRAME_MAILBOX_FRESH) != 0;
+            break;
+        }
+    }
+    g_mutex_unlock(&mb->wait_mutex);
+    g_atomic_int_add(&mb->waiters, -1);
+
+    return ready;
+}
+
+gint my_frame_mailbox_get_fd(struct my_frame_mailbox *mb) {
+#ifdef __linux__
+    if (mb->event_fd < 0) {
+        const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            return -1;
+        }
+        g_atomic_int_set(&mb->event_fd, fd);
+
+        // A frame may have been published before the fd existed.
+        if (g_atomic_int_get(&mb->shared) & MY_FRAME_MAILBOX_FRESH) {
+            const uint64_t one = 1;
+            (void)!write(fd, &one, sizeof(one));
+        }
+    }
+    return mb->event_fd;
+#else
+    return -1;
+#endif
+}
+
+void my_frame_mailbox_get_counters(struct my_frame_mailbox *mb, struct my_frame_counters *out_counters) {
+    out_counters->produced = g_atomic_int_get(&mb->produced);
+    out_counters->consumed = g_atomic_int_get(&mb->consumed);
+    out_counters->dropped = g_atomic_int_get(&mb->dropped);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <glib.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * Snapshot of the frame hand-off counters.
+ */
+struct my_frame_counters {
+    /// Frames published by the producer (decoder streaming thread)
+    guint produced;
+    /// Frames taken by the consumer (render thread)
+    guint consumed;
+    /// Frames replaced by a newer one before the consumer took them
+    guint dropped;
+};
+
+struct my_frame_mailbox_slot {
+    gpointer frame;
+    struct timespec decode_end;
+};
+
+/*!
+ * Wait-free triple buffer handing frames from a single producer thread to a single consumer thread.
+ *
+ * The producer owns one slot, the consumer owns another, and the third is shared and swapped with a single atomic
+ * exchange on either side, so neither thread ever waits for the other. A frame that gets replaced before the consumer
+ * took it is released on the producer thread and counted as dropped.
+ *
+ * Embed it in the owning object and use @ref my_frame_mailbox_init / @ref my_frame_mailbox_clear.
+ */
+struct my_frame_mailbox {
+    struct my_frame_mailbox_slot slots[3];
+
+    /// Index of the shared slot, with MY_FRAME_MAILBOX_FRESH set while it holds a frame not yet taken.
+    gint shared;
+    /// Slot index owned by the producer
+    gint back;
+    /// Slot index owned by the consumer
+    gint front;
+
+    GDestroyNotify frame_free;
+
+    /// Number of consumers blocked in @ref my_frame_mailbox_wait
+    gint waiters;
+    GMutex wait_mutex;
+    GCond wait_cond;
+
+    /// Lazily created eventfd signalled on every publish, -1 until requested or where unsupported
+    gint event_fd;
+
+    guint produced;
+    guint consumed;
+    guint dropped;
+};
+
+/*!
+ * Initialize an empty mailbox.
+ *
+ * @param frame_free Called on frames that are dropped or still queued when the mailbox is cleared.
+ */
+void my_frame_mailbox_init(struct my_frame_mailbox *mb, GDestroyNotify frame_free);
+
+/*!
+ * Release any frame still held by the mailbox, and the wakeup resources.
+ *
+ * Neither the producer nor the consumer may be using the mailbox anymore.
+ */
+void my_frame_mailbox_clear(struct my_frame_mailbox *mb);
+
+/*!
+ * Producer side: publish a new frame, taking ownership of it.
+ *
+ * Never blocks. Replaces (and frees) the previously published frame if the consumer has not taken it yet.
+ */
+void my_frame_mailbox_publish(struct my_frame_mailbox *mb, gpointer frame, const struct timespec *decode_end);
+
+/*!
+ * Consumer side: take the most recent frame, if a new one has been published since the last call.
+ *
+ * Never blocks. Ownership of a non-null return value moves to the caller.
+ *
+ * @param[out] out_decode_end Populated with the decode-end time of the returned frame. May be NULL.
+ */
+gpointer my_frame_mailbox_take(struct my_frame_mailbox *mb, struct timespec *out_decode_end);
+
+/*!
+ * Consumer side: block until a frame is ready to be taken, or until the timeout expires.
+ *
+ * The producer only touches the mutex when a consumer is actually waiting, so publishing stays lock-free otherwise.
+ *
+ * @param timeout_us Maximum time to wait in microseconds. Negative waits forever, zero just polls.
+ *
+ * @return TRUE if a frame is ready.
+ */
+gboolean my_frame_mailbox_wait(struct my_frame_mailbox *mb, gint64 timeout_us);
+
+/*!
+ * Consumer side: get a file descriptor that becomes readable when a frame is published, to add to a poll set or an
+ * event loop (e.g. ALooper_addFd).
+ *
+ * The descriptor is drained by @ref my_frame_mailbox_take, it stays owned by the mailbox.
+ *
+ * @return The descriptor, or -1 if the platform has no eventfd.
+ */
+gint my_frame_mailbox_get_fd(struct my_frame_mailbox *mb);
+
+/*!
+ * Read the hand-off counters. May be called from any thread.
+ */
+void my_frame_mailbox_get_counters(struct my_frame_mailbox *mb, struct my_frame_counters *out_counters);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,216 @@
+#include "load_client.h"
+
+#include <gst/gst.h>
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+#undef GST_USE_UNSTABLE_API
+#include <string.h>
+
+#include "../common/rtp_analyzer.h"
+#include "../common/webrtc_stats.h"
+#include "../utils/logger.h"
+#include "connection.h"
+
+/// How often webrtcbin stats are polled, and the latest sample sent to the server
+#define LOAD_CLIENT_STATS_INTERVAL_MS 1000
+/// Only the latest sample is used
+#define LOAD_CLIENT_STATS_HISTORY_S 10
+
+struct load_client {
+    enum load_client_mode mode;
+    MyConnection *connection;
+
+    /// NULL between connections
+    GstElement *pipeline;
+    struct webrtc_stats_collector *stats;
+    /// Totals carry over reconnects, the probes on each webrtcbin's pads keep it alive
+    struct rtp_analyzer *analyzer;
+
+    gint64 started_us;
+    gint64 connect_us;
+    gboolean connected;
+    /// Timestamp of the last sample reported to the server
+    gint64 stats_reported_us;
+    guint timeout_src_id_report_stats;
+};
+
+/// The best ranked depayloader for @p caps, NULL if none
+static GstElement *load_client_make_depayloader(GstCaps *caps) {
+    GList *depayloaders =
+        gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DEPAYLOADER, GST_RANK_MARGINAL);
+    GList *matching = gst_element_factory_list_filter(depayloaders, caps, GST_PAD_SINK, FALSE);
+    matching = g_list_sort(matching, gst_plugin_feature_rank_compare_func);
+
+    GstElement *depayloader = NULL;
+    for (GList *iter = matching; iter != NULL && depayloader == NULL; iter = iter->next) {
+        depayloader = gst_element_factory_create(GST_ELEMENT_FACTORY(iter->data), NULL);
+    }
+
+    gst_plugin_feature_list_free(matching);
+    gst_plugin_feature_list_free(depayloaders);
+
+    return depayloader;
+}
+
+static void load_client_pad_added_cb(GstElement *webrtcbin, GstPad *pad, struct load_client *client) {
+    if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC) {
+        return;
+    }
+
+    rtp_analyzer_attach(client->analyzer, pad);
+
+    GstElement *sink = gst_element_factory_make("fakesink", NULL);
+    g_object_set(sink, "sync", FALSE, "async", FALSE, NULL);
+    gst_bin_add(GST_BIN(client->pipeline), sink);
+    GstElement *first = sink;
+
+    if (client->mode == LOAD_CLIENT_DEPAYLOAD) {
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        GstElement *depayloader = caps ? load_client_make_depayloader(caps) : NULL;
+        if (depayloader) {
+            gst_bin_add(GST_BIN(client->pipeline), depayloader);
+            gst_element_link(depayloader, sink);
+            first = depayloader;
+        } else {
+            ALOGW("No depayloader for %" GST_PTR_FORMAT ", only counting", caps);
+        }
+        gst_clear_caps(&caps);
+    }
+
+    gst_element_sync_state_with_parent(sink);
+    if (first != sink) {
+        gst_element_sync_state_with_parent(first);
+    }
+
+    GstPad *sink_pad = gst_element_get_static_pad(first, "sink");
+    const GstPadLinkReturn ret = gst_pad_link(pad, sink_pad);
+    if (ret != GST_PAD_LINK_OK) {
+        ALOGE("Failed to link webrtcbin pad %s: %d", GST_PAD_NAME(pad), ret);
+    }
+    gst_object_unref(sink_pad);
+}
+
+static void load_client_new_transceiver_cb(GstElement *webrtcbin, GstWebRTCRTPTransceiver *trans) {
+    // Like the regular client, so that the server sends the same streams
+    g_object_set(trans, "fec-type", GST_WEBRTC_FEC_TYPE_ULP_RED, NULL);
+}
+
+static void load_client_need_pipeline_cb(MyConnection *connection, struct load_client *client) {
+    client->pipeline = gst_object_ref_sink(gst_pipeline_new(NULL));
+
+    GstElement *webrtcbin = gst_element_factory_make("webrtcbin", "webrtc");
+    g_object_set(webrtcbin, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, "latency", 50, NULL);
+    g_signal_connect(webrtcbin, "on-new-transceiver", G_CALLBACK(load_client_new_transceiver_cb), NULL);
+    g_signal_connect(webrtcbin, "pad-added", G_CALLBACK(load_client_pad_added_cb), client);
+    gst_bin_add(GST_BIN(client->pipeline), webrtcbin);
+
+    client->stats = webrtc_stats_collector_new(webrtcbin, LOAD_CLIENT_STATS_INTERVAL_MS, LOAD_CLIENT_STATS_HISTORY_S);
+    webrtc_stats_collector_start(client->stats);
+
+    g_signal_emit_by_name(connection, "set-pipeline", GST_PIPELINE(client->pipeline), NULL);
+}
+
+static void load_client_drop_pipeline_cb(MyConnection *connection, struct load_client *client) {
+    client->connected = FALSE;
+    g_clear_pointer(&client->stats, webrtc_stats_collector_free);
+
+    if (client->pipeline) {
+        gst_element_set_state(client->pipeline, GST_STATE_NULL);
+        gst_clear_object(&client->pipeline);
+    }
+}
+
+static void load_client_connected_cb(MyConnection *connection, struct load_client *client) {
+    client->connected = TRUE;
+    if (client->connect_us == 0) {
+        client->connect_us = g_get_monotonic_time() - client->started_us;
+    }
+}
+
+/// Send the latest stats sample to the server, like the regular client
+static gboolean load_client_report_stats_cb(struct load_client *client) {
+    struct webrtc_stats_sample sample;
+    if (!client->connected || client->stats == NULL || !webrtc_stats_collector_get_latest(client->stats, &sample) ||
+        sample.timestamp_us == client->stats_reported_us) {
+        return G_SOURCE_CONTINUE;
+    }
+    client->stats_reported_us = sample.timestamp_us;
+
+    GString *msg = g_string_new("{\"stats\":");
+    webrtc_stats_sample_append_json(&sample, msg);
+    // Drop the trailing newline
+    g_string_truncate(msg, msg->len - 1);
+    g_string_append_c(msg, '}');
+
+    my_connection_send_string(client->connection, msg->str);
+    g_string_free(msg, TRUE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+struct load_client *load_client_new(const gchar *websocket_uri,
+                                    const gchar *video_codecs,
+                                    const enum load_client_mode mode) {
+    struct load_client *client = g_new0(struct load_client, 1);
+    client->mode = mode;
+    client->analyzer = rtp_analyzer_new("load");
+
+    client->connection =
+        g_object_ref_sink(websocket_uri ? my_connection_new(websocket_uri) : my_connection_new_localhost());
+    if (video_codecs) {
+        g_object_set(client->connection, "video-codecs", video_codecs, NULL);
+    }
+    g_signal_connect(client->connection, "on-need-pipeline", G_CALLBACK(load_client_need_pipeline_cb), client);
+    g_signal_connect(client->connection, "on-drop-pipeline", G_CALLBACK(load_client_drop_pipeline_cb), client);
+    g_signal_connect(client->connection, "webrtc_connected", G_CALLBACK(load_client_connected_cb), client);
+
+    return client;
+}
+
+void load_client_start(struct load_client *client) {
+    client->started_us = g_get_monotonic_time();
+    my_connection_connect(client->connection);
+
+    client->timeout_src_id_report_stats =
+        g_timeout_add(LOAD_CLIENT_STATS_INTERVAL_MS, G_SOURCE_FUNC(load_client_report_stats_cb), client);
+}
+
+void load_client_free(struct load_client *client) {
+    if (client == NULL) {
+        return;
+    }
+
+    g_clear_handle_id(&client->timeout_src_id_report_stats, g_source_remove);
+    my_connection_disconnect(client->connection);
+    g_signal_handlers_disconnect_by_data(client->connection, client);
+    g_clear_object(&client->connection);
+
+    // Normally done as the connection drops the pipeline
+    load_client_drop_pipeline_cb(NULL, client);
+
+    rtp_analyzer_free(client->analyzer);
+    g_free(client);
+}
+
+void load_client_get_stats(struct load_client *client, struct load_client_stats *out) {
+    memset(out, 0, sizeof(*out));
+    out->connected = client->connected;
+    out->connect_us = client->connect_us;
+
+    struct rtp_stream_stats streams[RTP_ANALYZER_MAX_STREAMS];
+    const guint n_streams = rtp_analyzer_get_streams(client->analyzer, streams, G_N_ELEMENTS(streams));
+    for (guint i = 0; i < n_streams; i++) {
+        out->packets += streams[i].packets;
+        out->bytes += streams[i].bytes;
+        out->seq_gaps += streams[i].seq_gaps;
+        out->frames += streams[i].frames;
+    }
+
+    struct webrtc_stats_sample sample;
+    if (client->stats && webrtc_stats_collector_get_latest(client->stats, &sample)) {
+        out->recv_bitrate = sample.recv_bitrate;
+        out->recv_loss_percent = sample.recv_loss_percent;
+        out->recv_jitter_ms = sample.recv_jitter_ms;
+        out->rtt_ms = sample.rtt_ms;
+    }
+}
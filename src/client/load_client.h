@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+enum load_client_mode {
+    /// Received RTP goes straight into a fakesink, only counted
+    LOAD_CLIENT_COUNT,
+    /// Received RTP is depayloaded as well, but never decoded
+    LOAD_CLIENT_DEPAYLOAD,
+};
+
+/*!
+ * Totals of one load client, see load_client_get_stats().
+ */
+struct load_client_stats {
+    /// Whether the data channel is open
+    gboolean connected;
+    /// How long the first connection took, from load_client_start() to the data channel opening, 0 until then
+    gint64 connect_us;
+
+    /// RTP packets received, all streams together, across reconnects
+    guint64 packets;
+    guint64 bytes;
+    /// Packets missing from the sequence number space
+    guint seq_gaps;
+    /// RTP marker bits, i.e. video frames
+    guint frames;
+
+    /// From the latest webrtcbin stats interval, 0 until one completed
+    gdouble recv_bitrate;
+    gdouble recv_loss_percent;
+    gdouble recv_jitter_ms;
+    gdouble rtt_ms;
+};
+
+/*!
+ * A viewer that negotiates like webrtc_client_native but never decodes nor renders, so that a single process can
+ * stand in for many of them against one server, see native_load_generator.
+ *
+ * It reports its stats to the server like the regular client, so they also show in the server's metrics. Everything
+ * runs from the default main context, like MyConnection.
+ */
+struct load_client;
+
+/*!
+ * @param websocket_uri NULL for the local server.
+ * @param video_codecs Codecs to ask the server for, see MyConnection:video-codecs. May be NULL.
+ */
+struct load_client *load_client_new(const gchar *websocket_uri,
+                                    const gchar *video_codecs,
+                                    enum load_client_mode mode);
+
+/*!
+ * Connect to the server, reconnecting on its own if the connection is lost.
+ */
+void load_client_start(struct load_client *client);
+
+/*!
+ * Disconnect and free the client.
+ */
+void load_client_free(struct load_client *client);
+
+void load_client_get_stats(struct load_client *client, struct load_client_stats *out);
+
+G_END_DECLS
@@ -21,6 +21,8 @@ enum my_status {
     MY_STATUS_DISCONNECTED_ERROR,
     /// Disconnected following remote closing of the channel, will not retry.
     MY_STATUS_DISCONNECTED_REMOTE_CLOSE,
+    /// Lost connectivity, restarting ICE and/or reconnecting the websocket while keeping the pipeline.
+    MY_STATUS_RECOVERING,
 };
 
 #define MY_MAKE_CASE(E) \
@@ -37,6 +39,7 @@ static inline const char* my_status_to_string(enum my_status status) {
         MY_MAKE_CASE(MY_STATUS_CONNECTED);
         MY_MAKE_CASE(MY_STATUS_DISCONNECTED_ERROR);
         MY_MAKE_CASE(MY_STATUS_DISCONNECTED_REMOTE_CLOSE);
+        MY_MAKE_CASE(MY_STATUS_RECOVERING);
         default:
             return "Unknown!";
     }
@@ -22,9 +22,18 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef G_OS_UNIX
+    #include <glib-unix.h>
+    #include <signal.h>
+#endif
+
+#include "../common/dot_snapshot.h"
 #include "../common/general.h"
+#include "../common/signaling_protocol.h"
+#include "../common/webrtc_stats.h"
 #include "../utils/logger.h"
 #include "connection.h"
+#include "frame_mailbox.h"
 #include "gst_common.h"
 
 #ifdef ANDROID
@@ -134,12 +143,54 @@ struct my_stream_client {
 
     bool received_first_frame;
 
-    GMutex sample_mutex;
-    GstSample *sample;
-    struct timespec sample_decode_end_ts;
+    /// Decoded samples handed from the appsink streaming thread to the render thread
+    struct my_frame_mailbox frames;
+
+    /// Frames that went through the desktop video sink chain
+    guint frames_rendered;
+
+    struct webrtc_stats_collector *stats;
+    /// Timestamp of the last sample reported to the server
+    gint64 stats_reported_us;
+
+    struct dot_snapshotter *dot_snapshotter;
 
-    guint timeout_src_id_dot_data;
-    guint timeout_src_id_print_stats;
+    /// Inputs of the warm receive chains, kept across reconnects and fed by whichever webrtcbin is current
+    GstElement *video_in;
+    GstElement *audio_in;
+    /// Index in video_depayloaders of what the video chain decodes
+    guint video_codec;
+    /// Elements from video_in up to the decoder, rebuilt if the server sends another codec than expected
+    GPtrArray *video_chain;
+    /// Input of the video sink chain when decodebin3 stands in for the decoder, relinked to its newest pad
+    GstPad *video_sink_pad;
+
+    /// Monotonic time the current webrtcbin was attached, for the time to first frame
+    gint64 attached_us;
+    gint first_frame_seen;
+
+    guint signal_src_id_snapshot;
+    guint timeout_src_id_report_stats;
+};
+
+/// How often webrtcbin stats are polled
+#define STATS_POLL_INTERVAL_MS 1000
+/// How much stats history is kept
+#define STATS_HISTORY_S 300
+
+/// Video codecs the server may send, by RTP encoding name. The first one is what it sends when we do not ask.
+static const struct {
+    const gchar *encoding_name;
+    const gchar *depay;
+    /// May be NULL
+    const gchar *parse;
+    /// What the decoder gets, so it can be set up before the offer arrives
+    const gchar *caps;
+} video_depayloaders[] = {
+    {"H264", "rtph264depay", "h264parse", "video/x-h264, stream-format=byte-stream, alignment=au"},
+    {"VP8", "rtpvp8depay", NULL, "video/x-vp8"},
+    {"VP9", "rtpvp9depay", NULL, "video/x-vp9"},
+    {"AV1", "rtpav1depay", "av1parse", "video/x-av1, stream-format=obu-stream, alignment=tu"},
 };
 
 // clang-format off
@@ -176,7 +227,7 @@ static void my_stream_client_init(MyStreamClient *sc) {
 
     sc->loop = g_main_loop_new(NULL, FALSE);
     g_assert(os_thread_helper_init(&sc->play_thread) >= 0);
-    g_mutex_init(&sc->sample_mutex);
+    my_frame_mailbox_init(&sc->frames, (GDestroyNotify)gst_sample_unref);
 }
 
 #ifdef ANDROID
@@ -203,7 +254,7 @@ static void my_stream_client_dispose(MyStreamClient *self) {
     my_stream_client_stop(self);
     g_clear_object(&self->loop);
     g_clear_object(&self->connection);
-    gst_clear_object(&self->sample);
+    my_frame_mailbox_clear(&self->frames);
     gst_clear_object(&self->pipeline);
 #ifdef ANDROID
     gst_clear_object(&self->gst_gl_display);
@@ -284,6 +335,14 @@ static gboolean gst_bus_cb(GstBus *bus, GstMessage *message, gpointer user_data)
     return TRUE;
 }
 
+/// Log how long the first frame took after attaching a webrtcbin, warm or not
+static void note_first_frame(MyStreamClient *sc) {
+    if (g_atomic_int_compare_and_exchange(&sc->first_frame_seen, FALSE, TRUE)) {
+        ALOGI("First frame %.1f ms after attaching webrtcbin",
+              (gdouble)(g_get_monotonic_time() - sc->attached_us) / 1000.0);
+    }
+}
+
 #ifdef ANDROID
 static GstFlowReturn on_new_sample_cb(GstAppSink *appsink, gpointer user_data) {
     MyStreamClient *sc = (MyStreamClient *)user_data;
@@ -299,22 +358,10 @@ static GstFlowReturn on_new_sample_cb(GstAppSink *appsink, gpointer user_data) {
     GstSample *sample = gst_app_sink_pull_sample(appsink);
     g_assert_nonnull(sample);
 
-    GstSample *prevSample = NULL;
-
-    // Update client sample
-    {
-        g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
-        prevSample = sc->sample;
-        sc->sample = sample;
-        sc->sample_decode_end_ts = ts;
-        sc->received_first_frame = true;
-    }
-
-    // Previous client sample is not used.
-    if (prevSample) {
-        ALOGI("Discarding unused, replaced sample");
-        gst_sample_unref(prevSample);
-    }
+    // Hand the sample over to the render thread. A previous sample it has not picked up yet is dropped here.
+    my_frame_mailbox_publish(&sc->frames, sample, &ts);
+    sc->received_first_frame = true;
+    note_first_frame(sc);
 
     return GST_FLOW_OK;
 }
@@ -330,7 +377,10 @@ static void on_negotiation_needed(GstElement *webrtcbin, gpointer user_data) {
     // Pass
 }
 
-static void on_video_handoff(GstElement *identity, GstBuffer *buffer, gpointer user_data) {
+static void on_video_handoff(GstElement *identity, GstBuffer *buffer, MyStreamClient *sc) {
+    g_atomic_int_inc(&sc->frames_rendered);
+    note_first_frame(sc);
+
     GstClockTime pts = GST_BUFFER_PTS(buffer);
     GstClockTime dts = GST_BUFFER_DTS(buffer);
     // g_print("Buffer PTS: %" GST_TIME_FORMAT ", DTS: %" GST_TIME_FORMAT "\n", GST_TIME_ARGS(pts), GST_TIME_ARGS(dts));
@@ -454,7 +504,7 @@ static void handle_media_stream(GstPad *src_pad, MyStreamClient *sc, const char
         GstElement *identity = gst_element_factory_make("identity", NULL);
         g_assert_nonnull(identity);
         g_object_set(identity, "signal-handoffs", TRUE, NULL);
-        g_signal_connect(identity, "handoff", G_CALLBACK(on_video_handoff), NULL);
+        g_signal_connect(identity, "handoff", G_CALLBACK(on_video_handoff), sc);
 
         g_object_set(sink, "sync", FALSE, NULL);
 
@@ -503,7 +553,19 @@ static void on_decodebin_pad_added(GstElement *decodebin, GstPad *pad, MyStreamC
     g_free(str);
 
     if (g_str_has_prefix(name, "video")) {
-        handle_media_stream(pad, sc, "videoconvert", "autovideosink");
+        // A new stream after a reconnect gets a new pad, feed it to the sink chain we already have
+        if (sc->video_sink_pad) {
+            GstPad *old_peer = gst_pad_get_peer(sc->video_sink_pad);
+            if (old_peer) {
+                gst_pad_unlink(old_peer, sc->video_sink_pad);
+                gst_object_unref(old_peer);
+            }
+            const GstPadLinkReturn ret = gst_pad_link(pad, sc->video_sink_pad);
+            g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
+        } else {
+            handle_media_stream(pad, sc, "videoconvert", "autovideosink");
+            sc->video_sink_pad = gst_pad_get_peer(pad);
+        }
     } else if (g_str_has_prefix(name, "audio")) {
         gst_printerr("We should not use decodebin3 to handle audio");
         abort();
@@ -573,76 +635,246 @@ GstElement *find_element_by_name(GstBin *bin, const gchar *element_name) {
     return result;
 }
 
-static void on_webrtcbin_stats(GstPromise *promise, GstElement *user_data) {
-    const GstStructure *reply = gst_promise_get_reply(promise);
-    gchar *str = gst_structure_to_string(reply);
-    g_print("webrtcbin stats: %s\n", str);
-    g_free(str);
+static void stats_frame_counter_cb(gpointer user_data, guint64 *out_decoded, guint64 *out_dropped) {
+    MyStreamClient *sc = user_data;
+
+#ifdef ANDROID
+    struct my_frame_counters counters;
+    my_frame_mailbox_get_counters(&sc->frames, &counters);
+    *out_decoded = counters.produced;
+    *out_dropped = counters.dropped;
+#else
+    *out_decoded = g_atomic_int_get(&sc->frames_rendered);
+    *out_dropped = 0;
+#endif
 }
 
-static gboolean print_fec_stats(MyStreamClient *sc) {
-    if (!sc) {
+/// Send the latest stats sample to the server, which exposes it in its metrics.
+static gboolean report_stats_cb(MyStreamClient *sc) {
+    struct webrtc_stats_sample sample;
+    if (sc->stats == NULL || sc->connection == NULL || !webrtc_stats_collector_get_latest(sc->stats, &sample) ||
+        sample.timestamp_us == sc->stats_reported_us) {
         return G_SOURCE_CONTINUE;
     }
+    sc->stats_reported_us = sample.timestamp_us;
 
-    GstElement *webrtcbin = gst_bin_get_by_name(GST_BIN(sc->pipeline), "webrtc");
+    GString *msg = g_string_new("{\"stats\":");
+    webrtc_stats_sample_append_json(&sample, msg);
+    // Drop the trailing newline
+    g_string_truncate(msg, msg->len - 1);
+    g_string_append_c(msg, '}');
 
-    //    GstElement *rtpbin = NULL;
-    //    gst_bin_get_by_name(GST_BIN(webrtcbin), "rtpbin");
-    //
-    //    // For RTP session
-    //    GstElement *rtpsession = gst_bin_get_by_name(GST_BIN(rtpbin), "rtpsession0");
-    //    g_object_set(rtpsession, "rtcp-rr-bandwidth", 16777216, NULL);
-    //    g_object_set(rtpsession, "bandwidth", 16777216, NULL);
-
-    GstPromise *promise = gst_promise_new_with_change_func((GstPromiseChangeFunc)on_webrtcbin_stats, NULL, NULL);
-    g_signal_emit_by_name(webrtcbin, "get-stats", NULL, promise);
-
-    // FEC stats
-    for (int i = 0; i < 2; i++) {
-        gchar *name;
-        gchar *name_jitter;
-        gchar *name_storage;
-        if (i == 0) {
-            name = "rtpulpfecdec0";
-            name_jitter = "rtpjitterbuffer0";
-            name_storage = "rtpstorage0";
+    my_connection_send_string(sc->connection, msg->str);
+    g_string_free(msg, TRUE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+#if defined(G_OS_UNIX) && !defined(ANDROID)
+/// `kill -USR1 <pid>` writes a compressed snapshot
+static gboolean snapshot_signal_cb(MyStreamClient *sc) {
+    if (sc->dot_snapshotter) {
+        g_free(dot_snapshotter_request(sc->dot_snapshotter, TRUE));
+    }
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+/// Pick the best ranked decoder for @p caps_str, so it is instantiated before any stream shows up
+static GstElement *make_decoder_for_caps(const gchar *caps_str) {
+    GstCaps *caps = gst_caps_from_string(caps_str);
+    GList *decoders = gst_element_factory_list_get_elements(GST_ELEMENT_FACTORY_TYPE_DECODER, GST_RANK_MARGINAL);
+    GList *matching = gst_element_factory_list_filter(decoders, caps, GST_PAD_SINK, FALSE);
+    matching = g_list_sort(matching, gst_plugin_feature_rank_compare_func);
+
+    GstElement *decoder = NULL;
+    for (GList *iter = matching; iter != NULL && decoder == NULL; iter = iter->next) {
+        decoder = gst_element_factory_create(GST_ELEMENT_FACTORY(iter->data), NULL);
+    }
+    if (decoder) {
+        ALOGI("Pre-instantiated decoder %s for %s", GST_OBJECT_NAME(gst_element_get_factory(decoder)), caps_str);
+    }
+
+    gst_plugin_feature_list_free(matching);
+    gst_plugin_feature_list_free(decoders);
+    gst_caps_unref(caps);
+
+    return decoder;
+}
+
+/// The codec we asked the server for, see MyConnection:video-codecs
+static guint expected_video_codec(MyStreamClient *sc) {
+    gchar *codecs = NULL;
+    g_object_get(sc->connection, "video-codecs", &codecs, NULL);
+
+    const gchar *names[G_N_ELEMENTS(video_depayloaders)];
+    for (guint i = 0; i < G_N_ELEMENTS(video_depayloaders); i++) {
+        names[i] = video_depayloaders[i].encoding_name;
+    }
+    const gint expected = signaling_codecs_choose(codecs, names, G_N_ELEMENTS(video_depayloaders));
+    g_free(codecs);
+
+    // The server sends the first one when we do not ask or it has none of ours
+    return expected < 0 ? 0 : (guint)expected;
+}
+
+static void video_chain_add(MyStreamClient *sc, GstElement *element) {
+    gst_bin_add(GST_BIN(sc->pipeline), element);
+    g_ptr_array_add(sc->video_chain, gst_object_ref(element));
+}
+
+/// Build the video chain up to the decoder, and feed it to the sink chain, which is only built the first time
+static void build_video_chain(MyStreamClient *sc, const guint codec) {
+    const gchar *caps_str = video_depayloaders[codec].caps;
+
+    sc->video_codec = codec;
+    sc->video_chain = g_ptr_array_new_with_free_func(gst_object_unref);
+
+    sc->video_in = gst_element_factory_make("queue", "video_in");
+    video_chain_add(sc, sc->video_in);
+
+    GstElement *last = gst_element_factory_make(video_depayloaders[codec].depay, NULL);
+    video_chain_add(sc, last);
+    gst_element_link(sc->video_in, last);
+
+    if (video_depayloaders[codec].parse) {
+        GstElement *parse = gst_element_factory_make(video_depayloaders[codec].parse, NULL);
+        video_chain_add(sc, parse);
+        gst_element_link(last, parse);
+        last = parse;
+    }
+
+    GstElement *decoder = make_decoder_for_caps(caps_str);
+    if (decoder) {
+        video_chain_add(sc, decoder);
+        gst_element_link(last, decoder);
+
+        GstPad *src_pad = gst_element_get_static_pad(decoder, "src");
+        if (sc->video_sink_pad) {
+            const GstPadLinkReturn ret = gst_pad_link(src_pad, sc->video_sink_pad);
+            g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
         } else {
-            name = "rtpulpfecdec1";
-            name_jitter = "rtpjitterbuffer1";
-            name_storage = "rtpstorage1";
+            handle_media_stream(src_pad, sc, "videoconvert", "autovideosink");
+            sc->video_sink_pad = gst_pad_get_peer(src_pad);
         }
+        gst_object_unref(src_pad);
+    } else {
+        // Autoplugged on the first stream instead
+        ALOGW("No decoder for %s, falling back to decodebin3", caps_str);
+        GstElement *decodebin = gst_element_factory_make("decodebin3", NULL);
+        g_signal_connect(decodebin, "pad-added", G_CALLBACK(on_decodebin_pad_added), sc);
+        video_chain_add(sc, decodebin);
+        gst_element_link(last, decodebin);
+    }
+}
+
+/// Drop the video chain up to the decoder, the sink chain stays
+static void drop_video_chain(MyStreamClient *sc) {
+    for (guint i = 0; i < sc->video_chain->len; i++) {
+        GstElement *element = g_ptr_array_index(sc->video_chain, i);
+        gst_element_set_state(element, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(sc->pipeline), element);
+    }
+    g_clear_pointer(&sc->video_chain, g_ptr_array_unref);
+    sc->video_in = NULL;
+}
+
+/*!
+ * Build the decode and render chains once, ahead of the first offer: depayloaders, decoders and sinks stay in the
+ * pipeline across reconnects, and only the webrtcbin in front of them is replaced.
+ */
+static void build_receive_chains(MyStreamClient *sc) {
+    GstBin *bin = GST_BIN(sc->pipeline);
+
+    // Audio
+    {
+        sc->audio_in = gst_element_factory_make("queue", "audio_in");
+        GstElement *depay = gst_element_factory_make("rtpopusdepay", NULL);
+        GstElement *opusdec = gst_element_factory_make("opusdec", NULL);
+        gst_bin_add_many(bin, sc->audio_in, depay, opusdec, NULL);
+        gst_element_link_many(sc->audio_in, depay, opusdec, NULL);
+
+#ifdef ANDROID
+        const char *sink_name = "openslessink";
+#else
+        const char *sink_name = "autoaudiosink";
+#endif
 
-        GstElement *rtpulpfecdec = find_element_by_name(GST_BIN(webrtcbin), name);
+        GstPad *src_pad = gst_element_get_static_pad(opusdec, "src");
+        handle_media_stream(src_pad, sc, "audioconvert", sink_name);
+        gst_object_unref(src_pad);
+    }
 
-        if (rtpulpfecdec) {
-            GValue pt = G_VALUE_INIT;
-            GValue recovered = G_VALUE_INIT;
-            GValue unrecovered = G_VALUE_INIT;
+    build_video_chain(sc, expected_video_codec(sc));
 
-            g_object_get_property(G_OBJECT(rtpulpfecdec), "pt", &pt);
-            g_object_get_property(G_OBJECT(rtpulpfecdec), "recovered", &recovered);
-            g_object_get_property(G_OBJECT(rtpulpfecdec), "unrecovered", &unrecovered);
+    // Open the decoders and sinks now rather than when the first packets arrive
+    gst_element_set_state(sc->pipeline, GST_STATE_READY);
+}
 
-            g_object_set(G_OBJECT(rtpulpfecdec), "passthrough", FALSE, NULL);
+/// Feed a warm chain from a new webrtcbin pad
+static void link_webrtcbin_pad(MyStreamClient *sc, GstPad *pad, const bool is_audio) {
+    // Check webrtcbin output
+    // rtp_analyzer_attach(analyzer, pad);
 
-            g_print("FEC stats: pt %u, recovered %u, unrecovered %u\n",
-                    g_value_get_uint(&pt),
-                    g_value_get_uint(&recovered),
-                    g_value_get_uint(&unrecovered));
+    GstPad *sink_pad = gst_element_get_static_pad(is_audio ? sc->audio_in : sc->video_in, "sink");
 
-            g_value_unset(&pt);
-            g_value_unset(&recovered);
-            g_value_unset(&unrecovered);
-        }
+    // Whatever fed the chain before went away with the previous webrtcbin
+    GstPad *old_peer = gst_pad_get_peer(sink_pad);
+    if (old_peer) {
+        gst_pad_unlink(old_peer, sink_pad);
+        gst_object_unref(old_peer);
+    }
 
-        GstElement *rtpstorage = find_element_by_name(GST_BIN(webrtcbin), name_storage);
-        if (rtpstorage) {
-            g_object_set(rtpstorage, "size-time", 220000000, NULL);
-        }
+    const GstPadLinkReturn ret = gst_pad_link(pad, sink_pad);
+    if (ret != GST_PAD_LINK_OK) {
+        ALOGE("Failed to link webrtcbin %s pad: %d", is_audio ? "audio" : "video", ret);
     }
+    gst_object_unref(sink_pad);
+}
 
-    return G_SOURCE_CONTINUE;
+/*!
+ * A webrtcbin video pad of another codec than the video chain's, held blocked while the main context rebuilds the
+ * chain, as elements cannot be stopped and swapped from the streaming thread that feeds them.
+ */
+struct video_chain_rebuild {
+    MyStreamClient *sc;
+    GstPad *pad;
+    guint codec;
+    gulong probe_id;
+};
+
+static void video_chain_rebuild_free(gpointer data) {
+    struct video_chain_rebuild *rebuild = data;
+
+    gst_object_unref(rebuild->pad);
+    g_free(rebuild);
+}
+
+static GstPadProbeReturn video_chain_rebuild_block_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    // Until video_chain_rebuild_cb() removes the probe
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean video_chain_rebuild_cb(gpointer user_data) {
+    const struct video_chain_rebuild *rebuild = user_data;
+    MyStreamClient *sc = rebuild->sc;
+
+    ALOGW("Got %s video instead of %s, rebuilding the video chain",
+          video_depayloaders[rebuild->codec].encoding_name,
+          video_depayloaders[sc->video_codec].encoding_name);
+    drop_video_chain(sc);
+    build_video_chain(sc, rebuild->codec);
+    g_ptr_array_foreach(sc->video_chain, (GFunc)gst_element_sync_state_with_parent, NULL);
+
+    // Unless its webrtcbin was dropped meanwhile
+    GstElement *webrtcbin = gst_pad_get_parent_element(rebuild->pad);
+    if (webrtcbin) {
+        link_webrtcbin_pad(sc, rebuild->pad, false);
+        gst_object_unref(webrtcbin);
+    }
+    gst_pad_remove_probe(rebuild->pad, rebuild->probe_id);
+
+    return G_SOURCE_REMOVE;
 }
 
 static void on_webrtcbin_pad_added(GstElement *webrtcbin, GstPad *pad, MyStreamClient *sc) {
@@ -656,51 +888,64 @@ static void on_webrtcbin_pad_added(GstElement *webrtcbin, GstPad *pad, MyStreamC
     g_print("webrtcbin src pad caps: %s\n", str);
     bool is_audio = g_strstr_len(str, -1, "audio") != NULL;
     g_free(str);
-    gst_caps_unref(caps);
-
-    if (is_audio) {
-        GstElement *depay = gst_element_factory_make("rtpopusdepay", NULL);
-        gst_bin_add(GST_BIN(sc->pipeline), depay);
 
-        GstPad *sink_pad = gst_element_get_static_pad(depay, "sink");
-        gst_pad_link(pad, sink_pad);
-        gst_object_unref(sink_pad);
+    // The server falls back to another codec if it cannot encode the one we asked for. The video chain only changes
+    // on the main context, which is where this pad gets linked then.
+    const gchar *encoding_name = gst_structure_get_string(gst_caps_get_structure(caps, 0), "encoding-name");
+    if (!is_audio && encoding_name &&
+        g_ascii_strcasecmp(encoding_name, video_depayloaders[sc->video_codec].encoding_name) != 0) {
+        for (guint i = 0; i < G_N_ELEMENTS(video_depayloaders); i++) {
+            if (g_ascii_strcasecmp(encoding_name, video_depayloaders[i].encoding_name) == 0) {
+                struct video_chain_rebuild *rebuild = g_new0(struct video_chain_rebuild, 1);
+                rebuild->sc = sc;
+                rebuild->pad = gst_object_ref(pad);
+                rebuild->codec = i;
+                rebuild->probe_id = gst_pad_add_probe(pad,
+                                                      GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                                                      video_chain_rebuild_block_cb,
+                                                      NULL,
+                                                      NULL);
+                g_main_context_invoke_full(NULL,
+                                           G_PRIORITY_DEFAULT,
+                                           video_chain_rebuild_cb,
+                                           rebuild,
+                                           video_chain_rebuild_free);
+                gst_caps_unref(caps);
+                return;
+            }
+        }
+    }
+    gst_caps_unref(caps);
 
-        GstElement *opusdec = gst_element_factory_make("opusdec", NULL);
-        gst_bin_add(GST_BIN(sc->pipeline), opusdec);
+    link_webrtcbin_pad(sc, pad, is_audio);
+}
 
-        gst_element_link(depay, opusdec);
+/// Create the pipeline with its receive chains, on the first connect only
+static void create_pipeline(MyStreamClient *sc) {
+    sc->pipeline = gst_object_ref_sink(gst_pipeline_new("webrtc-recv-pipeline"));
 
-        GstPad *src_pad = gst_element_get_static_pad(opusdec, "src");
+    {
+        GstBus *bus = gst_element_get_bus(sc->pipeline);
 
 #ifdef ANDROID
-        const char *sink_name = "openslessink";
-#else
-        const char *sink_name = "autoaudiosink";
+        // We set this up to inject the EGL context
+        gst_bus_set_sync_handler(bus, (GstBusSyncHandler)bus_sync_handler_cb, sc, NULL);
 #endif
 
-        handle_media_stream(src_pad, sc, "audioconvert", sink_name);
-
-        gst_element_sync_state_with_parent(depay);
-        gst_element_sync_state_with_parent(opusdec);
-    } else {
-        // Check webrtcbin output
-        // gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)on_buffer_probe_cb, NULL, NULL);
-
-        GstElement *decodebin = gst_element_factory_make("decodebin3", NULL);
-
-        g_signal_connect(decodebin, "pad-added", G_CALLBACK(on_decodebin_pad_added), sc);
-        gst_bin_add(GST_BIN(sc->pipeline), decodebin);
+        // This just watches for errors and such
+        gst_bus_add_watch(bus, gst_bus_cb, sc->pipeline);
 
-        // Print stats repeatedly
-        //        sc->timeout_src_id_print_stats = g_timeout_add_seconds(3, G_SOURCE_FUNC(print_stats), sc);
+        g_object_unref(bus);
+    }
 
-        GstPad *sink_pad = gst_element_get_static_pad(decodebin, "sink");
-        gst_pad_link(pad, sink_pad);
-        gst_object_unref(sink_pad);
+    build_receive_chains(sc);
 
-        gst_element_sync_state_with_parent(decodebin);
-    }
+    sc->dot_snapshotter = dot_snapshotter_new(sc->pipeline, "client");
+#if defined(G_OS_UNIX) && !defined(ANDROID)
+    sc->signal_src_id_snapshot = g_unix_signal_add(SIGUSR1, G_SOURCE_FUNC(snapshot_signal_cb), sc);
+#endif
+    sc->timeout_src_id_report_stats =
+        g_timeout_add(STATS_POLL_INTERVAL_MS, G_SOURCE_FUNC(report_stats_cb), sc);
 }
 
 static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamClient *sc) {
@@ -748,7 +993,10 @@ static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamClient *sc) {
     //        abort();
     //    }
 
-    sc->pipeline = gst_pipeline_new("webrtc-recv-pipeline");
+    const gboolean warm = sc->pipeline != NULL;
+    if (!warm) {
+        create_pipeline(sc);
+    }
 
     GstElement *webrtcbin = gst_element_factory_make("webrtcbin", "webrtc");
     // Matching this to the offerer's bundle policy is necessary for negotiation
@@ -765,33 +1013,37 @@ static void on_need_pipeline_cb(MyConnection *my_conn, MyStreamClient *sc) {
 
     gst_bin_add_many(GST_BIN(sc->pipeline), webrtcbin, NULL);
 
-    {
-        GstBus *bus = gst_element_get_bus(sc->pipeline);
-
-#ifdef ANDROID
-        // We set this up to inject the EGL context
-        gst_bus_set_sync_handler(bus, (GstBusSyncHandler)bus_sync_handler_cb, sc, NULL);
-#endif
+    sc->stats = webrtc_stats_collector_new(webrtcbin, STATS_POLL_INTERVAL_MS, STATS_HISTORY_S);
+    webrtc_stats_collector_set_frame_counter(sc->stats, stats_frame_counter_cb, sc);
+    webrtc_stats_collector_start(sc->stats);
 
-        // This just watches for errors and such
-        gst_bus_add_watch(bus, gst_bus_cb, sc->pipeline);
+    sc->attached_us = g_get_monotonic_time();
+    g_atomic_int_set(&sc->first_frame_seen, FALSE);
 
-        g_object_unref(bus);
-    }
+    ALOGI("Attaching webrtcbin to %s receive chains", warm ? "warm" : "new");
 
     // This actually hands over the pipeline. Once our own handler returns,
     // the pipeline will be started by the connection.
     g_signal_emit_by_name(my_conn, "set-pipeline", GST_PIPELINE(sc->pipeline), NULL);
 
-    sc->timeout_src_id_dot_data = g_timeout_add_seconds(3, G_SOURCE_FUNC(check_pipeline_dot_data), sc->pipeline);
+    // The rest of the pipeline may already be running
+    gst_element_sync_state_with_parent(webrtcbin);
 }
 
+/// Only the webrtcbin goes away, the decode and render chains stay warm for the next connection.
 static void on_drop_pipeline_cb(MyConnection *my_conn, MyStreamClient *sc) {
-    if (sc->pipeline) {
-        gst_element_set_state(sc->pipeline, GST_STATE_NULL);
+    g_clear_pointer(&sc->stats, webrtc_stats_collector_free);
+
+    if (sc->pipeline == NULL) {
+        return;
+    }
+
+    GstElement *webrtcbin = gst_bin_get_by_name(GST_BIN(sc->pipeline), "webrtc");
+    if (webrtcbin) {
+        gst_element_set_state(webrtcbin, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(sc->pipeline), webrtcbin);
+        gst_object_unref(webrtcbin);
     }
-    gst_clear_object(&sc->pipeline);
-    gst_clear_object(&sc->app_sink);
 }
 
 static void *my_stream_client_thread_func(void *ptr) {
@@ -843,6 +1095,14 @@ void my_stream_client_stop(MyStreamClient *sc) {
     if (sc->connection != NULL) {
         my_connection_disconnect(sc->connection);
     }
+    g_clear_handle_id(&sc->timeout_src_id_report_stats, g_source_remove);
+    g_clear_handle_id(&sc->signal_src_id_snapshot, g_source_remove);
+    g_clear_pointer(&sc->dot_snapshotter, dot_snapshotter_free);
+    g_clear_pointer(&sc->stats, webrtc_stats_collector_free);
+    sc->video_in = NULL;
+    sc->audio_in = NULL;
+    g_clear_pointer(&sc->video_chain, g_ptr_array_unref);
+    gst_clear_object(&sc->video_sink_pad);
     gst_clear_object(&sc->pipeline);
     gst_clear_object(&sc->app_sink);
 #ifdef ANDROID
@@ -859,14 +1119,8 @@ struct my_sample *my_stream_client_try_pull_sample(MyStreamClient *sc, struct ti
 
     // We actually pull the sample in the new-sample signal handler,
     // so here we're just receiving the sample already pulled.
-    GstSample *sample = NULL;
     struct timespec decode_end;
-    {
-        g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sc->sample_mutex);
-        sample = sc->sample;
-        sc->sample = NULL;
-        decode_end = sc->sample_decode_end_ts;
-    }
+    GstSample *sample = my_frame_mailbox_take(&sc->frames, &decode_end);
 
     if (sample == NULL) {
         if (gst_app_sink_is_eos(GST_APP_SINK(sc->app_sink))) {
@@ -943,6 +1197,18 @@ void my_stream_client_release_sample(MyStreamClient *sc, struct my_sample *sampl
 }
 #endif
 
+bool my_stream_client_wait_for_sample(MyStreamClient *sc, const gint64 timeout_us) {
+    return my_frame_mailbox_wait(&sc->frames, timeout_us) == TRUE;
+}
+
+int my_stream_client_get_sample_fd(MyStreamClient *sc) {
+    return my_frame_mailbox_get_fd(&sc->frames);
+}
+
+void my_stream_client_get_frame_counters(MyStreamClient *sc, struct my_frame_counters *out_counters) {
+    my_frame_mailbox_get_counters(&sc->frames, out_counters);
+}
+
 /*
  * Helper functions
  */
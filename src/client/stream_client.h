@@ -3,6 +3,7 @@
 #include <glib-object.h>
 
 #include "connection.h"
+#include "frame_mailbox.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -57,6 +58,33 @@ struct my_sample *my_stream_client_try_pull_sample(MyStreamClient *sc, struct ti
  */
 void my_stream_client_release_sample(MyStreamClient *sc, struct my_sample *sample);
 
+/*!
+ * Block until a decoded sample is ready to be pulled, or until the timeout expires.
+ *
+ * Lets a render loop sleep between frames instead of spinning on @ref my_stream_client_try_pull_sample.
+ *
+ * @param timeout_us Maximum time to wait in microseconds. Negative waits forever, zero just polls.
+ *
+ * @return true if a sample is ready.
+ */
+bool my_stream_client_wait_for_sample(MyStreamClient *sc, gint64 timeout_us);
+
+/*!
+ * Get a file descriptor that becomes readable whenever a new sample has been decoded, so the render loop can add it
+ * to its own event loop (e.g. ALooper_addFd) and only wake up to render when there is something to show.
+ *
+ * The descriptor stays owned by the stream client and is drained by @ref my_stream_client_try_pull_sample.
+ *
+ * @return The descriptor, or -1 where unsupported.
+ */
+int my_stream_client_get_sample_fd(MyStreamClient *sc);
+
+/*!
+ * Read how many decoded frames were produced, consumed by @ref my_stream_client_try_pull_sample, and dropped because
+ * a newer frame replaced them first. May be called from any thread.
+ */
+void my_stream_client_get_frame_counters(MyStreamClient *sc, struct my_frame_counters *out_counters);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,146 @@
+#include "bulk_reassembler.h"
+
+#include <string.h>
+
+#include "../utils/logger.h"
+
+struct bulk_incoming {
+    /// Grows with the chunks, never sized from the announced total
+    GByteArray *data;
+    guint32 total;
+    gint64 start_us;
+    gint64 last_us;
+};
+
+struct bulk_reassembler {
+    guint32 max_size;
+    /// Transfer ID -> struct bulk_incoming*
+    GHashTable *incoming;
+    gsize held_bytes;
+};
+
+static void bulk_incoming_free(gpointer data) {
+    struct bulk_incoming *in = data;
+    g_byte_array_unref(in->data);
+    g_free(in);
+}
+
+struct bulk_reassembler *bulk_reassembler_new(const guint32 max_size) {
+    struct bulk_reassembler *r = g_new0(struct bulk_reassembler, 1);
+    r->max_size = max_size;
+    r->incoming = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, bulk_incoming_free);
+
+    return r;
+}
+
+void bulk_reassembler_free(struct bulk_reassembler *r) {
+    if (r == NULL) {
+        return;
+    }
+
+    g_hash_table_unref(r->incoming);
+    g_free(r);
+}
+
+static void bulk_reassembler_drop(struct bulk_reassembler *r, const guint32 id) {
+    const struct bulk_incoming *in = g_hash_table_lookup(r->incoming, GUINT_TO_POINTER(id));
+    if (in) {
+        r->held_bytes -= in->data->len;
+        g_hash_table_remove(r->incoming, GUINT_TO_POINTER(id));
+    }
+}
+
+GBytes *bulk_reassembler_push(struct bulk_reassembler *r,
+                              const guint8 *chunk,
+                              const gsize size,
+                              const gint64 now_us,
+                              guint32 *out_id,
+                              gint64 *out_start_us) {
+    g_return_val_if_fail(size >= BULK_CHUNK_HEADER_SIZE, NULL);
+
+    guint32 header[4];
+    memcpy(header, chunk, BULK_CHUNK_HEADER_SIZE);
+
+    const guint32 id = GUINT32_FROM_BE(header[1]);
+    const guint32 total = GUINT32_FROM_BE(header[2]);
+    const guint32 offset = GUINT32_FROM_BE(header[3]);
+    const guint8 *payload = chunk + BULK_CHUNK_HEADER_SIZE;
+    const gsize length = size - BULK_CHUNK_HEADER_SIZE;
+
+    *out_id = id;
+
+    struct bulk_incoming *in = g_hash_table_lookup(r->incoming, GUINT_TO_POINTER(id));
+    if (in == NULL && offset == 0) {
+        if (total > r->max_size) {
+            ALOGW("Dropping bulk transfer %u of %u bytes, too large", id, total);
+            return NULL;
+        }
+        if (g_hash_table_size(r->incoming) >= BULK_REASSEMBLER_MAX_INCOMING) {
+            ALOGW("Dropping bulk transfer %u, %u already being received", id, g_hash_table_size(r->incoming));
+            return NULL;
+        }
+        in = g_new0(struct bulk_incoming, 1);
+        in->data = g_byte_array_new();
+        in->total = total;
+        in->start_us = now_us;
+        g_hash_table_insert(r->incoming, GUINT_TO_POINTER(id), in);
+    }
+
+    // The channel is ordered, so anything else means we missed the start or the peer is confused
+    if (in == NULL || offset != in->data->len || (guint64)offset + length > in->total) {
+        bulk_reassembler_drop(r, id);
+        ALOGW("Dropping bulk transfer %u, unexpected chunk at offset %u", id, offset);
+        return NULL;
+    }
+
+    g_byte_array_append(in->data, payload, length);
+    in->last_us = now_us;
+    r->held_bytes += length;
+
+    if (in->data->len < in->total) {
+        return NULL;
+    }
+
+    *out_start_us = in->start_us;
+    r->held_bytes -= in->data->len;
+    g_hash_table_steal(r->incoming, GUINT_TO_POINTER(id));
+    GBytes *complete = g_byte_array_free_to_bytes(in->data);
+    g_free(in);
+
+    return complete;
+}
+
+guint bulk_reassembler_expire(struct bulk_reassembler *r, const gint64 now_us) {
+    guint expired = 0;
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    g_hash_table_iter_init(&iter, r->incoming);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const struct bulk_incoming *in = value;
+        if (now_us - in->last_us < BULK_REASSEMBLER_STALL_TIMEOUT_US) {
+            continue;
+        }
+
+        ALOGW("Dropping bulk transfer %u, stalled at %u of %u bytes", GPOINTER_TO_UINT(key), in->data->len, in->total);
+        r->held_bytes -= in->data->len;
+        g_hash_table_iter_remove(&iter);
+        expired++;
+    }
+
+    return expired;
+}
+
+guint bulk_reassembler_get_incoming(struct bulk_reassembler *r) {
+    return g_hash_table_size(r->incoming);
+}
+
+gsize bulk_reassembler_get_held_bytes(struct bulk_reassembler *r) {
+    return r->held_bytes;
+}
+
+void bulk_reassembler_clear(struct bulk_reassembler *r) {
+    g_hash_table_remove_all(r->incoming);
+    r->held_bytes = 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*!
+ * Puts the incoming transfers of a bulk_transfer back together from their chunks, see bulk_transfer.h for the format.
+ *
+ * Buffers only grow as chunks arrive, whatever total size the peer announces, and at most
+ * BULK_REASSEMBLER_MAX_INCOMING transfers are received at once, so a peer has to actually send the data it makes us
+ * hold. Not thread-safe, bulk_transfer guards it with its own lock.
+ */
+
+/// "GWDB"
+#define BULK_CHUNK_MAGIC 0x47574442
+#define BULK_CHUNK_HEADER_SIZE 16
+/// Transfers being received at once. Chunks starting any other are dropped until one completes or stalls.
+#define BULK_REASSEMBLER_MAX_INCOMING 4
+/// An incoming transfer without any chunk for this long is dropped by bulk_reassembler_expire()
+#define BULK_REASSEMBLER_STALL_TIMEOUT_US (10 * G_USEC_PER_SEC)
+
+struct bulk_reassembler;
+
+/*!
+ * @param max_size Larger incoming transfers are dropped.
+ */
+struct bulk_reassembler *bulk_reassembler_new(guint32 max_size);
+
+void bulk_reassembler_free(struct bulk_reassembler *r);
+
+/*!
+ * Add a chunk received at @p now_us, header included, which must start with the magic.
+ *
+ * @param out_id Set to the chunk's transfer ID.
+ * @param out_start_us Set to when the transfer's first chunk arrived, if it completed.
+ *
+ * @return The transfer's data if @p chunk completed it, NULL otherwise.
+ */
+GBytes *bulk_reassembler_push(struct bulk_reassembler *r,
+                              const guint8 *chunk,
+                              gsize size,
+                              gint64 now_us,
+                              guint32 *out_id,
+                              gint64 *out_start_us);
+
+/*!
+ * Drop the transfers that got no chunk for BULK_REASSEMBLER_STALL_TIMEOUT_US before @p now_us.
+ *
+ * @return How many were dropped.
+ */
+guint bulk_reassembler_expire(struct bulk_reassembler *r, gint64 now_us);
+
+/*!
+ * Transfers being received.
+ */
+guint bulk_reassembler_get_incoming(struct bulk_reassembler *r);
+
+/*!
+ * Bytes received so far for the transfers being received.
+ */
+gsize bulk_reassembler_get_held_bytes(struct bulk_reassembler *r);
+
+/*!
+ * Drop every transfer being received.
+ */
+void bulk_reassembler_clear(struct bulk_reassembler *r);
+
+G_END_DECLS
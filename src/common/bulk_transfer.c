@@ -0,0 +1,426 @@
+#include "bulk_transfer.h"
+
+#include <string.h>
+
+#include "../utils/logger.h"
+#include "bulk_reassembler.h"
+
+#define BULK_TRANSFER_PAYLOAD_SIZE (BULK_TRANSFER_CHUNK_SIZE - BULK_CHUNK_HEADER_SIZE)
+
+struct bulk_outgoing {
+    guint32 id;
+    GBytes *data;
+    /// How much of the data has been handed to the channel
+    gsize offset;
+    bulk_transfer_done_func done;
+    gpointer user_data;
+    gint64 queued_us;
+};
+
+struct bulk_transfer {
+    GMainContext *context;
+    GstWebRTCDataChannel *channel;
+    gulong low_handler_id;
+    gulong message_handler_id;
+
+    bulk_transfer_received_func received;
+    gpointer user_data;
+
+    /// Guards everything below. Never held while calling into the channel or a callback.
+    GMutex mutex;
+    /// Only written from the context
+    gboolean closed;
+    /// struct bulk_outgoing*, the head is the one being sent
+    GQueue outgoing;
+    guint64 queued_bytes;
+    guint32 next_id;
+    struct bulk_reassembler *incoming;
+    /// Drops stalled incoming transfers, only attached while there are any
+    GSource *expire_src;
+
+    gint pump_scheduled;
+};
+
+struct bulk_received {
+    struct bulk_transfer *bt;
+    guint32 id;
+    GBytes *data;
+};
+
+static gdouble bulk_throughput_mbps(const gsize size, const gint64 start_us) {
+    const gint64 elapsed_us = MAX(g_get_monotonic_time() - start_us, 1);
+    return (gdouble)size / (gdouble)elapsed_us;
+}
+
+static void bulk_outgoing_complete(struct bulk_outgoing *t, const gboolean success) {
+    if (success) {
+        const gsize size = g_bytes_get_size(t->data);
+        ALOGI("Bulk transfer %u sent: %zu bytes, %.1f MB/s", t->id, size, bulk_throughput_mbps(size, t->queued_us));
+    }
+    if (t->done) {
+        t->done(t->user_data, t->id, success);
+    }
+    g_bytes_unref(t->data);
+    g_free(t);
+}
+
+static void bulk_transfer_clear(struct bulk_transfer *bt) {
+    bulk_reassembler_free(bt->incoming);
+    gst_object_unref(bt->channel);
+    g_main_context_unref(bt->context);
+    g_mutex_clear(&bt->mutex);
+}
+
+static void bulk_transfer_release(gpointer data) {
+    g_atomic_rc_box_release_full(data, (GDestroyNotify)bulk_transfer_clear);
+}
+
+static void bulk_transfer_release_closure(gpointer data, GClosure *closure) {
+    bulk_transfer_release(data);
+}
+
+/// Copy the next chunk of @p t, header included
+static GBytes *bulk_chunk_new(const struct bulk_outgoing *t, const gsize length) {
+    const guint32 header[4] = {
+        GUINT32_TO_BE(BULK_CHUNK_MAGIC),
+        GUINT32_TO_BE(t->id),
+        GUINT32_TO_BE((guint32)g_bytes_get_size(t->data)),
+        GUINT32_TO_BE((guint32)t->offset),
+    };
+    G_STATIC_ASSERT(sizeof(header) == BULK_CHUNK_HEADER_SIZE);
+
+    guint8 *chunk = g_malloc(BULK_CHUNK_HEADER_SIZE + length);
+    memcpy(chunk, header, BULK_CHUNK_HEADER_SIZE);
+    memcpy(chunk + BULK_CHUNK_HEADER_SIZE, (const guint8 *)g_bytes_get_data(t->data, NULL) + t->offset, length);
+
+    return g_bytes_new_take(chunk, BULK_CHUNK_HEADER_SIZE + length);
+}
+
+static gboolean bulk_transfer_pump_cb(gpointer user_data) {
+    struct bulk_transfer *bt = user_data;
+
+    // Anything queued from here on schedules another run
+    g_atomic_int_set(&bt->pump_scheduled, FALSE);
+
+    GQueue finished = G_QUEUE_INIT;
+    gboolean failed = FALSE;
+
+    guint64 buffered = 0;
+    g_object_get(bt->channel, "buffered-amount", &buffered, NULL);
+
+    while (TRUE) {
+        if (buffered >= BULK_TRANSFER_HIGH_WATERMARK) {
+            // Our estimate only grows, the channel may have drained meanwhile. If it has not, it will tell us once it
+            // gets below the low watermark.
+            g_object_get(bt->channel, "buffered-amount", &buffered, NULL);
+            if (buffered >= BULK_TRANSFER_HIGH_WATERMARK) {
+                break;
+            }
+        }
+
+        g_mutex_lock(&bt->mutex);
+        // Only this function and free() pop, both from the context, so the head stays valid after unlocking
+        struct bulk_outgoing *t = bt->closed ? NULL : g_queue_peek_head(&bt->outgoing);
+        if (t == NULL) {
+            g_mutex_unlock(&bt->mutex);
+            break;
+        }
+        const gsize size = g_bytes_get_size(t->data);
+        const gsize length = MIN(size - t->offset, BULK_TRANSFER_PAYLOAD_SIZE);
+        GBytes *chunk = bulk_chunk_new(t, length);
+        t->offset += length;
+        bt->queued_bytes -= length;
+        const gboolean last = t->offset >= size;
+        if (last) {
+            g_queue_pop_head(&bt->outgoing);
+        }
+        g_mutex_unlock(&bt->mutex);
+
+        GError *error = NULL;
+        const gboolean sent = gst_webrtc_data_channel_send_data_full(bt->channel, chunk, &error);
+        buffered += g_bytes_get_size(chunk);
+        g_bytes_unref(chunk);
+
+        if (!sent) {
+            ALOGW("Bulk transfer %u failed: %s", t->id, error ? error->message : "unknown error");
+            g_clear_error(&error);
+
+            if (!last) {
+                g_mutex_lock(&bt->mutex);
+                g_queue_remove(&bt->outgoing, t);
+                bt->queued_bytes -= size - t->offset;
+                g_mutex_unlock(&bt->mutex);
+            }
+            g_queue_push_tail(&finished, t);
+            failed = TRUE;
+            // The channel is most likely closing, the rest will be dropped by free()
+            break;
+        }
+
+        if (last) {
+            g_queue_push_tail(&finished, t);
+        }
+    }
+
+    struct bulk_outgoing *t;
+    while ((t = g_queue_pop_head(&finished)) != NULL) {
+        // Only the last one can have failed
+        bulk_outgoing_complete(t, !(failed && g_queue_is_empty(&finished)));
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void bulk_transfer_schedule_pump(struct bulk_transfer *bt) {
+    if (!g_atomic_int_compare_and_exchange(&bt->pump_scheduled, FALSE, TRUE)) {
+        return;
+    }
+
+    GSource *src = g_idle_source_new();
+    g_source_set_callback(src, bulk_transfer_pump_cb, g_atomic_rc_box_acquire(bt), bulk_transfer_release);
+    g_source_attach(src, bt->context);
+    g_source_unref(src);
+}
+
+/// From the channel's thread
+static void bulk_transfer_on_buffered_amount_low(GstWebRTCDataChannel *channel, struct bulk_transfer *bt) {
+    bulk_transfer_schedule_pump(bt);
+}
+
+static void bulk_transfer_on_message_data(GstWebRTCDataChannel *channel, GBytes *message, struct bulk_transfer *bt);
+
+struct bulk_transfer *bulk_transfer_new(GMainContext *context,
+                                        GstWebRTCDataChannel *channel,
+                                        const bulk_transfer_received_func received,
+                                        const gpointer user_data) {
+    struct bulk_transfer *bt = g_atomic_rc_box_new0(struct bulk_transfer);
+
+    bt->context = context ? g_main_context_ref(context) : g_main_context_ref_thread_default();
+    bt->channel = gst_object_ref(channel);
+    bt->received = received;
+    bt->user_data = user_data;
+    g_mutex_init(&bt->mutex);
+    g_queue_init(&bt->outgoing);
+    bt->incoming = bulk_reassembler_new(BULK_TRANSFER_MAX_SIZE);
+
+    g_object_set(channel, "buffered-amount-low-threshold", (guint64)BULK_TRANSFER_LOW_WATERMARK, NULL);
+    bt->low_handler_id = g_signal_connect_data(channel,
+                                               "on-buffered-amount-low",
+                                               G_CALLBACK(bulk_transfer_on_buffered_amount_low),
+                                               g_atomic_rc_box_acquire(bt),
+                                               bulk_transfer_release_closure,
+                                               0);
+    bt->message_handler_id = g_signal_connect_data(channel,
+                                                   "on-message-data",
+                                                   G_CALLBACK(bulk_transfer_on_message_data),
+                                                   g_atomic_rc_box_acquire(bt),
+                                                   bulk_transfer_release_closure,
+                                                   0);
+
+    return bt;
+}
+
+static gboolean bulk_transfer_drop_cb(gpointer user_data) {
+    GQueue *dropped = user_data;
+
+    struct bulk_outgoing *t;
+    while ((t = g_queue_pop_head(dropped)) != NULL) {
+        bulk_outgoing_complete(t, FALSE);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/// Only called with transfers left if the context went away first
+static void bulk_transfer_drop_free(gpointer data) {
+    GQueue *dropped = data;
+
+    struct bulk_outgoing *t;
+    while ((t = g_queue_pop_head(dropped)) != NULL) {
+        g_bytes_unref(t->data);
+        g_free(t);
+    }
+    g_queue_free(dropped);
+}
+
+void bulk_transfer_free(struct bulk_transfer *bt) {
+    if (bt == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&bt->mutex);
+    bt->closed = TRUE;
+    GQueue pending = bt->outgoing;
+    g_queue_init(&bt->outgoing);
+    bt->queued_bytes = 0;
+    bulk_reassembler_clear(bt->incoming);
+    if (bt->expire_src) {
+        g_source_destroy(bt->expire_src);
+        g_clear_pointer(&bt->expire_src, g_source_unref);
+    }
+    g_mutex_unlock(&bt->mutex);
+
+    g_signal_handler_disconnect(bt->channel, bt->low_handler_id);
+    g_signal_handler_disconnect(bt->channel, bt->message_handler_id);
+
+    // Not from here, the caller may hold locks the callbacks need
+    if (!g_queue_is_empty(&pending)) {
+        GSource *src = g_idle_source_new();
+        g_source_set_callback(src, bulk_transfer_drop_cb, g_queue_copy(&pending), bulk_transfer_drop_free);
+        g_source_attach(src, bt->context);
+        g_source_unref(src);
+        g_queue_clear(&pending);
+    }
+
+    bulk_transfer_release(bt);
+}
+
+struct bulk_transfer *bulk_transfer_ref(struct bulk_transfer *bt) {
+    return g_atomic_rc_box_acquire(bt);
+}
+
+void bulk_transfer_unref(struct bulk_transfer *bt) {
+    bulk_transfer_release(bt);
+}
+
+guint32 bulk_transfer_send(struct bulk_transfer *bt,
+                           GBytes *data,
+                           const bulk_transfer_done_func done,
+                           const gpointer user_data) {
+    const gsize size = g_bytes_get_size(data);
+    if (size > BULK_TRANSFER_MAX_SIZE) {
+        ALOGW("Bulk transfer of %zu bytes is larger than the peer accepts", size);
+        return 0;
+    }
+
+    struct bulk_outgoing *t = g_new0(struct bulk_outgoing, 1);
+    t->data = g_bytes_ref(data);
+    t->done = done;
+    t->user_data = user_data;
+    t->queued_us = g_get_monotonic_time();
+
+    g_mutex_lock(&bt->mutex);
+    if (bt->closed) {
+        g_mutex_unlock(&bt->mutex);
+        g_bytes_unref(t->data);
+        g_free(t);
+        return 0;
+    }
+    // 0 means failure
+    if (++bt->next_id == 0) {
+        ++bt->next_id;
+    }
+    t->id = bt->next_id;
+    g_queue_push_tail(&bt->outgoing, t);
+    bt->queued_bytes += size;
+    const guint32 id = t->id;
+    g_mutex_unlock(&bt->mutex);
+
+    bulk_transfer_schedule_pump(bt);
+
+    return id;
+}
+
+guint64 bulk_transfer_get_queued_bytes(struct bulk_transfer *bt) {
+    g_mutex_lock(&bt->mutex);
+    const guint64 queued = bt->queued_bytes;
+    g_mutex_unlock(&bt->mutex);
+
+    return queued;
+}
+
+static gboolean bulk_transfer_dispatch_received_cb(gpointer user_data) {
+    const struct bulk_received *r = user_data;
+
+    if (!r->bt->closed && r->bt->received) {
+        r->bt->received(r->bt->user_data, r->id, r->data);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void bulk_received_free(gpointer data) {
+    struct bulk_received *r = data;
+    g_bytes_unref(r->data);
+    bulk_transfer_release(r->bt);
+    g_free(r);
+}
+
+gboolean bulk_transfer_is_chunk(GBytes *message) {
+    gsize size;
+    const guint8 *bytes = g_bytes_get_data(message, &size);
+
+    guint32 magic;
+    if (size < BULK_CHUNK_HEADER_SIZE) {
+        return FALSE;
+    }
+    memcpy(&magic, bytes, sizeof(magic));
+
+    return GUINT32_FROM_BE(magic) == BULK_CHUNK_MAGIC;
+}
+
+static gboolean bulk_transfer_expire_cb(gpointer user_data) {
+    struct bulk_transfer *bt = user_data;
+
+    g_mutex_lock(&bt->mutex);
+    bulk_reassembler_expire(bt->incoming, g_get_monotonic_time());
+    // Attached again by the next transfer to start
+    const gboolean idle = bulk_reassembler_get_incoming(bt->incoming) == 0;
+    if (idle) {
+        g_clear_pointer(&bt->expire_src, g_source_unref);
+    }
+    g_mutex_unlock(&bt->mutex);
+
+    return idle ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+/// With the mutex held
+static void bulk_transfer_schedule_expire(struct bulk_transfer *bt) {
+    if (bt->expire_src || bulk_reassembler_get_incoming(bt->incoming) == 0) {
+        return;
+    }
+
+    bt->expire_src = g_timeout_source_new(BULK_REASSEMBLER_STALL_TIMEOUT_US / G_TIME_SPAN_MILLISECOND / 2);
+    g_source_set_callback(bt->expire_src, bulk_transfer_expire_cb, g_atomic_rc_box_acquire(bt), bulk_transfer_release);
+    g_source_attach(bt->expire_src, bt->context);
+}
+
+/// From the channel's thread. The handler holds a reference, so we stay valid while a message is being handled.
+static void bulk_transfer_on_message_data(GstWebRTCDataChannel *channel, GBytes *message, struct bulk_transfer *bt) {
+    if (!bulk_transfer_is_chunk(message)) {
+        return;
+    }
+
+    gsize size;
+    const guint8 *bytes = g_bytes_get_data(message, &size);
+
+    guint32 id;
+    gint64 start_us = 0;
+
+    g_mutex_lock(&bt->mutex);
+
+    if (bt->closed) {
+        g_mutex_unlock(&bt->mutex);
+        return;
+    }
+
+    GBytes *complete = bulk_reassembler_push(bt->incoming, bytes, size, g_get_monotonic_time(), &id, &start_us);
+    bulk_transfer_schedule_expire(bt);
+
+    g_mutex_unlock(&bt->mutex);
+
+    if (complete) {
+        const gsize total = g_bytes_get_size(complete);
+        ALOGI("Bulk transfer %u received: %zu bytes, %.1f MB/s", id, total, bulk_throughput_mbps(total, start_us));
+
+        struct bulk_received *r = g_new0(struct bulk_received, 1);
+        r->bt = g_atomic_rc_box_acquire(bt);
+        r->id = id;
+        r->data = complete;
+        g_main_context_invoke_full(bt->context,
+                                   G_PRIORITY_DEFAULT,
+                                   bulk_transfer_dispatch_received_cb,
+                                   r,
+                                   bulk_received_free);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <glib.h>
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+#undef GST_USE_UNSTABLE_API
+
+G_BEGIN_DECLS
+
+/*!
+ * Large payloads over a data channel, split into chunks that are only handed to SCTP while its send buffer is below
+ * BULK_TRANSFER_HIGH_WATERMARK, and resumed from "on-buffered-amount-low". Both peers use the same code.
+ *
+ * Each chunk is one binary message starting with a 16 byte header, all fields big-endian:
+ *   u32 magic ("GWDB"), u32 transfer ID, u32 total size, u32 offset of the chunk's payload
+ *
+ * The channel must be ordered and reliable. Chunks are picked up from "on-message-data" by the transfer itself, the
+ * channel's owner can skip them with @ref bulk_transfer_is_chunk and keep handling its other binary messages.
+ */
+
+/// Size of each message on the channel, header included
+#define BULK_TRANSFER_CHUNK_SIZE 16384
+/// Stop handing chunks to the channel once this much is buffered, so that it stays responsive for other messages
+#define BULK_TRANSFER_HIGH_WATERMARK (256 * 1024)
+/// Resume when the buffer drains below this
+#define BULK_TRANSFER_LOW_WATERMARK (64 * 1024)
+/// Larger incoming transfers are dropped, see bulk_reassembler.h for how many may be received at once
+#define BULK_TRANSFER_MAX_SIZE (64 * 1024 * 1024)
+
+/*!
+ * Called once per transfer from the transfer's main context.
+ *
+ * @param success TRUE once the last chunk has been handed to the channel, FALSE if the transfer was dropped.
+ */
+typedef void (*bulk_transfer_done_func)(gpointer user_data, guint32 transfer_id, gboolean success);
+
+/*!
+ * Called with each completely reassembled incoming transfer, from the transfer's main context.
+ */
+typedef void (*bulk_transfer_received_func)(gpointer user_data, guint32 transfer_id, GBytes *data);
+
+struct bulk_transfer;
+
+/*!
+ * @param context Where chunks are sent and callbacks called. NULL for the thread-default one.
+ * @param received May be NULL to drop incoming transfers.
+ */
+struct bulk_transfer *bulk_transfer_new(GMainContext *context,
+                                        GstWebRTCDataChannel *channel,
+                                        bulk_transfer_received_func received,
+                                        gpointer user_data);
+
+/*!
+ * Stop sending and receiving. Transfers still queued complete with FALSE later from the main context, incoming ones are
+ * no longer reported.
+ *
+ * Must be called from the transfer's main context.
+ */
+void bulk_transfer_free(struct bulk_transfer *bt);
+
+/*!
+ * Keep @p bt valid past @ref bulk_transfer_free, e.g. to send from another thread without holding the owner's lock.
+ * Sends then fail with 0. Thread-safe.
+ */
+struct bulk_transfer *bulk_transfer_ref(struct bulk_transfer *bt);
+
+/*!
+ * Drop a reference from @ref bulk_transfer_ref. Thread-safe.
+ */
+void bulk_transfer_unref(struct bulk_transfer *bt);
+
+/*!
+ * Queue @p data to be sent. Thread-safe.
+ *
+ * @param done May be NULL.
+ *
+ * @return The transfer ID, or 0 if the transfer has already been freed.
+ */
+guint32 bulk_transfer_send(struct bulk_transfer *bt, GBytes *data, bulk_transfer_done_func done, gpointer user_data);
+
+/*!
+ * Bytes queued but not handed to the channel yet. Thread-safe.
+ */
+guint64 bulk_transfer_get_queued_bytes(struct bulk_transfer *bt);
+
+/*!
+ * Whether a binary message received on the channel is a bulk transfer chunk.
+ */
+gboolean bulk_transfer_is_chunk(GBytes *message);
+
+G_END_DECLS
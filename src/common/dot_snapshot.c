@@ -0,0 +1,140 @@
+#include "dot_snapshot.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "../utils/logger.h"
+
+struct dot_snapshotter {
+    GstElement *pipeline;
+    gchar *prefix;
+
+    /// Set while a worker thread is writing a snapshot
+    gint in_progress;
+    /// Monotonic time of the last accepted request, in seconds
+    gint last_request_s;
+};
+
+struct dot_snapshot_job {
+    struct dot_snapshotter *snapshotter;
+    gchar *path;
+    gboolean compress;
+};
+
+static void dot_snapshotter_clear(struct dot_snapshotter *snapshotter) {
+    gst_clear_object(&snapshotter->pipeline);
+    g_free(snapshotter->prefix);
+}
+
+static void dot_snapshotter_release(struct dot_snapshotter *snapshotter) {
+    g_atomic_rc_box_release_full(snapshotter, (GDestroyNotify)dot_snapshotter_clear);
+}
+
+static gboolean dot_snapshot_write(const gchar *path, const gchar *dot_data, const gboolean compress, GError **error) {
+    GFile *file = g_file_new_for_path(path);
+    GOutputStream *out = G_OUTPUT_STREAM(g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error));
+    g_object_unref(file);
+
+    if (out == NULL) {
+        return FALSE;
+    }
+
+    if (compress) {
+        GConverter *compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+        GOutputStream *compressed = g_converter_output_stream_new(out, compressor);
+        g_object_unref(compressor);
+        g_object_unref(out);
+        out = compressed;
+    }
+
+    const gboolean ok = g_output_stream_write_all(out, dot_data, strlen(dot_data), NULL, NULL, error) &&
+                        g_output_stream_close(out, NULL, error);
+    g_object_unref(out);
+
+    return ok;
+}
+
+static gpointer dot_snapshot_thread_func(gpointer data) {
+    struct dot_snapshot_job *job = data;
+    struct dot_snapshotter *snapshotter = job->snapshotter;
+
+    const gint64 start_us = g_get_monotonic_time();
+    gchar *dot_data = gst_debug_bin_to_dot_data(GST_BIN(snapshotter->pipeline), GST_DEBUG_GRAPH_SHOW_ALL);
+
+    GError *error = NULL;
+    if (dot_snapshot_write(job->path, dot_data, job->compress, &error)) {
+        ALOGI("Wrote pipeline snapshot %s in %" G_GINT64_FORMAT " ms",
+              job->path,
+              (g_get_monotonic_time() - start_us) / 1000);
+    } else {
+        ALOGE("Failed to write pipeline snapshot %s: %s", job->path, error->message);
+        g_clear_error(&error);
+    }
+
+    g_free(dot_data);
+
+    g_atomic_int_set(&snapshotter->in_progress, 0);
+    dot_snapshotter_release(snapshotter);
+    g_free(job->path);
+    g_free(job);
+
+    return NULL;
+}
+
+struct dot_snapshotter *dot_snapshotter_new(GstElement *pipeline, const gchar *prefix) {
+    g_assert_nonnull(pipeline);
+
+    struct dot_snapshotter *snapshotter = g_atomic_rc_box_new0(struct dot_snapshotter);
+    snapshotter->pipeline = gst_object_ref(pipeline);
+    snapshotter->prefix = g_strdup(prefix);
+    snapshotter->last_request_s = -DOT_SNAPSHOT_MIN_INTERVAL_S;
+
+    return snapshotter;
+}
+
+void dot_snapshotter_free(struct dot_snapshotter *snapshotter) {
+    if (snapshotter != NULL) {
+        dot_snapshotter_release(snapshotter);
+    }
+}
+
+gchar *dot_snapshotter_request(struct dot_snapshotter *snapshotter, const gboolean compress) {
+    const gint now_s = (gint)(g_get_monotonic_time() / G_USEC_PER_SEC);
+    const gint last_s = g_atomic_int_get(&snapshotter->last_request_s);
+
+    if (now_s - last_s < DOT_SNAPSHOT_MIN_INTERVAL_S) {
+        ALOGW("Pipeline snapshot rate limited, try again in %d s", DOT_SNAPSHOT_MIN_INTERVAL_S - (now_s - last_s));
+        return NULL;
+    }
+    if (!g_atomic_int_compare_and_exchange(&snapshotter->in_progress, 0, 1)) {
+        ALOGW("Pipeline snapshot already in progress");
+        return NULL;
+    }
+    g_atomic_int_set(&snapshotter->last_request_s, now_s);
+
+    const gchar *dir = g_getenv("GST_DEBUG_DUMP_DOT_DIR");
+    if (dir == NULL || *dir == '\0') {
+        dir = g_get_tmp_dir();
+    }
+
+    GDateTime *now = g_date_time_new_now_local();
+    gchar *timestamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    gchar *name = g_strdup_printf("%s-%s-%03d.dot%s",
+                                  snapshotter->prefix,
+                                  timestamp,
+                                  g_date_time_get_microsecond(now) / 1000,
+                                  compress ? ".gz" : "");
+    g_date_time_unref(now);
+    g_free(timestamp);
+
+    struct dot_snapshot_job *job = g_new0(struct dot_snapshot_job, 1);
+    job->snapshotter = g_atomic_rc_box_acquire(snapshotter);
+    job->path = g_build_filename(dir, name, NULL);
+    job->compress = compress;
+    g_free(name);
+
+    gchar *path = g_strdup(job->path);
+    g_thread_unref(g_thread_new("dot_snapshot", dot_snapshot_thread_func, job));
+
+    return path;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gst/gst.h>
+
+/// Minimum time between two snapshots of the same pipeline
+#define DOT_SNAPSHOT_MIN_INTERVAL_S 5
+
+/*!
+ * Takes pipeline topology snapshots (DOT files) on demand.
+ *
+ * Serialization, compression and writing all happen on a short-lived worker thread, so a request costs the caller
+ * nothing but a timestamp check, and an idle snapshotter costs nothing at all.
+ */
+struct dot_snapshotter;
+
+/*!
+ * @param prefix File name prefix, e.g. "server".
+ */
+struct dot_snapshotter *dot_snapshotter_new(GstElement *pipeline, const gchar *prefix);
+
+/*!
+ * Drop the caller's reference. A snapshot in progress still completes.
+ */
+void dot_snapshotter_free(struct dot_snapshotter *snapshotter);
+
+/*!
+ * Start writing a snapshot to GST_DEBUG_DUMP_DOT_DIR, or the temporary directory if unset. Thread-safe.
+ *
+ * @param compress Write a gzip-compressed ".dot.gz" file.
+ *
+ * @return The path of the file being written, to be freed with g_free(), or NULL if rate limited or another snapshot
+ * is still being written.
+ */
+gchar *dot_snapshotter_request(struct dot_snapshotter *snapshotter, gboolean compress);
@@ -4,58 +4,6 @@
 
 #include "../utils/logger.h"
 
-GstPadProbeReturn on_buffer_probe_cb(GstPad* pad, const GstPadProbeInfo* info, gpointer user_data) {
-    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
-        return GST_PAD_PROBE_OK;
-    }
-
-    GstBuffer* buf = GST_PAD_PROBE_INFO_BUFFER(info);
-
-    const GstClockTime pts = GST_BUFFER_PTS(buf);
-    const GstClockTime dts = GST_BUFFER_DTS(buf);
-    const GstClockTime duration = GST_BUFFER_DURATION(buf);
-
-    static GstClockTime prev_pts = 0;
-
-    if (prev_pts != 0) {
-        const int64_t pts_diff = (pts - prev_pts) / 1e6;
-
-        if (pts_diff < 0) {
-            ALOGE("Buffer probe: PTS: %" GST_TIME_FORMAT ", PTS diff: %ld. Bad packet: decreasing timestamp",
-                  GST_TIME_ARGS(pts),
-                  pts_diff);
-        } else if (pts_diff > 50) {
-            ALOGE("Buffer probe: PTS: %" GST_TIME_FORMAT ", PTS diff: %ld. Bad packet: arrives too late",
-                  GST_TIME_ARGS(pts),
-                  pts_diff);
-        } else {
-            ALOGD("Buffer probe: PTS: %" GST_TIME_FORMAT ", PTS diff: %ld", GST_TIME_ARGS(pts), pts_diff);
-        }
-    }
-
-    prev_pts = pts;
-
-    static uint16_t prev_seq_num = 0;
-
-    GstMapInfo map;
-    if (gst_buffer_map(buf, &map, GST_MAP_READ)) {
-        if (map.size >= 12) {
-            const guint8* data = map.data;
-            const uint16_t seq_num = (data[2] << 8) | data[3]; // For big-endian systems
-            ALOGD("Buffer probe: sequence number: %u", seq_num);
-
-            if (seq_num - prev_seq_num > 1) {
-                ALOGE("Discontinuous sequence number!");
-            }
-
-            prev_seq_num = seq_num;
-        }
-        gst_buffer_unmap(buf, &map);
-    }
-
-    return GST_PAD_PROBE_OK;
-}
-
 void list_element_properties(GstElement* element) {
     GObjectClass* gobject_class = G_OBJECT_GET_CLASS(element);
 
@@ -79,18 +27,6 @@ void list_element_properties(GstElement* element) {
     g_free(properties); // Free the array of GParamSpec pointers
 }
 
-gboolean check_pipeline_dot_data(GstElement* pipeline) {
-    if (!pipeline) {
-        return G_SOURCE_CONTINUE;
-    }
-
-    gchar* dot_data = gst_debug_bin_to_dot_data(GST_BIN(pipeline), GST_DEBUG_GRAPH_SHOW_ALL);
-    // Put you breakpoint here.
-    g_free(dot_data);
-
-    return G_SOURCE_CONTINUE;
-}
-
 void hook_android_log(GstDebugCategory* category,
                       const GstDebugLevel level,
                       const gchar* file,
@@ -0,0 +1,55 @@
+#include "input_event.h"
+
+#include <string.h>
+
+void input_event_pack(const struct input_event *event, guint8 out[INPUT_EVENT_SIZE]) {
+    const guint16 type = GUINT16_TO_BE(event->type);
+    const guint16 flags = GUINT16_TO_BE(event->flags);
+    const guint32 seq = GUINT32_TO_BE(event->seq);
+    const guint64 sent_us = GUINT64_TO_BE((guint64)event->sent_us);
+
+    memcpy(out, &type, 2);
+    memcpy(out + 2, &flags, 2);
+    memcpy(out + 4, &seq, 4);
+    memcpy(out + 8, &sent_us, 8);
+    memcpy(out + 16, event->data, INPUT_EVENT_DATA_SIZE);
+}
+
+gboolean input_event_unpack(const guint8 *data, const gsize size, struct input_event *out) {
+    if (size != INPUT_EVENT_SIZE) {
+        return FALSE;
+    }
+
+    guint16 type, flags;
+    guint32 seq;
+    guint64 sent_us;
+    memcpy(&type, data, 2);
+    memcpy(&flags, data + 2, 2);
+    memcpy(&seq, data + 4, 4);
+    memcpy(&sent_us, data + 8, 8);
+
+    out->type = GUINT16_FROM_BE(type);
+    out->flags = GUINT16_FROM_BE(flags);
+    out->seq = GUINT32_FROM_BE(seq);
+    out->sent_us = (gint64)GUINT64_FROM_BE(sent_us);
+    memcpy(out->data, data + 16, INPUT_EVENT_DATA_SIZE);
+
+    return TRUE;
+}
+
+GstStructure *input_event_channel_options(void) {
+    return gst_structure_new("data-channel-options",
+                             "ordered",
+                             G_TYPE_BOOLEAN,
+                             FALSE,
+                             "max-retransmits",
+                             G_TYPE_INT,
+                             0,
+                             "negotiated",
+                             G_TYPE_BOOLEAN,
+                             TRUE,
+                             "id",
+                             G_TYPE_INT,
+                             INPUT_EVENT_CHANNEL_ID,
+                             NULL);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*!
+ * Time-critical client input (controller, pose, ...) on its own data channel, unordered and never retransmitted, so
+ * that a lost or late event never holds back the ones after it.
+ *
+ * The channel is negotiated: both peers create it with INPUT_EVENT_CHANNEL_ID once the SCTP m-line is in the SDP,
+ * instead of announcing it in-band.
+ *
+ * Every message is one event of INPUT_EVENT_SIZE bytes, all fields big-endian:
+ *   u16 type, u16 flags, u32 sequence number, i64 send time (wall clock, microseconds), 16 bytes of data
+ *
+ * The send time is compared against the receiver's wall clock, so latencies are only meaningful with synchronized
+ * clocks, e.g. on the same host or with NTP.
+ */
+#define INPUT_EVENT_CHANNEL_LABEL "input"
+#define INPUT_EVENT_CHANNEL_ID 32
+
+#define INPUT_EVENT_SIZE 32
+#define INPUT_EVENT_DATA_SIZE 16
+
+struct input_event {
+    /// Application defined
+    guint16 type;
+    guint16 flags;
+    /// Consecutive per channel, starting from 0, which lets the receiver count losses
+    guint32 seq;
+    /// g_get_real_time() on the sender
+    gint64 sent_us;
+    guint8 data[INPUT_EVENT_DATA_SIZE];
+};
+
+void input_event_pack(const struct input_event *event, guint8 out[INPUT_EVENT_SIZE]);
+
+/*!
+ * @return FALSE if @p data is not an event.
+ */
+gboolean input_event_unpack(const guint8 *data, gsize size, struct input_event *out);
+
+/*!
+ * Options for "create-data-channel", the same on both peers.
+ */
+GstStructure *input_event_channel_options(void);
+
+G_END_DECLS
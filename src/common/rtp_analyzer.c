@@ -0,0 +1,350 @@
+#include "rtp_analyzer.h"
+
+#include <string.h>
+
+#include "../utils/logger.h"
+
+#define RTP_HEADER_SIZE 12
+
+/// Forward timestamp jump counted as a discontinuity
+#define RTP_ANALYZER_PTS_JUMP (100 * GST_MSECOND)
+
+enum rtp_stream_state {
+    RTP_STREAM_EMPTY = 0,
+    /// Being claimed by the streaming thread that saw the SSRC first
+    RTP_STREAM_CLAIMING,
+    RTP_STREAM_READY,
+};
+
+struct rtp_stream {
+    gint state;
+    guint32 ssrc;
+    guint8 payload_type;
+
+    // Only touched by the streaming thread of this SSRC
+    guint16 highest_seq;
+    gboolean has_seq;
+    GstClockTime last_pts;
+    gint64 last_arrival_us;
+    guint32 frame_timestamp;
+    guint frame_bytes;
+
+    // Read from any thread
+    guint packets;
+    guint bytes_low;
+    guint bytes_high;
+    guint seq_gaps;
+    guint reordered;
+    guint pts_discontinuities;
+    guint frames;
+    guint arrival_histogram[RTP_ANALYZER_ARRIVAL_BUCKETS];
+    guint frame_size_histogram[RTP_ANALYZER_FRAME_SIZE_BUCKETS];
+};
+
+struct rtp_analyzer {
+    gchar *name;
+
+    struct rtp_stream streams[RTP_ANALYZER_MAX_STREAMS];
+    /// Packets of SSRCs that found no free slot, or too short to be RTP
+    guint untracked;
+
+    GSource *report_src;
+    /// Totals at the previous report, only touched by the report timer
+    struct rtp_stream_stats reported[RTP_ANALYZER_MAX_STREAMS];
+    guint reported_untracked;
+};
+
+static const gint64 arrival_bucket_limits_us[RTP_ANALYZER_ARRIVAL_BUCKETS - 1] = {
+    100,
+    500,
+    1000,
+    2000,
+    5000,
+    10000,
+    20000,
+    50000,
+    100000,
+};
+
+static guint arrival_bucket(const gint64 delta_us) {
+    guint i = 0;
+    while (i < G_N_ELEMENTS(arrival_bucket_limits_us) && delta_us >= arrival_bucket_limits_us[i]) {
+        i++;
+    }
+    return i;
+}
+
+static guint frame_size_bucket(const guint size) {
+    // Power-of-two buckets starting at 1 KiB
+    guint i = 0;
+    while (i < RTP_ANALYZER_FRAME_SIZE_BUCKETS - 1 && size >= (1024u << i)) {
+        i++;
+    }
+    return i;
+}
+
+static struct rtp_stream *rtp_analyzer_find_stream(struct rtp_analyzer *analyzer, const guint32 ssrc) {
+    for (guint i = 0; i < RTP_ANALYZER_MAX_STREAMS; i++) {
+        struct rtp_stream *stream = &analyzer->streams[i];
+        const gint state = g_atomic_int_get(&stream->state);
+
+        if (state == RTP_STREAM_READY && stream->ssrc == ssrc) {
+            return stream;
+        }
+        if (state == RTP_STREAM_EMPTY &&
+            g_atomic_int_compare_and_exchange(&stream->state, RTP_STREAM_EMPTY, RTP_STREAM_CLAIMING)) {
+            stream->ssrc = ssrc;
+            g_atomic_int_set(&stream->state, RTP_STREAM_READY);
+            return stream;
+        }
+    }
+    return NULL;
+}
+
+static void rtp_analyzer_handle_buffer(struct rtp_analyzer *analyzer, GstBuffer *buffer, const gint64 arrival_us) {
+    guint8 header[RTP_HEADER_SIZE];
+
+    // Copies only the fixed header, whatever the memory layout of the buffer
+    if (gst_buffer_extract(buffer, 0, header, RTP_HEADER_SIZE) != RTP_HEADER_SIZE || (header[0] >> 6) != 2) {
+        g_atomic_int_inc(&analyzer->untracked);
+        return;
+    }
+
+    const gboolean marker = (header[1] & 0x80) != 0;
+    const guint16 seq = (guint16)(header[2] << 8 | header[3]);
+    const guint32 timestamp = (guint32)header[4] << 24 | (guint32)header[5] << 16 | (guint32)header[6] << 8 | header[7];
+    const guint32 ssrc = (guint32)header[8] << 24 | (guint32)header[9] << 16 | (guint32)header[10] << 8 | header[11];
+
+    struct rtp_stream *stream = rtp_analyzer_find_stream(analyzer, ssrc);
+    if (stream == NULL) {
+        g_atomic_int_inc(&analyzer->untracked);
+        return;
+    }
+
+    const gsize size = gst_buffer_get_size(buffer);
+
+    stream->payload_type = header[1] & 0x7f;
+    g_atomic_int_inc(&stream->packets);
+    // 64-bit byte count from two 32-bit atomics, the reader tolerates a torn carry
+    const guint prev_low = (guint)g_atomic_int_add(&stream->bytes_low, (gint)size);
+    if (prev_low + (guint)size < prev_low) {
+        g_atomic_int_inc(&stream->bytes_high);
+    }
+
+    if (stream->has_seq) {
+        const gint16 delta = (gint16)(seq - stream->highest_seq);
+        if (delta > 1) {
+            g_atomic_int_add(&stream->seq_gaps, delta - 1);
+        } else if (delta <= 0) {
+            g_atomic_int_inc(&stream->reordered);
+        }
+        if (delta > 0) {
+            stream->highest_seq = seq;
+        }
+
+        g_atomic_int_inc(&stream->arrival_histogram[arrival_bucket(arrival_us - stream->last_arrival_us)]);
+    } else {
+        stream->highest_seq = seq;
+        stream->has_seq = TRUE;
+        stream->frame_timestamp = timestamp;
+    }
+    stream->last_arrival_us = arrival_us;
+
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (GST_CLOCK_TIME_IS_VALID(pts)) {
+        if (GST_CLOCK_TIME_IS_VALID(stream->last_pts) &&
+            (pts < stream->last_pts || pts - stream->last_pts > RTP_ANALYZER_PTS_JUMP)) {
+            g_atomic_int_inc(&stream->pts_discontinuities);
+        }
+        stream->last_pts = pts;
+    }
+
+    // A frame is every packet sharing an RTP timestamp, closed by the marker bit
+    if (timestamp != stream->frame_timestamp) {
+        stream->frame_timestamp = timestamp;
+        stream->frame_bytes = 0;
+    }
+    stream->frame_bytes += (guint)(size - RTP_HEADER_SIZE);
+    if (marker) {
+        g_atomic_int_inc(&stream->frame_size_histogram[frame_size_bucket(stream->frame_bytes)]);
+        g_atomic_int_inc(&stream->frames);
+        stream->frame_bytes = 0;
+    }
+}
+
+static gboolean rtp_analyzer_handle_list_item(GstBuffer **buffer, const guint idx, gpointer user_data) {
+    gpointer *args = user_data;
+    rtp_analyzer_handle_buffer(args[0], *buffer, *(const gint64 *)args[1]);
+    return TRUE;
+}
+
+static GstPadProbeReturn rtp_analyzer_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    struct rtp_analyzer *analyzer = user_data;
+    gint64 arrival_us = g_get_monotonic_time();
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        rtp_analyzer_handle_buffer(analyzer, GST_PAD_PROBE_INFO_BUFFER(info), arrival_us);
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        gpointer args[2] = {analyzer, &arrival_us};
+        gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), rtp_analyzer_handle_list_item, args);
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void rtp_analyzer_clear(struct rtp_analyzer *analyzer) {
+    g_free(analyzer->name);
+}
+
+static void rtp_analyzer_release(gpointer data) {
+    g_atomic_rc_box_release_full(data, (GDestroyNotify)rtp_analyzer_clear);
+}
+
+static void rtp_stream_read(struct rtp_stream *stream, struct rtp_stream_stats *out) {
+    out->ssrc = stream->ssrc;
+    out->payload_type = stream->payload_type;
+    out->packets = g_atomic_int_get(&stream->packets);
+    out->bytes = (guint64)g_atomic_int_get(&stream->bytes_high) << 32 | (guint)g_atomic_int_get(&stream->bytes_low);
+    out->seq_gaps = g_atomic_int_get(&stream->seq_gaps);
+    out->reordered = g_atomic_int_get(&stream->reordered);
+    out->pts_discontinuities = g_atomic_int_get(&stream->pts_discontinuities);
+    out->frames = g_atomic_int_get(&stream->frames);
+    for (guint i = 0; i < RTP_ANALYZER_ARRIVAL_BUCKETS; i++) {
+        out->arrival_histogram[i] = g_atomic_int_get(&stream->arrival_histogram[i]);
+    }
+    for (guint i = 0; i < RTP_ANALYZER_FRAME_SIZE_BUCKETS; i++) {
+        out->frame_size_histogram[i] = g_atomic_int_get(&stream->frame_size_histogram[i]);
+    }
+}
+
+static gboolean rtp_analyzer_report_cb(gpointer user_data) {
+    struct rtp_analyzer *analyzer = user_data;
+
+    for (guint i = 0; i < RTP_ANALYZER_MAX_STREAMS; i++) {
+        struct rtp_stream *stream = &analyzer->streams[i];
+        if (g_atomic_int_get(&stream->state) != RTP_STREAM_READY) {
+            continue;
+        }
+
+        struct rtp_stream_stats cur;
+        rtp_stream_read(stream, &cur);
+        struct rtp_stream_stats *prev = &analyzer->reported[i];
+
+        // Most common inter-arrival bucket over the interval
+        guint mode = 0;
+        guint mode_count = 0;
+        for (guint b = 0; b < RTP_ANALYZER_ARRIVAL_BUCKETS; b++) {
+            const guint count = cur.arrival_histogram[b] - prev->arrival_histogram[b];
+            if (count > mode_count) {
+                mode = b;
+                mode_count = count;
+            }
+        }
+
+        const guint gaps = cur.seq_gaps - prev->seq_gaps;
+        const guint reordered = cur.reordered - prev->reordered;
+        const guint discontinuities = cur.pts_discontinuities - prev->pts_discontinuities;
+
+        const gchar *arrival_mode = mode < G_N_ELEMENTS(arrival_bucket_limits_us) ? "<" : ">=";
+        const gint64 arrival_limit_us =
+            arrival_bucket_limits_us[MIN(mode, G_N_ELEMENTS(arrival_bucket_limits_us) - 1)];
+
+        if (gaps || reordered || discontinuities) {
+            ALOGW("RTP analyzer %s: ssrc %u pt %u: %u packets, %u frames, %" G_GUINT64_FORMAT
+                  " bytes, %u lost, %u reordered, %u PTS discontinuities, inter-arrival mostly %s%" G_GINT64_FORMAT
+                  "us",
+                  analyzer->name,
+                  cur.ssrc,
+                  cur.payload_type,
+                  cur.packets - prev->packets,
+                  cur.frames - prev->frames,
+                  cur.bytes - prev->bytes,
+                  gaps,
+                  reordered,
+                  discontinuities,
+                  arrival_mode,
+                  arrival_limit_us);
+        } else {
+            ALOGD("RTP analyzer %s: ssrc %u pt %u: %u packets, %u frames, %" G_GUINT64_FORMAT
+                  " bytes, inter-arrival mostly %s%" G_GINT64_FORMAT "us",
+                  analyzer->name,
+                  cur.ssrc,
+                  cur.payload_type,
+                  cur.packets - prev->packets,
+                  cur.frames - prev->frames,
+                  cur.bytes - prev->bytes,
+                  arrival_mode,
+                  arrival_limit_us);
+        }
+
+        *prev = cur;
+    }
+
+    const guint untracked = g_atomic_int_get(&analyzer->untracked);
+    if (untracked != analyzer->reported_untracked) {
+        ALOGW("RTP analyzer %s: %u packets not tracked (not RTP, or too many SSRCs)",
+              analyzer->name,
+              untracked - analyzer->reported_untracked);
+        analyzer->reported_untracked = untracked;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+struct rtp_analyzer *rtp_analyzer_new(const gchar *name) {
+    struct rtp_analyzer *analyzer = g_atomic_rc_box_new0(struct rtp_analyzer);
+    analyzer->name = g_strdup(name);
+
+    for (guint i = 0; i < RTP_ANALYZER_MAX_STREAMS; i++) {
+        analyzer->streams[i].last_pts = GST_CLOCK_TIME_NONE;
+    }
+
+    return analyzer;
+}
+
+gulong rtp_analyzer_attach(struct rtp_analyzer *analyzer, GstPad *pad) {
+    return gst_pad_add_probe(pad,
+                             GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                             rtp_analyzer_probe_cb,
+                             g_atomic_rc_box_acquire(analyzer),
+                             rtp_analyzer_release);
+}
+
+void rtp_analyzer_start_reports(struct rtp_analyzer *analyzer, const guint interval_ms) {
+    if (analyzer->report_src != NULL) {
+        return;
+    }
+
+    analyzer->report_src = g_timeout_source_new(interval_ms);
+    g_source_set_callback(analyzer->report_src,
+                          rtp_analyzer_report_cb,
+                          g_atomic_rc_box_acquire(analyzer),
+                          rtp_analyzer_release);
+    g_source_attach(analyzer->report_src, g_main_context_get_thread_default());
+}
+
+void rtp_analyzer_free(struct rtp_analyzer *analyzer) {
+    if (analyzer == NULL) {
+        return;
+    }
+
+    if (analyzer->report_src != NULL) {
+        g_source_destroy(analyzer->report_src);
+        g_clear_pointer(&analyzer->report_src, g_source_unref);
+    }
+
+    rtp_analyzer_release(analyzer);
+}
+
+guint rtp_analyzer_get_streams(struct rtp_analyzer *analyzer, struct rtp_stream_stats *out, const guint max_streams) {
+    guint count = 0;
+
+    for (guint i = 0; i < RTP_ANALYZER_MAX_STREAMS && count < max_streams; i++) {
+        struct rtp_stream *stream = &analyzer->streams[i];
+        if (g_atomic_int_get(&stream->state) == RTP_STREAM_READY) {
+            rtp_stream_read(stream, &out[count++]);
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <gst/gst.h>
+
+/// Maximum number of SSRCs tracked by one analyzer. Packets of further SSRCs are only counted as untracked.
+#define RTP_ANALYZER_MAX_STREAMS 8
+
+/// Inter-arrival buckets: < 100us, 500us, 1ms, 2ms, 5ms, 10ms, 20ms, 50ms, 100ms, and above
+#define RTP_ANALYZER_ARRIVAL_BUCKETS 10
+/// Frame size buckets: < 1, 2, 4, 8, 16, 32, 64, 128, 256 KiB, and above
+#define RTP_ANALYZER_FRAME_SIZE_BUCKETS 10
+
+/*!
+ * Totals of one RTP stream since the analyzer was created.
+ */
+struct rtp_stream_stats {
+    guint32 ssrc;
+    guint8 payload_type;
+
+    guint packets;
+    guint64 bytes;
+    /// Packets missing from the sequence number space
+    guint seq_gaps;
+    /// Packets arriving with a sequence number older than one already seen, including duplicates
+    guint reordered;
+    /// Buffer timestamps going backwards, or jumping forward by more than RTP_ANALYZER_PTS_JUMP
+    guint pts_discontinuities;
+    /// Frames completed by a marker bit
+    guint frames;
+
+    guint arrival_histogram[RTP_ANALYZER_ARRIVAL_BUCKETS];
+    guint frame_size_histogram[RTP_ANALYZER_FRAME_SIZE_BUCKETS];
+};
+
+/*!
+ * Watches RTP packets on one or more pads and keeps per-SSRC counters and histograms.
+ *
+ * The probe only reads the 12-byte fixed header and updates atomics, it never maps whole buffers nor logs, so it is
+ * cheap enough to leave on a production hot path. Reports are logged from a timer instead.
+ *
+ * A given SSRC is expected to flow through a single pad (i.e. a single streaming thread).
+ */
+struct rtp_analyzer;
+
+/*!
+ * Create an analyzer. @p name is used to tell reports apart.
+ */
+struct rtp_analyzer *rtp_analyzer_new(const gchar *name);
+
+/*!
+ * Start watching the RTP buffers (and buffer lists) flowing through @p pad. The probe keeps the analyzer alive.
+ *
+ * @return The probe ID.
+ */
+gulong rtp_analyzer_attach(struct rtp_analyzer *analyzer, GstPad *pad);
+
+/*!
+ * Log a summary of what changed every @p interval_ms, from the thread-default main context of the calling thread.
+ */
+void rtp_analyzer_start_reports(struct rtp_analyzer *analyzer, guint interval_ms);
+
+/*!
+ * Stop reporting and drop the caller's reference. Attached probes keep the analyzer alive until they are removed.
+ */
+void rtp_analyzer_free(struct rtp_analyzer *analyzer);
+
+/*!
+ * Copy the totals of up to @p max_streams streams. May be called from any thread.
+ *
+ * @return The number of streams copied.
+ */
+guint rtp_analyzer_get_streams(struct rtp_analyzer *analyzer, struct rtp_stream_stats *out, guint max_streams);
@@ -0,0 +1,394 @@
+#include "signaling_protocol.h"
+
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+struct signaling_codec {
+    /// Guards the encoder state
+    GMutex encode_mutex;
+    JsonBuilder *builder;
+    JsonGenerator *generator;
+
+    JsonParser *parser;
+};
+
+struct signaling_pending_candidate {
+    guint mline_index;
+    gchar *candidate;
+};
+
+struct signaling_candidate_batcher {
+    GMainContext *context;
+    struct signaling_codec *codec;
+    signaling_send_func send;
+    gpointer user_data;
+
+    GMutex mutex;
+    /// struct signaling_pending_candidate
+    GArray *pending;
+    gboolean end;
+    /// Pending flush, if any
+    GSource *flush_src;
+};
+
+struct signaling_codec *signaling_codec_new(void) {
+    struct signaling_codec *codec = g_new0(struct signaling_codec, 1);
+
+    g_mutex_init(&codec->encode_mutex);
+    codec->builder = json_builder_new_immutable();
+    codec->generator = json_generator_new();
+    // Compact output, the default, spelled out since v1 used to pretty-print
+    json_generator_set_pretty(codec->generator, FALSE);
+    codec->parser = json_parser_new_immutable();
+
+    return codec;
+}
+
+void signaling_codec_free(struct signaling_codec *codec) {
+    if (codec == NULL) {
+        return;
+    }
+
+    g_object_unref(codec->builder);
+    g_object_unref(codec->generator);
+    g_object_unref(codec->parser);
+    g_mutex_clear(&codec->encode_mutex);
+    g_free(codec);
+}
+
+/// Serialize what the builder holds and reset it, called with encode_mutex held
+static gchar *signaling_codec_finish_locked(struct signaling_codec *codec) {
+    JsonNode *root = json_builder_get_root(codec->builder);
+    json_generator_set_root(codec->generator, root);
+    gchar *str = json_generator_to_data(codec->generator, NULL);
+
+    json_generator_set_root(codec->generator, NULL);
+    json_node_unref(root);
+    json_builder_reset(codec->builder);
+
+    return str;
+}
+
+static void signaling_codec_add_candidate_object(JsonBuilder *builder,
+                                                 const guint mline_index,
+                                                 const gchar *candidate) {
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "candidate");
+    json_builder_add_string_value(builder, candidate);
+    json_builder_set_member_name(builder, "sdpMLineIndex");
+    json_builder_add_int_value(builder, mline_index);
+    json_builder_end_object(builder);
+}
+
+gchar *signaling_codec_encode_sdp(struct signaling_codec *codec, const gchar *type, const gchar *sdp) {
+    g_mutex_lock(&codec->encode_mutex);
+
+    JsonBuilder *builder = codec->builder;
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msg");
+    json_builder_add_string_value(builder, type);
+    json_builder_set_member_name(builder, "sdp");
+    json_builder_add_string_value(builder, sdp);
+    json_builder_end_object(builder);
+
+    gchar *str = signaling_codec_finish_locked(codec);
+    g_mutex_unlock(&codec->encode_mutex);
+
+    return str;
+}
+
+gchar *signaling_codec_encode_candidate(struct signaling_codec *codec,
+                                        const guint mline_index,
+                                        const gchar *candidate) {
+    g_mutex_lock(&codec->encode_mutex);
+
+    JsonBuilder *builder = codec->builder;
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msg");
+    json_builder_add_string_value(builder, "candidate");
+    json_builder_set_member_name(builder, "candidate");
+    signaling_codec_add_candidate_object(builder, mline_index, candidate);
+    json_builder_end_object(builder);
+
+    gchar *str = signaling_codec_finish_locked(codec);
+    g_mutex_unlock(&codec->encode_mutex);
+
+    return str;
+}
+
+gchar *signaling_codec_encode_session(struct signaling_codec *codec, const gchar *id, const gboolean resumed) {
+    g_mutex_lock(&codec->encode_mutex);
+
+    JsonBuilder *builder = codec->builder;
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msg");
+    json_builder_add_string_value(builder, "session");
+    json_builder_set_member_name(builder, "id");
+    json_builder_add_string_value(builder, id);
+    json_builder_set_member_name(builder, "resumed");
+    json_builder_add_boolean_value(builder, resumed);
+    json_builder_end_object(builder);
+
+    gchar *str = signaling_codec_finish_locked(codec);
+    g_mutex_unlock(&codec->encode_mutex);
+
+    return str;
+}
+
+gchar *signaling_codec_encode_restart(struct signaling_codec *codec) {
+    g_mutex_lock(&codec->encode_mutex);
+
+    JsonBuilder *builder = codec->builder;
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msg");
+    json_builder_add_string_value(builder, "restart");
+    json_builder_end_object(builder);
+
+    gchar *str = signaling_codec_finish_locked(codec);
+    g_mutex_unlock(&codec->encode_mutex);
+
+    return str;
+}
+
+static gchar *signaling_codec_encode_candidates(struct signaling_codec *codec,
+                                                const GArray *candidates,
+                                                const gboolean end) {
+    g_mutex_lock(&codec->encode_mutex);
+
+    JsonBuilder *builder = codec->builder;
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "msg");
+    json_builder_add_string_value(builder, "candidates");
+    json_builder_set_member_name(builder, "candidates");
+    json_builder_begin_array(builder);
+    for (guint i = 0; i < candidates->len; i++) {
+        const struct signaling_pending_candidate *c =
+            &g_array_index(candidates, struct signaling_pending_candidate, i);
+        signaling_codec_add_candidate_object(builder, c->mline_index, c->candidate);
+    }
+    json_builder_end_array(builder);
+    if (end) {
+        json_builder_set_member_name(builder, "end");
+        json_builder_add_boolean_value(builder, TRUE);
+    }
+    json_builder_end_object(builder);
+
+    gchar *str = signaling_codec_finish_locked(codec);
+    g_mutex_unlock(&codec->encode_mutex);
+
+    return str;
+}
+
+static gboolean signaling_decode_candidate(JsonNode *node,
+                                           const struct signaling_handlers *handlers,
+                                           gpointer user_data) {
+    JsonObject *candidate = node && JSON_NODE_HOLDS_OBJECT(node) ? json_node_get_object(node) : NULL;
+    if (candidate == NULL || !json_object_has_member(candidate, "candidate")) {
+        return FALSE;
+    }
+
+    handlers->candidate(user_data,
+                        (guint)json_object_get_int_member_with_default(candidate, "sdpMLineIndex", 0),
+                        json_object_get_string_member(candidate, "candidate"));
+    return TRUE;
+}
+
+gboolean signaling_codec_decode(struct signaling_codec *codec,
+                                const gchar *data,
+                                const gsize length,
+                                const struct signaling_handlers *handlers,
+                                const gpointer user_data) {
+    if (length > G_MAXSSIZE || !json_parser_load_from_data(codec->parser, data, (gssize)length, NULL)) {
+        return FALSE;
+    }
+
+    JsonNode *root = json_parser_get_root(codec->parser);
+    JsonObject *msg = root && JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+    const gchar *type = msg ? json_object_get_string_member_with_default(msg, "msg", NULL) : NULL;
+    if (type == NULL) {
+        return FALSE;
+    }
+
+    if (g_str_equal(type, "offer") || g_str_equal(type, "answer")) {
+        const gchar *sdp = json_object_get_string_member_with_default(msg, "sdp", NULL);
+        if (sdp == NULL) {
+            return FALSE;
+        }
+        handlers->sdp(user_data, type, sdp);
+        return TRUE;
+    }
+
+    if (g_str_equal(type, "candidate")) {
+        return signaling_decode_candidate(json_object_get_member(msg, "candidate"), handlers, user_data);
+    }
+
+    if (g_str_equal(type, "candidates")) {
+        JsonNode *node = json_object_get_member(msg, "candidates");
+        JsonArray *candidates = node && JSON_NODE_HOLDS_ARRAY(node) ? json_node_get_array(node) : NULL;
+        const guint n = candidates ? json_array_get_length(candidates) : 0;
+        for (guint i = 0; i < n; i++) {
+            signaling_decode_candidate(json_array_get_element(candidates, i), handlers, user_data);
+        }
+        if (json_object_get_boolean_member_with_default(msg, "end", FALSE) && handlers->end_of_candidates) {
+            handlers->end_of_candidates(user_data);
+        }
+        return TRUE;
+    }
+
+    if (g_str_equal(type, "session")) {
+        const gchar *id = json_object_get_string_member_with_default(msg, "id", NULL);
+        if (id == NULL) {
+            return FALSE;
+        }
+        if (handlers->session) {
+            handlers->session(user_data, id, json_object_get_boolean_member_with_default(msg, "resumed", FALSE));
+        }
+        return TRUE;
+    }
+
+    if (g_str_equal(type, "restart")) {
+        if (handlers->restart) {
+            handlers->restart(user_data);
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+gint signaling_codecs_choose(const gchar *codecs, const gchar *const *supported, const guint n_supported) {
+    if (codecs == NULL) {
+        return -1;
+    }
+
+    gint chosen = -1;
+    gchar **names = g_strsplit(codecs, ",", -1);
+    for (guint n = 0; names[n] != NULL && chosen < 0; n++) {
+        const gchar *name = g_strstrip(names[n]);
+        for (guint i = 0; i < n_supported; i++) {
+            if (supported[i] != NULL && g_ascii_strcasecmp(name, supported[i]) == 0) {
+                chosen = (gint)i;
+                break;
+            }
+        }
+    }
+    g_strfreev(names);
+
+    return chosen;
+}
+
+static void signaling_pending_candidate_clear(gpointer data) {
+    struct signaling_pending_candidate *c = data;
+    g_free(c->candidate);
+}
+
+static void signaling_candidate_batcher_clear(struct signaling_candidate_batcher *batcher) {
+    g_array_unref(batcher->pending);
+    g_main_context_unref(batcher->context);
+    g_mutex_clear(&batcher->mutex);
+}
+
+static void signaling_candidate_batcher_release(gpointer data) {
+    g_atomic_rc_box_release_full(data, (GDestroyNotify)signaling_candidate_batcher_clear);
+}
+
+static gboolean signaling_candidate_batcher_flush_cb(gpointer user_data) {
+    struct signaling_candidate_batcher *batcher = user_data;
+
+    g_mutex_lock(&batcher->mutex);
+
+    // Destroyed by a reschedule or by free() while we were waiting for the lock
+    if (batcher->flush_src == NULL || g_source_is_destroyed(batcher->flush_src)) {
+        g_mutex_unlock(&batcher->mutex);
+        return G_SOURCE_REMOVE;
+    }
+    g_clear_pointer(&batcher->flush_src, g_source_unref);
+
+    if (batcher->send != NULL && (batcher->pending->len > 0 || batcher->end)) {
+        gchar *message = signaling_codec_encode_candidates(batcher->codec, batcher->pending, batcher->end);
+        // Under the lock, so nothing gets sent once free() has returned
+        batcher->send(batcher->user_data, message);
+        g_free(message);
+    }
+    g_array_set_size(batcher->pending, 0);
+    // An ICE restart on the same connection gathers, and ends, again
+    batcher->end = FALSE;
+
+    g_mutex_unlock(&batcher->mutex);
+
+    return G_SOURCE_REMOVE;
+}
+
+/// Called with the lock held
+static void signaling_candidate_batcher_schedule_locked(struct signaling_candidate_batcher *batcher,
+                                                        const guint delay_ms) {
+    if (batcher->flush_src != NULL) {
+        if (delay_ms > 0) {
+            // Already scheduled, the window started with the first candidate
+            return;
+        }
+        g_source_destroy(batcher->flush_src);
+        g_clear_pointer(&batcher->flush_src, g_source_unref);
+    }
+
+    batcher->flush_src = g_timeout_source_new(delay_ms);
+    g_source_set_callback(batcher->flush_src,
+                          signaling_candidate_batcher_flush_cb,
+                          g_atomic_rc_box_acquire(batcher),
+                          signaling_candidate_batcher_release);
+    g_source_attach(batcher->flush_src, batcher->context);
+}
+
+struct signaling_candidate_batcher *signaling_candidate_batcher_new(GMainContext *context,
+                                                                    struct signaling_codec *codec,
+                                                                    const signaling_send_func send,
+                                                                    const gpointer user_data) {
+    struct signaling_candidate_batcher *batcher = g_atomic_rc_box_new0(struct signaling_candidate_batcher);
+
+    batcher->context = context ? g_main_context_ref(context) : g_main_context_ref_thread_default();
+    batcher->codec = codec;
+    batcher->send = send;
+    batcher->user_data = user_data;
+    g_mutex_init(&batcher->mutex);
+    batcher->pending = g_array_new(FALSE, FALSE, sizeof(struct signaling_pending_candidate));
+    g_array_set_clear_func(batcher->pending, signaling_pending_candidate_clear);
+
+    return batcher;
+}
+
+void signaling_candidate_batcher_free(struct signaling_candidate_batcher *batcher) {
+    if (batcher == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&batcher->mutex);
+    batcher->send = NULL;
+    if (batcher->flush_src != NULL) {
+        g_source_destroy(batcher->flush_src);
+        g_clear_pointer(&batcher->flush_src, g_source_unref);
+    }
+    g_array_set_size(batcher->pending, 0);
+    g_mutex_unlock(&batcher->mutex);
+
+    signaling_candidate_batcher_release(batcher);
+}
+
+void signaling_candidate_batcher_add(struct signaling_candidate_batcher *batcher,
+                                     const guint mline_index,
+                                     const gchar *candidate) {
+    const struct signaling_pending_candidate c = {mline_index, g_strdup(candidate)};
+
+    g_mutex_lock(&batcher->mutex);
+    g_array_append_val(batcher->pending, c);
+    signaling_candidate_batcher_schedule_locked(
+        batcher,
+        batcher->pending->len >= SIGNALING_CANDIDATE_BATCH_MAX ? 0 : SIGNALING_CANDIDATE_BATCH_MS);
+    g_mutex_unlock(&batcher->mutex);
+}
+
+void signaling_candidate_batcher_end(struct signaling_candidate_batcher *batcher) {
+    g_mutex_lock(&batcher->mutex);
+    batcher->end = TRUE;
+    signaling_candidate_batcher_schedule_locked(batcher, 0);
+    g_mutex_unlock(&batcher->mutex);
+}
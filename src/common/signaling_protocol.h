@@ -0,0 +1,138 @@
+#pragma once
+
+#include <glib.h>
+
+/*!
+ * Websocket subprotocol selecting the v2 signaling protocol.
+ *
+ * v1 (no subprotocol) sends one JSON message per SDP and per ICE candidate:
+ *   {"msg":"offer"|"answer","sdp":"..."}
+ *   {"msg":"candidate","candidate":{"candidate":"...","sdpMLineIndex":0}}
+ *
+ * v2 serializes compactly and batches candidates over a short window, with an end-of-candidates marker:
+ *   {"msg":"candidates","candidates":[{"candidate":"...","sdpMLineIndex":0},...],"end":true}
+ *
+ * Peers that do not offer the subprotocol (or servers that do not accept it) stay on v1. Decoding always accepts both.
+ *
+ * Both versions also carry session resumption, which older peers ignore:
+ *   {"msg":"session","id":"...","resumed":false}  server -> client, before the first offer on a websocket
+ *   {"msg":"restart"}                               client -> server, asks for an ICE restart offer
+ *
+ * A client reconnecting its websocket passes the session ID back as the "session" query parameter of the URI.
+ *
+ * A client can also list the video codecs it decodes, in order of preference, as the "codecs" query parameter, e.g.
+ * "codecs=VP8,H264". The server picks the first one it can encode, H264 otherwise.
+ */
+#define SIGNALING_PROTOCOL_V2 "gwd-signaling-v2"
+
+/// How long candidates are held back to be sent together
+#define SIGNALING_CANDIDATE_BATCH_MS 10
+/// A batch is sent right away once it holds this many candidates
+#define SIGNALING_CANDIDATE_BATCH_MAX 16
+
+/// URI query parameter carrying the session ID to resume
+#define SIGNALING_SESSION_QUERY "session"
+/// URI query parameter carrying the client's video codecs, comma separated RTP encoding names
+#define SIGNALING_CODECS_QUERY "codecs"
+
+/*!
+ * Match a SIGNALING_CODECS_QUERY list against the codecs a peer handles, keeping the list's order of preference.
+ *
+ * @param codecs Comma separated RTP encoding names, preferred first, compared without case. May be NULL.
+ * @param supported Encoding names the caller handles. NULL entries, e.g. codecs without an encoder, are skipped.
+ * @return Index in @p supported of the first codec of @p codecs found there, -1 if there is none.
+ */
+gint signaling_codecs_choose(const gchar *codecs, const gchar *const *supported, guint n_supported);
+
+struct signaling_handlers {
+    /// @p type is "offer" or "answer"
+    void (*sdp)(gpointer user_data, const gchar *type, const gchar *sdp);
+    void (*candidate)(gpointer user_data, guint mline_index, const gchar *candidate);
+    /// The remote has sent all of its candidates. May be NULL.
+    void (*end_of_candidates)(gpointer user_data);
+    /// Session ID to resume with, and whether this websocket resumed an existing session. May be NULL.
+    void (*session)(gpointer user_data, const gchar *id, gboolean resumed);
+    /// The remote asks for an ICE restart. May be NULL.
+    void (*restart)(gpointer user_data);
+};
+
+/*!
+ * Per connection encoder and decoder state, reused across messages.
+ *
+ * Encoding is thread-safe. Decoding must happen on a single thread.
+ */
+struct signaling_codec;
+
+struct signaling_codec *signaling_codec_new(void);
+
+void signaling_codec_free(struct signaling_codec *codec);
+
+/*!
+ * Encode an SDP message.
+ *
+ * @param type "offer" or "answer"
+ */
+gchar *signaling_codec_encode_sdp(struct signaling_codec *codec, const gchar *type, const gchar *sdp);
+
+/*!
+ * Encode a single candidate in the v1 form.
+ */
+gchar *signaling_codec_encode_candidate(struct signaling_codec *codec, guint mline_index, const gchar *candidate);
+
+/*!
+ * Encode the session announcement sent by the server.
+ */
+gchar *signaling_codec_encode_session(struct signaling_codec *codec, const gchar *id, gboolean resumed);
+
+/*!
+ * Encode an ICE restart request.
+ */
+gchar *signaling_codec_encode_restart(struct signaling_codec *codec);
+
+/*!
+ * Decode one message and dispatch it to @p handlers.
+ *
+ * @return FALSE if the message could not be parsed or has an unknown type.
+ */
+gboolean signaling_codec_decode(struct signaling_codec *codec,
+                                const gchar *data,
+                                gsize length,
+                                const struct signaling_handlers *handlers,
+                                gpointer user_data);
+
+/*!
+ * Called with each encoded message, from the batcher's main context.
+ */
+typedef void (*signaling_send_func)(gpointer user_data, const gchar *message);
+
+/*!
+ * Collects candidates from any thread, and sends them in v2 batches from a main context.
+ */
+struct signaling_candidate_batcher;
+
+/*!
+ * @param context Where batches are flushed, and @p send called.
+ * @param codec Must outlive the batcher.
+ */
+struct signaling_candidate_batcher *signaling_candidate_batcher_new(GMainContext *context,
+                                                                    struct signaling_codec *codec,
+                                                                    signaling_send_func send,
+                                                                    gpointer user_data);
+
+/*!
+ * Stop the batcher. Pending candidates are dropped and @p send is never called again.
+ */
+void signaling_candidate_batcher_free(struct signaling_candidate_batcher *batcher);
+
+/*!
+ * Queue a candidate. Thread-safe.
+ */
+void signaling_candidate_batcher_add(struct signaling_candidate_batcher *batcher,
+                                     guint mline_index,
+                                     const gchar *candidate);
+
+/*!
+ * Flush what is left, marked as the end of candidates. Candidates added afterwards, e.g. after an ICE restart, start
+ * a new round. Thread-safe.
+ */
+void signaling_candidate_batcher_end(struct signaling_candidate_batcher *batcher);
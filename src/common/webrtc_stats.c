@@ -1,10 +1,12 @@
 #include "webrtc_stats.h"
 
 #define GST_USE_UNSTABLE_API
-#include <gst/webrtc/webrtc_fwd.h>
+#include <gst/webrtc/webrtc.h>
 #include <stdint.h>
 #undef GST_USE_UNSTABLE_API
 
+#include <string.h>
+
 #define ENUM_TO_STR(r) \
     case r:            \
         return #r
@@ -67,15 +69,15 @@ static gboolean print_field(const GQuark field_id, const GValue *value, const gp
 			                       webrtc_stats_type_string(g_value_get_enum(value)));
 			break;
 		case G_TYPE_UINT:
-			g_string_append_printf(info->str, "\"%s\": %d",
+			g_string_append_printf(info->str, "\"%s\": %u",
 			                       name, g_value_get_uint(value));
 			break;
 		case G_TYPE_UINT64:
-			g_string_append_printf(info->str, "\"%s\": %ld",
+			g_string_append_printf(info->str, "\"%s\": %" G_GUINT64_FORMAT,
 			                       name, g_value_get_uint64(value));
 			break;
 		case G_TYPE_INT64:
-			g_string_append_printf(info->str, "\"%s\": %ld",
+			g_string_append_printf(info->str, "\"%s\": %" G_GINT64_FORMAT,
 			                       name, g_value_get_int64(value));
 			break;
 		case G_TYPE_BOOLEAN:
@@ -98,7 +100,7 @@ static gboolean print_field(const GQuark field_id, const GValue *value, const gp
 			break;
 		}
 		default:
-			g_printerr("%s: Unhandled type %s (%ld)\n", name, g_type_name(type), type);
+			g_printerr("%s: Unhandled type %s (%" G_GSIZE_FORMAT ")\n", name, g_type_name(type), (gsize)type);
 	}
     // clang-format on
 
@@ -155,6 +157,488 @@ GString *webrtc_stats_get_json(const GstStructure *stats) {
     return json_str;
 }
 
+/*
+ * Typed stats collector
+ */
+
+struct webrtc_stats_collector {
+    GstElement *webrtcbin;
+    guint interval_ms;
+    GSource *timeout_src;
+
+    webrtc_stats_frame_counter_func frame_counter;
+    gpointer frame_counter_data;
+
+    gulong fec_added_id;
+    gulong fec_removed_id;
+
+    /// Protects everything below, written from the webrtcbin thread delivering the stats reply
+    GMutex mutex;
+
+    /// The rtpulpfecdec elements inside webrtcbin, tracked as they come and go rather than looked up on every poll
+    GPtrArray *fec_decoders;
+
+    gboolean has_snapshot;
+    struct webrtc_stats_snapshot last;
+
+    struct webrtc_stats_sample *ring;
+    guint ring_capacity;
+    /// Next write position
+    guint ring_head;
+    guint ring_count;
+};
+
+static guint64 stats_get_uint64(const GstStructure *s, const gchar *field) {
+    const GValue *value = gst_structure_get_value(s, field);
+    if (value == NULL) {
+        return 0;
+    }
+
+    switch (G_VALUE_TYPE(value)) {
+        case G_TYPE_UINT64:
+            return g_value_get_uint64(value);
+        case G_TYPE_INT64:
+            return (guint64)MAX(g_value_get_int64(value), 0);
+        case G_TYPE_UINT:
+            return g_value_get_uint(value);
+        case G_TYPE_INT:
+            return (guint64)MAX(g_value_get_int(value), 0);
+        default:
+            return 0;
+    }
+}
+
+static gint64 stats_get_int64(const GstStructure *s, const gchar *field) {
+    const GValue *value = gst_structure_get_value(s, field);
+    if (value == NULL) {
+        return 0;
+    }
+
+    switch (G_VALUE_TYPE(value)) {
+        case G_TYPE_INT64:
+            return g_value_get_int64(value);
+        case G_TYPE_UINT64:
+            return (gint64)g_value_get_uint64(value);
+        case G_TYPE_INT:
+            return g_value_get_int(value);
+        case G_TYPE_UINT:
+            return g_value_get_uint(value);
+        default:
+            return 0;
+    }
+}
+
+static gdouble stats_get_double(const GstStructure *s, const gchar *field) {
+    gdouble value = 0;
+    gst_structure_get_double(s, field, &value);
+    return value;
+}
+
+static gboolean stats_parse_field(GQuark field_id, const GValue *value, gpointer user_data) {
+    struct webrtc_stats_snapshot *snapshot = user_data;
+
+    if (!GST_VALUE_HOLDS_STRUCTURE(value)) {
+        return TRUE;
+    }
+
+    const GstStructure *s = gst_value_get_structure(value);
+
+    GstWebRTCStatsType type;
+    if (!gst_structure_get_enum(s, "type", GST_TYPE_WEBRTC_STATS_TYPE, (gint *)&type)) {
+        return TRUE;
+    }
+
+    switch (type) {
+        case GST_WEBRTC_STATS_INBOUND_RTP: {
+            if (snapshot->n_inbound == WEBRTC_STATS_MAX_STREAMS) {
+                break;
+            }
+            struct webrtc_stats_inbound *in = &snapshot->inbound[snapshot->n_inbound++];
+            in->ssrc = (guint32)stats_get_uint64(s, "ssrc");
+            in->packets_received = stats_get_uint64(s, "packets-received");
+            in->bytes_received = stats_get_uint64(s, "bytes-received");
+            in->packets_lost = stats_get_int64(s, "packets-lost");
+            in->jitter = stats_get_double(s, "jitter");
+        } break;
+        case GST_WEBRTC_STATS_OUTBOUND_RTP: {
+            if (snapshot->n_outbound == WEBRTC_STATS_MAX_STREAMS) {
+                break;
+            }
+            struct webrtc_stats_outbound *out = &snapshot->outbound[snapshot->n_outbound++];
+            out->ssrc = (guint32)stats_get_uint64(s, "ssrc");
+            out->packets_sent = stats_get_uint64(s, "packets-sent");
+            out->bytes_sent = stats_get_uint64(s, "bytes-sent");
+            out->nack_count = (guint)stats_get_uint64(s, "nack-count");
+            out->pli_count = (guint)stats_get_uint64(s, "pli-count");
+        } break;
+        case GST_WEBRTC_STATS_REMOTE_INBOUND_RTP: {
+            if (snapshot->n_remote_inbound == WEBRTC_STATS_MAX_STREAMS) {
+                break;
+            }
+            struct webrtc_stats_remote_inbound *rin = &snapshot->remote_inbound[snapshot->n_remote_inbound++];
+            rin->ssrc = (guint32)stats_get_uint64(s, "ssrc");
+            rin->packets_lost = stats_get_int64(s, "packets-lost");
+            rin->fraction_lost = stats_get_double(s, "fraction-lost");
+            rin->jitter = stats_get_double(s, "jitter");
+            rin->round_trip_time = stats_get_double(s, "round-trip-time");
+        } break;
+        case GST_WEBRTC_STATS_CANDIDATE_PAIR: {
+            // Prefer a pair that has actually measured a round trip
+            const gdouble rtt = stats_get_double(s, "current-round-trip-time");
+            if (snapshot->has_candidate_pair && (rtt <= 0 || snapshot->candidate_pair.current_round_trip_time > 0)) {
+                break;
+            }
+            snapshot->has_candidate_pair = TRUE;
+            snapshot->candidate_pair.bytes_sent = stats_get_uint64(s, "bytes-sent");
+            snapshot->candidate_pair.bytes_received = stats_get_uint64(s, "bytes-received");
+            snapshot->candidate_pair.current_round_trip_time = rtt;
+        } break;
+        default:
+            break;
+    }
+
+    return TRUE;
+}
+
+static gboolean stats_is_fec_decoder(GstElement *element) {
+    GstElementFactory *factory = gst_element_get_factory(element);
+    return factory != NULL && g_str_equal(GST_OBJECT_NAME(factory), "rtpulpfecdec");
+}
+
+/// webrtcbin creates a decoder per stream when the transceiver's receive side is set up, after we start watching
+static void stats_on_deep_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    struct webrtc_stats_collector *collector = user_data;
+
+    if (!stats_is_fec_decoder(element)) {
+        return;
+    }
+
+    g_mutex_lock(&collector->mutex);
+    g_ptr_array_add(collector->fec_decoders, gst_object_ref(element));
+    g_mutex_unlock(&collector->mutex);
+}
+
+static void stats_on_deep_element_removed(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data) {
+    struct webrtc_stats_collector *collector = user_data;
+
+    if (!stats_is_fec_decoder(element)) {
+        return;
+    }
+
+    g_mutex_lock(&collector->mutex);
+    g_ptr_array_remove(collector->fec_decoders, element);
+    g_mutex_unlock(&collector->mutex);
+}
+
+/// Called with the collector lock held
+static void stats_read_fec(struct webrtc_stats_collector *collector, struct webrtc_stats_snapshot *snapshot) {
+    for (guint i = 0; i < collector->fec_decoders->len; i++) {
+        guint recovered = 0;
+        guint unrecovered = 0;
+        g_object_get(g_ptr_array_index(collector->fec_decoders, i),
+                     "recovered",
+                     &recovered,
+                     "unrecovered",
+                     &unrecovered,
+                     NULL);
+        snapshot->fec_recovered += recovered;
+        snapshot->fec_unrecovered += unrecovered;
+    }
+}
+
+// Counters restart when a stream is replaced, never report that as a negative delta.
+#define STATS_DELTA(cur, prev) ((cur) > (prev) ? (cur) - (prev) : 0)
+
+static void stats_compute_sample(const struct webrtc_stats_snapshot *prev,
+                                 const struct webrtc_stats_snapshot *cur,
+                                 struct webrtc_stats_sample *out) {
+    memset(out, 0, sizeof(struct webrtc_stats_sample));
+
+    out->timestamp_us = cur->timestamp_us;
+    out->interval = (gdouble)(cur->timestamp_us - prev->timestamp_us) / G_USEC_PER_SEC;
+    if (out->interval <= 0) {
+        return;
+    }
+
+    // Receiving side
+    {
+        guint64 cur_bytes = 0, prev_bytes = 0, cur_packets = 0, prev_packets = 0;
+        gint64 cur_lost = 0, prev_lost = 0;
+        for (guint i = 0; i < cur->n_inbound; i++) {
+            cur_bytes += cur->inbound[i].bytes_received;
+            cur_packets += cur->inbound[i].packets_received;
+            cur_lost += cur->inbound[i].packets_lost;
+            out->recv_jitter_ms = MAX(out->recv_jitter_ms, cur->inbound[i].jitter * 1000.0);
+        }
+        for (guint i = 0; i < prev->n_inbound; i++) {
+            prev_bytes += prev->inbound[i].bytes_received;
+            prev_packets += prev->inbound[i].packets_received;
+            prev_lost += prev->inbound[i].packets_lost;
+        }
+
+        out->recv_bitrate = (gdouble)STATS_DELTA(cur_bytes, prev_bytes) * 8.0 / out->interval;
+
+        const gint64 lost = STATS_DELTA(cur_lost, prev_lost);
+        const guint64 received = STATS_DELTA(cur_packets, prev_packets);
+        if (lost + received > 0) {
+            out->recv_loss_percent = 100.0 * (gdouble)lost / (gdouble)(lost + received);
+        }
+    }
+
+    // Sending side
+    {
+        guint64 cur_bytes = 0, prev_bytes = 0, cur_packets = 0, prev_packets = 0;
+        gint64 cur_lost = 0, prev_lost = 0;
+        gdouble fraction_lost = 0;
+        for (guint i = 0; i < cur->n_outbound; i++) {
+            cur_bytes += cur->outbound[i].bytes_sent;
+            cur_packets += cur->outbound[i].packets_sent;
+        }
+        for (guint i = 0; i < prev->n_outbound; i++) {
+            prev_bytes += prev->outbound[i].bytes_sent;
+            prev_packets += prev->outbound[i].packets_sent;
+        }
+        for (guint i = 0; i < cur->n_remote_inbound; i++) {
+            cur_lost += cur->remote_inbound[i].packets_lost;
+            fraction_lost = MAX(fraction_lost, cur->remote_inbound[i].fraction_lost);
+            out->send_jitter_ms = MAX(out->send_jitter_ms, cur->remote_inbound[i].jitter * 1000.0);
+            out->rtt_ms = MAX(out->rtt_ms, cur->remote_inbound[i].round_trip_time * 1000.0);
+        }
+        for (guint i = 0; i < prev->n_remote_inbound; i++) {
+            prev_lost += prev->remote_inbound[i].packets_lost;
+        }
+
+        out->send_bitrate = (gdouble)STATS_DELTA(cur_bytes, prev_bytes) * 8.0 / out->interval;
+
+        const guint64 sent = STATS_DELTA(cur_packets, prev_packets);
+        if (sent > 0) {
+            out->send_loss_percent = MIN(100.0, 100.0 * (gdouble)STATS_DELTA(cur_lost, prev_lost) / (gdouble)sent);
+        } else {
+            out->send_loss_percent = 100.0 * fraction_lost;
+        }
+    }
+
+    if (out->rtt_ms <= 0 && cur->has_candidate_pair) {
+        out->rtt_ms = cur->candidate_pair.current_round_trip_time * 1000.0;
+    }
+
+    out->frames_decoded = (guint)STATS_DELTA(cur->frames_decoded, prev->frames_decoded);
+    out->frames_dropped = (guint)STATS_DELTA(cur->frames_dropped, prev->frames_dropped);
+    out->fec_recovered = STATS_DELTA(cur->fec_recovered, prev->fec_recovered);
+}
+
+#undef STATS_DELTA
+
+static void webrtc_stats_collector_clear(struct webrtc_stats_collector *collector) {
+    gst_clear_object(&collector->webrtcbin);
+    g_ptr_array_unref(collector->fec_decoders);
+    g_free(collector->ring);
+    g_mutex_clear(&collector->mutex);
+}
+
+static void webrtc_stats_collector_release(gpointer data) {
+    g_atomic_rc_box_release_full(data, (GDestroyNotify)webrtc_stats_collector_clear);
+}
+
+static void webrtc_stats_collector_on_stats(GstPromise *promise, gpointer user_data) {
+    struct webrtc_stats_collector *collector = user_data;
+
+    const GstStructure *reply = gst_promise_get_reply(promise);
+    if (reply == NULL) {
+        return;
+    }
+
+    struct webrtc_stats_snapshot snapshot = {0};
+    snapshot.timestamp_us = g_get_monotonic_time();
+    gst_structure_foreach(reply, stats_parse_field, &snapshot);
+
+    g_mutex_lock(&collector->mutex);
+    stats_read_fec(collector, &snapshot);
+    // Under the lock, so the frame counter owner can detach it in webrtc_stats_collector_free()
+    if (collector->frame_counter != NULL) {
+        collector->frame_counter(collector->frame_counter_data, &snapshot.frames_decoded, &snapshot.frames_dropped);
+    }
+    if (collector->has_snapshot) {
+        stats_compute_sample(&collector->last, &snapshot, &collector->ring[collector->ring_head]);
+        collector->ring_head = (collector->ring_head + 1) % collector->ring_capacity;
+        collector->ring_count = MIN(collector->ring_count + 1, collector->ring_capacity);
+    }
+    collector->last = snapshot;
+    collector->has_snapshot = TRUE;
+    g_mutex_unlock(&collector->mutex);
+}
+
+static gboolean webrtc_stats_collector_poll_cb(gpointer user_data) {
+    struct webrtc_stats_collector *collector = user_data;
+
+    GstPromise *promise = gst_promise_new_with_change_func(webrtc_stats_collector_on_stats,
+                                                           g_atomic_rc_box_acquire(collector),
+                                                           webrtc_stats_collector_release);
+    g_signal_emit_by_name(collector->webrtcbin, "get-stats", NULL, promise);
+    gst_promise_unref(promise);
+
+    return G_SOURCE_CONTINUE;
+}
+
+struct webrtc_stats_collector *webrtc_stats_collector_new(GstElement *webrtcbin,
+                                                          const guint interval_ms,
+                                                          const guint history_s) {
+    g_assert_nonnull(webrtcbin);
+    g_assert(interval_ms > 0);
+
+    struct webrtc_stats_collector *collector = g_atomic_rc_box_new0(struct webrtc_stats_collector);
+
+    collector->webrtcbin = gst_object_ref(webrtcbin);
+    collector->interval_ms = interval_ms;
+    collector->ring_capacity = MAX(1, history_s * 1000 / interval_ms);
+    collector->ring = g_new0(struct webrtc_stats_sample, collector->ring_capacity);
+    collector->fec_decoders = g_ptr_array_new_with_free_func(gst_object_unref);
+    g_mutex_init(&collector->mutex);
+
+    collector->fec_added_id = g_signal_connect_data(webrtcbin,
+                                                    "deep-element-added",
+                                                    G_CALLBACK(stats_on_deep_element_added),
+                                                    g_atomic_rc_box_acquire(collector),
+                                                    (GClosureNotify)webrtc_stats_collector_release,
+                                                    0);
+    collector->fec_removed_id = g_signal_connect_data(webrtcbin,
+                                                      "deep-element-removed",
+                                                      G_CALLBACK(stats_on_deep_element_removed),
+                                                      g_atomic_rc_box_acquire(collector),
+                                                      (GClosureNotify)webrtc_stats_collector_release,
+                                                      0);
+
+    // Decoders created before we started watching, only walked once
+    GstIterator *iter = gst_bin_iterate_recurse(GST_BIN(webrtcbin));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+        if (stats_is_fec_decoder(element)) {
+            g_ptr_array_add(collector->fec_decoders, gst_object_ref(element));
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iter);
+
+    return collector;
+}
+
+void webrtc_stats_collector_set_frame_counter(struct webrtc_stats_collector *collector,
+                                              const webrtc_stats_frame_counter_func func,
+                                              const gpointer user_data) {
+    collector->frame_counter = func;
+    collector->frame_counter_data = user_data;
+}
+
+void webrtc_stats_collector_start(struct webrtc_stats_collector *collector) {
+    if (collector->timeout_src != NULL) {
+        return;
+    }
+
+    collector->timeout_src = g_timeout_source_new(collector->interval_ms);
+    g_source_set_callback(collector->timeout_src,
+                          webrtc_stats_collector_poll_cb,
+                          g_atomic_rc_box_acquire(collector),
+                          webrtc_stats_collector_release);
+    g_source_attach(collector->timeout_src, g_main_context_get_thread_default());
+}
+
+void webrtc_stats_collector_free(struct webrtc_stats_collector *collector) {
+    if (collector == NULL) {
+        return;
+    }
+
+    if (collector->timeout_src != NULL) {
+        g_source_destroy(collector->timeout_src);
+        g_clear_pointer(&collector->timeout_src, g_source_unref);
+    }
+
+    g_signal_handler_disconnect(collector->webrtcbin, collector->fec_added_id);
+    g_signal_handler_disconnect(collector->webrtcbin, collector->fec_removed_id);
+
+    // A reply still in flight must not call back into an owner that is going away
+    g_mutex_lock(&collector->mutex);
+    collector->frame_counter = NULL;
+    collector->frame_counter_data = NULL;
+    g_mutex_unlock(&collector->mutex);
+
+    webrtc_stats_collector_release(collector);
+}
+
+gboolean webrtc_stats_collector_get_latest(struct webrtc_stats_collector *collector, struct webrtc_stats_sample *out) {
+    g_mutex_lock(&collector->mutex);
+    const gboolean has_sample = collector->ring_count > 0;
+    if (has_sample) {
+        *out = collector->ring[(collector->ring_head + collector->ring_capacity - 1) % collector->ring_capacity];
+    }
+    g_mutex_unlock(&collector->mutex);
+
+    return has_sample;
+}
+
+gboolean webrtc_stats_collector_get_snapshot(struct webrtc_stats_collector *collector,
+                                             struct webrtc_stats_snapshot *out) {
+    g_mutex_lock(&collector->mutex);
+    const gboolean has_snapshot = collector->has_snapshot;
+    if (has_snapshot) {
+        *out = collector->last;
+    }
+    g_mutex_unlock(&collector->mutex);
+
+    return has_snapshot;
+}
+
+guint webrtc_stats_collector_copy_samples(struct webrtc_stats_collector *collector,
+                                          struct webrtc_stats_sample *out,
+                                          const guint max_samples) {
+    g_mutex_lock(&collector->mutex);
+    const guint count = MIN(max_samples, collector->ring_count);
+    const guint first = (collector->ring_head + collector->ring_capacity - count) % collector->ring_capacity;
+    for (guint i = 0; i < count; i++) {
+        out[i] = collector->ring[(first + i) % collector->ring_capacity];
+    }
+    g_mutex_unlock(&collector->mutex);
+
+    return count;
+}
+
+static void append_json_double(GString *out, const gchar *key, const gdouble value) {
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    // Always use '.' as the decimal separator, whatever the locale
+    g_string_append_printf(out, ",\"%s\":%s", key, g_ascii_formatd(buf, sizeof(buf), "%.3f", value));
+}
+
+void webrtc_stats_sample_append_json(const struct webrtc_stats_sample *sample, GString *out) {
+    g_string_append_printf(out, "{\"t_us\":%" G_GINT64_FORMAT, sample->timestamp_us);
+    append_json_double(out, "dt", sample->interval);
+    append_json_double(out, "rx_bps", sample->recv_bitrate);
+    append_json_double(out, "tx_bps", sample->send_bitrate);
+    append_json_double(out, "rx_loss", sample->recv_loss_percent);
+    append_json_double(out, "tx_loss", sample->send_loss_percent);
+    append_json_double(out, "rx_jitter_ms", sample->recv_jitter_ms);
+    append_json_double(out, "tx_jitter_ms", sample->send_jitter_ms);
+    append_json_double(out, "rtt_ms", sample->rtt_ms);
+    g_string_append_printf(out,
+                           ",\"frames_decoded\":%u,\"frames_dropped\":%u,\"fec_recovered\":%u}\n",
+                           sample->frames_decoded,
+                           sample->frames_dropped,
+                           sample->fec_recovered);
+}
+
+void webrtc_stats_collector_append_jsonl(struct webrtc_stats_collector *collector,
+                                         GString *out,
+                                         const guint max_samples) {
+    struct webrtc_stats_sample *samples = g_new(struct webrtc_stats_sample, MAX(1, max_samples));
+    const guint count = webrtc_stats_collector_copy_samples(collector, samples, max_samples);
+
+    for (guint i = 0; i < count; i++) {
+        webrtc_stats_sample_append_json(&samples[i], out);
+    }
+
+    g_free(samples);
+}
+
 // static void on_webrtcbin_stats(GstPromise *promise, GstElement *user_data) {
 //     const GstStructure *reply = gst_promise_get_reply(promise);
 //
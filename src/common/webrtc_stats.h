@@ -4,3 +4,160 @@
 #include <gst/gst.h>
 
 GString *webrtc_stats_get_json(const GstStructure *stats);
+
+/// Maximum number of streams (SSRCs) of each kind kept per snapshot, which covers audio, video and their FEC/RTX.
+#define WEBRTC_STATS_MAX_STREAMS 4
+
+struct webrtc_stats_inbound {
+    guint32 ssrc;
+    guint64 packets_received;
+    guint64 bytes_received;
+    gint64 packets_lost;
+    /// Seconds
+    gdouble jitter;
+};
+
+struct webrtc_stats_outbound {
+    guint32 ssrc;
+    guint64 packets_sent;
+    guint64 bytes_sent;
+    guint nack_count;
+    guint pli_count;
+};
+
+/// What the remote receiver reported back about one of our outbound streams (from RTCP receiver reports).
+struct webrtc_stats_remote_inbound {
+    guint32 ssrc;
+    gint64 packets_lost;
+    gdouble fraction_lost;
+    /// Seconds
+    gdouble jitter;
+    /// Seconds
+    gdouble round_trip_time;
+};
+
+struct webrtc_stats_candidate_pair {
+    guint64 bytes_sent;
+    guint64 bytes_received;
+    /// Seconds
+    gdouble current_round_trip_time;
+};
+
+/*!
+ * The fields we care about from one "get-stats" reply, parsed into typed structs.
+ */
+struct webrtc_stats_snapshot {
+    /// Monotonic time the reply was received, in microseconds
+    gint64 timestamp_us;
+
+    guint n_inbound;
+    struct webrtc_stats_inbound inbound[WEBRTC_STATS_MAX_STREAMS];
+    guint n_outbound;
+    struct webrtc_stats_outbound outbound[WEBRTC_STATS_MAX_STREAMS];
+    guint n_remote_inbound;
+    struct webrtc_stats_remote_inbound remote_inbound[WEBRTC_STATS_MAX_STREAMS];
+    gboolean has_candidate_pair;
+    struct webrtc_stats_candidate_pair candidate_pair;
+
+    /// Totals from the ULP FEC decoders, if any
+    guint fec_recovered;
+    guint fec_unrecovered;
+
+    /// Totals from the frame counter source, if any
+    guint64 frames_decoded;
+    guint64 frames_dropped;
+};
+
+/*!
+ * Per-interval values derived from two consecutive snapshots.
+ */
+struct webrtc_stats_sample {
+    /// Monotonic time of the newer snapshot, in microseconds
+    gint64 timestamp_us;
+    /// Length of the interval in seconds
+    gdouble interval;
+
+    gdouble recv_bitrate;
+    gdouble send_bitrate;
+    /// Incoming loss over the interval, in percent
+    gdouble recv_loss_percent;
+    /// Outgoing loss over the interval as reported by the remote, in percent
+    gdouble send_loss_percent;
+    /// Highest jitter among the incoming streams as we measure it, in milliseconds
+    gdouble recv_jitter_ms;
+    /// Highest jitter among the outgoing streams as the remote reports it, in milliseconds
+    gdouble send_jitter_ms;
+    /// Milliseconds, 0 if unknown
+    gdouble rtt_ms;
+
+    guint frames_decoded;
+    guint frames_dropped;
+    guint fec_recovered;
+};
+
+/*!
+ * Source of decoded/dropped frame totals, which webrtcbin does not know about.
+ *
+ * Called with the collector lock held from the thread delivering the stats reply, so it must be cheap.
+ */
+typedef void (*webrtc_stats_frame_counter_func)(gpointer user_data, guint64 *out_decoded, guint64 *out_dropped);
+
+struct webrtc_stats_collector;
+
+/*!
+ * Create a collector polling @p webrtcbin every @p interval_ms and keeping the samples of the last @p history_s
+ * seconds in a fixed-size ring.
+ */
+struct webrtc_stats_collector *webrtc_stats_collector_new(GstElement *webrtcbin, guint interval_ms, guint history_s);
+
+/*!
+ * Set where decoded/dropped frame counts come from. Must be called before @ref webrtc_stats_collector_start.
+ */
+void webrtc_stats_collector_set_frame_counter(struct webrtc_stats_collector *collector,
+                                              webrtc_stats_frame_counter_func func,
+                                              gpointer user_data);
+
+/*!
+ * Start polling from the thread-default main context of the calling thread.
+ */
+void webrtc_stats_collector_start(struct webrtc_stats_collector *collector);
+
+/*!
+ * Stop polling, detach the frame counter and drop the caller's reference. A reply still in flight keeps the collector
+ * alive until it lands.
+ */
+void webrtc_stats_collector_free(struct webrtc_stats_collector *collector);
+
+/*!
+ * Get the most recent sample.
+ *
+ * @return FALSE if no interval has been completed yet.
+ */
+gboolean webrtc_stats_collector_get_latest(struct webrtc_stats_collector *collector, struct webrtc_stats_sample *out);
+
+/*!
+ * Get the most recent raw snapshot.
+ *
+ * @return FALSE if no reply has been received yet.
+ */
+gboolean webrtc_stats_collector_get_snapshot(struct webrtc_stats_collector *collector,
+                                             struct webrtc_stats_snapshot *out);
+
+/*!
+ * Copy up to @p max_samples of the most recent samples, oldest first, e.g. for a binary dump.
+ *
+ * @return The number of samples copied.
+ */
+guint webrtc_stats_collector_copy_samples(struct webrtc_stats_collector *collector,
+                                          struct webrtc_stats_sample *out,
+                                          guint max_samples);
+
+/*!
+ * Append up to @p max_samples of the most recent samples to @p out as compact JSON lines, oldest first.
+ */
+void webrtc_stats_collector_append_jsonl(struct webrtc_stats_collector *collector, GString *out, guint max_samples);
+
+/*!
+ * Append one sample to @p out as a single compact JSON line.
+ */
+void webrtc_stats_sample_append_json(const struct webrtc_stats_sample *sample, GString *out);
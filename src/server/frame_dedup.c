@@ -0,0 +1,321 @@
+#include "frame_dedup.h"
+
+#include <gst/video/video.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/logger.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FRAME_DEDUP_SSE2
+    #include <emmintrin.h>
+#endif
+#if defined(FRAME_DEDUP_SSE2) && defined(__GNUC__)
+    // Built for the target alone and only used if the CPU has it
+    #define FRAME_DEDUP_AVX2
+    #include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    #define FRAME_DEDUP_NEON
+    #include <arm_neon.h>
+#endif
+
+static void frame_dedup_sad_tail(const guint8 *a, const guint8 *b, gsize from, const gsize to, guint32 *sums) {
+    for (; from < to; from++) {
+        sums[from / FRAME_DEDUP_BLOCK_BYTES] += abs((gint)a[from] - (gint)b[from]);
+    }
+}
+
+static void frame_dedup_sad_c(const guint8 *a,
+                              const gsize stride_a,
+                              const guint8 *b,
+                              const gsize stride_b,
+                              const gsize row_bytes,
+                              const guint rows,
+                              guint32 *sums) {
+    for (guint y = 0; y < rows; y++) {
+        frame_dedup_sad_tail(a + y * stride_a, b + y * stride_b, 0, row_bytes, sums);
+    }
+}
+
+#ifdef FRAME_DEDUP_SSE2
+static void frame_dedup_sad_sse2(const guint8 *a,
+                                 const gsize stride_a,
+                                 const guint8 *b,
+                                 const gsize stride_b,
+                                 const gsize row_bytes,
+                                 const guint rows,
+                                 guint32 *sums) {
+    const gsize simd_bytes = row_bytes & ~(gsize)15;
+
+    for (guint y = 0; y < rows; y++) {
+        const guint8 *ra = a + y * stride_a;
+        const guint8 *rb = b + y * stride_b;
+
+        for (gsize x = 0; x < simd_bytes; x += 16) {
+            // Two 64 bit lanes, each the sum of 8 differences
+            const __m128i sad = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(ra + x)),
+                                             _mm_loadu_si128((const __m128i *)(rb + x)));
+            sums[x / FRAME_DEDUP_BLOCK_BYTES] += _mm_cvtsi128_si32(sad) + _mm_extract_epi16(sad, 4);
+        }
+        frame_dedup_sad_tail(ra, rb, simd_bytes, row_bytes, sums);
+    }
+}
+#endif
+
+#ifdef FRAME_DEDUP_AVX2
+__attribute__((target("avx2"))) static void frame_dedup_sad_avx2(const guint8 *a,
+                                                                  const gsize stride_a,
+                                                                  const guint8 *b,
+                                                                  const gsize stride_b,
+                                                                  const gsize row_bytes,
+                                                                  const guint rows,
+                                                                  guint32 *sums) {
+    const gsize simd_bytes = row_bytes & ~(gsize)31;
+
+    for (guint y = 0; y < rows; y++) {
+        const guint8 *ra = a + y * stride_a;
+        const guint8 *rb = b + y * stride_b;
+
+        for (gsize x = 0; x < simd_bytes; x += 32) {
+            // Four 64 bit lanes, each the sum of 8 differences
+            const __m256i sad = _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(ra + x)),
+                                                _mm256_loadu_si256((const __m256i *)(rb + x)));
+            const __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+            sums[x / FRAME_DEDUP_BLOCK_BYTES] += _mm_cvtsi128_si32(half) + _mm_extract_epi16(half, 4);
+        }
+        frame_dedup_sad_tail(ra, rb, simd_bytes, row_bytes, sums);
+    }
+}
+#endif
+
+#ifdef FRAME_DEDUP_NEON
+static void frame_dedup_sad_neon(const guint8 *a,
+                                 const gsize stride_a,
+                                 const guint8 *b,
+                                 const gsize stride_b,
+                                 const gsize row_bytes,
+                                 const guint rows,
+                                 guint32 *sums) {
+    const gsize simd_bytes = row_bytes & ~(gsize)15;
+
+    for (guint y = 0; y < rows; y++) {
+        const guint8 *ra = a + y * stride_a;
+        const guint8 *rb = b + y * stride_b;
+
+        for (gsize x = 0; x < simd_bytes; x += 16) {
+            sums[x / FRAME_DEDUP_BLOCK_BYTES] += vaddlvq_u8(vabdq_u8(vld1q_u8(ra + x), vld1q_u8(rb + x)));
+        }
+        frame_dedup_sad_tail(ra, rb, simd_bytes, row_bytes, sums);
+    }
+}
+#endif
+
+struct frame_dedup {
+    GstPad *pad;
+    gulong probe_id;
+    frame_dedup_sad_func sad;
+
+    /// Streaming thread only
+    GstVideoInfo info;
+    gboolean has_info;
+    /// Last frame forwarded, compared against
+    GstBuffer *last;
+    gint64 last_forwarded_us;
+    guint32 *sums;
+    gsize n_blocks;
+
+    /// Set by key frame requests, from the encoders' threads
+    gint force_next;
+
+    /// Protects the stats
+    GMutex mutex;
+    guint64 frames;
+    guint64 dropped;
+    gint64 compare_us;
+};
+
+/// Whether any block of the first plane differs from the last frame forwarded
+static gboolean frame_dedup_changed(struct frame_dedup *dedup, GstBuffer *buffer) {
+    GstVideoFrame current;
+    GstVideoFrame last;
+    if (!gst_video_frame_map(&current, &dedup->info, buffer, GST_MAP_READ)) {
+        return TRUE;
+    }
+    if (!gst_video_frame_map(&last, &dedup->info, dedup->last, GST_MAP_READ)) {
+        gst_video_frame_unmap(&current);
+        return TRUE;
+    }
+
+    const guint8 *a = GST_VIDEO_FRAME_PLANE_DATA(&current, 0);
+    const guint8 *b = GST_VIDEO_FRAME_PLANE_DATA(&last, 0);
+    const gsize stride_a = GST_VIDEO_FRAME_PLANE_STRIDE(&current, 0);
+    const gsize stride_b = GST_VIDEO_FRAME_PLANE_STRIDE(&last, 0);
+    const gsize row_bytes = (gsize)GST_VIDEO_FRAME_COMP_WIDTH(&current, 0) * GST_VIDEO_FRAME_COMP_PSTRIDE(&current, 0);
+    const guint rows = GST_VIDEO_FRAME_COMP_HEIGHT(&current, 0);
+
+    const gsize n_blocks = (row_bytes + FRAME_DEDUP_BLOCK_BYTES - 1) / FRAME_DEDUP_BLOCK_BYTES;
+    if (n_blocks > dedup->n_blocks) {
+        dedup->sums = g_renew(guint32, dedup->sums, n_blocks);
+        dedup->n_blocks = n_blocks;
+    }
+
+    gboolean changed = FALSE;
+    for (guint y = 0; y < rows && !changed; y += FRAME_DEDUP_BLOCK_ROWS) {
+        memset(dedup->sums, 0, n_blocks * sizeof(guint32));
+        dedup->sad(a + y * stride_a,
+                   stride_a,
+                   b + y * stride_b,
+                   stride_b,
+                   row_bytes,
+                   MIN(FRAME_DEDUP_BLOCK_ROWS, rows - y),
+                   dedup->sums);
+
+        for (gsize i = 0; i < n_blocks; i++) {
+            if (dedup->sums[i] > FRAME_DEDUP_BLOCK_THRESHOLD) {
+                changed = TRUE;
+                break;
+            }
+        }
+    }
+
+    gst_video_frame_unmap(&last);
+    gst_video_frame_unmap(&current);
+
+    return changed;
+}
+
+static GstPadProbeReturn frame_dedup_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    struct frame_dedup *dedup = user_data;
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_UPSTREAM) {
+        if (gst_video_event_is_force_key_unit(GST_PAD_PROBE_INFO_EVENT(info))) {
+            g_atomic_int_set(&dedup->force_next, 1);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS) {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+            dedup->has_info = gst_video_info_from_caps(&dedup->info, caps);
+            gst_clear_buffer(&dedup->last);
+        } else if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP) {
+            gst_clear_buffer(&dedup->last);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    const gint64 now_us = g_get_monotonic_time();
+
+    gboolean forward = !dedup->has_info || dedup->last == NULL ||
+                       now_us - dedup->last_forwarded_us >= FRAME_DEDUP_REFRESH_MS * 1000 ||
+                       g_atomic_int_compare_and_exchange(&dedup->force_next, 1, 0);
+    gint64 compare_us = 0;
+    if (!forward) {
+        forward = frame_dedup_changed(dedup, buffer);
+        compare_us = g_get_monotonic_time() - now_us;
+    }
+
+    g_mutex_lock(&dedup->mutex);
+    dedup->frames++;
+    dedup->dropped += forward ? 0 : 1;
+    dedup->compare_us += compare_us;
+    g_mutex_unlock(&dedup->mutex);
+
+    if (!forward) {
+        return GST_PAD_PROBE_DROP;
+    }
+
+    // Holding a reference is enough: raw frames are not written to once pushed
+    gst_buffer_replace(&dedup->last, buffer);
+    dedup->last_forwarded_us = now_us;
+
+    return GST_PAD_PROBE_OK;
+}
+
+frame_dedup_sad_func frame_dedup_get_sad(const gchar *name) {
+#ifdef FRAME_DEDUP_AVX2
+    if (g_strcmp0(name, "AVX2") == 0) {
+        return __builtin_cpu_supports("avx2") ? frame_dedup_sad_avx2 : NULL;
+    }
+#endif
+#ifdef FRAME_DEDUP_SSE2
+    if (g_strcmp0(name, "SSE2") == 0) {
+        return frame_dedup_sad_sse2;
+    }
+#endif
+#ifdef FRAME_DEDUP_NEON
+    if (g_strcmp0(name, "NEON") == 0) {
+        return frame_dedup_sad_neon;
+    }
+#endif
+    if (g_strcmp0(name, "C") == 0) {
+        return frame_dedup_sad_c;
+    }
+    return NULL;
+}
+
+static frame_dedup_sad_func frame_dedup_pick_sad(const gchar **out_name) {
+    // Fastest first, the C kernel is always there
+    static const gchar *const names[] = {"AVX2", "SSE2", "NEON", "C"};
+
+    for (guint i = 0;; i++) {
+        const frame_dedup_sad_func sad = frame_dedup_get_sad(names[i]);
+        if (sad != NULL) {
+            *out_name = names[i];
+            return sad;
+        }
+    }
+}
+
+struct frame_dedup *frame_dedup_new(GstPad *pad) {
+    if (g_strcmp0(g_getenv(FRAME_DEDUP_ENV), "0") == 0) {
+        ALOGI("Duplicate frame dropping disabled by %s", FRAME_DEDUP_ENV);
+        return NULL;
+    }
+
+    struct frame_dedup *dedup = g_new0(struct frame_dedup, 1);
+    dedup->pad = gst_object_ref(pad);
+    g_mutex_init(&dedup->mutex);
+
+    const gchar *name;
+    dedup->sad = frame_dedup_pick_sad(&name);
+    ALOGI("Dropping duplicate frames, compared with %s", name);
+
+    dedup->probe_id = gst_pad_add_probe(pad,
+                                        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+                                            GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+                                        frame_dedup_probe,
+                                        dedup,
+                                        NULL);
+
+    return dedup;
+}
+
+void frame_dedup_free(struct frame_dedup *dedup) {
+    if (dedup == NULL) {
+        return;
+    }
+
+    gst_pad_remove_probe(dedup->pad, dedup->probe_id);
+    gst_object_unref(dedup->pad);
+    gst_clear_buffer(&dedup->last);
+    g_free(dedup->sums);
+    g_mutex_clear(&dedup->mutex);
+    g_free(dedup);
+}
+
+void frame_dedup_get_stats(struct frame_dedup *dedup,
+                           guint64 *out_frames,
+                           guint64 *out_dropped,
+                           gdouble *out_seconds) {
+    g_mutex_lock(&dedup->mutex);
+    *out_frames = dedup->frames;
+    *out_dropped = dedup->dropped;
+    *out_seconds = (gdouble)dedup->compare_us / 1e6;
+    g_mutex_unlock(&dedup->mutex);
+}
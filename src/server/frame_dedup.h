@@ -0,0 +1,66 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/// Set to 0 to send every raw frame to the encoders, e.g. to compare CPU and bitrate with and without
+#define FRAME_DEDUP_ENV "GWD_FRAME_DEDUP"
+/// Forward a frame at least this often even if nothing changed, so clients keep receiving video and quality settles
+#define FRAME_DEDUP_REFRESH_MS 500
+/// Frames are compared in blocks of this many bytes of a row, by this many rows
+#define FRAME_DEDUP_BLOCK_BYTES 64
+#define FRAME_DEDUP_BLOCK_ROWS 16
+/// A block changed if the sum of its absolute byte differences exceeds this, an average of 1 per byte: noise stays
+/// below, while a mouse pointer or a character of text moving is well above
+#define FRAME_DEDUP_BLOCK_THRESHOLD (FRAME_DEDUP_BLOCK_BYTES * FRAME_DEDUP_BLOCK_ROWS)
+
+/*!
+ * Add the absolute differences of @p rows rows of @p row_bytes bytes to the sum of each block they cross, the first
+ * FRAME_DEDUP_BLOCK_BYTES bytes to sums[0] and so on.
+ */
+typedef void (*frame_dedup_sad_func)(const guint8 *a,
+                                     gsize stride_a,
+                                     const guint8 *b,
+                                     gsize stride_b,
+                                     gsize row_bytes,
+                                     guint rows,
+                                     guint32 *sums);
+
+/*!
+ * Drops raw frames identical or nearly identical to the last one forwarded, before they reach any encoder.
+ *
+ * Each frame's first plane, the luma of YUV formats or the pixels of packed RGB ones, is compared with the last
+ * forwarded frame's using the sum of absolute differences over small blocks, with SSE2, AVX2 or NEON where available.
+ * Comparing stops at the first block that changed, so moving content costs little more than one block row.
+ *
+ * Static content then goes to the encoders at FRAME_DEDUP_REFRESH_MS intervals instead of the source frame rate, and
+ * a key frame request from an encoder, i.e. a new client, lets the next frame through whatever it holds.
+ */
+struct frame_dedup;
+
+/*!
+ * Start dropping duplicates of the raw video flowing through @p pad.
+ *
+ * @return NULL if disabled with FRAME_DEDUP_ENV.
+ */
+struct frame_dedup *frame_dedup_new(GstPad *pad);
+
+/*!
+ * Only call this once the pad has stopped streaming.
+ */
+void frame_dedup_free(struct frame_dedup *dedup);
+
+/*!
+ * Frames seen and dropped so far, and the time spent comparing them. May be called from any thread.
+ */
+void frame_dedup_get_stats(struct frame_dedup *dedup, guint64 *out_frames, guint64 *out_dropped, gdouble *out_seconds);
+
+/*!
+ * The sum of absolute differences kernel called @p name, "C", "SSE2", "AVX2" or "NEON", for tests and benchmarks.
+ *
+ * @return NULL if it is not built in or this CPU lacks it. "C" is always there and the others must match it.
+ */
+frame_dedup_sad_func frame_dedup_get_sad(const gchar *name);
+
+G_END_DECLS
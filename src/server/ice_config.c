@@ -0,0 +1,81 @@
+#include "ice_config.h"
+
+#include "../utils/logger.h"
+
+/// The ICE agent's properties depend on the GStreamer version, only use those there
+static gboolean ice_config_has_property(gpointer object, const gchar *name, const GParamFlags flags) {
+    const GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(object), name);
+    return pspec != NULL && (pspec->flags & flags) == flags;
+}
+
+/// ICE_PORTS_ENV, only parsed once, FALSE if unset or invalid
+static gboolean ice_config_get_ports(guint *out_min, guint *out_max) {
+    static gsize parsed = 0;
+    static guint min_port;
+    static guint max_port;
+
+    if (g_once_init_enter(&parsed)) {
+        const gchar *value = g_getenv(ICE_PORTS_ENV);
+        if (value) {
+            gchar *end = NULL;
+            const guint64 min = g_ascii_strtoull(value, &end, 10);
+            const guint64 max = *end == '-' ? g_ascii_strtoull(end + 1, &end, 10) : 0;
+            if (*end != '\0' || min == 0 || max < min || max > G_MAXUINT16) {
+                ALOGE("Ignoring %s=%s, expected <min>-<max>", ICE_PORTS_ENV, value);
+            } else {
+                min_port = min;
+                max_port = max;
+                ALOGI("ICE candidates on UDP ports %u-%u", min_port, max_port);
+            }
+        }
+        g_once_init_leave(&parsed, 1);
+    }
+
+    *out_min = min_port;
+    *out_max = max_port;
+
+    return min_port != 0;
+}
+
+void ice_config_apply(GstElement *webrtcbin) {
+    guint min_port;
+    guint max_port;
+    const gboolean ports = ice_config_get_ports(&min_port, &max_port);
+    const gboolean no_tcp = g_strcmp0(g_getenv(ICE_TCP_ENV), "0") == 0;
+    if (!ports && !no_tcp) {
+        return;
+    }
+
+    if (!ice_config_has_property(webrtcbin, "ice-agent", G_PARAM_READABLE)) {
+        ALOGW("No ICE agent to configure on %s, ignoring %s and %s",
+              GST_ELEMENT_NAME(webrtcbin),
+              ICE_PORTS_ENV,
+              ICE_TCP_ENV);
+        return;
+    }
+    GObject *agent = NULL;
+    g_object_get(webrtcbin, "ice-agent", &agent, NULL);
+    if (agent == NULL) {
+        return;
+    }
+
+    if (ports) {
+        if (ice_config_has_property(agent, "min-rtp-port", G_PARAM_WRITABLE) &&
+            ice_config_has_property(agent, "max-rtp-port", G_PARAM_WRITABLE)) {
+            // The default maximum is above any minimum, so the minimum goes first
+            g_object_set(agent, "min-rtp-port", min_port, "max-rtp-port", max_port, NULL);
+        } else {
+            ALOGW("The ICE agent has no port range, ignoring %s", ICE_PORTS_ENV);
+        }
+    }
+
+    if (no_tcp) {
+        if (ice_config_has_property(agent, "ice-tcp", G_PARAM_WRITABLE)) {
+            g_object_set(agent, "ice-tcp", FALSE, NULL);
+        } else {
+            ALOGW("The ICE agent cannot skip TCP, ignoring %s", ICE_TCP_ENV);
+        }
+    }
+
+    g_object_unref(agent);
+}
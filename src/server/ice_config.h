@@ -0,0 +1,22 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/// "<min>-<max>" to only gather UDP candidates on these ports, e.g. "50000-50999", so that a firewall only needs to
+/// open that range. With max-bundle each session takes one port per local address, so allow one per client at least.
+#define ICE_PORTS_ENV "GWD_ICE_PORTS"
+/// Set to 0 to skip ICE-TCP candidates and their listening sockets, for deployments whose clients reach the UDP ports
+#define ICE_TCP_ENV "GWD_ICE_TCP"
+
+/*!
+ * Apply ICE_PORTS_ENV and ICE_TCP_ENV to the ICE agent of a new session's @p webrtcbin, before it starts gathering.
+ *
+ * Every webrtcbin keeps an ICE agent of its own: a single agent cannot be shared, as it reports candidates to one
+ * webrtcbin only, and libnice cannot demultiplex sessions on one UDP port. This only bounds which ports and transports
+ * each agent uses: sessions still share no sockets, and their cost in memory and wakeups is unchanged.
+ */
+void ice_config_apply(GstElement *webrtcbin);
+
+G_END_DECLS
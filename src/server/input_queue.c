@@ -0,0 +1,97 @@
+#include "input_queue.h"
+
+G_STATIC_ASSERT((INPUT_QUEUE_CAPACITY & (INPUT_QUEUE_CAPACITY - 1)) == 0);
+
+/// Keeps the producer and consumer positions on separate cache lines
+#define INPUT_QUEUE_CACHE_LINE 64
+
+struct input_queue_cell {
+    /// Position this cell is ready for: equal to the push position when free, one past the pop position when full
+    gint sequence;
+    struct input_queue_entry entry;
+};
+
+/*!
+ * Bounded MPMC ring after Dmitry Vyukov's: each cell carries a sequence number telling producers and consumers
+ * whether it is their turn, so claiming a position is a single compare-and-swap and no thread waits on another.
+ */
+struct input_queue {
+    gint push_pos;
+    guint8 pad0[INPUT_QUEUE_CACHE_LINE - sizeof(gint)];
+    gint pop_pos;
+    guint8 pad1[INPUT_QUEUE_CACHE_LINE - sizeof(gint)];
+    guint dropped;
+
+    struct input_queue_cell cells[INPUT_QUEUE_CAPACITY];
+};
+
+struct input_queue *input_queue_new(void) {
+    struct input_queue *queue = g_new0(struct input_queue, 1);
+
+    for (gint i = 0; i < INPUT_QUEUE_CAPACITY; i++) {
+        queue->cells[i].sequence = i;
+    }
+
+    return queue;
+}
+
+void input_queue_free(struct input_queue *queue) {
+    g_free(queue);
+}
+
+gboolean input_queue_push(struct input_queue *queue, const struct input_queue_entry *entry) {
+    gint pos = g_atomic_int_get(&queue->push_pos);
+
+    while (TRUE) {
+        struct input_queue_cell *cell = &queue->cells[pos & (INPUT_QUEUE_CAPACITY - 1)];
+        const gint sequence = g_atomic_int_get(&cell->sequence);
+        // Positions wrap around, only their difference matters
+        const gint diff = (gint)((guint)sequence - (guint)pos);
+
+        if (diff == 0) {
+            if (g_atomic_int_compare_and_exchange(&queue->push_pos, pos, (gint)((guint)pos + 1))) {
+                cell->entry = *entry;
+                // Publishes the entry to consumers
+                g_atomic_int_set(&cell->sequence, (gint)((guint)pos + 1));
+                return TRUE;
+            }
+            pos = g_atomic_int_get(&queue->push_pos);
+        } else if (diff < 0) {
+            // Still holds an entry from the previous lap
+            g_atomic_int_inc(&queue->dropped);
+            return FALSE;
+        } else {
+            // Another producer got this position first
+            pos = g_atomic_int_get(&queue->push_pos);
+        }
+    }
+}
+
+gboolean input_queue_pop(struct input_queue *queue, struct input_queue_entry *out) {
+    gint pos = g_atomic_int_get(&queue->pop_pos);
+
+    while (TRUE) {
+        struct input_queue_cell *cell = &queue->cells[pos & (INPUT_QUEUE_CAPACITY - 1)];
+        const gint sequence = g_atomic_int_get(&cell->sequence);
+        const gint diff = (gint)((guint)sequence - ((guint)pos + 1));
+
+        if (diff == 0) {
+            if (g_atomic_int_compare_and_exchange(&queue->pop_pos, pos, (gint)((guint)pos + 1))) {
+                *out = cell->entry;
+                // Hands the cell back to producers for the next lap
+                g_atomic_int_set(&cell->sequence, (gint)((guint)pos + INPUT_QUEUE_CAPACITY));
+                return TRUE;
+            }
+            pos = g_atomic_int_get(&queue->pop_pos);
+        } else if (diff < 0) {
+            // Nothing pushed here yet
+            return FALSE;
+        } else {
+            pos = g_atomic_int_get(&queue->pop_pos);
+        }
+    }
+}
+
+guint input_queue_get_dropped(struct input_queue *queue) {
+    return g_atomic_int_get(&queue->dropped);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../common/input_event.h"
+
+G_BEGIN_DECLS
+
+/// Number of events the queue holds, a power of two
+#define INPUT_QUEUE_CAPACITY 1024
+
+struct input_queue_entry {
+    /// Which session the event came from, see server_pipeline_get_input_queue()
+    guint session;
+    struct input_event event;
+    /// g_get_real_time() on arrival
+    gint64 received_us;
+};
+
+/*!
+ * Bounded lock-free queue of received input events.
+ *
+ * Any number of threads may push (each session's SCTP thread) and pop at the same time, without ever blocking each
+ * other. Pushing fails rather than overwriting when the consumers fall behind.
+ */
+struct input_queue;
+
+struct input_queue *input_queue_new(void);
+
+/*!
+ * Only call once nothing pushes or pops anymore.
+ */
+void input_queue_free(struct input_queue *queue);
+
+/*!
+ * @return FALSE if the queue is full, the event is dropped and counted.
+ */
+gboolean input_queue_push(struct input_queue *queue, const struct input_queue_entry *entry);
+
+/*!
+ * @return FALSE if the queue is empty.
+ */
+gboolean input_queue_pop(struct input_queue *queue, struct input_queue_entry *out);
+
+/*!
+ * Events dropped because the queue was full.
+ */
+guint input_queue_get_dropped(struct input_queue *queue);
+
+G_END_DECLS
@@ -0,0 +1,127 @@
+#include "overload_control.h"
+
+#include "../utils/logger.h"
+
+/// Back off once the queue is below this share of its budget and encoding takes less than this share of a frame
+#define OVERLOAD_CONTROL_RECOVER_RATIO 0.25
+#define OVERLOAD_CONTROL_ENCODE_RECOVER_RATIO 0.7
+
+struct overload_control {
+    GstElement *queue;
+    GstPad *src_pad;
+    gulong probe_id;
+    gulong overrun_id;
+    struct encoder_timing *timing;
+    guint64 budget_ns;
+
+    /// Streaming thread only
+    GstClockTime last_pts;
+    GstClockTime frame_ns;
+    gint64 changed_us;
+    guint since_kept;
+
+    /// Read from any thread
+    gint skip;
+    guint skipped;
+    guint overruns;
+};
+
+static void overload_control_set_skip(struct overload_control *control, const gint skip, const gint64 now_us) {
+    ALOGI("%s: dropping %d of every %d frames", GST_ELEMENT_NAME(control->queue), skip, skip + 1);
+    g_atomic_int_set(&control->skip, skip);
+    control->changed_us = now_us;
+}
+
+/// From the queue's streaming thread, once per frame
+static GstPadProbeReturn overload_control_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    struct overload_control *control = user_data;
+    const GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    // The frame interval, from the durations or the timestamps
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (GST_BUFFER_DURATION_IS_VALID(buffer)) {
+        control->frame_ns = GST_BUFFER_DURATION(buffer);
+    } else if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(control->last_pts) && pts > control->last_pts) {
+        control->frame_ns = pts - control->last_pts;
+    }
+    control->last_pts = pts;
+
+    const gint64 now_us = g_get_monotonic_time();
+    gint skip = g_atomic_int_get(&control->skip);
+
+    if (control->frame_ns > 0 && now_us - control->changed_us >= OVERLOAD_CONTROL_HOLD_MS * 1000) {
+        guint64 level_ns = 0;
+        g_object_get(control->queue, "current-level-time", &level_ns, NULL);
+
+        gdouble encode_ms = 0;
+        guint64 frames = 0;
+        encoder_timing_get(control->timing, &encode_ms, &frames);
+        const gdouble frame_ms = (gdouble)control->frame_ns / GST_MSECOND;
+
+        // The encoder gets one frame every skip + 1 intervals, and would get one every skip after backing off
+        const gboolean overloaded =
+            level_ns > control->budget_ns / 2 || (frames > 0 && encode_ms > frame_ms * (skip + 1));
+        const gboolean relaxed = level_ns < control->budget_ns * OVERLOAD_CONTROL_RECOVER_RATIO &&
+                                 encode_ms < frame_ms * MAX(skip, 1) * OVERLOAD_CONTROL_ENCODE_RECOVER_RATIO;
+
+        if (overloaded && skip < OVERLOAD_CONTROL_MAX_SKIP) {
+            overload_control_set_skip(control, ++skip, now_us);
+        } else if (relaxed && skip > 0) {
+            overload_control_set_skip(control, --skip, now_us);
+        }
+    }
+
+    // Keep one frame, drop the next skip ones
+    if (skip > 0 && control->since_kept < (guint)skip) {
+        control->since_kept++;
+        g_atomic_int_inc(&control->skipped);
+        return GST_PAD_PROBE_DROP;
+    }
+    control->since_kept = 0;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void overload_control_overrun_cb(GstElement *queue, struct overload_control *control) {
+    g_atomic_int_inc(&control->overruns);
+}
+
+struct overload_control *overload_control_new(GstElement *queue,
+                                              struct encoder_timing *timing,
+                                              const guint64 budget_ns) {
+    g_assert_nonnull(timing);
+
+    struct overload_control *control = g_new0(struct overload_control, 1);
+    control->queue = gst_object_ref(queue);
+    control->src_pad = gst_element_get_static_pad(queue, "src");
+    control->timing = timing;
+    control->budget_ns = budget_ns;
+    control->last_pts = GST_CLOCK_TIME_NONE;
+
+    control->probe_id =
+        gst_pad_add_probe(control->src_pad, GST_PAD_PROBE_TYPE_BUFFER, overload_control_probe, control, NULL);
+    control->overrun_id = g_signal_connect(queue, "overrun", G_CALLBACK(overload_control_overrun_cb), control);
+
+    return control;
+}
+
+void overload_control_free(struct overload_control *control) {
+    if (control == NULL) {
+        return;
+    }
+
+    gst_pad_remove_probe(control->src_pad, control->probe_id);
+    g_signal_handler_disconnect(control->queue, control->overrun_id);
+    gst_object_unref(control->src_pad);
+    gst_object_unref(control->queue);
+    g_free(control);
+}
+
+void overload_control_get_dropped(struct overload_control *control, guint *out_skipped, guint *out_overruns) {
+    *out_skipped = g_atomic_int_get(&control->skipped);
+    *out_overruns = g_atomic_int_get(&control->overruns);
+}
+
+guint overload_control_get_skip(struct overload_control *control) {
+    return g_atomic_int_get(&control->skip);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include "server_metrics.h"
+
+G_BEGIN_DECLS
+
+/// Most frames dropped in a row, i.e. the encoder gets at least one frame in OVERLOAD_CONTROL_MAX_SKIP + 1
+#define OVERLOAD_CONTROL_MAX_SKIP 3
+/// Minimum time between two changes of the drop rate, so each one can show its effect first
+#define OVERLOAD_CONTROL_HOLD_MS 500
+
+/*!
+ * Protects an encoder's latency by dropping raw frames in front of it while it cannot keep up.
+ *
+ * Watches the queue feeding the encoder and the encoder's own processing time. The encoder is overloaded when the
+ * queue holds more than half its budget, or when a frame takes longer to encode than the time between two frames.
+ * Under overload, more and more frames are dropped at the queue output (1 in 2, then 2 in 3, ...), and fewer again
+ * once the queue is nearly empty and encoding fits comfortably in the frame interval.
+ *
+ * The queue's overruns, i.e. frames it leaked for being full, are counted too.
+ */
+struct overload_control;
+
+/*!
+ * Start watching. @p queue must be the last queue before the encoder, and @p timing measure that encoder.
+ *
+ * @param budget_ns The most the queue should hold, its max-size-time
+ */
+struct overload_control *overload_control_new(GstElement *queue, struct encoder_timing *timing, guint64 budget_ns);
+
+/*!
+ * Only call this once the queue has stopped, and before freeing the encoder timing.
+ */
+void overload_control_free(struct overload_control *control);
+
+/*!
+ * Frames dropped so far by the controller, and by the queue for being full. May be called from any thread.
+ */
+void overload_control_get_dropped(struct overload_control *control, guint *out_skipped, guint *out_overruns);
+
+/*!
+ * Frames currently dropped in a row between two encoded ones, 0 when not overloaded. May be called from any thread.
+ */
+guint overload_control_get_skip(struct overload_control *control);
+
+G_END_DECLS
@@ -0,0 +1,96 @@
+#include "passthrough.h"
+
+#include "../utils/logger.h"
+
+/// H.264 profiles every client decoder handles, with frames in decoding order
+static const gchar *const passthrough_profiles[] = {"constrained-baseline", "baseline"};
+
+/// The caps h264parse settled on, once the probe pipeline prerolled
+static GstCaps *passthrough_probe_caps(const gchar *location) {
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(
+        "filesrc name=src ! qtdemux name=demux demux.video_0 ! h264parse ! fakesink name=sink", &error);
+    if (pipeline == NULL) {
+        ALOGW("Cannot probe %s: %s", location, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+    g_clear_error(&error);
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_object_set(src, "location", location, NULL);
+    gst_object_unref(src);
+
+    GstCaps *caps = NULL;
+
+    // Fails, rather than hangs, when the video is not H.264 or there is no video at all: the demuxer's pad is then
+    // not linked
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    if (gst_element_get_state(pipeline, NULL, NULL, PASSTHROUGH_PROBE_TIMEOUT_S * GST_SECOND) ==
+        GST_STATE_CHANGE_SUCCESS) {
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+        GstPad *pad = gst_element_get_static_pad(sink, "sink");
+        caps = gst_pad_get_current_caps(pad);
+        gst_object_unref(pad);
+        gst_object_unref(sink);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    return caps;
+}
+
+gboolean passthrough_probe(const gchar *location, gchar **out_profile) {
+    if (out_profile) {
+        *out_profile = NULL;
+    }
+
+    if (g_strcmp0(g_getenv(PASSTHROUGH_ENV), "0") == 0) {
+        ALOGI("Passthrough disabled by %s", PASSTHROUGH_ENV);
+        return FALSE;
+    }
+
+    GstCaps *caps = passthrough_probe_caps(location);
+    if (caps == NULL) {
+        ALOGI("%s: no H.264 video, decoding it", location);
+        return FALSE;
+    }
+
+    const GstStructure *s = gst_caps_get_structure(caps, 0);
+    const gchar *profile = gst_structure_get_string(s, "profile");
+
+    gboolean compatible = FALSE;
+    for (guint i = 0; profile != NULL && i < G_N_ELEMENTS(passthrough_profiles); i++) {
+        compatible |= g_str_equal(profile, passthrough_profiles[i]);
+    }
+
+    ALOGI("%s: H.264 %s, %s",
+          location,
+          profile ? profile : "(unknown profile)",
+          compatible ? "streaming it as is" : "decoding it");
+
+    if (out_profile) {
+        *out_profile = g_strdup(profile);
+    }
+    gst_caps_unref(caps);
+
+    return compatible;
+}
+
+gboolean passthrough_seek_start(GstElement *demuxer, const gboolean flush) {
+    // The segment ends at the end of the file, with SEGMENT_DONE instead of EOS
+    GstSeekFlags flags = GST_SEEK_FLAG_SEGMENT | GST_SEEK_FLAG_KEY_UNIT;
+    if (flush) {
+        flags |= GST_SEEK_FLAG_FLUSH;
+    }
+
+    return gst_element_seek(demuxer,
+                            1.0,
+                            GST_FORMAT_TIME,
+                            flags,
+                            GST_SEEK_TYPE_SET,
+                            0,
+                            GST_SEEK_TYPE_NONE,
+                            GST_CLOCK_TIME_NONE);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/// Set to 0 to always decode and re-encode, e.g. to compare the CPU cost of both modes
+#define PASSTHROUGH_ENV "GWD_PASSTHROUGH"
+/// Give up on probing a file whose headers take longer than this to read
+#define PASSTHROUGH_PROBE_TIMEOUT_S 5
+
+/*!
+ * Streaming the H.264 video of a file as is, without decoding and re-encoding it.
+ *
+ * Only constrained-baseline and baseline streams qualify: they have no B-frames, so every client decodes them and
+ * frames go out in the order they are decoded. The demuxer plays the file as a segment, which ends with SEGMENT_DONE
+ * rather than EOS, and the next segment continues from the start of the file with running times that keep increasing,
+ * so playback loops without any gap or timestamp jump. The file's first frame is a key frame, clients pick up there.
+ */
+
+/*!
+ * Whether the video of the MP4 file at @p location can be streamed as is, and passthrough is not disabled with
+ * PASSTHROUGH_ENV. Blocks while the file's headers are read.
+ *
+ * @param out_profile Set to the H.264 profile found, NULL if the video is not H.264. May be NULL.
+ */
+gboolean passthrough_probe(const gchar *location, gchar **out_profile);
+
+/*!
+ * Play @p demuxer's file from the start, as a segment.
+ *
+ * @param flush TRUE to drop whatever is flowing, for the first seek. FALSE from SEGMENT_DONE, to loop seamlessly.
+ */
+gboolean passthrough_seek_start(GstElement *demuxer, gboolean flush);
+
+G_END_DECLS
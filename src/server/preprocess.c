@@ -0,0 +1,611 @@
+#include "preprocess.h"
+
+#include <gst/video/gstvideofilter.h>
+#include <gst/video/video.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../utils/logger.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define PREPROCESS_SSE2
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+    #define PREPROCESS_NEON
+    #include <arm_neon.h>
+#endif
+
+#define PREPROCESS_CAPS GST_VIDEO_CAPS_MAKE("{ I420, NV12 }")
+
+/// Limited range black, white and neutral chroma, for the overlay
+#define PREPROCESS_BLACK 16
+#define PREPROCESS_WHITE 235
+#define PREPROCESS_GREY 128
+
+/// Glyphs of 5x7 pixels, one byte per row, the leftmost pixel in bit 4
+#define PREPROCESS_GLYPH_WIDTH 5
+#define PREPROCESS_GLYPH_HEIGHT 7
+/// Timestamps are at most this long, frame counters shorter
+#define PREPROCESS_TEXT_MAX 24
+
+static const guint8 preprocess_font[][PREPROCESS_GLYPH_HEIGHT] = {
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+    {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+    {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+    {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+    {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+    {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+    {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, // :
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, // .
+};
+#define PREPROCESS_GLYPH_COLON 10
+#define PREPROCESS_GLYPH_DOT 11
+#define PREPROCESS_N_GLYPHS G_N_ELEMENTS(preprocess_font)
+
+enum {
+    PROP_0,
+    PROP_DOWNSCALE,
+    PROP_OVERLAY,
+};
+
+typedef struct {
+    GstVideoFilter parent;
+
+    /// Properties, under the object lock
+    guint downscale;
+    enum preprocess_overlay overlay;
+
+    /// Streaming thread only, set with the caps
+    guint scale;
+    /// Rows of intermediate results, see preprocess_chroma_row()
+    guint8 *rows;
+    /// Each glyph's pixels at the overlay's size, including the space after it
+    guint8 *glyphs;
+    guint glyph_width;
+    guint glyph_height;
+    /// Background around the text, in pixels, so that the box's corner and size stay even
+    guint margin;
+    guint64 frames;
+} GwdPreprocess;
+
+typedef struct {
+    GstVideoFilterClass parent_class;
+} GwdPreprocessClass;
+
+#define GWD_TYPE_PREPROCESS (gwd_preprocess_get_type())
+#define GWD_PREPROCESS(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GWD_TYPE_PREPROCESS, GwdPreprocess))
+
+G_DEFINE_TYPE(GwdPreprocess, gwd_preprocess, GST_TYPE_VIDEO_FILTER)
+
+static GType gwd_preprocess_overlay_get_type(void) {
+    static gsize type = 0;
+
+    if (g_once_init_enter(&type)) {
+        static const GEnumValue values[] = {
+            {PREPROCESS_OVERLAY_NONE, "No overlay", "none"},
+            {PREPROCESS_OVERLAY_TIME, "Buffer timestamp", "time"},
+            {PREPROCESS_OVERLAY_FRAME_COUNT, "Frame counter", "frame-count"},
+            {0, NULL, NULL},
+        };
+        g_once_init_leave(&type, g_enum_register_static("GwdPreprocessOverlay", values));
+    }
+
+    return type;
+}
+
+/// dst[i] = average of a[i] and b[i], rounding up
+static void preprocess_average_rows(guint8 *dst, const guint8 *a, const guint8 *b, const gsize n) {
+    gsize i = 0;
+#ifdef PREPROCESS_SSE2
+    for (; i + 16 <= n; i += 16) {
+        const __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_avg_epu8(va, vb));
+    }
+#elif defined(PREPROCESS_NEON)
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(dst + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (a[i] + b[i] + 1) >> 1;
+    }
+}
+
+/// dst[i] = average of src[2i] and src[2i + 1], rounding up
+static void preprocess_halve_row(guint8 *dst, const guint8 *src, const gsize n) {
+    gsize i = 0;
+#ifdef PREPROCESS_SSE2
+    const __m128i low = _mm_set1_epi16(0xff);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+        const __m128i avg0 = _mm_avg_epu16(_mm_and_si128(v0, low), _mm_srli_epi16(v0, 8));
+        const __m128i avg1 = _mm_avg_epu16(_mm_and_si128(v1, low), _mm_srli_epi16(v1, 8));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(avg0, avg1));
+    }
+#elif defined(PREPROCESS_NEON)
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16x2_t v = vld2q_u8(src + 2 * i);
+        vst1q_u8(dst + i, vrhaddq_u8(v.val[0], v.val[1]));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (src[2 * i] + src[2 * i + 1] + 1) >> 1;
+    }
+}
+
+/// NV12 chroma to I420: u[i] = src[2i], v[i] = src[2i + 1]
+static void preprocess_deinterleave(guint8 *u, guint8 *v, const guint8 *src, const gsize n) {
+    gsize i = 0;
+#ifdef PREPROCESS_SSE2
+    const __m128i low = _mm_set1_epi16(0xff);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v0 = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        const __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+        _mm_storeu_si128((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(v0, low), _mm_and_si128(v1, low)));
+        _mm_storeu_si128((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(v0, 8), _mm_srli_epi16(v1, 8)));
+    }
+#elif defined(PREPROCESS_NEON)
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16x2_t uv = vld2q_u8(src + 2 * i);
+        vst1q_u8(u + i, uv.val[0]);
+        vst1q_u8(v + i, uv.val[1]);
+    }
+#endif
+    for (; i < n; i++) {
+        u[i] = src[2 * i];
+        v[i] = src[2 * i + 1];
+    }
+}
+
+/// I420 chroma to NV12: dst[2i] = u[i], dst[2i + 1] = v[i]
+static void preprocess_interleave(guint8 *dst, const guint8 *u, const guint8 *v, const gsize n) {
+    gsize i = 0;
+#ifdef PREPROCESS_SSE2
+    for (; i + 16 <= n; i += 16) {
+        const __m128i vu = _mm_loadu_si128((const __m128i *)(u + i));
+        const __m128i vv = _mm_loadu_si128((const __m128i *)(v + i));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(vu, vv));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(vu, vv));
+    }
+#elif defined(PREPROCESS_NEON)
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16x2_t uv = {{vld1q_u8(u + i), vld1q_u8(v + i)}};
+        vst2q_u8(dst + 2 * i, uv);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[2 * i] = u[i];
+        dst[2 * i + 1] = v[i];
+    }
+}
+
+static guint8 *preprocess_row(const GstVideoFrame *frame, const guint plane, const guint row) {
+    return (guint8 *)GST_VIDEO_FRAME_PLANE_DATA(frame, plane) + (gsize)row * GST_VIDEO_FRAME_PLANE_STRIDE(frame, plane);
+}
+
+static void preprocess_luma_row(GwdPreprocess *self, const GstVideoFrame *in, GstVideoFrame *out, const guint y) {
+    const guint8 *src = preprocess_row(in, 0, y * self->scale);
+    guint8 *dst = preprocess_row(out, 0, y);
+    const guint width = GST_VIDEO_FRAME_COMP_WIDTH(out, 0);
+
+    if (self->scale == 1) {
+        memcpy(dst, src, width);
+        return;
+    }
+    preprocess_average_rows(self->rows, src, src + GST_VIDEO_FRAME_PLANE_STRIDE(in, 0), 2 * width);
+    preprocess_halve_row(dst, self->rows, width);
+}
+
+/*!
+ * Chroma goes through I420 rows whatever the formats: both input rows averaged if scaling, split into U and V if NV12,
+ * then each halved if scaling, and interleaved into the output if NV12. The few intermediate rows stay in cache.
+ */
+static void preprocess_chroma_row(GwdPreprocess *self, const GstVideoFrame *in, GstVideoFrame *out, const guint y) {
+    const gboolean in_nv12 = GST_VIDEO_FRAME_FORMAT(in) == GST_VIDEO_FORMAT_NV12;
+    const gboolean out_nv12 = GST_VIDEO_FRAME_FORMAT(out) == GST_VIDEO_FORMAT_NV12;
+    const guint width = GST_VIDEO_FRAME_COMP_WIDTH(out, 1);
+    const guint in_width = width * self->scale;
+    const guint in_y = y * self->scale;
+
+    if (self->scale == 1 && in_nv12 == out_nv12) {
+        for (guint plane = 1; plane < GST_VIDEO_FRAME_N_PLANES(out); plane++) {
+            memcpy(preprocess_row(out, plane, y), preprocess_row(in, plane, in_y), out_nv12 ? 2 * width : width);
+        }
+        return;
+    }
+
+    // Six rows of in_width, see gwd_preprocess_set_info()
+    guint8 *uv = self->rows;
+    guint8 *u = uv + 2 * in_width;
+    guint8 *v = u + in_width;
+    guint8 *half_u = v + in_width;
+    guint8 *half_v = half_u + in_width;
+
+    const guint8 *src_u;
+    const guint8 *src_v;
+    if (in_nv12) {
+        const guint8 *src = preprocess_row(in, 1, in_y);
+        if (self->scale == 2) {
+            preprocess_average_rows(uv, src, src + GST_VIDEO_FRAME_PLANE_STRIDE(in, 1), 2 * in_width);
+            src = uv;
+        }
+        preprocess_deinterleave(u, v, src, in_width);
+        src_u = u;
+        src_v = v;
+    } else {
+        src_u = preprocess_row(in, 1, in_y);
+        src_v = preprocess_row(in, 2, in_y);
+        if (self->scale == 2) {
+            preprocess_average_rows(u, src_u, src_u + GST_VIDEO_FRAME_PLANE_STRIDE(in, 1), in_width);
+            preprocess_average_rows(v, src_v, src_v + GST_VIDEO_FRAME_PLANE_STRIDE(in, 2), in_width);
+            src_u = u;
+            src_v = v;
+        }
+    }
+
+    if (out_nv12) {
+        if (self->scale == 2) {
+            preprocess_halve_row(half_u, src_u, width);
+            preprocess_halve_row(half_v, src_v, width);
+            src_u = half_u;
+            src_v = half_v;
+        }
+        preprocess_interleave(preprocess_row(out, 1, y), src_u, src_v, width);
+    } else if (self->scale == 2) {
+        preprocess_halve_row(preprocess_row(out, 1, y), src_u, width);
+        preprocess_halve_row(preprocess_row(out, 2, y), src_v, width);
+    } else {
+        memcpy(preprocess_row(out, 1, y), src_u, width);
+        memcpy(preprocess_row(out, 2, y), src_v, width);
+    }
+}
+
+/// The glyphs of the overlay's text for this frame, returns how many
+static guint preprocess_format_text(GwdPreprocess *self, const GstBuffer *buffer, guint8 glyphs[PREPROCESS_TEXT_MAX]) {
+    GST_OBJECT_LOCK(self);
+    const enum preprocess_overlay overlay = self->overlay;
+    GST_OBJECT_UNLOCK(self);
+
+    gchar text[PREPROCESS_TEXT_MAX + 1] = "";
+    if (overlay == PREPROCESS_OVERLAY_TIME && GST_BUFFER_PTS_IS_VALID(buffer)) {
+        const GstClockTime pts = GST_BUFFER_PTS(buffer);
+        snprintf(text,
+                 sizeof(text),
+                 "%u:%02u:%02u.%03u",
+                 (guint)(pts / (GST_SECOND * 60 * 60)),
+                 (guint)(pts / (GST_SECOND * 60) % 60),
+                 (guint)(pts / GST_SECOND % 60),
+                 (guint)(pts / GST_MSECOND % 1000));
+    } else if (overlay == PREPROCESS_OVERLAY_FRAME_COUNT) {
+        snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT, self->frames);
+    }
+
+    guint n = 0;
+    for (const gchar *c = text; *c; c++) {
+        glyphs[n++] = g_ascii_isdigit(*c) ? *c - '0' : *c == ':' ? PREPROCESS_GLYPH_COLON : PREPROCESS_GLYPH_DOT;
+    }
+
+    return n;
+}
+
+/// Draw the text over the converted frame, only touching the rows and columns of its box
+static void preprocess_draw_text(GwdPreprocess *self, GstVideoFrame *out, const guint8 *text, const guint n) {
+    const guint x0 = self->margin;
+    const guint y0 = self->margin;
+    const guint width = n * self->glyph_width + 2 * self->margin;
+    const guint height = self->glyph_height + 2 * self->margin;
+
+    if (n == 0 || x0 + width > GST_VIDEO_FRAME_WIDTH(out) || y0 + height > GST_VIDEO_FRAME_HEIGHT(out)) {
+        return;
+    }
+
+    for (guint y = 0; y < height; y++) {
+        guint8 *row = preprocess_row(out, 0, y0 + y) + x0;
+        memset(row, PREPROCESS_BLACK, width);
+        if (y < self->margin || y >= self->margin + self->glyph_height) {
+            continue;
+        }
+        const gsize glyph_row = (gsize)(y - self->margin) * self->glyph_width;
+        const gsize glyph_size = (gsize)self->glyph_height * self->glyph_width;
+        for (guint i = 0; i < n; i++) {
+            memcpy(row + self->margin + i * self->glyph_width,
+                   self->glyphs + text[i] * glyph_size + glyph_row,
+                   self->glyph_width);
+        }
+    }
+
+    // The box's corner and size are even, so it covers whole chroma samples
+    const gboolean nv12 = GST_VIDEO_FRAME_FORMAT(out) == GST_VIDEO_FORMAT_NV12;
+    for (guint y = y0 / 2; y < (y0 + height) / 2; y++) {
+        if (nv12) {
+            memset(preprocess_row(out, 1, y) + x0, PREPROCESS_GREY, width);
+        } else {
+            memset(preprocess_row(out, 1, y) + x0 / 2, PREPROCESS_GREY, width / 2);
+            memset(preprocess_row(out, 2, y) + x0 / 2, PREPROCESS_GREY, width / 2);
+        }
+    }
+}
+
+static GstFlowReturn gwd_preprocess_transform_frame(GstVideoFilter *filter, GstVideoFrame *in, GstVideoFrame *out) {
+    GwdPreprocess *self = GWD_PREPROCESS(filter);
+
+    guint8 text[PREPROCESS_TEXT_MAX];
+    const guint n = preprocess_format_text(self, in->buffer, text);
+    self->frames++;
+
+    // Luma and chroma rows go together, so that a chroma row's two input rows were just read for luma
+    const guint chroma_height = GST_VIDEO_FRAME_COMP_HEIGHT(out, 1);
+    for (guint y = 0; y < chroma_height; y++) {
+        preprocess_luma_row(self, in, out, 2 * y);
+        if (2 * y + 1 < GST_VIDEO_FRAME_HEIGHT(out)) {
+            preprocess_luma_row(self, in, out, 2 * y + 1);
+        }
+        preprocess_chroma_row(self, in, out, y);
+    }
+
+    preprocess_draw_text(self, out, text, n);
+
+    return GST_FLOW_OK;
+}
+
+/// Render each glyph at an integer scale fitting the frame, with a one pixel gap on its right
+static void preprocess_rasterize_font(GwdPreprocess *self, const guint frame_height) {
+    const guint scale = MAX(1, frame_height / 240);
+    self->glyph_width = (PREPROCESS_GLYPH_WIDTH + 1) * scale;
+    self->glyph_height = PREPROCESS_GLYPH_HEIGHT * scale;
+    self->margin = 2 * scale;
+
+    const gsize glyph_size = (gsize)self->glyph_width * self->glyph_height;
+    g_free(self->glyphs);
+    self->glyphs = g_malloc(PREPROCESS_N_GLYPHS * glyph_size);
+
+    for (guint g = 0; g < PREPROCESS_N_GLYPHS; g++) {
+        for (guint y = 0; y < self->glyph_height; y++) {
+            guint8 *row = self->glyphs + g * glyph_size + y * self->glyph_width;
+            for (guint x = 0; x < self->glyph_width; x++) {
+                const guint bit = x / scale;
+                const gboolean on = bit < PREPROCESS_GLYPH_WIDTH &&
+                                    preprocess_font[g][y / scale] & (1 << (PREPROCESS_GLYPH_WIDTH - 1 - bit));
+                row[x] = on ? PREPROCESS_WHITE : PREPROCESS_BLACK;
+            }
+        }
+    }
+}
+
+static gboolean gwd_preprocess_set_info(GstVideoFilter *filter,
+                                        GstCaps *incaps,
+                                        GstVideoInfo *in_info,
+                                        GstCaps *outcaps,
+                                        GstVideoInfo *out_info) {
+    GwdPreprocess *self = GWD_PREPROCESS(filter);
+
+    GST_OBJECT_LOCK(self);
+    self->scale = self->downscale;
+    const enum preprocess_overlay overlay = self->overlay;
+    GST_OBJECT_UNLOCK(self);
+
+    // Rows are read from the input as many times over as the output is scaled down, they must be there
+    if (GST_VIDEO_INFO_WIDTH(in_info) < GST_VIDEO_INFO_WIDTH(out_info) * self->scale ||
+        GST_VIDEO_INFO_HEIGHT(in_info) < GST_VIDEO_INFO_HEIGHT(out_info) * self->scale ||
+        (self->scale == 2 && (GST_VIDEO_INFO_WIDTH(out_info) % 2 || GST_VIDEO_INFO_HEIGHT(out_info) % 2))) {
+        ALOGE("Cannot preprocess %dx%d into %dx%d",
+              GST_VIDEO_INFO_WIDTH(in_info),
+              GST_VIDEO_INFO_HEIGHT(in_info),
+              GST_VIDEO_INFO_WIDTH(out_info),
+              GST_VIDEO_INFO_HEIGHT(out_info));
+        return FALSE;
+    }
+
+    // Two rows of interleaved chroma, then U, V, and both halved, of the input's chroma width at most
+    g_free(self->rows);
+    self->rows = g_malloc(6 * (gsize)GST_VIDEO_INFO_WIDTH(in_info));
+
+    preprocess_rasterize_font(self, GST_VIDEO_INFO_HEIGHT(out_info));
+    self->frames = 0;
+
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(filter),
+                                       self->scale == 1 && overlay == PREPROCESS_OVERLAY_NONE &&
+                                           GST_VIDEO_INFO_FORMAT(in_info) == GST_VIDEO_INFO_FORMAT(out_info));
+
+    ALOGI("Preprocessing %s %dx%d into %s %dx%d",
+          GST_VIDEO_INFO_NAME(in_info),
+          GST_VIDEO_INFO_WIDTH(in_info),
+          GST_VIDEO_INFO_HEIGHT(in_info),
+          GST_VIDEO_INFO_NAME(out_info),
+          GST_VIDEO_INFO_WIDTH(out_info),
+          GST_VIDEO_INFO_HEIGHT(out_info));
+
+    return TRUE;
+}
+
+/// Map a width or height across the element, halved downstream when scaling, or the sizes halving to it upstream
+static void preprocess_scale_size(GstStructure *structure, const gchar *field, const GstPadDirection direction) {
+    const GValue *value = gst_structure_get_value(structure, field);
+    gint min;
+    gint max;
+    if (value == NULL) {
+        return;
+    } else if (G_VALUE_HOLDS_INT(value)) {
+        min = max = g_value_get_int(value);
+    } else if (GST_VALUE_HOLDS_INT_RANGE(value)) {
+        min = gst_value_get_int_range_min(value);
+        max = gst_value_get_int_range_max(value);
+    } else {
+        return;
+    }
+
+    if (direction == GST_PAD_SINK) {
+        // Even, so that chroma rows and columns pair up
+        min = MAX(2, min / 2 & ~1);
+        max = MAX(2, max / 2 & ~1);
+    } else {
+        min = MIN(min, G_MAXINT / 2 - 2) * 2;
+        max = MIN(max, G_MAXINT / 2 - 2) * 2 + 3;
+    }
+
+    if (min == max) {
+        gst_structure_set(structure, field, G_TYPE_INT, min, NULL);
+    } else {
+        gst_structure_set(structure, field, GST_TYPE_INT_RANGE, min, max, NULL);
+    }
+}
+
+static GstCaps *gwd_preprocess_transform_caps(GstBaseTransform *trans,
+                                              const GstPadDirection direction,
+                                              GstCaps *caps,
+                                              GstCaps *filter) {
+    GwdPreprocess *self = GWD_PREPROCESS(trans);
+
+    GST_OBJECT_LOCK(self);
+    const guint downscale = self->downscale;
+    GST_OBJECT_UNLOCK(self);
+
+    GstCaps *ret = gst_caps_new_empty();
+    for (guint i = 0; i < gst_caps_get_size(caps); i++) {
+        GstStructure *structure = gst_structure_copy(gst_caps_get_structure(caps, i));
+        const GstCapsFeatures *features = gst_caps_get_features(caps, i);
+
+        // The same format first, so that nothing is converted unless the other side asks for it
+        const gchar *format = gst_structure_get_string(structure, "format");
+        const gboolean nv12_first = g_strcmp0(format, "NV12") == 0;
+        GValue formats = G_VALUE_INIT;
+        GValue item = G_VALUE_INIT;
+        gst_value_list_init(&formats, 2);
+        g_value_init(&item, G_TYPE_STRING);
+        g_value_set_static_string(&item, nv12_first ? "NV12" : "I420");
+        gst_value_list_append_value(&formats, &item);
+        g_value_set_static_string(&item, nv12_first ? "I420" : "NV12");
+        gst_value_list_append_value(&formats, &item);
+        g_value_unset(&item);
+        gst_structure_take_value(structure, "format", &formats);
+
+        if (downscale == 2) {
+            preprocess_scale_size(structure, "width", direction);
+            preprocess_scale_size(structure, "height", direction);
+        }
+
+        ret = gst_caps_merge_structure_full(ret, structure, features ? gst_caps_features_copy(features) : NULL);
+    }
+
+    if (filter) {
+        GstCaps *intersection = gst_caps_intersect_full(filter, ret, GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref(ret);
+        ret = intersection;
+    }
+
+    return ret;
+}
+
+static void gwd_preprocess_set_property(GObject *object, const guint prop_id, const GValue *value, GParamSpec *pspec) {
+    GwdPreprocess *self = GWD_PREPROCESS(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_DOWNSCALE:
+            self->downscale = g_value_get_uint(value);
+            break;
+        case PROP_OVERLAY:
+            self->overlay = g_value_get_enum(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+    GST_OBJECT_UNLOCK(self);
+
+    // Sizes, formats and passthrough may all change
+    gst_base_transform_reconfigure_src(GST_BASE_TRANSFORM(self));
+}
+
+static void gwd_preprocess_get_property(GObject *object, const guint prop_id, GValue *value, GParamSpec *pspec) {
+    GwdPreprocess *self = GWD_PREPROCESS(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_DOWNSCALE:
+            g_value_set_uint(value, self->downscale);
+            break;
+        case PROP_OVERLAY:
+            g_value_set_enum(value, self->overlay);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void gwd_preprocess_finalize(GObject *object) {
+    GwdPreprocess *self = GWD_PREPROCESS(object);
+
+    g_free(self->rows);
+    g_free(self->glyphs);
+
+    G_OBJECT_CLASS(gwd_preprocess_parent_class)->finalize(object);
+}
+
+static void gwd_preprocess_class_init(GwdPreprocessClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass *transform_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+    object_class->set_property = gwd_preprocess_set_property;
+    object_class->get_property = gwd_preprocess_get_property;
+    object_class->finalize = gwd_preprocess_finalize;
+
+    g_object_class_install_property(object_class,
+                                    PROP_DOWNSCALE,
+                                    g_param_spec_uint("downscale",
+                                                      "Downscale",
+                                                      "Divide the width and height by this",
+                                                      1,
+                                                      2,
+                                                      1,
+                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(object_class,
+                                    PROP_OVERLAY,
+                                    g_param_spec_enum("overlay",
+                                                      "Overlay",
+                                                      "What to draw in the top left corner",
+                                                      gwd_preprocess_overlay_get_type(),
+                                                      PREPROCESS_OVERLAY_TIME,
+                                                      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_set_static_metadata(element_class,
+                                          "Raw video preprocessing",
+                                          "Filter/Converter/Video",
+                                          "Converts, scales down and stamps raw video in one pass",
+                                          "gst-webrtc-demo");
+    gst_element_class_add_pad_template(
+        element_class,
+        gst_pad_template_new("sink", GST_PAD_SINK, GST_PAD_ALWAYS, gst_caps_from_string(PREPROCESS_CAPS)));
+    gst_element_class_add_pad_template(
+        element_class,
+        gst_pad_template_new("src", GST_PAD_SRC, GST_PAD_ALWAYS, gst_caps_from_string(PREPROCESS_CAPS)));
+
+    transform_class->transform_caps = gwd_preprocess_transform_caps;
+
+    filter_class->set_info = gwd_preprocess_set_info;
+    filter_class->transform_frame = gwd_preprocess_transform_frame;
+}
+
+static void gwd_preprocess_init(GwdPreprocess *self) {
+    self->downscale = 1;
+    self->overlay = PREPROCESS_OVERLAY_TIME;
+}
+
+gboolean preprocess_register(void) {
+#ifdef PREPROCESS_SSE2
+    ALOGI("Preprocessing with SSE2");
+#elif defined(PREPROCESS_NEON)
+    ALOGI("Preprocessing with NEON");
+#endif
+    return gst_element_register(NULL, PREPROCESS_ELEMENT_NAME, GST_RANK_NONE, GWD_TYPE_PREPROCESS);
+}
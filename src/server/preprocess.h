@@ -0,0 +1,33 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/// Registered with preprocess_register()
+#define PREPROCESS_ELEMENT_NAME "gwdpreprocess"
+/// Set to 2 to halve the raw video's resolution before encoding, e.g. for 4K sources
+#define PREPROCESS_DOWNSCALE_ENV "GWD_DOWNSCALE"
+
+/// What the "overlay" property of the element draws in the top left corner
+enum preprocess_overlay {
+    PREPROCESS_OVERLAY_NONE,
+    /// The buffer timestamp, like timeoverlay
+    PREPROCESS_OVERLAY_TIME,
+    /// Frames seen so far
+    PREPROCESS_OVERLAY_FRAME_COUNT,
+};
+
+/*!
+ * Register PREPROCESS_ELEMENT_NAME, a video filter replacing videoconvert ! timeoverlay on the raw video path.
+ *
+ * It converts between I420 and NV12, keeping the input format unless downstream asks for the other, optionally halves
+ * the resolution ("downscale" property, 1 or 2), and stamps a timestamp or frame counter from a built-in bitmap font
+ * rasterized once per caps, all in one pass over each row while it is still in cache, with SSE2 or NEON where
+ * available. Without any of these it runs in passthrough.
+ *
+ * Other formats need a videoconvert in front, which stays in passthrough for decoders outputting I420 or NV12.
+ */
+gboolean preprocess_register(void);
+
+G_END_DECLS
@@ -0,0 +1,265 @@
+#include "server_metrics.h"
+
+#include <string.h>
+#include <time.h>
+
+#ifdef G_OS_UNIX
+    #include <unistd.h>
+#endif
+
+/// Number of frames that can be inside the encoder at once and still be matched
+#define ENCODER_TIMING_SLOTS 64
+
+/// Weight of the newest frame in the smoothed encoder time
+#define ENCODER_TIMING_SMOOTHING 0.1
+
+struct encoder_timing {
+    GstPad *sink_pad;
+    GstPad *src_pad;
+    gulong sink_probe_id;
+    gulong src_probe_id;
+
+    /// Protects everything below, taken once per frame on each side
+    GMutex mutex;
+
+    GstClockTime pts[ENCODER_TIMING_SLOTS];
+    gint64 enter_us[ENCODER_TIMING_SLOTS];
+    guint next_slot;
+
+    gdouble avg_us;
+    guint64 frames;
+
+    /// Thread that last pushed into the encoder, and its CPU time back then
+    GThread *cpu_thread;
+    gint64 cpu_last_ns;
+    gint64 cpu_total_ns;
+};
+
+/// CPU time consumed by the calling thread so far, -1 where unsupported
+static gint64 thread_cpu_time_ns(void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+    }
+#endif
+    return -1;
+}
+
+static GstPad *first_pad(GstIterator *iter) {
+    GstPad *pad = NULL;
+    GValue item = G_VALUE_INIT;
+
+    if (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        pad = g_value_dup_object(&item);
+        g_value_unset(&item);
+    }
+    gst_iterator_free(iter);
+
+    return pad;
+}
+
+static GstPadProbeReturn encoder_timing_sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    struct encoder_timing *timing = user_data;
+    const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    const gint64 cpu_ns = thread_cpu_time_ns();
+    GThread *thread = g_thread_self();
+
+    g_mutex_lock(&timing->mutex);
+    if (GST_CLOCK_TIME_IS_VALID(pts)) {
+        const guint slot = timing->next_slot++ % ENCODER_TIMING_SLOTS;
+        timing->pts[slot] = pts;
+        timing->enter_us[slot] = g_get_monotonic_time();
+    }
+    // Everything the thread did since the previous frame, which is encoding this branch
+    if (cpu_ns >= 0 && thread == timing->cpu_thread) {
+        timing->cpu_total_ns += cpu_ns - timing->cpu_last_ns;
+    }
+    timing->cpu_thread = thread;
+    timing->cpu_last_ns = cpu_ns;
+    g_mutex_unlock(&timing->mutex);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn encoder_timing_src_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    struct encoder_timing *timing = user_data;
+    const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    const gint64 now_us = g_get_monotonic_time();
+
+    g_mutex_lock(&timing->mutex);
+    // Newest first, as encoders without B-frames emit in order
+    for (guint i = 1; i <= ENCODER_TIMING_SLOTS; i++) {
+        const guint slot = (timing->next_slot - i) % ENCODER_TIMING_SLOTS;
+        if (timing->pts[slot] == pts) {
+            const gdouble elapsed_us = (gdouble)(now_us - timing->enter_us[slot]);
+            timing->avg_us = timing->frames == 0 ? elapsed_us
+                                                 : timing->avg_us + ENCODER_TIMING_SMOOTHING *
+                                                                        (elapsed_us - timing->avg_us);
+            timing->frames++;
+            timing->pts[slot] = GST_CLOCK_TIME_NONE;
+            break;
+        }
+    }
+    g_mutex_unlock(&timing->mutex);
+
+    return GST_PAD_PROBE_OK;
+}
+
+struct encoder_timing *encoder_timing_new(GstElement *encoder) {
+    GstPad *sink_pad = first_pad(gst_element_iterate_sink_pads(encoder));
+    GstPad *src_pad = first_pad(gst_element_iterate_src_pads(encoder));
+
+    if (sink_pad == NULL || src_pad == NULL) {
+        gst_clear_object(&sink_pad);
+        gst_clear_object(&src_pad);
+        return NULL;
+    }
+
+    struct encoder_timing *timing = g_new0(struct encoder_timing, 1);
+    g_mutex_init(&timing->mutex);
+    for (guint i = 0; i < ENCODER_TIMING_SLOTS; i++) {
+        timing->pts[i] = GST_CLOCK_TIME_NONE;
+    }
+
+    timing->sink_pad = sink_pad;
+    timing->src_pad = src_pad;
+    timing->sink_probe_id =
+        gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, encoder_timing_sink_probe, timing, NULL);
+    timing->src_probe_id =
+        gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, encoder_timing_src_probe, timing, NULL);
+
+    return timing;
+}
+
+void encoder_timing_free(struct encoder_timing *timing) {
+    if (timing == NULL) {
+        return;
+    }
+
+    gst_pad_remove_probe(timing->sink_pad, timing->sink_probe_id);
+    gst_pad_remove_probe(timing->src_pad, timing->src_probe_id);
+    gst_object_unref(timing->sink_pad);
+    gst_object_unref(timing->src_pad);
+    g_mutex_clear(&timing->mutex);
+    g_free(timing);
+}
+
+void encoder_timing_get(struct encoder_timing *timing, gdouble *out_avg_ms, guint64 *out_frames) {
+    g_mutex_lock(&timing->mutex);
+    *out_avg_ms = timing->avg_us / 1000.0;
+    *out_frames = timing->frames;
+    g_mutex_unlock(&timing->mutex);
+}
+
+gdouble encoder_timing_get_cpu_seconds(struct encoder_timing *timing) {
+    g_mutex_lock(&timing->mutex);
+    const gint64 cpu_ns = timing->cpu_total_ns;
+    g_mutex_unlock(&timing->mutex);
+
+    return (gdouble)cpu_ns / 1e9;
+}
+
+void metrics_append_family(GString *out, const gchar *name, const gchar *type, const gchar *help) {
+    g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_append_value(GString *out, const gchar *name, const gchar *labels, const gdouble value) {
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+    // Prometheus wants '.' as the decimal separator, whatever the locale
+    g_ascii_formatd(buf, sizeof(buf), "%.3f", value);
+
+    if (labels != NULL) {
+        g_string_append_printf(out, "%s{%s} %s\n", name, labels, buf);
+    } else {
+        g_string_append_printf(out, "%s %s\n", name, buf);
+    }
+}
+
+void metrics_append_queue_levels(GString *out, GstBin *bin) {
+    GString *buffers = g_string_new(NULL);
+    GString *time = g_string_new(NULL);
+
+    GstIterator *iter = gst_bin_iterate_recurse(bin);
+    GValue item = G_VALUE_INIT;
+
+    while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+        GstElement *element = g_value_get_object(&item);
+        GstElementFactory *factory = gst_element_get_factory(element);
+
+        if (factory != NULL && g_str_equal(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "queue")) {
+            guint level_buffers = 0;
+            guint64 level_time = 0;
+            g_object_get(element, "current-level-buffers", &level_buffers, "current-level-time", &level_time, NULL);
+
+            gchar *labels = g_strdup_printf("queue=\"%s\"", GST_ELEMENT_NAME(element));
+            metrics_append_value(buffers, "gwd_queue_level_buffers", labels, level_buffers);
+            metrics_append_value(time, "gwd_queue_level_ms", labels, (gdouble)level_time / GST_MSECOND);
+            g_free(labels);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iter);
+
+    metrics_append_family(out, "gwd_queue_level_buffers", "gauge", "Buffers currently held by a queue.");
+    g_string_append_len(out, buffers->str, (gssize)buffers->len);
+    metrics_append_family(out, "gwd_queue_level_ms", "gauge", "Duration of the data currently held by a queue.");
+    g_string_append_len(out, time->str, (gssize)time->len);
+
+    g_string_free(buffers, TRUE);
+    g_string_free(time, TRUE);
+}
+
+void metrics_append_process_cpu(GString *out) {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+        return;
+    }
+
+    metrics_append_family(out,
+                          "gwd_process_cpu_seconds_total",
+                          "counter",
+                          "CPU time used by the server, all threads included.");
+    metrics_append_value(out, "gwd_process_cpu_seconds_total", NULL, (gdouble)ts.tv_sec + (gdouble)ts.tv_nsec / 1e9);
+#endif
+}
+
+void metrics_append_process_resources(GString *out) {
+    GDir *fds = g_dir_open("/proc/self/fd", 0, NULL);
+    if (fds) {
+        guint n_fds = 0;
+        while (g_dir_read_name(fds)) {
+            n_fds++;
+        }
+        g_dir_close(fds);
+
+        // Less the one listing them
+        metrics_append_family(out, "gwd_process_open_fds", "gauge", "File descriptors open in the server process.");
+        metrics_append_value(out, "gwd_process_open_fds", NULL, n_fds > 0 ? n_fds - 1 : 0);
+    }
+
+#ifdef G_OS_UNIX
+    gchar *statm = NULL;
+    if (g_file_get_contents("/proc/self/statm", &statm, NULL, NULL)) {
+        // Total pages, then resident ones
+        gchar *end = NULL;
+        g_ascii_strtoull(statm, &end, 10);
+        const guint64 resident_pages = g_ascii_strtoull(end, NULL, 10);
+        g_free(statm);
+
+        metrics_append_family(out, "gwd_process_resident_memory_bytes", "gauge", "Resident memory of the server.");
+        metrics_append_value(out,
+                             "gwd_process_resident_memory_bytes",
+                             NULL,
+                             (gdouble)resident_pages * (gdouble)sysconf(_SC_PAGESIZE));
+    }
+#endif
+}
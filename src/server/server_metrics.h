@@ -0,0 +1,58 @@
+#pragma once
+
+#include <gst/gst.h>
+
+/*!
+ * Measures how long frames spend in an encoder, by matching buffer PTS between its sink and src pads.
+ */
+struct encoder_timing;
+
+/*!
+ * Install the probes on the first sink and src pads of @p encoder.
+ *
+ * @return NULL if the encoder has no linked pads yet.
+ */
+struct encoder_timing *encoder_timing_new(GstElement *encoder);
+
+/*!
+ * Remove the probes. Only call this once the pipeline has stopped.
+ */
+void encoder_timing_free(struct encoder_timing *timing);
+
+/*!
+ * Get the smoothed time a frame spends in the encoder in milliseconds, and the number of frames measured so far.
+ */
+void encoder_timing_get(struct encoder_timing *timing, gdouble *out_avg_ms, guint64 *out_frames);
+
+/*!
+ * Get the CPU time spent so far by the streaming thread feeding the encoder, measured between consecutive frames.
+ *
+ * That thread runs everything between the closest queues upstream and downstream of the encoder, the encoder included.
+ * Worker threads the encoder starts on its own are not counted. Always 0 without per-thread CPU clocks.
+ */
+gdouble encoder_timing_get_cpu_seconds(struct encoder_timing *timing);
+
+/*!
+ * Append the "# HELP" and "# TYPE" lines of a metric family in Prometheus text format.
+ */
+void metrics_append_family(GString *out, const gchar *name, const gchar *type, const gchar *help);
+
+/*!
+ * Append one sample line in Prometheus text format. @p labels is the inside of the braces, and may be NULL.
+ */
+void metrics_append_value(GString *out, const gchar *name, const gchar *labels, gdouble value);
+
+/*!
+ * Append the current fill level of every queue in @p bin, including those of its child bins.
+ */
+void metrics_append_queue_levels(GString *out, GstBin *bin);
+
+/*!
+ * Append the CPU time used by the whole process so far, all threads included. Nothing without a process CPU clock.
+ */
+void metrics_append_process_cpu(GString *out);
+
+/*!
+ * Append the process' open file descriptors and resident memory, where /proc tells.
+ */
+void metrics_append_process_resources(GString *out);
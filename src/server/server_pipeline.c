@@ -3,10 +3,27 @@
 #include <gst/app/app.h>
 #include <gst/gst.h>
 #include <gst/gststructure.h>
+#include <json-glib/json-glib.h>
 
+#include "../common/bulk_transfer.h"
+#include "../common/dot_snapshot.h"
 #include "../common/general.h"
+#include "../common/input_event.h"
+#include "../common/rtp_analyzer.h"
+#include "../common/signaling_protocol.h"
+#include "../common/webrtc_stats.h"
 #include "../utils/logger.h"
+#include "frame_dedup.h"
+#include "ice_config.h"
+#include "input_queue.h"
+#include "overload_control.h"
+#include "passthrough.h"
+#include "preprocess.h"
+#include "server_metrics.h"
 #include "signaling_server.h"
+#include "temporal_layers.h"
+#include "vod_cache.h"
+#include "vod_source.h"
 
 #define GST_USE_UNSTABLE_API
 #include <gst/webrtc/datachannel.h>
@@ -16,21 +33,332 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#define VIDEO_TEE_NAME "video_tee"
+#ifdef G_OS_UNIX
+    #include <glib-unix.h>
+    #include <signal.h>
+#endif
+
+#define RAW_VIDEO_TEE_NAME "raw_video_tee"
+/// Converts, scales and stamps raw video, see preprocess.h. Duplicate frames are dropped ahead of it, sparing it the
+/// pass and keeping its timestamp from making every frame differ.
+#define PREPROCESS_NAME "preprocess"
 #define AUDIO_TEE_NAME "audio_tee"
+/// Only on desktop, streaming the file's video as is, see passthrough.h
+#define PASSTHROUGH_TEE_NAME "h264_passthrough_tee"
+#define PASSTHROUGH_DEMUX_NAME "demux"
+/// Only on desktop, playing a cache rather than test.mp4, see vod_source.h
+#define VOD_VIDEO_SRC_NAME "vod_video"
+#define VOD_AUDIO_SRC_NAME "vod_audio"
+
+#define AUDIO_PAYLOAD 127
+#define AUDIO_SSRC 3484078953
+
+#ifndef ANDROID
+    #define TEST_MEDIA_LOCATION "test.mp4"
+#endif
+
+/// Everything after the raw audio source, the same in both desktop modes and on Android
+#define AUDIO_ENCODE_DESCRIPTION                                                           \
+    "audioconvert ! "                                                                      \
+    "audioresample ! "                                                                     \
+    "queue name=q_audio_enc ! "                                                            \
+    "opusenc perfect-timestamp=true ! "                                                    \
+    "rtpopuspay name=audiopay ! "                                                          \
+    "application/x-rtp,encoding-name=OPUS,media=audio,payload=" G_STRINGIFY(AUDIO_PAYLOAD) \
+    ",ssrc=(uint)" G_STRINGIFY(AUDIO_SSRC) " ! "                                           \
+    "queue name=q_audio_out ! "
+
+/// How often per-session webrtcbin stats are polled
+#define STATS_POLL_INTERVAL_MS 1000
+/// How much per-session stats history is kept
+#define STATS_HISTORY_S 60
+/// How often the metrics served on the signaling server are refreshed
+#define METRICS_REFRESH_INTERVAL_MS 1000
+/// How often the outgoing RTP streams are summarized in the log
+#define RTP_REPORT_INTERVAL_MS 5000
+/// How long a session outlives its websocket, waiting for the client to reconnect and resume it
+#define SESSION_RESUME_GRACE_S 15
+/// A session with this much still waiting on its data channel misses broadcasts until it catches up
+#define BROADCAST_MAX_BEHIND_BYTES (64 * 1024)
+/// Most a client's stats report may add to each of its totals, far above what one second of video counts
+#define CLIENT_STATS_MAX_COUNT 100000
+/// How long an encoder keeps running after its last session left, in case another one comes right back
+#define VIDEO_BRANCH_LINGER_S 5
+/// How long stopping waits for EOS to drain. It never does without any sink, in passthrough before any session joined.
+#define STOP_EOS_TIMEOUT_MS 3000
+
+/// End-to-end budget for the time media may wait in the server's queues, shared out between them below
+#define LATENCY_BUDGET_MS 100
+/// Share of the budget for the queue in front of each video encoder, on top of the raw video queue's
+#define VIDEO_ENCODER_QUEUE_PERCENT 40
+
+/*!
+ * Share of LATENCY_BUDGET_MS each queue on the media path may hold, along the audio and the video paths.
+ *
+ * Leaky queues drop their oldest data when full rather than blocking upstream. Only raw media queues are: dropping RTP
+ * packets would look like loss to the clients. Each one must come after a live source or a clocksync, or a decoder
+ * running ahead of the clock would have most of its output thrown away.
+ */
+static const struct {
+    const gchar* name;
+    guint percent;
+    gboolean leaky;
+} queue_budgets[] = {
+    // Only on desktop, after the decoder
+    {"q_audio_in", 30, TRUE},
+    {"q_audio_enc", 30, TRUE},
+    {"q_audio_out", 30, FALSE},
+    {"q1", 40, TRUE},
+};
+
+/// A video codec we can offer. Each one is encoded at most once, whatever the number of sessions using it.
+struct video_codec {
+    /// RTP encoding name, as listed by clients in SIGNALING_CODECS_QUERY
+    const gchar* name;
+    /// Lowercase, for element names and metric labels
+    const gchar* id;
+    /// Checked for at startup, the codec is not offered without them
+    const gchar* factories[2];
+    const gchar* encoder;
+    const gchar* payloader;
+    /// Appended to the RTP caps webrtcbin negotiates
+    const gchar* rtp_fields;
+    guint payload;
+    guint32 ssrc;
+    /// Temporal layers tagged by the payloader, which each session's forwarding can leave out, see temporal_layers.h
+    guint temporal_layers;
+};
+
+/// In the order the server prefers them, when clients do not say
+static const struct video_codec video_codecs[] = {
+    {"H264",
+     "h264",
+     {"encodebin2", "rtph264pay"},
+     "encodebin2 "
+     "profile=\"video/x-h264|element-properties,tune=4,speed-preset=1,bframes=0,key-int-max=120,bitrate=16000\"",
+     "rtph264pay config-interval=-1 aggregate-mode=zero-latency",
+     ",packetization-mode=(string)1",
+     96,
+     3484078952u,
+     1},
+    // L1T3: layers 0, 2, 1, 2 in a cycle of 4 frames at a quarter, half and full frame rate. Each layer only references
+    // lower ones, and the frames marked sync only the base layer. The payloader tags them from the encoder's meta.
+    {"VP8",
+     "vp8",
+     {"vp8enc", "rtpvp8pay"},
+     "vp8enc deadline=1 cpu-used=8 end-usage=cbr target-bitrate=16000000 keyframe-max-dist=120 lag-in-frames=0 "
+     "error-resilient=default threads=4 "
+     "temporal-scalability-number-layers=3 temporal-scalability-periodicity=4 "
+     "temporal-scalability-layer-id=\"<0,2,1,2>\" "
+     "temporal-scalability-rate-decimator=\"<4,2,1>\" "
+     "temporal-scalability-target-bitrate=\"<9600000,12800000,16000000>\" "
+     "temporal-scalability-layer-sync-flags=\"<false,true,true,false>\" "
+     "temporal-scalability-layer-flags=\"<"
+     "no-ref-golden+no-ref-arf+no-upd-golden+no-upd-arf,"
+     "no-ref-golden+no-ref-arf+no-upd-last+no-upd-golden+no-upd-entropy,"
+     "no-ref-golden+no-ref-arf+no-upd-last+no-upd-arf+no-upd-entropy,"
+     "no-upd-last+no-upd-golden+no-upd-arf+no-upd-entropy>\"",
+     "rtpvp8pay picture-id-mode=15-bit",
+     "",
+     97,
+     3484078954u,
+     3},
+    {"VP9",
+     "vp9",
+     {"vp9enc", "rtpvp9pay"},
+     "vp9enc deadline=1 cpu-used=8 end-usage=cbr target-bitrate=16000000 keyframe-max-dist=120 lag-in-frames=0 "
+     "row-mt=true threads=4",
+     "rtpvp9pay picture-id-mode=15-bit",
+     "",
+     98,
+     3484078955u,
+     1},
+    {"AV1",
+     "av1",
+     {"av1enc", "rtpav1pay"},
+     "av1enc usage-profile=realtime cpu-used=8 end-usage=cbr target-bitrate=16000 keyframe-max-dist=120 "
+     "lag-in-frames=0 threads=4",
+     "rtpav1pay",
+     "",
+     99,
+     3484078956u,
+     1},
+};
+
+/// Index of H264 in video_codecs, the only codec passthrough serves
+#define VIDEO_CODEC_H264 0
+/*!
+ * Offered to clients that do not list any codec we have. Kept on H264 as before codecs could be chosen: clients that
+ * predate SIGNALING_CODECS_QUERY only decode it, passthrough only serves it, and there are no per-codec encode cost or
+ * latency figures that would favour another one.
+ */
+#define VIDEO_CODEC_DEFAULT VIDEO_CODEC_H264
+
+#define N_VIDEO_CODECS G_N_ELEMENTS(video_codecs)
+
+/// The running encoder of one codec, from the raw video tee to a tee of RTP packets. Control thread only.
+struct video_branch {
+    struct MyGstData* mgd;
+    guint codec;
+    /// All the codec's elements were found at startup
+    gboolean available;
+
+    /// NULL while stopped, and for the passthrough H264 branch which is part of the pipeline
+    GstElement* bin;
+    /// Where each subscribed session requests its pad, NULL while stopped
+    GstElement* tee;
+    /// Requested from the raw video tee, feeds the bin
+    GstPad* raw_pad;
+    struct encoder_timing* timing;
+    /// Drops raw frames in front of the encoder while it falls behind
+    struct overload_control* overload;
+
+    guint subscribers;
+    /// Pending stop once the last subscriber left
+    GSource* linger_src;
+};
 
 static SignalingServer* signaling_server = NULL;
 
+/// Per-client state. Reference counted, as data channel callbacks may outlive the client's removal.
+struct MySession {
+    ClientId client_id;
+    /// Handed to the client, which passes it back to resume the session after losing its websocket
+    gchar* id;
+    GstElement* webrtcbin;
+    GstWebRTCDataChannel* data_channel;
+    /// Chunked transfers over the data channel, sent and reported from the control thread
+    struct bulk_transfer* bulk;
+    struct MyGstData* mgd;
+    /// Unordered and unreliable, for client input, see input_event.h
+    GstWebRTCDataChannel* input_channel;
+    /// Tags the session's input events, same as the webrtcbin name suffix
+    guint number;
+    /// Index in video_codecs, whose branch the session is subscribed to
+    guint video_codec;
+    /// Video forwarding, for codecs with temporal layers
+    struct temporal_layer_filter layers;
+    /// Timestamp of the last stats sample the layers were adapted to
+    gint64 layers_sample_us;
+
+    /// Input event tracking, only written from the input channel's thread
+    gboolean input_started;
+    guint32 input_expected_seq;
+    /// Read by the metrics refresh
+    guint input_received;
+    gint input_lost;
+    gint input_latency_sum_us;
+    gint input_latency_count;
+    gint input_latency_max_us;
+
+    struct webrtc_stats_collector* stats;
+
+    /// Totals accumulated from the stats the client reports back over the data channel
+    guint client_fec_recovered;
+    guint client_frames_decoded;
+    guint client_frames_dropped;
+    /// Reused for each of those reports, only from the data channel's thread
+    JsonParser* client_stats_parser;
+
+    /// Broadcasts missed for being too far behind
+    guint broadcast_skipped;
+
+    /// Pending expiry while detached from any websocket, control thread only
+    GSource* grace_src;
+};
+
 struct MyGstData {
     GstElement* pipeline;
     GstElement* webrtcbin;
 
-    GObject* data_channel;
+    /// ClientId -> struct MySession*
+    GHashTable* sessions;
+    /// Session ID -> struct MySession* whose websocket went away, until they are resumed or expire
+    GHashTable* detached_sessions;
+    GMutex sessions_mutex;
+    /// Names the webrtcbins
+    guint webrtcbin_count;
+
+    /// Input events from all sessions, drained by the application
+    struct input_queue* input_queue;
+
+    guint broadcasts;
+    /// Longest server_pipeline_broadcast() call since the last metrics refresh
+    gint broadcast_duration_max_us;
+
+    /// The file's H.264 video is streamed as is, and only H264 is offered
+    gboolean passthrough;
+    /// Played instead of the file when set, with passthrough on
+    struct vod_cache* vod_cache;
+    struct vod_source* vod_source;
+    /// Drops unchanged raw frames before any encoder, NULL in passthrough or if disabled
+    struct frame_dedup* frame_dedup;
+    /// Indexed like video_codecs
+    struct video_branch video_branches[N_VIDEO_CODECS];
+    /// Names the branch bins, as a stopping one may still be around when its codec starts again
+    guint video_branches_started;
+
+    /// Frames leaked by each queue of queue_budgets for being full
+    guint queue_overruns[G_N_ELEMENTS(queue_budgets)];
+
+    /// Watches the payloader outputs, shared by all sessions
+    struct rtp_analyzer* rtp_analyzer;
+
+    struct dot_snapshotter* dot_snapshotter;
+
+    /// Set before the pipeline plays
+    server_bulk_received_func bulk_received;
+    gpointer bulk_received_data;
+
+    /// Bus handling, negotiation and timers run on this context and its thread, see server_pipeline.h
+    GMainContext* control_context;
+    GMainLoop* control_loop;
+    GThread* control_thread;
+
+    /// Control thread only
+    guint control_ops;
+    gint64 control_delay_max_us;
 
     guint timeout_src_id_msg;
-    guint timeout_src_id_dot_data;
+    guint timeout_src_id_metrics;
+    guint timeout_src_id_layers;
+    guint signal_src_id_snapshot;
 };
 
+static void session_clear(struct MySession* session) {
+    g_free(session->id);
+    gst_clear_object(&session->data_channel);
+    gst_clear_object(&session->input_channel);
+    gst_clear_object(&session->webrtcbin);
+    g_clear_object(&session->client_stats_parser);
+}
+
+static void session_release(gpointer data) {
+    g_atomic_rc_box_release_full(data, (GDestroyNotify)session_clear);
+}
+
+/// Called on the session's removal from the table
+static void session_remove(gpointer data) {
+    struct MySession* session = data;
+
+    if (session->grace_src) {
+        g_source_destroy(session->grace_src);
+        g_clear_pointer(&session->grace_src, g_source_unref);
+    }
+    g_clear_pointer(&session->stats, webrtc_stats_collector_free);
+    g_clear_pointer(&session->bulk, bulk_transfer_free);
+
+    // Drops the references held by the handlers, once any emission in progress is done
+    if (session->data_channel) {
+        g_signal_handlers_disconnect_by_data(session->data_channel, session);
+    }
+    if (session->input_channel) {
+        g_signal_handlers_disconnect_by_data(session->input_channel, session);
+    }
+
+    session_release(session);
+}
+
 static gboolean gst_bus_cb(GstBus* bus, GstMessage* message, gpointer user_data) {
     const struct MyGstData* mgd = user_data;
     GstBin* pipeline = GST_BIN(mgd->pipeline);
@@ -57,6 +385,14 @@ static gboolean gst_bus_cb(GstBus* bus, GstMessage* message, gpointer user_data)
         case GST_MESSAGE_EOS: {
             g_error("Got EOS!");
         } break;
+        case GST_MESSAGE_SEGMENT_DONE: {
+            // Passthrough reached the end of the file, carry on from the start
+            GstElement* demuxer = gst_bin_get_by_name(pipeline, PASSTHROUGH_DEMUX_NAME);
+            if (demuxer == NULL || !passthrough_seek_start(demuxer, FALSE)) {
+                ALOGE("Cannot loop the passthrough video");
+            }
+            gst_clear_object(&demuxer);
+        } break;
         case GST_MESSAGE_LATENCY: {
             gst_bin_recalculate_latency(pipeline);
         } break;
@@ -96,10 +432,15 @@ static gboolean gst_bus_cb(GstBus* bus, GstMessage* message, gpointer user_data)
     return TRUE;
 }
 
-static GstElement* get_webrtcbin_for_client(GstBin* pipeline, ClientId client_id) {
-    gchar* name = g_strdup_printf("webrtcbin_%p", client_id);
-    GstElement* webrtcbin = gst_bin_get_by_name(pipeline, name);
-    g_free(name);
+static GstElement* get_webrtcbin_for_client(struct MyGstData* mgd, ClientId client_id) {
+    GstElement* webrtcbin = NULL;
+
+    g_mutex_lock(&mgd->sessions_mutex);
+    const struct MySession* session = g_hash_table_lookup(mgd->sessions, client_id);
+    if (session) {
+        webrtcbin = gst_object_ref(session->webrtcbin);
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
 
     return webrtcbin;
 }
@@ -137,29 +478,49 @@ static void on_prepare_data_channel(GstElement* webrtcbin,
     g_object_unref(sctp_transport);
 }
 
-static void link_webrtc_to_tee(GstElement* webrtcbin) {
+/// From the video branch's streaming thread
+static GstPadProbeReturn session_layers_probe_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    struct MySession* session = user_data;
+    return temporal_layer_filter_probe(&session->layers, info);
+}
+
+static void link_webrtc_to_tee(struct MySession* session, const struct video_branch* branch) {
+    GstElement* webrtcbin = session->webrtcbin;
     GstElement* pipeline = GST_ELEMENT(gst_element_get_parent(webrtcbin));
     g_assert(pipeline != NULL);
 
     {
-        GstElement* tee = gst_bin_get_by_name(GST_BIN(pipeline), VIDEO_TEE_NAME);
-        GstPad* src_pad = gst_element_request_pad_simple(tee, "src_%u");
+        const struct video_codec* codec = &video_codecs[branch->codec];
+        GstPad* src_pad = gst_element_request_pad_simple(branch->tee, "src_%u");
 
         GstPadTemplate* pad_template = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(webrtcbin), "sink_%u");
 
-        GstCaps* caps = gst_caps_from_string(
-            "application/x-rtp,"
-            "payload=96,encoding-name=H264,clock-rate=90000,media=video,packetization-mode=(string)1");
+        gchar* caps_str = g_strdup_printf("application/x-rtp,"
+                                          "payload=%u,encoding-name=%s,clock-rate=90000,media=video%s",
+                                          codec->payload,
+                                          codec->name,
+                                          codec->rtp_fields);
+        GstCaps* caps = gst_caps_from_string(caps_str);
+        g_free(caps_str);
 
         GstPad* sink_pad = gst_element_request_pad(webrtcbin, pad_template, "sink_0", caps);
 
         const GstPadLinkReturn ret = gst_pad_link(src_pad, sink_pad);
         g_assert(ret == GST_PAD_LINK_OK);
 
+        // The pad keeps the session alive for as long as it may be filtering
+        temporal_layer_filter_init(&session->layers, codec->temporal_layers);
+        if (codec->temporal_layers > 1) {
+            gst_pad_add_probe(src_pad,
+                              GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                              session_layers_probe_cb,
+                              g_atomic_rc_box_acquire(session),
+                              session_release);
+        }
+
         gst_caps_unref(caps);
         gst_object_unref(src_pad);
         gst_object_unref(sink_pad);
-        gst_object_unref(tee);
     }
 
     {
@@ -169,7 +530,8 @@ static void link_webrtc_to_tee(GstElement* webrtcbin) {
         GstPadTemplate* pad_template = gst_element_class_get_pad_template(GST_ELEMENT_GET_CLASS(webrtcbin), "sink_%u");
 
         GstCaps* caps =
-            gst_caps_from_string("application/x-rtp,payload=127,encoding-name=OPUS,clock-rate=48000,media=audio");
+            gst_caps_from_string("application/x-rtp,payload=" G_STRINGIFY(AUDIO_PAYLOAD)
+                                 ",encoding-name=OPUS,clock-rate=48000,media=audio");
 
         GstPad* sink_pad = gst_element_request_pad(webrtcbin, pad_template, "sink_1", caps);
 
@@ -201,7 +563,220 @@ static void link_webrtc_to_tee(GstElement* webrtcbin) {
 
     gst_object_unref(pipeline);
 
-    ALOGD("Linked webrtcbin to tee");
+    ALOGD("Linked webrtcbin to the %s tee", video_codecs[branch->codec].name);
+}
+
+/// Bound a queue by time only, to its share of the latency budget
+static void configure_queue(GstElement* queue, const guint64 max_time_ns, const gboolean leaky) {
+    g_object_set(queue,
+                 "max-size-time",
+                 max_time_ns,
+                 "max-size-buffers",
+                 0,
+                 "max-size-bytes",
+                 0,
+                 // 2: downstream, i.e. drop the oldest
+                 "leaky",
+                 leaky ? 2 : 0,
+                 NULL);
+}
+
+static void queue_overrun_cb(GstElement* queue, guint* overruns) {
+    g_atomic_int_inc(overruns);
+}
+
+/// The first of the client's codecs we can encode, the default one if none or if it did not say
+static guint video_codec_choose(const struct MyGstData* mgd, const gchar* codecs) {
+    const gchar* names[N_VIDEO_CODECS];
+    for (guint i = 0; i < N_VIDEO_CODECS; i++) {
+        names[i] = mgd->video_branches[i].available ? video_codecs[i].name : NULL;
+    }
+
+    const gint chosen = signaling_codecs_choose(codecs, names, N_VIDEO_CODECS);
+
+    return chosen < 0 ? VIDEO_CODEC_DEFAULT : (guint)chosen;
+}
+
+/// Build and start the encoder of a codec, fed from the raw video tee
+static gboolean video_branch_start(struct video_branch* branch) {
+    struct MyGstData* mgd = branch->mgd;
+    const struct video_codec* codec = &video_codecs[branch->codec];
+
+    // Own queue and thread per branch, so a slow encoder does not hold the others back
+    gchar* description = g_strdup_printf("queue name=q_venc_%s ! videoconvert ! %s name=venc ! %s name=pay ! "
+                                         "application/x-rtp,payload=%u,ssrc=(uint)%u ! "
+                                         "tee name=tee allow-not-linked=true",
+                                         codec->id,
+                                         codec->encoder,
+                                         codec->payloader,
+                                         codec->payload,
+                                         codec->ssrc);
+    GError* error = NULL;
+    GstElement* bin = gst_parse_bin_from_description(description, TRUE, &error);
+    g_free(description);
+    if (bin == NULL) {
+        ALOGE("Cannot build the %s encoder: %s", codec->name, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    gchar* name = g_strdup_printf("video_%s_%u", codec->id, mgd->video_branches_started++);
+    gst_element_set_name(bin, name);
+    g_free(name);
+
+    gst_bin_add(GST_BIN(mgd->pipeline), bin);
+    branch->bin = gst_object_ref(bin);
+    branch->tee = gst_bin_get_by_name(GST_BIN(bin), "tee");
+
+    GstElement* encoder = gst_bin_get_by_name(GST_BIN(bin), "venc");
+    branch->timing = encoder_timing_new(encoder);
+    gst_object_unref(encoder);
+
+    gchar* queue_name = g_strdup_printf("q_venc_%s", codec->id);
+    GstElement* queue = gst_bin_get_by_name(GST_BIN(bin), queue_name);
+    g_free(queue_name);
+    const guint64 queue_budget_ns = LATENCY_BUDGET_MS * GST_MSECOND * VIDEO_ENCODER_QUEUE_PERCENT / 100;
+    configure_queue(queue, queue_budget_ns, TRUE);
+    if (branch->timing) {
+        branch->overload = overload_control_new(queue, branch->timing, queue_budget_ns);
+    }
+    gst_object_unref(queue);
+
+    GstElement* payloader = gst_bin_get_by_name(GST_BIN(bin), "pay");
+    GstPad* pay_pad = gst_element_get_static_pad(payloader, "src");
+    rtp_analyzer_attach(mgd->rtp_analyzer, pay_pad);
+    gst_object_unref(pay_pad);
+    gst_object_unref(payloader);
+
+    GstElement* raw_tee = gst_bin_get_by_name(GST_BIN(mgd->pipeline), RAW_VIDEO_TEE_NAME);
+    branch->raw_pad = gst_element_request_pad_simple(raw_tee, "src_%u");
+    GstPad* sink_pad = gst_element_get_static_pad(bin, "sink");
+    const GstPadLinkReturn ret = gst_pad_link(branch->raw_pad, sink_pad);
+    g_assert(ret == GST_PAD_LINK_OK);
+    gst_object_unref(sink_pad);
+    gst_object_unref(raw_tee);
+
+    gst_element_sync_state_with_parent(bin);
+
+    ALOGI("Started the %s encoder", codec->name);
+
+    return TRUE;
+}
+
+/// What is left of a stopped branch, dropped from the control thread once the raw video tee stopped feeding it
+struct video_branch_teardown {
+    struct MyGstData* mgd;
+    GstElement* bin;
+    GstPad* raw_pad;
+    struct encoder_timing* timing;
+    struct overload_control* overload;
+};
+
+static void video_branch_teardown_free(gpointer data) {
+    struct video_branch_teardown* teardown = data;
+
+    overload_control_free(teardown->overload);
+    encoder_timing_free(teardown->timing);
+    gst_object_unref(teardown->raw_pad);
+    gst_object_unref(teardown->bin);
+    g_free(teardown);
+}
+
+static gboolean video_branch_teardown_cb(gpointer data) {
+    const struct video_branch_teardown* teardown = data;
+    GstBin* pipeline = GST_BIN(teardown->mgd->pipeline);
+
+    gst_element_set_state(teardown->bin, GST_STATE_NULL);
+    gst_bin_remove(pipeline, teardown->bin);
+
+    GstElement* raw_tee = gst_bin_get_by_name(pipeline, RAW_VIDEO_TEE_NAME);
+    gst_element_release_request_pad(raw_tee, teardown->raw_pad);
+    gst_object_unref(raw_tee);
+
+    return G_SOURCE_REMOVE;
+}
+
+/// From the raw video tee's streaming thread, between two frames
+static GstPadProbeReturn video_branch_block_cb(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    struct video_branch_teardown* teardown = user_data;
+
+    GstPad* peer = gst_pad_get_peer(pad);
+    if (peer) {
+        gst_pad_unlink(pad, peer);
+        gst_object_unref(peer);
+    }
+
+    g_main_context_invoke_full(teardown->mgd->control_context,
+                               G_PRIORITY_DEFAULT,
+                               video_branch_teardown_cb,
+                               teardown,
+                               video_branch_teardown_free);
+
+    return GST_PAD_PROBE_REMOVE;
+}
+
+/// Unlink the encoder from the raw video, and drop it once nothing is flowing in anymore
+static void video_branch_stop(struct video_branch* branch) {
+    ALOGI("Stopping the %s encoder, no session uses it anymore", video_codecs[branch->codec].name);
+
+    struct video_branch_teardown* teardown = g_new0(struct video_branch_teardown, 1);
+    teardown->mgd = branch->mgd;
+    teardown->bin = g_steal_pointer(&branch->bin);
+    teardown->raw_pad = g_steal_pointer(&branch->raw_pad);
+    teardown->timing = g_steal_pointer(&branch->timing);
+    teardown->overload = g_steal_pointer(&branch->overload);
+    gst_clear_object(&branch->tee);
+
+    gst_pad_add_probe(teardown->raw_pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, video_branch_block_cb, teardown, NULL);
+}
+
+static gboolean video_branch_linger_cb(gpointer data) {
+    struct video_branch* branch = data;
+
+    g_clear_pointer(&branch->linger_src, g_source_unref);
+    if (branch->subscribers == 0 && branch->bin) {
+        video_branch_stop(branch);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/// Count a session in, starting the codec's encoder if it is not running yet
+static gboolean video_branch_subscribe(struct MyGstData* mgd, const guint codec) {
+    struct video_branch* branch = &mgd->video_branches[codec];
+
+    if (branch->linger_src) {
+        g_source_destroy(branch->linger_src);
+        g_clear_pointer(&branch->linger_src, g_source_unref);
+    }
+
+    if (branch->tee == NULL && !video_branch_start(branch)) {
+        branch->available = FALSE;
+        return FALSE;
+    }
+
+    branch->subscribers++;
+
+    return TRUE;
+}
+
+/// Count a session out, the encoder stops a while after the last one left
+static void video_branch_unsubscribe(struct MyGstData* mgd, const guint codec) {
+    struct video_branch* branch = &mgd->video_branches[codec];
+
+    g_assert(branch->subscribers > 0);
+    if (--branch->subscribers > 0 || branch->linger_src) {
+        return;
+    }
+
+    branch->linger_src = g_timeout_source_new_seconds(VIDEO_BRANCH_LINGER_S);
+    g_source_set_callback(branch->linger_src, video_branch_linger_cb, branch, NULL);
+    g_source_attach(branch->linger_src, mgd->control_context);
+}
+
+/// The websocket a session's webrtcbin signals through, NULL while the session is detached from any
+static ClientId webrtcbin_get_client_id(GstElement* webrtcbin) {
+    return g_object_get_data(G_OBJECT(webrtcbin), "client_id");
 }
 
 static void on_offer_created(GstPromise* promise, GstElement* webrtcbin) {
@@ -213,9 +788,13 @@ static void on_offer_created(GstPromise* promise, GstElement* webrtcbin) {
 
     g_signal_emit_by_name(webrtcbin, "set-local-description", offer, NULL);
 
-    gchar* sdp = gst_sdp_message_as_text(offer->sdp);
-    signaling_server_send_sdp_offer(signaling_server, g_object_get_data(G_OBJECT(webrtcbin), "client_id"), sdp);
-    g_free(sdp);
+    // A detached session gets a new offer once resumed
+    const ClientId client_id = webrtcbin_get_client_id(webrtcbin);
+    if (client_id) {
+        gchar* sdp = gst_sdp_message_as_text(offer->sdp);
+        signaling_server_send_sdp_offer(signaling_server, client_id, sdp);
+        g_free(sdp);
+    }
 
     gst_webrtc_session_description_free(offer);
 }
@@ -225,13 +804,24 @@ static void webrtc_on_data_channel_cb(GstElement* webrtcbin, GObject* data_chann
 }
 
 static void webrtc_on_ice_candidate_cb(GstElement* webrtcbin, guint m_line_index, gchar* candidate) {
-    signaling_server_send_candidate(signaling_server,
-                                    g_object_get_data(G_OBJECT(webrtcbin), "client_id"),
-                                    m_line_index,
-                                    candidate);
+    // Dropped while detached, resuming restarts ICE
+    const ClientId client_id = webrtcbin_get_client_id(webrtcbin);
+    if (client_id) {
+        signaling_server_send_candidate(signaling_server, client_id, m_line_index, candidate);
+    }
+}
+
+static void webrtc_on_ice_gathering_state_cb(GstElement* webrtcbin, GParamSpec* pspec, gpointer user_data) {
+    GstWebRTCICEGatheringState state;
+    g_object_get(webrtcbin, "ice-gathering-state", &state, NULL);
+
+    const ClientId client_id = webrtcbin_get_client_id(webrtcbin);
+    if (state == GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE && client_id) {
+        signaling_server_send_end_of_candidates(signaling_server, client_id);
+    }
 }
 
-static void data_channel_error_cb(GstWebRTCDataChannel* data_channel, struct MyGstData* mgd) {
+static void data_channel_error_cb(GstWebRTCDataChannel* data_channel, struct MySession* session) {
     ALOGE(__func__);
 }
 
@@ -247,41 +837,176 @@ gboolean data_channel_send_message(GstWebRTCDataChannel* data_channel) {
     return G_SOURCE_REMOVE;
 }
 
-static void data_channel_open_cb(GstWebRTCDataChannel* data_channel, struct MyGstData* mgd) {
+static void data_channel_open_cb(GstWebRTCDataChannel* data_channel, struct MySession* session) {
     ALOGD("Data channel opened");
 
     // mgd->timeout_src_id_msg = g_timeout_add_seconds(3, G_SOURCE_FUNC(data_channel_send_message), data_channel);
 }
 
-static void data_channel_close_cb(GstWebRTCDataChannel* data_channel, struct MyGstData* mgd) {
+static void data_channel_close_cb(GstWebRTCDataChannel* data_channel, struct MySession* session) {
     ALOGD("Data channel closed");
 
     // g_clear_handle_id(&mgd->timeout_src_id_msg, g_source_remove);
-    g_clear_object(&mgd->data_channel);
 }
 
-static void data_channel_message_data_cb(GstWebRTCDataChannel* data_channel, GBytes* data, struct MyGstData* mgd) {
+static void data_channel_message_data_cb(GstWebRTCDataChannel* data_channel, GBytes* data, struct MySession* session) {
+    // Handled by session->bulk
+    if (bulk_transfer_is_chunk(data)) {
+        return;
+    }
     ALOGD("Received data channel message (data), size: %u\n", (uint32_t)g_bytes_get_size(data));
 }
 
-static void data_channel_message_string_cb(GstWebRTCDataChannel* data_channel, gchar* str, struct MyGstData* mgd) {
+/// One count of a client stats report, 0 if missing. FALSE unless an integer, clamped to 0..CLIENT_STATS_MAX_COUNT.
+static gboolean client_stats_get_count(JsonObject* stats, const gchar* name, gint* out) {
+    JsonNode* node = json_object_get_member(stats, name);
+    if (node == NULL) {
+        *out = 0;
+        return TRUE;
+    }
+    if (!JSON_NODE_HOLDS_VALUE(node) || json_node_get_value_type(node) != G_TYPE_INT64) {
+        return FALSE;
+    }
+
+    *out = (gint)CLAMP(json_node_get_int(node), 0, CLIENT_STATS_MAX_COUNT);
+    return TRUE;
+}
+
+/// Accumulate a stats report from the client, see webrtc_stats_sample_append_json() for the format.
+static gboolean handle_client_stats(struct MySession* session, const gchar* str) {
+    if (!json_parser_load_from_data(session->client_stats_parser, str, -1, NULL)) {
+        return FALSE;
+    }
+
+    JsonNode* root = json_parser_get_root(session->client_stats_parser);
+    JsonObject* msg = JSON_NODE_HOLDS_OBJECT(root) ? json_node_get_object(root) : NULL;
+    if (msg == NULL || !json_object_has_member(msg, "stats")) {
+        return FALSE;
+    }
+
+    // A report that is not what our clients send is dropped whole, rather than counted in part
+    JsonNode* stats_node = json_object_get_member(msg, "stats");
+    JsonObject* stats = JSON_NODE_HOLDS_OBJECT(stats_node) ? json_node_get_object(stats_node) : NULL;
+    gint fec_recovered;
+    gint frames_decoded;
+    gint frames_dropped;
+    if (stats == NULL || !client_stats_get_count(stats, "fec_recovered", &fec_recovered) ||
+        !client_stats_get_count(stats, "frames_decoded", &frames_decoded) ||
+        !client_stats_get_count(stats, "frames_dropped", &frames_dropped)) {
+        ALOGD("Session %s sent invalid stats: %s", session->id, str);
+        return TRUE;
+    }
+
+    g_atomic_int_add(&session->client_fec_recovered, fec_recovered);
+    g_atomic_int_add(&session->client_frames_decoded, frames_decoded);
+    g_atomic_int_add(&session->client_frames_dropped, frames_dropped);
+
+    return TRUE;
+}
+
+static void data_channel_message_string_cb(GstWebRTCDataChannel* data_channel,
+                                           gchar* str,
+                                           struct MySession* session) {
+    if (handle_client_stats(session, str)) {
+        return;
+    }
+
     ALOGD("Received data channel message (string): %s", str);
 }
 
-static void webrtc_client_connected_cb(SignalingServer* server, const ClientId client_id, struct MyGstData* mgd) {
+static void session_bulk_received(gpointer user_data, const guint32 transfer_id, GBytes* data) {
+    const struct MySession* session = user_data;
+    struct MyGstData* mgd = session->mgd;
+
+    if (mgd->bulk_received) {
+        mgd->bulk_received(mgd->bulk_received_data, session->id, transfer_id, data);
+    }
+}
+
+/// Count losses and latency. Events are unordered, so one older than expected was counted lost when it got overtaken.
+static void session_track_input(struct MySession* session, const struct input_queue_entry* entry) {
+    const guint32 seq = entry->event.seq;
+
+    if (!session->input_started) {
+        session->input_started = TRUE;
+        session->input_expected_seq = seq + 1;
+    } else if ((gint32)(seq - session->input_expected_seq) >= 0) {
+        g_atomic_int_add(&session->input_lost, (gint)(seq - session->input_expected_seq));
+        session->input_expected_seq = seq + 1;
+    } else {
+        g_atomic_int_add(&session->input_lost, -1);
+    }
+    g_atomic_int_inc(&session->input_received);
+
+    // Negative with skewed clocks, which the metrics should show rather than hide
+    const gint latency_us = (gint)CLAMP(entry->received_us - entry->event.sent_us, G_MININT / 2, G_MAXINT / 2);
+    g_atomic_int_add(&session->input_latency_sum_us, latency_us);
+    g_atomic_int_inc(&session->input_latency_count);
+
+    gint max_us;
+    do {
+        max_us = g_atomic_int_get(&session->input_latency_max_us);
+    } while (latency_us > max_us &&
+             !g_atomic_int_compare_and_exchange(&session->input_latency_max_us, max_us, latency_us));
+}
+
+/// From the input channel's thread
+static void input_channel_message_data_cb(GstWebRTCDataChannel* channel, GBytes* data, struct MySession* session) {
+    struct input_queue_entry entry;
+
+    gsize size;
+    const guint8* bytes = g_bytes_get_data(data, &size);
+    if (!input_event_unpack(bytes, size, &entry.event)) {
+        ALOGW("Ignoring input event of %zu bytes", size);
+        return;
+    }
+    entry.session = session->number;
+    entry.received_us = g_get_real_time();
+
+    session_track_input(session, &entry);
+
+    // Counted by the queue if it is full
+    input_queue_push(session->mgd->input_queue, &entry);
+}
+
+static gboolean webrtc_session_resume(struct MyGstData* mgd, ClientId client_id, const gchar* session_id);
+
+static void webrtc_client_connected_cb(SignalingServer* server,
+                                       const ClientId client_id,
+                                       const gchar* resume_id,
+                                       const gchar* codecs,
+                                       struct MyGstData* mgd) {
     ALOGI("WebSocket client connected, ID: %p", client_id);
 
+    if (resume_id && webrtc_session_resume(mgd, client_id, resume_id)) {
+        return;
+    }
+
+    guint video_codec = video_codec_choose(mgd, codecs);
+    if (!video_branch_subscribe(mgd, video_codec)) {
+        video_codec = VIDEO_CODEC_DEFAULT;
+        const gboolean subscribed = video_branch_subscribe(mgd, video_codec);
+        g_assert(subscribed);
+    }
+    ALOGI("Client %p gets %s video (asked for %s)", client_id, video_codecs[video_codec].name, codecs ? codecs : "-");
+
     GstBin* pipeline_bin = GST_BIN(mgd->pipeline);
 
     // Create webrtcbin
-    gchar* name = g_strdup_printf("webrtcbin_%p", client_id);
+    const guint number = mgd->webrtcbin_count++;
+    gchar* name = g_strdup_printf("webrtcbin_%u", number);
     GstElement* webrtcbin = gst_element_factory_make("webrtcbin", name);
     g_free(name);
 
     g_object_set(webrtcbin, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+    ice_config_apply(webrtcbin);
     g_object_set_data(G_OBJECT(webrtcbin), "client_id", client_id); // Custom data
 
     g_signal_connect(webrtcbin, "on-ice-candidate", G_CALLBACK(webrtc_on_ice_candidate_cb), NULL);
+    g_signal_connect(webrtcbin,
+                     "notify::ice-gathering-state",
+                     G_CALLBACK(webrtc_on_ice_gathering_state_cb),
+                     NULL);
     g_signal_connect(webrtcbin, "on-data-channel", G_CALLBACK(webrtc_on_data_channel_cb), NULL);
 
     gst_bin_add(pipeline_bin, webrtcbin);
@@ -291,42 +1016,98 @@ static void webrtc_client_connected_cb(SignalingServer* server, const ClientId c
 
     mgd->webrtcbin = webrtcbin;
 
+    struct MySession* session = g_atomic_rc_box_new0(struct MySession);
+    session->client_id = client_id;
+    session->id = g_uuid_string_random();
+    session->webrtcbin = gst_object_ref(webrtcbin);
+    session->mgd = mgd;
+    session->number = number;
+    session->video_codec = video_codec;
+    session->client_stats_parser = json_parser_new_immutable();
+
     // I also think this would work if the pipeline state is READY but /shrug
 
     // Set up a data channel
     {
         // TODO add priority
         GstStructure* data_channel_options = gst_structure_new_from_string("data-channel-options, ordered=true");
-        g_signal_emit_by_name(webrtcbin, "create-data-channel", "channel", data_channel_options, &mgd->data_channel);
+        g_signal_emit_by_name(webrtcbin,
+                              "create-data-channel",
+                              "channel",
+                              data_channel_options,
+                              &session->data_channel);
         gst_clear_structure(&data_channel_options);
 
         // Make sure a data channel is successfully created
-        g_assert(mgd->data_channel != NULL);
+        g_assert(session->data_channel != NULL);
+
+        // Each handler holds a session reference, dropped when the channel goes away
+        const struct {
+            const gchar* signal;
+            GCallback callback;
+        } handlers[] = {
+            {"on-open", G_CALLBACK(data_channel_open_cb)},
+            {"on-close", G_CALLBACK(data_channel_close_cb)},
+            {"on-error", G_CALLBACK(data_channel_error_cb)},
+            {"on-message-data", G_CALLBACK(data_channel_message_data_cb)},
+            {"on-message-string", G_CALLBACK(data_channel_message_string_cb)},
+        };
+        for (guint i = 0; i < G_N_ELEMENTS(handlers); i++) {
+            g_signal_connect_data(session->data_channel,
+                                  handlers[i].signal,
+                                  handlers[i].callback,
+                                  g_atomic_rc_box_acquire(session),
+                                  (GClosureNotify)session_release,
+                                  0);
+        }
+
+        // Freed in session_remove(), before the session itself
+        session->bulk = bulk_transfer_new(mgd->control_context, session->data_channel, session_bulk_received, session);
+    }
 
-        g_signal_connect(mgd->data_channel, "on-open", G_CALLBACK(data_channel_open_cb), mgd);
-        g_signal_connect(mgd->data_channel, "on-close", G_CALLBACK(data_channel_close_cb), mgd);
-        g_signal_connect(mgd->data_channel, "on-error", G_CALLBACK(data_channel_error_cb), mgd);
-        g_signal_connect(mgd->data_channel, "on-message-data", G_CALLBACK(data_channel_message_data_cb), mgd);
-        g_signal_connect(mgd->data_channel, "on-message-string", G_CALLBACK(data_channel_message_string_cb), mgd);
+    // And the input channel, which the client creates on its side with the same options
+    {
+        GstStructure* input_options = input_event_channel_options();
+        g_signal_emit_by_name(webrtcbin,
+                              "create-data-channel",
+                              INPUT_EVENT_CHANNEL_LABEL,
+                              input_options,
+                              &session->input_channel);
+        gst_structure_free(input_options);
+
+        g_assert(session->input_channel != NULL);
+
+        g_signal_connect_data(session->input_channel,
+                              "on-message-data",
+                              G_CALLBACK(input_channel_message_data_cb),
+                              g_atomic_rc_box_acquire(session),
+                              (GClosureNotify)session_release,
+                              0);
     }
 
-    link_webrtc_to_tee(webrtcbin);
+    session->stats = webrtc_stats_collector_new(webrtcbin, STATS_POLL_INTERVAL_MS, STATS_HISTORY_S);
+    webrtc_stats_collector_start(session->stats);
+
+    g_mutex_lock(&mgd->sessions_mutex);
+    g_hash_table_insert(mgd->sessions, client_id, session);
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    link_webrtc_to_tee(session, &mgd->video_branches[video_codec]);
+
+    // Queued ahead of the offer
+    signaling_server_send_session(signaling_server, client_id, session->id, FALSE);
 
     GstPromise* promise = gst_promise_new_with_change_func((GstPromiseChangeFunc)on_offer_created, webrtcbin, NULL);
     g_signal_emit_by_name(webrtcbin, "create-offer", NULL, promise);
 
     ret = gst_element_set_state(webrtcbin, GST_STATE_PLAYING);
     g_assert(ret != GST_STATE_CHANGE_FAILURE);
-
-    // Debug
-    mgd->timeout_src_id_dot_data = g_timeout_add_seconds(3, G_SOURCE_FUNC(check_pipeline_dot_data), mgd->pipeline);
 }
 
 static void webrtc_sdp_answer_cb(SignalingServer* server,
                                  const ClientId client_id,
                                  const gchar* sdp,
-                                 const struct MyGstData* mgd) {
-    GstBin* pipeline = GST_BIN(mgd->pipeline);
+                                 struct MyGstData* mgd) {
     GstSDPMessage* sdp_msg = NULL;
     GstWebRTCSessionDescription* desc = NULL;
 
@@ -337,7 +1118,7 @@ static void webrtc_sdp_answer_cb(SignalingServer* server,
 
     desc = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp_msg);
     if (desc) {
-        GstElement* webrtcbin = get_webrtcbin_for_client(pipeline, client_id);
+        GstElement* webrtcbin = get_webrtcbin_for_client(mgd, client_id);
         if (!webrtcbin) {
             goto out;
         }
@@ -362,11 +1143,9 @@ static void webrtc_candidate_cb(SignalingServer* server,
                                 const ClientId client_id,
                                 const guint m_line_index,
                                 const gchar* candidate,
-                                const struct MyGstData* mgd) {
-    GstBin* pipeline = GST_BIN(mgd->pipeline);
-
+                                struct MyGstData* mgd) {
     if (strlen(candidate)) {
-        GstElement* webrtcbin = get_webrtcbin_for_client(pipeline, client_id);
+        GstElement* webrtcbin = get_webrtcbin_for_client(mgd, client_id);
         if (webrtcbin) {
             g_signal_emit_by_name(webrtcbin, "add-ice-candidate", m_line_index, candidate);
             gst_object_unref(webrtcbin);
@@ -376,6 +1155,15 @@ static void webrtc_candidate_cb(SignalingServer* server,
     ALOGD("Remote candidate: %s", candidate);
 }
 
+/// Only v2 clients say so, webrtcbin takes a NULL candidate for it
+static void webrtc_end_of_candidates_cb(SignalingServer* server, const ClientId client_id, struct MyGstData* mgd) {
+    GstElement* webrtcbin = get_webrtcbin_for_client(mgd, client_id);
+    if (webrtcbin) {
+        g_signal_emit_by_name(webrtcbin, "add-ice-candidate", 0, NULL);
+        gst_object_unref(webrtcbin);
+    }
+}
+
 static GstPadProbeReturn remove_webrtcbin_probe_audio(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
     GstElement* webrtcbin = GST_ELEMENT(user_data);
 
@@ -410,35 +1198,681 @@ static GstPadProbeReturn remove_webrtcbin_probe_cb_video(GstPad* pad, GstPadProb
     return GST_PAD_PROBE_REMOVE;
 }
 
+/// Unlink and drop a webrtcbin once the tees are not pushing into it, consuming the reference.
+static void remove_webrtcbin(GstElement* webrtcbin) {
+    GstPad* video_sinkpad = gst_element_get_static_pad(webrtcbin, "sink_0");
+
+    if (video_sinkpad) {
+        gst_pad_add_probe(GST_PAD_PEER(video_sinkpad),
+                          GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                          remove_webrtcbin_probe_cb_video,
+                          webrtcbin,
+                          NULL);
+
+        gst_clear_object(&video_sinkpad);
+    } else {
+        gst_element_set_state(webrtcbin, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(GST_ELEMENT_PARENT(webrtcbin)), webrtcbin);
+        gst_object_unref(webrtcbin);
+    }
+}
+
+struct session_expiry {
+    struct MyGstData* mgd;
+    struct MySession* session;
+};
+
+static void session_expiry_free(gpointer data) {
+    struct session_expiry* expiry = data;
+
+    session_release(expiry->session);
+    g_free(expiry);
+}
+
+/// The client did not come back in time
+static gboolean session_expire_cb(gpointer data) {
+    const struct session_expiry* expiry = data;
+    struct MyGstData* mgd = expiry->mgd;
+    struct MySession* session = expiry->session;
+
+    ALOGI("Session %s was not resumed, removing it", session->id);
+
+    GstElement* webrtcbin = gst_object_ref(session->webrtcbin);
+
+    // Clears grace_src, which is us
+    g_mutex_lock(&mgd->sessions_mutex);
+    g_hash_table_remove(mgd->detached_sessions, session->id);
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    remove_webrtcbin(webrtcbin);
+    video_branch_unsubscribe(mgd, session->video_codec);
+
+    return G_SOURCE_REMOVE;
+}
+
+/// Keep the session and its webrtcbin around for a while, so the client can resume it from a new websocket.
 static void webrtc_client_disconnected_cb(SignalingServer* server, ClientId client_id, struct MyGstData* mgd) {
     ALOGI("WebSocket client disconnected, ID: %p", client_id);
 
-    GstBin* pipeline = GST_BIN(mgd->pipeline);
+    g_mutex_lock(&mgd->sessions_mutex);
+    struct MySession* session = g_hash_table_lookup(mgd->sessions, client_id);
+    if (session) {
+        g_hash_table_steal(mgd->sessions, client_id);
+        session->client_id = NULL;
+        g_hash_table_insert(mgd->detached_sessions, session->id, session);
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    if (session == NULL) {
+        return;
+    }
 
-    GstElement* webrtcbin = get_webrtcbin_for_client(pipeline, client_id);
+    // Nothing to signal through until resumed
+    g_object_set_data(G_OBJECT(session->webrtcbin), "client_id", NULL);
 
-    if (webrtcbin) {
-        GstPad* video_sinkpad = gst_element_get_static_pad(webrtcbin, "sink_0");
+    ALOGI("Session %s detached, can be resumed for %d s", session->id, SESSION_RESUME_GRACE_S);
+
+    struct session_expiry* expiry = g_new0(struct session_expiry, 1);
+    expiry->mgd = mgd;
+    expiry->session = g_atomic_rc_box_acquire(session);
+
+    session->grace_src = g_timeout_source_new_seconds(SESSION_RESUME_GRACE_S);
+    g_source_set_callback(session->grace_src, session_expire_cb, expiry, session_expiry_free);
+    g_source_attach(session->grace_src, mgd->control_context);
+}
+
+/// Offer new ICE credentials on the existing webrtcbin, keeping DTLS, the data channel and the client's decoders.
+static void session_restart_ice(struct MySession* session) {
+    ALOGI("Restarting ICE for session %s", session->id);
+
+    GstStructure* options = gst_structure_new("offer-options", "ice-restart", G_TYPE_BOOLEAN, TRUE, NULL);
+    GstPromise* promise =
+        gst_promise_new_with_change_func((GstPromiseChangeFunc)on_offer_created, session->webrtcbin, NULL);
+    g_signal_emit_by_name(session->webrtcbin, "create-offer", options, promise);
+    gst_structure_free(options);
+}
+
+static void webrtc_restart_requested_cb(SignalingServer* server, const ClientId client_id, struct MyGstData* mgd) {
+    g_mutex_lock(&mgd->sessions_mutex);
+    struct MySession* session = g_hash_table_lookup(mgd->sessions, client_id);
+    if (session) {
+        g_atomic_rc_box_acquire(session);
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    if (session) {
+        session_restart_ice(session);
+        session_release(session);
+    }
+}
+
+/// Move a detached session over to a new websocket, if it is still around.
+static gboolean webrtc_session_resume(struct MyGstData* mgd, const ClientId client_id, const gchar* session_id) {
+    g_mutex_lock(&mgd->sessions_mutex);
+    struct MySession* session = g_hash_table_lookup(mgd->detached_sessions, session_id);
+    if (session) {
+        g_hash_table_steal(mgd->detached_sessions, session_id);
+        session->client_id = client_id;
+        g_hash_table_insert(mgd->sessions, client_id, session);
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    if (session == NULL) {
+        ALOGI("Session %s cannot be resumed, starting a new one", session_id);
+        return FALSE;
+    }
+
+    if (session->grace_src) {
+        g_source_destroy(session->grace_src);
+        g_clear_pointer(&session->grace_src, g_source_unref);
+    }
+
+    // Read by the webrtcbin callbacks to address the signaling messages
+    g_object_set_data(G_OBJECT(session->webrtcbin), "client_id", client_id);
+
+    ALOGI("Session %s resumed by client %p", session->id, client_id);
+
+    signaling_server_send_session(signaling_server, client_id, session->id, TRUE);
+    session_restart_ice(session);
+
+    return TRUE;
+}
+
+/// Forward fewer temporal layers to the sessions losing packets, and more again once they stop
+static gboolean adapt_layers_cb(struct MyGstData* mgd) {
+    g_mutex_lock(&mgd->sessions_mutex);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, mgd->sessions);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct MySession* session = value;
+
+        struct webrtc_stats_sample sample;
+        if (session->layers.n_layers < 2 || !webrtc_stats_collector_get_latest(session->stats, &sample) ||
+            sample.timestamp_us == session->layers_sample_us) {
+            continue;
+        }
+        session->layers_sample_us = sample.timestamp_us;
+
+        const guint before = (guint)g_atomic_int_get(&session->layers.target_tid) + 1;
+        const guint after = temporal_layer_filter_update(&session->layers, sample.send_loss_percent);
+        if (after != before) {
+            ALOGI("Session %s: %.1f%% loss, forwarding %u of %u temporal layers",
+                  session->id,
+                  sample.send_loss_percent,
+                  after,
+                  session->layers.n_layers);
+        }
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void append_session_metrics(GString* out, struct MyGstData* mgd) {
+    GString* send_bitrate = g_string_new(NULL);
+    GString* rtt = g_string_new(NULL);
+    GString* loss = g_string_new(NULL);
+    GString* fec_recovered = g_string_new(NULL);
+    GString* frames_decoded = g_string_new(NULL);
+    GString* frames_dropped = g_string_new(NULL);
+    GString* input_received = g_string_new(NULL);
+    GString* input_lost = g_string_new(NULL);
+    GString* input_latency = g_string_new(NULL);
+    GString* input_latency_max = g_string_new(NULL);
+    GString* broadcast_skipped = g_string_new(NULL);
+    GString* temporal_layers = g_string_new(NULL);
+    GString* layer_dropped = g_string_new(NULL);
+
+    g_mutex_lock(&mgd->sessions_mutex);
+
+    const guint n_sessions = g_hash_table_size(mgd->sessions);
+    const guint n_detached = g_hash_table_size(mgd->detached_sessions);
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, mgd->sessions);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct MySession* session = value;
+
+        // Stable across resumes, unlike the ClientId
+        gchar* labels = g_strdup_printf("session=\"%s\"", session->id);
+
+        struct webrtc_stats_sample sample;
+        if (webrtc_stats_collector_get_latest(session->stats, &sample)) {
+            metrics_append_value(send_bitrate, "gwd_session_send_bitrate_bps", labels, sample.send_bitrate);
+            metrics_append_value(rtt, "gwd_session_rtt_ms", labels, sample.rtt_ms);
+            metrics_append_value(loss, "gwd_session_send_loss_percent", labels, sample.send_loss_percent);
+        }
+        metrics_append_value(fec_recovered,
+                             "gwd_session_fec_recovered_total",
+                             labels,
+                             g_atomic_int_get(&session->client_fec_recovered));
+        metrics_append_value(frames_decoded,
+                             "gwd_session_frames_decoded_total",
+                             labels,
+                             g_atomic_int_get(&session->client_frames_decoded));
+        metrics_append_value(frames_dropped,
+                             "gwd_session_frames_dropped_total",
+                             labels,
+                             g_atomic_int_get(&session->client_frames_dropped));
+
+        metrics_append_value(input_received,
+                             "gwd_session_input_events_total",
+                             labels,
+                             g_atomic_int_get(&session->input_received));
+        metrics_append_value(input_lost,
+                             "gwd_session_input_events_lost_total",
+                             labels,
+                             MAX(g_atomic_int_get(&session->input_lost), 0));
+        metrics_append_value(broadcast_skipped,
+                             "gwd_session_broadcast_skipped_total",
+                             labels,
+                             g_atomic_int_get(&session->broadcast_skipped));
+        if (session->layers.n_layers > 1) {
+            metrics_append_value(temporal_layers,
+                                 "gwd_session_temporal_layers",
+                                 labels,
+                                 temporal_layer_filter_get_layers(&session->layers));
+            metrics_append_value(layer_dropped,
+                                 "gwd_session_layer_packets_dropped_total",
+                                 labels,
+                                 temporal_layer_filter_get_dropped(&session->layers));
+        }
+        // Per interval, so reset on every refresh
+        const gint latency_sum_us = g_atomic_int_exchange(&session->input_latency_sum_us, 0);
+        const gint latency_count = g_atomic_int_exchange(&session->input_latency_count, 0);
+        const gint latency_max_us = g_atomic_int_exchange(&session->input_latency_max_us, 0);
+        if (latency_count > 0) {
+            metrics_append_value(input_latency,
+                                 "gwd_session_input_latency_ms",
+                                 labels,
+                                 (gdouble)latency_sum_us / latency_count / 1000.0);
+            metrics_append_value(input_latency_max,
+                                 "gwd_session_input_latency_max_ms",
+                                 labels,
+                                 (gdouble)latency_max_us / 1000.0);
+        }
+
+        g_free(labels);
+    }
+
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    metrics_append_family(out, "gwd_sessions", "gauge", "Active WebRTC sessions.");
+    metrics_append_value(out, "gwd_sessions", NULL, n_sessions);
+    metrics_append_family(out, "gwd_sessions_detached", "gauge", "Sessions waiting for their client to resume them.");
+    metrics_append_value(out, "gwd_sessions_detached", NULL, n_detached);
+
+    const struct {
+        const gchar* name;
+        const gchar* type;
+        const gchar* help;
+        GString* values;
+    } families[] = {
+        {"gwd_session_send_bitrate_bps", "gauge", "Outgoing bitrate over the last stats interval.", send_bitrate},
+        {"gwd_session_rtt_ms", "gauge", "Round trip time to the client.", rtt},
+        {"gwd_session_send_loss_percent", "gauge", "Outgoing packet loss reported by the client.", loss},
+        {"gwd_session_fec_recovered_total", "counter", "Packets recovered by FEC, reported by the client.",
+         fec_recovered},
+        {"gwd_session_frames_decoded_total", "counter", "Frames decoded, reported by the client.", frames_decoded},
+        {"gwd_session_frames_dropped_total", "counter", "Frames dropped, reported by the client.", frames_dropped},
+        {"gwd_session_input_events_total", "counter", "Input events received from the client.", input_received},
+        {"gwd_session_input_events_lost_total",
+         "counter",
+         "Input events that never arrived, from gaps in their sequence numbers.",
+         input_lost},
+        {"gwd_session_input_latency_ms",
+         "gauge",
+         "Mean one-way input latency over the last interval, only meaningful with synchronized clocks.",
+         input_latency},
+        {"gwd_session_input_latency_max_ms",
+         "gauge",
+         "Highest one-way input latency over the last interval.",
+         input_latency_max},
+        {"gwd_session_broadcast_skipped_total",
+         "counter",
+         "Broadcasts the session missed for being too far behind.",
+         broadcast_skipped},
+        {"gwd_session_temporal_layers",
+         "gauge",
+         "Temporal video layers forwarded to the session, fewer while it is congested.",
+         temporal_layers},
+        {"gwd_session_layer_packets_dropped_total",
+         "counter",
+         "Video packets of higher temporal layers left out for the session.",
+         layer_dropped},
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(families); i++) {
+        metrics_append_family(out, families[i].name, families[i].type, families[i].help);
+        g_string_append_len(out, families[i].values->str, (gssize)families[i].values->len);
+        g_string_free(families[i].values, TRUE);
+    }
+}
+
+static void append_video_branch_metrics(GString* out, struct MyGstData* mgd) {
+    GString* subscribers = g_string_new(NULL);
+    GString* frame_time = g_string_new(NULL);
+    GString* frames = g_string_new(NULL);
+    GString* cpu = g_string_new(NULL);
+    GString* skipped = g_string_new(NULL);
+    GString* overruns = g_string_new(NULL);
+    GString* skip = g_string_new(NULL);
+
+    for (guint i = 0; i < N_VIDEO_CODECS; i++) {
+        const struct video_branch* branch = &mgd->video_branches[i];
+        if (!branch->available) {
+            continue;
+        }
+
+        gchar* labels = g_strdup_printf("codec=\"%s\"", video_codecs[i].id);
+
+        metrics_append_value(subscribers, "gwd_video_encoder_sessions", labels, branch->subscribers);
+        if (branch->timing) {
+            gdouble avg_ms;
+            guint64 n_frames;
+            encoder_timing_get(branch->timing, &avg_ms, &n_frames);
+
+            metrics_append_value(frame_time, "gwd_encoder_frame_time_ms", labels, avg_ms);
+            metrics_append_value(frames, "gwd_encoder_frames_total", labels, (gdouble)n_frames);
+            metrics_append_value(cpu,
+                                 "gwd_encoder_cpu_seconds_total",
+                                 labels,
+                                 encoder_timing_get_cpu_seconds(branch->timing));
+        }
+        if (branch->overload) {
+            guint n_skipped;
+            guint n_overruns;
+            overload_control_get_dropped(branch->overload, &n_skipped, &n_overruns);
+
+            metrics_append_value(skipped, "gwd_encoder_frames_skipped_total", labels, n_skipped);
+            metrics_append_value(overruns, "gwd_encoder_queue_overruns_total", labels, n_overruns);
+            metrics_append_value(skip,
+                                 "gwd_encoder_overload_skip",
+                                 labels,
+                                 overload_control_get_skip(branch->overload));
+        }
+
+        g_free(labels);
+    }
+
+    const struct {
+        const gchar* name;
+        const gchar* type;
+        const gchar* help;
+        GString* values;
+    } families[] = {
+        {"gwd_video_encoder_sessions", "gauge", "Sessions fed by a codec's encoder, which runs while any is.",
+         subscribers},
+        {"gwd_encoder_frame_time_ms", "gauge", "Smoothed time a frame spends in the encoder.", frame_time},
+        {"gwd_encoder_frames_total", "counter", "Frames that went through the encoder since it started.", frames},
+        {"gwd_encoder_cpu_seconds_total",
+         "counter",
+         "CPU time of the encoder's streaming thread since it started, excluding its own worker threads.",
+         cpu},
+        {"gwd_encoder_frames_skipped_total",
+         "counter",
+         "Raw frames dropped in front of the encoder because it could not keep up.",
+         skipped},
+        {"gwd_encoder_queue_overruns_total",
+         "counter",
+         "Raw frames leaked by the queue in front of the encoder for exceeding its latency budget.",
+         overruns},
+        {"gwd_encoder_overload_skip",
+         "gauge",
+         "Frames currently dropped between two encoded ones, 0 when the encoder keeps up.",
+         skip},
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(families); i++) {
+        metrics_append_family(out, families[i].name, families[i].type, families[i].help);
+        g_string_append_len(out, families[i].values->str, (gssize)families[i].values->len);
+        g_string_free(families[i].values, TRUE);
+    }
+}
+
+/// Rebuild the metrics text off the request path, so scraping never touches the pipeline.
+static gboolean refresh_metrics_cb(struct MyGstData* mgd) {
+    GString* out = g_string_new(NULL);
+
+    append_session_metrics(out, mgd);
 
-        if (video_sinkpad) {
-            gst_pad_add_probe(GST_PAD_PEER(video_sinkpad),
-                              GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
-                              remove_webrtcbin_probe_cb_video,
-                              webrtcbin,
-                              NULL);
+    append_video_branch_metrics(out, mgd);
 
-            gst_clear_object(&video_sinkpad);
+    metrics_append_family(out,
+                          "gwd_video_passthrough",
+                          "gauge",
+                          "1 if the source's H.264 video is streamed as is, 0 if it is decoded and re-encoded.");
+    metrics_append_value(out, "gwd_video_passthrough", NULL, mgd->passthrough);
+    if (mgd->vod_source) {
+        metrics_append_family(out, "gwd_vod_loops_total", "counter", "Times the cache was played through.");
+        metrics_append_value(out, "gwd_vod_loops_total", NULL, vod_source_get_loops(mgd->vod_source));
+    }
+    if (mgd->frame_dedup) {
+        guint64 n_frames, n_dropped;
+        gdouble seconds;
+        frame_dedup_get_stats(mgd->frame_dedup, &n_frames, &n_dropped, &seconds);
+        metrics_append_family(out, "gwd_raw_video_frames_total", "counter", "Raw frames checked for duplicates.");
+        metrics_append_value(out, "gwd_raw_video_frames_total", NULL, n_frames);
+        metrics_append_family(out,
+                              "gwd_raw_video_frames_duplicate_total",
+                              "counter",
+                              "Raw frames dropped before the encoders for being unchanged.");
+        metrics_append_value(out, "gwd_raw_video_frames_duplicate_total", NULL, n_dropped);
+        metrics_append_family(out,
+                              "gwd_raw_video_compare_seconds_total",
+                              "counter",
+                              "Time spent comparing raw frames with the last one encoded.");
+        metrics_append_value(out, "gwd_raw_video_compare_seconds_total", NULL, seconds);
+    }
+    metrics_append_process_cpu(out);
+    metrics_append_process_resources(out);
+
+    metrics_append_queue_levels(out, GST_BIN(mgd->pipeline));
+
+    metrics_append_family(out,
+                          "gwd_queue_overruns_total",
+                          "counter",
+                          "Buffers a queue dropped, or blocked on, for exceeding its latency budget.");
+    for (guint i = 0; i < G_N_ELEMENTS(queue_budgets); i++) {
+        gchar* labels = g_strdup_printf("queue=\"%s\"", queue_budgets[i].name);
+        metrics_append_value(out, "gwd_queue_overruns_total", labels, g_atomic_int_get(&mgd->queue_overruns[i]));
+        g_free(labels);
+    }
+
+    metrics_append_family(out,
+                          "gwd_input_queue_dropped_total",
+                          "counter",
+                          "Input events dropped because the application did not drain the queue in time.");
+    metrics_append_value(out, "gwd_input_queue_dropped_total", NULL, input_queue_get_dropped(mgd->input_queue));
+
+    metrics_append_family(out, "gwd_broadcasts_total", "counter", "Messages broadcast to all sessions.");
+    metrics_append_value(out, "gwd_broadcasts_total", NULL, g_atomic_int_get(&mgd->broadcasts));
+    metrics_append_family(out,
+                          "gwd_broadcast_duration_max_us",
+                          "gauge",
+                          "Longest time spent queuing one broadcast over the last interval.");
+    metrics_append_value(out,
+                         "gwd_broadcast_duration_max_us",
+                         NULL,
+                         g_atomic_int_exchange(&mgd->broadcast_duration_max_us, 0));
+
+    metrics_append_family(out,
+                          "gwd_control_queue_delay_max_ms",
+                          "gauge",
+                          "Longest wait of a signaling event for the control thread over the last interval.");
+    metrics_append_value(out, "gwd_control_queue_delay_max_ms", NULL, (gdouble)mgd->control_delay_max_us / 1000.0);
+    metrics_append_family(out, "gwd_control_ops_total", "counter", "Signaling events handled by the control thread.");
+    metrics_append_value(out, "gwd_control_ops_total", NULL, mgd->control_ops);
+    mgd->control_delay_max_us = 0;
+
+    struct rtp_stream_stats streams[RTP_ANALYZER_MAX_STREAMS];
+    const guint n_streams = rtp_analyzer_get_streams(mgd->rtp_analyzer, streams, RTP_ANALYZER_MAX_STREAMS);
+
+    const struct {
+        const gchar* name;
+        const gchar* help;
+        gsize offset;
+    } rtp_counters[] = {
+        {"gwd_rtp_packets_total",
+         "RTP packets sent by the payloader.",
+         G_STRUCT_OFFSET(struct rtp_stream_stats, packets)},
+        {"gwd_rtp_frames_total", "Frames sent by the payloader.", G_STRUCT_OFFSET(struct rtp_stream_stats, frames)},
+        {"gwd_rtp_seq_gaps_total",
+         "Gaps in the RTP sequence numbers.",
+         G_STRUCT_OFFSET(struct rtp_stream_stats, seq_gaps)},
+        {"gwd_rtp_pts_discontinuities_total",
+         "Buffer timestamps going backwards or jumping forward.",
+         G_STRUCT_OFFSET(struct rtp_stream_stats, pts_discontinuities)},
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(rtp_counters); i++) {
+        metrics_append_family(out, rtp_counters[i].name, "counter", rtp_counters[i].help);
+        for (guint s = 0; s < n_streams; s++) {
+            gchar* labels = g_strdup_printf("ssrc=\"%u\"", streams[s].ssrc);
+            metrics_append_value(out,
+                                 rtp_counters[i].name,
+                                 labels,
+                                 G_STRUCT_MEMBER(guint, &streams[s], rtp_counters[i].offset));
+            g_free(labels);
         }
     }
+
+    GBytes* metrics = g_string_free_to_bytes(out);
+    signaling_server_set_metrics(signaling_server, metrics);
+    g_bytes_unref(metrics);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gchar* snapshot_requested_cb(SignalingServer* server, const gboolean compress, struct MyGstData* mgd) {
+    return mgd->dot_snapshotter ? dot_snapshotter_request(mgd->dot_snapshotter, compress) : NULL;
+}
+
+#if defined(G_OS_UNIX) && !defined(__ANDROID__)
+/// `kill -USR1 <pid>` writes a compressed snapshot
+static gboolean snapshot_signal_cb(struct MyGstData* mgd) {
+    g_free(dot_snapshotter_request(mgd->dot_snapshotter, TRUE));
+    return G_SOURCE_CONTINUE;
+}
+#endif
+
+enum control_op_kind {
+    CONTROL_OP_CLIENT_CONNECTED,
+    CONTROL_OP_CLIENT_DISCONNECTED,
+    CONTROL_OP_SDP_ANSWER,
+    CONTROL_OP_CANDIDATE,
+    CONTROL_OP_END_OF_CANDIDATES,
+    CONTROL_OP_RESTART,
+};
+
+/// Signaling event queued from the signaling thread to the control thread
+struct control_op {
+    struct MyGstData* mgd;
+    enum control_op_kind kind;
+    ClientId client_id;
+    guint m_line_index;
+    gchar* str;
+    /// The client's video codecs, for CONTROL_OP_CLIENT_CONNECTED
+    gchar* codecs;
+    gint64 queued_us;
+};
+
+static void control_op_free(gpointer data) {
+    struct control_op* op = data;
+
+    g_free(op->str);
+    g_free(op->codecs);
+    g_free(op);
+}
+
+static gboolean control_op_dispatch(gpointer data) {
+    const struct control_op* op = data;
+    struct MyGstData* mgd = op->mgd;
+
+    mgd->control_ops++;
+    mgd->control_delay_max_us = MAX(mgd->control_delay_max_us, g_get_monotonic_time() - op->queued_us);
+
+    switch (op->kind) {
+        case CONTROL_OP_CLIENT_CONNECTED:
+            webrtc_client_connected_cb(signaling_server, op->client_id, op->str, op->codecs, mgd);
+            break;
+        case CONTROL_OP_CLIENT_DISCONNECTED:
+            webrtc_client_disconnected_cb(signaling_server, op->client_id, mgd);
+            break;
+        case CONTROL_OP_SDP_ANSWER:
+            webrtc_sdp_answer_cb(signaling_server, op->client_id, op->str, mgd);
+            break;
+        case CONTROL_OP_CANDIDATE:
+            webrtc_candidate_cb(signaling_server, op->client_id, op->m_line_index, op->str, mgd);
+            break;
+        case CONTROL_OP_END_OF_CANDIDATES:
+            webrtc_end_of_candidates_cb(signaling_server, op->client_id, mgd);
+            break;
+        case CONTROL_OP_RESTART:
+            webrtc_restart_requested_cb(signaling_server, op->client_id, mgd);
+            break;
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static struct control_op* control_op_new(struct MyGstData* mgd,
+                                         const enum control_op_kind kind,
+                                         const ClientId client_id,
+                                         const guint m_line_index,
+                                         const gchar* str) {
+    struct control_op* op = g_new0(struct control_op, 1);
+    op->mgd = mgd;
+    op->kind = kind;
+    op->client_id = client_id;
+    op->m_line_index = m_line_index;
+    op->str = g_strdup(str);
+    op->queued_us = g_get_monotonic_time();
+
+    return op;
+}
+
+/// Queue a signaling event to the control thread, in order, so the signaling thread never waits on negotiation.
+static void control_queue_push_op(struct MyGstData* mgd, struct control_op* op) {
+    g_main_context_invoke_full(mgd->control_context, G_PRIORITY_DEFAULT, control_op_dispatch, op, control_op_free);
+}
+
+static void control_queue_push(struct MyGstData* mgd,
+                               const enum control_op_kind kind,
+                               const ClientId client_id,
+                               const guint m_line_index,
+                               const gchar* str) {
+    control_queue_push_op(mgd, control_op_new(mgd, kind, client_id, m_line_index, str));
+}
+
+static void on_ws_client_connected(SignalingServer* server,
+                                   const ClientId client_id,
+                                   const gchar* resume_id,
+                                   const gchar* codecs,
+                                   struct MyGstData* mgd) {
+    struct control_op* op = control_op_new(mgd, CONTROL_OP_CLIENT_CONNECTED, client_id, 0, resume_id);
+    op->codecs = g_strdup(codecs);
+    control_queue_push_op(mgd, op);
+}
+
+static void on_ws_client_disconnected(SignalingServer* server, const ClientId client_id, struct MyGstData* mgd) {
+    control_queue_push(mgd, CONTROL_OP_CLIENT_DISCONNECTED, client_id, 0, NULL);
+}
+
+static void on_sdp_answer(SignalingServer* server, const ClientId client_id, const gchar* sdp, struct MyGstData* mgd) {
+    control_queue_push(mgd, CONTROL_OP_SDP_ANSWER, client_id, 0, sdp);
+}
+
+static void on_restart_requested(SignalingServer* server, const ClientId client_id, struct MyGstData* mgd) {
+    control_queue_push(mgd, CONTROL_OP_RESTART, client_id, 0, NULL);
+}
+
+static void on_candidate(SignalingServer* server,
+                         const ClientId client_id,
+                         const guint m_line_index,
+                         const gchar* candidate,
+                         struct MyGstData* mgd) {
+    control_queue_push(mgd, CONTROL_OP_CANDIDATE, client_id, m_line_index, candidate);
+}
+
+static void on_end_of_candidates(SignalingServer* server, const ClientId client_id, struct MyGstData* mgd) {
+    control_queue_push(mgd, CONTROL_OP_END_OF_CANDIDATES, client_id, 0, NULL);
+}
+
+/// Attach a source to the control context, returning its ID
+static guint control_attach(struct MyGstData* mgd, GSource* source, GSourceFunc func) {
+    g_source_set_callback(source, func, mgd, NULL);
+    const guint id = g_source_attach(source, mgd->control_context);
+    g_source_unref(source);
+    return id;
+}
+
+static void control_clear_source(struct MyGstData* mgd, guint* id) {
+    if (*id == 0) {
+        return;
+    }
+    GSource* source = g_main_context_find_source_by_id(mgd->control_context, *id);
+    if (source) {
+        g_source_destroy(source);
+    }
+    *id = 0;
 }
 
-GMainLoop* main_loop = NULL;
+static gpointer control_thread_func(gpointer data) {
+    struct MyGstData* mgd = data;
+
+    // Stats collectors and the RTP reports started from here attach to the thread-default context
+    g_main_context_push_thread_default(mgd->control_context);
+    g_main_loop_run(mgd->control_loop);
+    g_main_context_pop_thread_default(mgd->control_context);
 
-void* loop_thread(void* data) {
-    g_main_loop_run(main_loop);
     return NULL;
 }
 
+static gboolean control_quit_cb(gpointer data) {
+    g_main_loop_quit(data);
+    return G_SOURCE_REMOVE;
+}
+
 /*
  *
  * Exported functions.
@@ -448,15 +1882,32 @@ void* loop_thread(void* data) {
 void server_pipeline_play(struct MyGstData* mgd) {
     ALOGI("Starting pipeline");
 
-    main_loop = g_main_loop_new(NULL, FALSE);
-
     // Play the pipeline (but webrtcbin is not linked yet)
     const GstStateChangeReturn ret = gst_element_set_state(mgd->pipeline, GST_STATE_PLAYING);
     g_assert(ret != GST_STATE_CHANGE_FAILURE);
 
-    g_signal_connect(signaling_server, "ws-client-connected", G_CALLBACK(webrtc_client_connected_cb), mgd);
+    if (mgd->vod_source) {
+        vod_source_start(mgd->vod_source, 0);
+    }
+
+    g_signal_connect(signaling_server, "ws-client-connected", G_CALLBACK(on_ws_client_connected), mgd);
+
+    mgd->timeout_src_id_metrics = control_attach(mgd,
+                                                 g_timeout_source_new(METRICS_REFRESH_INTERVAL_MS),
+                                                 G_SOURCE_FUNC(refresh_metrics_cb));
+    mgd->timeout_src_id_layers =
+        control_attach(mgd, g_timeout_source_new(STATS_POLL_INTERVAL_MS), G_SOURCE_FUNC(adapt_layers_cb));
+
+    g_main_context_push_thread_default(mgd->control_context);
+    rtp_analyzer_start_reports(mgd->rtp_analyzer, RTP_REPORT_INTERVAL_MS);
+    g_main_context_pop_thread_default(mgd->control_context);
+
+#if defined(G_OS_UNIX) && !defined(__ANDROID__)
+    mgd->signal_src_id_snapshot =
+        control_attach(mgd, g_unix_signal_source_new(SIGUSR1), G_SOURCE_FUNC(snapshot_signal_cb));
+#endif
 
-    GThread* thread = g_thread_new("loop_thread", (GThreadFunc)loop_thread, NULL);
+    mgd->control_thread = g_thread_new("pipeline-control", control_thread_func, mgd);
 }
 
 void server_pipeline_stop(struct MyGstData* mgd) {
@@ -469,7 +1920,7 @@ void server_pipeline_stop(struct MyGstData* mgd) {
     // Wait for an EOS message on the pipeline bus.
     ALOGD("Waiting for EOS message");
     GstMessage* msg = gst_bus_timed_pop_filtered(GST_ELEMENT_BUS(mgd->pipeline),
-                                                 GST_CLOCK_TIME_NONE,
+                                                 STOP_EOS_TIMEOUT_MS * GST_MSECOND,
                                                  GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
 
     // TODO: should check if we got an error message here or an eos.
@@ -479,11 +1930,67 @@ void server_pipeline_stop(struct MyGstData* mgd) {
     ALOGI("Setting pipeline state to NULL");
     gst_element_set_state(mgd->pipeline, GST_STATE_NULL);
 
-    g_clear_handle_id(&mgd->timeout_src_id_dot_data, g_source_remove);
+    // Nothing new reaches the control thread from here, and whatever is still queued is dropped with the context
+    g_signal_handlers_disconnect_by_data(signaling_server, mgd);
+    if (mgd->control_thread) {
+        g_main_context_invoke(mgd->control_context, control_quit_cb, mgd->control_loop);
+        g_clear_pointer(&mgd->control_thread, g_thread_join);
+    }
+    g_clear_pointer(&mgd->vod_source, vod_source_free);
+
+    gst_bus_remove_watch(GST_ELEMENT_BUS(mgd->pipeline));
+    control_clear_source(mgd, &mgd->timeout_src_id_metrics);
+    control_clear_source(mgd, &mgd->timeout_src_id_layers);
+    control_clear_source(mgd, &mgd->signal_src_id_snapshot);
+    g_clear_pointer(&mgd->dot_snapshotter, dot_snapshotter_free);
+
+    for (guint i = 0; i < N_VIDEO_CODECS; i++) {
+        struct video_branch* branch = &mgd->video_branches[i];
+        if (branch->linger_src) {
+            g_source_destroy(branch->linger_src);
+            g_clear_pointer(&branch->linger_src, g_source_unref);
+        }
+        g_clear_pointer(&branch->overload, overload_control_free);
+        g_clear_pointer(&branch->timing, encoder_timing_free);
+        gst_clear_object(&branch->raw_pad);
+        gst_clear_object(&branch->tee);
+        gst_clear_object(&branch->bin);
+    }
+    g_clear_pointer(&mgd->frame_dedup, frame_dedup_free);
+    g_clear_pointer(&mgd->rtp_analyzer, rtp_analyzer_free);
+    g_clear_pointer(&mgd->vod_cache, vod_cache_free);
+
+    g_mutex_lock(&mgd->sessions_mutex);
+    g_hash_table_remove_all(mgd->sessions);
+    g_hash_table_remove_all(mgd->detached_sessions);
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    g_clear_pointer(&mgd->input_queue, input_queue_free);
+
+    g_clear_pointer(&mgd->control_loop, g_main_loop_unref);
+    g_clear_pointer(&mgd->control_context, g_main_context_unref);
 }
 
 #define U_TYPED_CALLOC(TYPE) ((TYPE*)calloc(1, sizeof(TYPE)))
 
+static gboolean passthrough_start_cb(gpointer data) {
+    const struct MyGstData* mgd = data;
+
+    GstElement* demuxer = gst_bin_get_by_name(GST_BIN(mgd->pipeline), PASSTHROUGH_DEMUX_NAME);
+    if (!passthrough_seek_start(demuxer, TRUE)) {
+        ALOGE("Cannot start the passthrough segment, the video will end with the file");
+    }
+    gst_object_unref(demuxer);
+
+    return G_SOURCE_REMOVE;
+}
+
+/// From the demuxer's streaming thread, which cannot seek itself. Queued rather than invoked: the control thread may
+/// not run yet, and the context would then be acquired right here.
+static void passthrough_demux_ready_cb(GstElement* demuxer, struct MyGstData* mgd) {
+    control_attach(mgd, g_idle_source_new(), passthrough_start_cb);
+}
+
 static void on_handoff(GstElement* identity, GstBuffer* buffer, gpointer user_data) {
     GstClockTime pts = GST_BUFFER_PTS(buffer);
     GstClockTime dts = GST_BUFFER_DTS(buffer);
@@ -497,6 +2004,14 @@ void server_pipeline_create(struct MyGstData** out_mgd) {
 
     struct MyGstData* mgd = U_TYPED_CALLOC(struct MyGstData);
 
+    mgd->sessions = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, session_remove);
+    mgd->detached_sessions = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, session_remove);
+    g_mutex_init(&mgd->sessions_mutex);
+    mgd->input_queue = input_queue_new();
+
+    mgd->control_context = g_main_context_new();
+    mgd->control_loop = g_main_loop_new(mgd->control_context, FALSE);
+
 #ifdef __linux__
     // Trace logs
     // setenv("GST_DEBUG", "GST_TRACER:7", 1);
@@ -522,50 +2037,115 @@ void server_pipeline_create(struct MyGstData** out_mgd) {
     }
 
     gst_init(NULL, NULL);
+    preprocess_register();
+
+#ifndef ANDROID
+    const gchar* vod_path = g_getenv(VOD_CACHE_ENV);
+    if (vod_path != NULL) {
+        mgd->vod_cache = vod_cache_open(vod_path, &error);
+        if (mgd->vod_cache == NULL) {
+            ALOGE("Cannot play %s, playing %s instead: %s", vod_path, TEST_MEDIA_LOCATION, error->message);
+            g_clear_error(&error);
+        }
+    }
+    // A cache is encoded already, its video is served as is too
+    mgd->passthrough = mgd->vod_cache != NULL || passthrough_probe(TEST_MEDIA_LOCATION, NULL);
+#endif
 
     // Setup pipeline
     // is-live=true is to fix first frame delay
-    gchar* pipeline_str = g_strdup_printf(
+    gchar* pipeline_str;
+#ifndef ANDROID
+    if (mgd->vod_cache) {
+        // Packets go straight from the cache to the tees
+        const struct video_codec* h264 = &video_codecs[VIDEO_CODEC_H264];
+        pipeline_str = g_strdup_printf(
+            "appsrc name=" VOD_AUDIO_SRC_NAME " is-live=true format=time "
+            "caps=\"application/x-rtp,media=audio,encoding-name=OPUS,payload=%u,clock-rate=48000\" ! "
+            "tee name=%s allow-not-linked=true "
+            "appsrc name=" VOD_VIDEO_SRC_NAME " is-live=true format=time "
+            "caps=\"application/x-rtp,media=video,encoding-name=%s,payload=%u,clock-rate=90000%s\" ! "
+            "tee name=%s allow-not-linked=true",
+            AUDIO_PAYLOAD,
+            AUDIO_TEE_NAME,
+            h264->name,
+            h264->payload,
+            h264->rtp_fields,
+            PASSTHROUGH_TEE_NAME);
+    } else if (mgd->passthrough) {
+        // Nothing is decoded but the audio. clocksync paces each path in real time, which the local display sink does
+        // in the other mode, and the queues after the demuxer let it read ahead of the slower path.
+        const struct video_codec* h264 = &video_codecs[VIDEO_CODEC_H264];
+        pipeline_str = g_strdup_printf(
+            "filesrc location=%s ! "
+            "qtdemux name=%s "
+            "%s.audio_0 ! "
+            "queue max-size-time=2000000000 max-size-buffers=0 max-size-bytes=0 ! "
+            "decodebin3 ! "
+            "clocksync ! "
+            "queue name=q_audio_in ! "
+            AUDIO_ENCODE_DESCRIPTION
+            "tee name=%s allow-not-linked=true "
+            "%s.video_0 ! "
+            "queue max-size-time=2000000000 max-size-buffers=0 max-size-bytes=0 ! "
+            // In-band SPS/PPS before every key frame, so clients can start at any of them
+            "h264parse config-interval=-1 ! "
+            "video/x-h264,stream-format=byte-stream,alignment=au ! "
+            "clocksync ! "
+            "%s name=pay ! "
+            "application/x-rtp,payload=%u,ssrc=(uint)%u ! "
+            "tee name=%s allow-not-linked=true",
+            TEST_MEDIA_LOCATION,
+            PASSTHROUGH_DEMUX_NAME,
+            PASSTHROUGH_DEMUX_NAME,
+            AUDIO_TEE_NAME,
+            PASSTHROUGH_DEMUX_NAME,
+            h264->payloader,
+            h264->payload,
+            h264->ssrc,
+            PASSTHROUGH_TEE_NAME);
+    } else
+#endif
+    {
+        pipeline_str = g_strdup_printf(
 #ifndef ANDROID
-        "filesrc location=test.mp4 ! "
-        "decodebin3 name=dec "
-        "dec. ! "
-        "queue ! "
+            "filesrc location=" TEST_MEDIA_LOCATION " ! "
+            "decodebin3 name=dec "
+            "dec. ! "
+            // The file is not live, pace the decoder in front of the leaky queues
+            "clocksync ! "
+            "queue name=q_audio_in ! "
 #else
-        // "openslessrc ! " // Mic
-        // "audiotestsrc is-live=true wave=red-noise ! " // Test audio
-        "appsrc name=audiosrc format=GST_FORMAT_TIME is-live=true ! "
-        "audio/x-raw,format=S16LE,layout=interleaved,rate=44100,channels=2 ! "
+            // "openslessrc ! " // Mic
+            // "audiotestsrc is-live=true wave=red-noise ! " // Test audio
+            "appsrc name=audiosrc format=GST_FORMAT_TIME is-live=true ! "
+            "audio/x-raw,format=S16LE,layout=interleaved,rate=44100,channels=2 ! "
 #endif
-        "audioconvert ! "
-        "audioresample ! "
-        "queue ! "
-        "opusenc perfect-timestamp=true ! "
-        "rtpopuspay ! "
-        "application/x-rtp,encoding-name=OPUS,media=audio,payload=127,ssrc=(uint)3484078953 ! "
-        "queue ! "
-        "tee name=%s allow-not-linked=true "
+            AUDIO_ENCODE_DESCRIPTION
+            "tee name=%s allow-not-linked=true "
 #ifndef ANDROID
-        "dec. ! "
+            "dec. ! "
+            "clocksync ! "
 #else
-        "videotestsrc pattern=colors is-live=true horizontal-speed=2 ! "
-        "video/x-raw,format=NV12,width=1280,height=720,framerate=60/1 ! "
+            "videotestsrc pattern=colors is-live=true horizontal-speed=2 ! "
+            "video/x-raw,format=NV12,width=1280,height=720,framerate=60/1 ! "
 #endif
-        "queue name=q1 ! "
-        "videoconvert ! "
-        "timeoverlay ! "
+            "queue name=q1 ! "
+            // In passthrough unless the decoder outputs neither I420 nor NV12
+            "videoconvert ! "
+            PREPROCESS_ELEMENT_NAME " name=%s downscale=%u ! "
 #ifndef ANDROID
-        // FIXME: this autovideosink is added to fix stream arriving super late on native platforms
-        // Local display sink for latency comparison
-        "tee name=testlocalsink ! videoconvert ! autovideosink testlocalsink. ! "
+            // FIXME: this autovideosink is added to fix stream arriving super late on native platforms
+            // Local display sink for latency comparison
+            "tee name=testlocalsink ! videoconvert ! autovideosink testlocalsink. ! "
 #endif
-        "encodebin2 "
-        "profile=\"video/x-h264|element-properties,tune=4,speed-preset=1,bframes=0,key-int-max=120,bitrate=16000\" ! "
-        "rtph264pay name=rtppay config-interval=-1 aggregate-mode=zero-latency ! "
-        "application/x-rtp,payload=96,ssrc=(uint)3484078952 ! "
-        "tee name=%s allow-not-linked=true",
-        AUDIO_TEE_NAME,
-        VIDEO_TEE_NAME);
+            // Each codec's encoder is only added while a session uses it
+            "tee name=%s allow-not-linked=true",
+            AUDIO_TEE_NAME,
+            PREPROCESS_NAME,
+            g_strcmp0(g_getenv(PREPROCESS_DOWNSCALE_ENV), "2") == 0 ? 2 : 1,
+            RAW_VIDEO_TEE_NAME);
+    }
 
     // No webrtcbin yet until later!
 
@@ -576,9 +2156,95 @@ void server_pipeline_create(struct MyGstData** out_mgd) {
     g_assert_no_error(error);
     g_free(pipeline_str);
 
-    GstPad* pad = gst_element_get_static_pad(gst_bin_get_by_name(GST_BIN(pipeline), "rtppay"), "src");
-    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)on_buffer_probe_cb, NULL, NULL);
-    gst_object_unref(pad);
+    for (guint i = 0; i < G_N_ELEMENTS(queue_budgets); i++) {
+        GstElement* queue = gst_bin_get_by_name(GST_BIN(pipeline), queue_budgets[i].name);
+        if (queue == NULL) {
+            continue;
+        }
+        const guint64 budget_ns = LATENCY_BUDGET_MS * GST_MSECOND * queue_budgets[i].percent / 100;
+        configure_queue(queue, budget_ns, queue_budgets[i].leaky);
+        g_signal_connect(queue, "overrun", G_CALLBACK(queue_overrun_cb), &mgd->queue_overruns[i]);
+        gst_object_unref(queue);
+    }
+
+    // Video payloaders are attached as their encoders start
+    mgd->rtp_analyzer = rtp_analyzer_new("server");
+    {
+        const gchar* name = mgd->vod_cache ? VOD_AUDIO_SRC_NAME : "audiopay";
+        GstElement* payloader = gst_bin_get_by_name(GST_BIN(pipeline), name);
+        GstPad* pad = gst_element_get_static_pad(payloader, "src");
+        rtp_analyzer_attach(mgd->rtp_analyzer, pad);
+        gst_object_unref(pad);
+        gst_object_unref(payloader);
+    }
+
+    for (guint i = 0; i < N_VIDEO_CODECS; i++) {
+        struct video_branch* branch = &mgd->video_branches[i];
+        branch->mgd = mgd;
+        branch->codec = i;
+        branch->available = TRUE;
+        if (mgd->passthrough) {
+            // Nothing is decoded to encode the other codecs from
+            branch->available = i == VIDEO_CODEC_H264;
+            ALOGI("%s video: %s", video_codecs[i].name, branch->available ? "passthrough" : "not in passthrough");
+            continue;
+        }
+        for (guint f = 0; f < G_N_ELEMENTS(video_codecs[i].factories); f++) {
+            GstElementFactory* factory = gst_element_factory_find(video_codecs[i].factories[f]);
+            if (factory == NULL) {
+                branch->available = FALSE;
+                break;
+            }
+            gst_object_unref(factory);
+        }
+        ALOGI("%s video: %s", video_codecs[i].name, branch->available ? "available" : "missing elements");
+    }
+
+    // The passthrough H264 branch is part of the pipeline, always running whether or not any session uses it
+    if (mgd->passthrough) {
+        struct video_branch* branch = &mgd->video_branches[VIDEO_CODEC_H264];
+        branch->tee = gst_bin_get_by_name(GST_BIN(pipeline), PASSTHROUGH_TEE_NAME);
+
+        GstElement* payloader = gst_bin_get_by_name(GST_BIN(pipeline), mgd->vod_cache ? VOD_VIDEO_SRC_NAME : "pay");
+        GstPad* pad = gst_element_get_static_pad(payloader, "src");
+        rtp_analyzer_attach(mgd->rtp_analyzer, pad);
+        gst_object_unref(pad);
+        gst_object_unref(payloader);
+    }
+
+    if (mgd->vod_cache) {
+        GstElement* srcs[VOD_CACHE_N_STREAMS] = {
+            [VOD_CACHE_STREAM_VIDEO] = gst_bin_get_by_name(GST_BIN(pipeline), VOD_VIDEO_SRC_NAME),
+            [VOD_CACHE_STREAM_AUDIO] = gst_bin_get_by_name(GST_BIN(pipeline), VOD_AUDIO_SRC_NAME),
+        };
+        const guint payloads[VOD_CACHE_N_STREAMS] = {
+            [VOD_CACHE_STREAM_VIDEO] = video_codecs[VIDEO_CODEC_H264].payload,
+            [VOD_CACHE_STREAM_AUDIO] = AUDIO_PAYLOAD,
+        };
+        const guint32 ssrcs[VOD_CACHE_N_STREAMS] = {
+            [VOD_CACHE_STREAM_VIDEO] = video_codecs[VIDEO_CODEC_H264].ssrc,
+            [VOD_CACHE_STREAM_AUDIO] = AUDIO_SSRC,
+        };
+        mgd->vod_source = vod_source_new(mgd->vod_cache, pipeline, srcs, payloads, ssrcs);
+        for (guint i = 0; i < VOD_CACHE_N_STREAMS; i++) {
+            gst_object_unref(srcs[i]);
+        }
+    } else if (mgd->passthrough) {
+        // Once the demuxer exposed its streams, restart the file as a segment that loops rather than ends
+        GstElement* demuxer = gst_bin_get_by_name(GST_BIN(pipeline), PASSTHROUGH_DEMUX_NAME);
+        g_signal_connect(demuxer, "no-more-pads", G_CALLBACK(passthrough_demux_ready_cb), mgd);
+        gst_object_unref(demuxer);
+    }
+
+    if (!mgd->passthrough) {
+        GstElement* preprocess = gst_bin_get_by_name(GST_BIN(pipeline), PREPROCESS_NAME);
+        GstPad* pad = gst_element_get_static_pad(preprocess, "sink");
+        mgd->frame_dedup = frame_dedup_new(pad);
+        gst_object_unref(pad);
+        gst_object_unref(preprocess);
+    }
+
+    g_assert(mgd->video_branches[VIDEO_CODEC_DEFAULT].available);
 
     GstElement* iden = gst_bin_get_by_name(GST_BIN(pipeline), "identity");
     if (iden) {
@@ -586,14 +2252,22 @@ void server_pipeline_create(struct MyGstData** out_mgd) {
         gst_object_unref(iden);
     }
 
+    // The bus watch attaches to the thread-default context
     GstBus* bus = gst_element_get_bus(pipeline);
+    g_main_context_push_thread_default(mgd->control_context);
     gst_bus_add_watch(bus, gst_bus_cb, mgd);
+    g_main_context_pop_thread_default(mgd->control_context);
     gst_object_unref(bus);
 
     // "ws-client-connected" will be connected later when the pipeline starts playing
-    g_signal_connect(signaling_server, "ws-client-disconnected", G_CALLBACK(webrtc_client_disconnected_cb), mgd);
-    g_signal_connect(signaling_server, "sdp-answer", G_CALLBACK(webrtc_sdp_answer_cb), mgd);
-    g_signal_connect(signaling_server, "candidate", G_CALLBACK(webrtc_candidate_cb), mgd);
+    g_signal_connect(signaling_server, "ws-client-disconnected", G_CALLBACK(on_ws_client_disconnected), mgd);
+    g_signal_connect(signaling_server, "sdp-answer", G_CALLBACK(on_sdp_answer), mgd);
+    g_signal_connect(signaling_server, "candidate", G_CALLBACK(on_candidate), mgd);
+    g_signal_connect(signaling_server, "end-of-candidates", G_CALLBACK(on_end_of_candidates), mgd);
+    g_signal_connect(signaling_server, "restart-requested", G_CALLBACK(on_restart_requested), mgd);
+
+    mgd->dot_snapshotter = dot_snapshotter_new(pipeline, "server");
+    g_signal_connect(signaling_server, "snapshot-requested", G_CALLBACK(snapshot_requested_cb), mgd);
 
     mgd->pipeline = pipeline;
     *out_mgd = mgd;
@@ -653,3 +2327,123 @@ void server_pipeline_push_pcm(struct MyGstData* mgd, const void* audio_bytes, co
 
     gst_object_unref(audio_app_src);
 }
+
+void server_pipeline_set_bulk_received_callback(struct MyGstData* mgd,
+                                                const server_bulk_received_func func,
+                                                const gpointer user_data) {
+    mgd->bulk_received = func;
+    mgd->bulk_received_data = user_data;
+}
+
+static gboolean session_has_id(gpointer key, gpointer value, gpointer user_data) {
+    const struct MySession* session = value;
+    return g_strcmp0(session->id, user_data) == 0;
+}
+
+guint32 server_pipeline_send_bulk(struct MyGstData* mgd,
+                                  const char* session_id,
+                                  GBytes* data,
+                                  const bulk_transfer_done_func done,
+                                  const gpointer user_data) {
+    guint32 transfer_id = 0;
+
+    // Under the lock, so the session cannot be removed meanwhile. Sending does not call back into us.
+    g_mutex_lock(&mgd->sessions_mutex);
+    struct MySession* session = g_hash_table_find(mgd->sessions, session_has_id, (gpointer)session_id);
+    if (session == NULL) {
+        session = g_hash_table_lookup(mgd->detached_sessions, session_id);
+    }
+    if (session && session->bulk) {
+        transfer_id = bulk_transfer_send(session->bulk, data, done, user_data);
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    if (transfer_id == 0) {
+        ALOGW("Cannot send bulk data to session %s", session_id);
+    }
+
+    return transfer_id;
+}
+
+struct input_queue* server_pipeline_get_input_queue(struct MyGstData* mgd) {
+    return mgd->input_queue;
+}
+
+/*!
+ * What server_pipeline_broadcast() needs of one session, taken under the sessions lock and used outside of it.
+ */
+struct broadcast_target {
+    struct MySession* session;
+    /// session->bulk is cleared on the session's removal, this keeps it valid and failing sends from then on
+    struct bulk_transfer* bulk;
+};
+
+static void broadcast_target_clear(gpointer data) {
+    struct broadcast_target* target = data;
+    bulk_transfer_unref(target->bulk);
+    session_release(target->session);
+}
+
+/// Queue @p data on one session's data channel, unless it is too far behind
+static gboolean session_broadcast(const struct broadcast_target* target, GBytes* data) {
+    struct MySession* session = target->session;
+
+    GstWebRTCDataChannelState state;
+    guint64 buffered;
+    g_object_get(session->data_channel, "ready-state", &state, "buffered-amount", &buffered, NULL);
+
+    if (state != GST_WEBRTC_DATA_CHANNEL_STATE_OPEN) {
+        return FALSE;
+    }
+
+    if (buffered + bulk_transfer_get_queued_bytes(target->bulk) > BROADCAST_MAX_BEHIND_BYTES) {
+        g_atomic_int_inc(&session->broadcast_skipped);
+        ALOGD("Session %s is too far behind, skipping broadcast", session->id);
+        return FALSE;
+    }
+
+    // The channel wraps the bytes without copying, so every session shares them
+    if (g_bytes_get_size(data) <= BULK_TRANSFER_CHUNK_SIZE) {
+        return gst_webrtc_data_channel_send_data_full(session->data_channel, data, NULL);
+    }
+    return bulk_transfer_send(target->bulk, data, NULL, NULL) != 0;
+}
+
+guint server_pipeline_broadcast(struct MyGstData* mgd, GBytes* data) {
+    const gint64 start_us = g_get_monotonic_time();
+
+    // Only references are taken under the lock, so that sessions come and go while a slow channel is being sent to
+    GArray* targets = g_array_new(FALSE, FALSE, sizeof(struct broadcast_target));
+    g_array_set_clear_func(targets, broadcast_target_clear);
+    g_mutex_lock(&mgd->sessions_mutex);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, mgd->sessions);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct MySession* session = value;
+        if (session->bulk) {
+            const struct broadcast_target target = {g_atomic_rc_box_acquire(session), bulk_transfer_ref(session->bulk)};
+            g_array_append_val(targets, target);
+        }
+    }
+    g_mutex_unlock(&mgd->sessions_mutex);
+
+    guint n_sent = 0;
+    for (guint i = 0; i < targets->len; i++) {
+        if (session_broadcast(&g_array_index(targets, struct broadcast_target, i), data)) {
+            n_sent++;
+        }
+    }
+    g_array_unref(targets);
+
+    g_atomic_int_inc(&mgd->broadcasts);
+
+    const gint duration_us = (gint)MIN(g_get_monotonic_time() - start_us, G_MAXINT);
+    gint max_us;
+    do {
+        max_us = g_atomic_int_get(&mgd->broadcast_duration_max_us);
+    } while (duration_us > max_us &&
+             !g_atomic_int_compare_and_exchange(&mgd->broadcast_duration_max_us, max_us, duration_us));
+
+    return n_sent;
+}
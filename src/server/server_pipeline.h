@@ -1,19 +1,82 @@
 #pragma once
 
+#include "../common/bulk_transfer.h"
+#include "input_queue.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*!
+ * Threading: the pipeline has its own GMainContext, run on a "pipeline-control" thread started by
+ * @ref server_pipeline_play. That thread owns the bus watch, negotiation (webrtcbin creation, SDP and remote
+ * candidates), stats polling and the metrics refresh. Signaling events arrive from the signaling server's own thread
+ * and are queued to it in order, and outgoing SDP/candidates are queued back the other way, so neither thread ever
+ * blocks on the other.
+ *
+ * The functions below are called from the application thread, not from either of those.
+ */
 struct MyGstData;
 
 void server_pipeline_create(struct MyGstData** out_mgd);
 
+/*!
+ * Start the pipeline and the control thread.
+ */
 void server_pipeline_play(struct MyGstData* mgd);
 
+/*!
+ * Stop the pipeline and join the control thread.
+ */
 void server_pipeline_stop(struct MyGstData* mgd);
 
 void server_pipeline_push_pcm(struct MyGstData* mgd, const void* audio_bytes, int size);
 
+/*!
+ * Called from the control thread with each bulk transfer a client has sent over its data channel.
+ *
+ * @param session_id The session the transfer arrived on, see @ref server_pipeline_send_bulk.
+ */
+typedef void (*server_bulk_received_func)(void* user_data, const char* session_id, guint32 transfer_id, GBytes* data);
+
+/*!
+ * Must be called before @ref server_pipeline_play.
+ */
+void server_pipeline_set_bulk_received_callback(struct MyGstData* mgd, server_bulk_received_func func, void* user_data);
+
+/*!
+ * Send a large message to the client of a session, in chunks paced by its data channel's send buffer. A session
+ * waiting to be resumed keeps its queue. May be called from any thread.
+ *
+ * @param done Called from the control thread. May be NULL.
+ *
+ * @return The transfer ID, or 0 if there is no such session.
+ */
+guint32 server_pipeline_send_bulk(struct MyGstData* mgd,
+                                  const char* session_id,
+                                  GBytes* data,
+                                  bulk_transfer_done_func done,
+                                  void* user_data);
+
+/*!
+ * Send one message to every connected client over its data channel. Serialize it once: the same @p data is shared by
+ * all sessions, messages up to BULK_TRANSFER_CHUNK_SIZE are sent as is and larger ones as bulk transfers.
+ *
+ * Never blocks on a slow client: a session that is too far behind on its channel misses the message, which is counted
+ * in its metrics. Sessions can join and leave while a broadcast is being sent. May be called from any thread.
+ *
+ * @return The number of sessions the message was queued for.
+ */
+guint server_pipeline_broadcast(struct MyGstData* mgd, GBytes* data);
+
+/*!
+ * Input events received from every session's input channel, for the application to drain with @ref input_queue_pop
+ * from any thread. Each entry's session number matches the suffix of the session's webrtcbin name.
+ *
+ * Valid from @ref server_pipeline_create until @ref server_pipeline_stop.
+ */
+struct input_queue* server_pipeline_get_input_queue(struct MyGstData* mgd);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,14 +1,15 @@
 #include "signaling_server.h"
 
 #include <glib/gstdio.h>
-#include <json-glib/json-glib.h>
 #include <libsoup/soup-server.h>
 #include <libsoup/soup-version.h>
+#include <string.h>
 
 #if SOUP_CHECK_VERSION(3, 0, 0)
     #include <libsoup/soup-server-message.h>
 #endif
 
+#include "../common/signaling_protocol.h"
 #include "../utils/logger.h"
 
 struct _SignalingServer {
@@ -16,9 +17,66 @@ struct _SignalingServer {
 
     SoupServer *soup_server;
 
-    GSList *websocket_connections;
+    /// Websocket I/O, the HTTP endpoints and all connection state live on this context and its thread
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+
+    /// ClientId -> struct signaling_connection*, only touched from the signaling thread
+    GHashTable *connections;
+    /// Last ClientId handed out, signaling thread only
+    gsize last_client_id;
+
+    /// Longest time a send waited to reach the signaling thread in the current and the previous window, signaling
+    /// thread only
+    gint64 send_delay_max_us[2];
+    gint64 send_delay_window_us;
+
+    /// Signaling counters, updated atomically and read by the metrics endpoint
+    guint connections_total;
+    guint messages_received;
+    guint messages_sent;
+    guint messages_invalid;
+    guint bytes_received;
+    guint bytes_sent;
+
+    /// Last metrics text published with signaling_server_set_metrics()
+    GMutex metrics_mutex;
+    GBytes *metrics;
 };
 
+/*!
+ * Per websocket connection state.
+ */
+struct signaling_connection {
+    /// Handed out to users, see ClientId
+    ClientId id;
+    SoupWebsocketConnection *websocket;
+    gchar *remote_host;
+    gint64 connected_us;
+
+    guint messages_received;
+    guint messages_sent;
+    guint bytes_received;
+    guint bytes_sent;
+
+    /// Reused for every message on this connection
+    struct signaling_codec *codec;
+    /// Only for clients speaking SIGNALING_PROTOCOL_V2, NULL otherwise
+    struct signaling_candidate_batcher *batcher;
+
+    SignalingServer *server;
+    gulong message_handler_id;
+    gulong closed_handler_id;
+};
+
+/// The longest send delay is reported over the last one to two of these windows, whoever scrapes and how often
+#define SEND_DELAY_WINDOW_US (10 * G_USEC_PER_SEC)
+
+#define METRICS_PATH "/metrics"
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+#define SNAPSHOT_PATH "/debug/snapshot"
+
 G_DEFINE_TYPE(SignalingServer, signaling_server, G_TYPE_OBJECT)
 
 enum {
@@ -26,6 +84,9 @@ enum {
     SIGNAL_WS_CLIENT_DISCONNECTED,
     SIGNAL_SDP_ANSWER,
     SIGNAL_CANDIDATE,
+    SIGNAL_END_OF_CANDIDATES,
+    SIGNAL_RESTART_REQUESTED,
+    SIGNAL_SNAPSHOT_REQUESTED,
     N_SIGNALS
 };
 
@@ -35,119 +96,393 @@ SignalingServer *signaling_server_new() {
     return GWD_SIGNALING_SERVER(g_object_new(TYPE_SIGNALING_SERVER, NULL));
 }
 
+/// Move on to the window @p now_us is in
+static void signaling_server_send_delay_rotate(SignalingServer *server, const gint64 now_us) {
+    const gint64 elapsed_us = now_us - server->send_delay_window_us;
+    if (elapsed_us < SEND_DELAY_WINDOW_US) {
+        return;
+    }
+
+    server->send_delay_max_us[1] = elapsed_us < 2 * SEND_DELAY_WINDOW_US ? server->send_delay_max_us[0] : 0;
+    server->send_delay_max_us[0] = 0;
+    server->send_delay_window_us = now_us - elapsed_us % SEND_DELAY_WINDOW_US;
+}
+
+/// Render the Prometheus text exposition. Only reads cached values, never touches the pipeline.
+static GBytes *signaling_server_render_metrics(SignalingServer *server) {
+    GString *out = g_string_new(NULL);
+
+    signaling_server_send_delay_rotate(server, g_get_monotonic_time());
+    const gint64 send_delay_max_us = MAX(server->send_delay_max_us[0], server->send_delay_max_us[1]);
+
+    g_string_append_printf(out,
+                           "# HELP gwd_signaling_connections Open websocket connections.\n"
+                           "# TYPE gwd_signaling_connections gauge\n"
+                           "gwd_signaling_connections %u\n"
+                           "# HELP gwd_signaling_connections_total Websocket connections accepted.\n"
+                           "# TYPE gwd_signaling_connections_total counter\n"
+                           "gwd_signaling_connections_total %u\n"
+                           "# HELP gwd_signaling_messages_received_total Signaling messages received.\n"
+                           "# TYPE gwd_signaling_messages_received_total counter\n"
+                           "gwd_signaling_messages_received_total %u\n"
+                           "# HELP gwd_signaling_messages_sent_total Signaling messages sent.\n"
+                           "# TYPE gwd_signaling_messages_sent_total counter\n"
+                           "gwd_signaling_messages_sent_total %u\n"
+                           "# HELP gwd_signaling_messages_invalid_total Signaling messages that could not be parsed.\n"
+                           "# TYPE gwd_signaling_messages_invalid_total counter\n"
+                           "gwd_signaling_messages_invalid_total %u\n"
+                           "# HELP gwd_signaling_bytes_received_total Signaling payload bytes received.\n"
+                           "# TYPE gwd_signaling_bytes_received_total counter\n"
+                           "gwd_signaling_bytes_received_total %u\n"
+                           "# HELP gwd_signaling_bytes_sent_total Signaling payload bytes sent.\n"
+                           "# TYPE gwd_signaling_bytes_sent_total counter\n"
+                           "gwd_signaling_bytes_sent_total %u\n"
+                           "# HELP gwd_signaling_send_delay_max_ms Longest wait of a send for the signaling thread "
+                           "over the last 10 to 20 s.\n"
+                           "# TYPE gwd_signaling_send_delay_max_ms gauge\n"
+                           "gwd_signaling_send_delay_max_ms %.3f\n",
+                           g_hash_table_size(server->connections),
+                           g_atomic_int_get(&server->connections_total),
+                           g_atomic_int_get(&server->messages_received),
+                           g_atomic_int_get(&server->messages_sent),
+                           g_atomic_int_get(&server->messages_invalid),
+                           g_atomic_int_get(&server->bytes_received),
+                           g_atomic_int_get(&server->bytes_sent),
+                           (gdouble)send_delay_max_us / 1000.0);
+
+    g_mutex_lock(&server->metrics_mutex);
+    if (server->metrics != NULL) {
+        gsize size = 0;
+        const gchar *data = g_bytes_get_data(server->metrics, &size);
+        g_string_append_len(out, data, (gssize)size);
+    }
+    g_mutex_unlock(&server->metrics_mutex);
+
+    return g_string_free_to_bytes(out);
+}
+
+/// Request a pipeline snapshot, see the "snapshot-requested" signal.
+static guint signaling_server_handle_snapshot(SignalingServer *server,
+                                             GHashTable *query,
+                                             GBytes **out_body,
+                                             const char **out_reason) {
+    const char *compress_str = query ? g_hash_table_lookup(query, "compress") : NULL;
+    const gboolean compress = compress_str == NULL || !g_str_equal(compress_str, "0");
+
+    if (!g_signal_has_handler_pending(server, signals[SIGNAL_SNAPSHOT_REQUESTED], 0, FALSE)) {
+        *out_reason = "No pipeline";
+        return SOUP_STATUS_SERVICE_UNAVAILABLE;
+    }
+
+    gchar *path = NULL;
+    g_signal_emit(server, signals[SIGNAL_SNAPSHOT_REQUESTED], 0, compress, &path);
+
+    if (path == NULL) {
+        *out_reason = "Too Many Requests";
+        return 429;
+    }
+
+    // Written asynchronously, so only tell where it will land
+    gchar *body = g_strdup_printf("%s\n", path);
+    *out_body = g_bytes_new_take(body, strlen(body));
+    g_free(path);
+
+    return SOUP_STATUS_ACCEPTED;
+}
+
+/*!
+ * Route the plain HTTP requests, shared by the libsoup 2 and 3 handlers.
+ *
+ * @return The status code. @p out_body is left NULL for an empty body.
+ */
+static guint signaling_server_handle_http(SignalingServer *server,
+                                         const char *method,
+                                         const char *path,
+                                         GHashTable *query,
+                                         GBytes **out_body,
+                                         const char **out_content_type,
+                                         const char **out_reason) {
+    *out_content_type = "text/plain; charset=utf-8";
+    *out_reason = NULL;
+
+    if (!g_str_equal(method, SOUP_METHOD_GET)) {
+        return SOUP_STATUS_NOT_FOUND;
+    }
+
+    if (g_str_equal(path, METRICS_PATH)) {
+        *out_body = signaling_server_render_metrics(server);
+        *out_content_type = METRICS_CONTENT_TYPE;
+        return SOUP_STATUS_OK;
+    }
+
+    if (g_str_equal(path, SNAPSHOT_PATH)) {
+        return signaling_server_handle_snapshot(server, query, out_body, out_reason);
+    }
+
+    return SOUP_STATUS_NOT_FOUND;
+}
+
 #if !SOUP_CHECK_VERSION(3, 0, 0)
 
-static void http_cb(SoupServer *server,
+static void http_cb(SoupServer *soup_server,
                     SoupMessage *msg,
                     const char *path,
                     GHashTable *query,
                     SoupClientContext *client,
                     gpointer user_data) {
-    // We're not serving any HTTP traffic - if somebody (erroneously) submits an HTTP request,
-    // tell them to get lost.
-    ALOGE("Got an erroneous HTTP request from %s", soup_client_context_get_host(client));
-    soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+    SignalingServer *server = GWD_SIGNALING_SERVER(user_data);
+
+    GBytes *body = NULL;
+    const char *content_type;
+    const char *reason;
+    const guint status =
+        signaling_server_handle_http(server, msg->method, path, query, &body, &content_type, &reason);
+
+    if (status == SOUP_STATUS_NOT_FOUND) {
+        // We're not serving any other HTTP traffic - if somebody (erroneously) submits an HTTP request,
+        // tell them to get lost.
+        ALOGE("Got an erroneous HTTP request from %s", soup_client_context_get_host(client));
+    }
+
+    if (reason) {
+        soup_message_set_status_full(msg, status, reason);
+    } else {
+        soup_message_set_status(msg, status);
+    }
+
+    if (body) {
+        gsize size = 0;
+        const gchar *data = g_bytes_get_data(body, &size);
+        soup_message_set_response(msg, content_type, SOUP_MEMORY_COPY, data, size);
+        g_bytes_unref(body);
+    }
 }
 
 #else
 
-static void http_cb(SoupServer *server,     //
-                    SoupServerMessage *msg, //
-                    const char *path,       //
-                    GHashTable *query,      //
+static void http_cb(SoupServer *soup_server, //
+                    SoupServerMessage *msg,  //
+                    const char *path,        //
+                    GHashTable *query,       //
                     gpointer user_data) {
-    // We're not serving any HTTP traffic - if somebody (erroneously) submits an HTTP request,
-    // tell them to get lost.
-    ALOGE("Got an erroneous HTTP request from %s", soup_server_message_get_remote_host(msg));
-    soup_server_message_set_status(msg, SOUP_STATUS_NOT_FOUND, NULL);
+    SignalingServer *server = GWD_SIGNALING_SERVER(user_data);
+
+    GBytes *body = NULL;
+    const char *content_type;
+    const char *reason;
+    const guint status = signaling_server_handle_http(server,
+                                                      soup_server_message_get_method(msg),
+                                                      path,
+                                                      query,
+                                                      &body,
+                                                      &content_type,
+                                                      &reason);
+
+    if (status == SOUP_STATUS_NOT_FOUND) {
+        // We're not serving any other HTTP traffic - if somebody (erroneously) submits an HTTP request,
+        // tell them to get lost.
+        ALOGE("Got an erroneous HTTP request from %s", soup_server_message_get_remote_host(msg));
+    }
+
+    soup_server_message_set_status(msg, status, reason);
+
+    if (body) {
+        gsize size = 0;
+        const gchar *data = g_bytes_get_data(body, &size);
+        soup_server_message_set_response(msg, content_type, SOUP_MEMORY_COPY, data, size);
+        g_bytes_unref(body);
+    }
 }
 
 #endif
 
+struct signaling_message_context {
+    SignalingServer *server;
+    ClientId client_id;
+};
+
+static void signaling_server_on_sdp(gpointer user_data, const gchar *type, const gchar *sdp) {
+    struct signaling_message_context *ctx = user_data;
+
+    if (!g_str_equal(type, "answer")) {
+        ALOGE("Unexpected SDP %s from client, ignoring", type);
+        return;
+    }
+
+    ALOGD("Received SDP answer: \n%s", sdp);
+
+    g_signal_emit(ctx->server, signals[SIGNAL_SDP_ANSWER], 0, ctx->client_id, sdp);
+}
+
+static void signaling_server_on_candidate(gpointer user_data, const guint mline_index, const gchar *candidate) {
+    struct signaling_message_context *ctx = user_data;
+
+    g_signal_emit(ctx->server, signals[SIGNAL_CANDIDATE], 0, ctx->client_id, mline_index, candidate);
+}
+
+static void signaling_server_on_end_of_candidates(gpointer user_data) {
+    struct signaling_message_context *ctx = user_data;
+
+    g_signal_emit(ctx->server, signals[SIGNAL_END_OF_CANDIDATES], 0, ctx->client_id);
+}
+
+static void signaling_server_on_restart(gpointer user_data) {
+    struct signaling_message_context *ctx = user_data;
+
+    g_signal_emit(ctx->server, signals[SIGNAL_RESTART_REQUESTED], 0, ctx->client_id);
+}
+
+static const struct signaling_handlers signaling_server_handlers = {
+    .sdp = signaling_server_on_sdp,
+    .candidate = signaling_server_on_candidate,
+    .end_of_candidates = signaling_server_on_end_of_candidates,
+    // Only ever sent by us
+    .session = NULL,
+    .restart = signaling_server_on_restart,
+};
+
 static void signaling_server_handle_message(SignalingServer *server,
-                                            SoupWebsocketConnection *connection,
+                                            struct signaling_connection *conn,
                                             GBytes *message) {
     gsize length = 0;
     const gchar *msg_data = g_bytes_get_data(message, &length);
-    JsonParser *parser = json_parser_new();
-    GError *error = NULL;
 
-    if (json_parser_load_from_data(parser, msg_data, length, &error)) {
-        JsonObject *msg = json_node_get_object(json_parser_get_root(parser));
+    conn->messages_received++;
+    conn->bytes_received += length;
+    g_atomic_int_inc(&server->messages_received);
+    g_atomic_int_add(&server->bytes_received, (gint)length);
 
-        if (!json_object_has_member(msg, "msg")) {
-            // Invalid message
-            goto out;
-        }
-
-        const gchar *msg_type = json_object_get_string_member(msg, "msg");
-        if (g_str_equal(msg_type, "answer")) {
-            const gchar *answer_sdp = json_object_get_string_member(msg, "sdp");
-            ALOGD("Received SDP answer: \n%s", answer_sdp);
-
-            g_signal_emit(server, signals[SIGNAL_SDP_ANSWER], 0, connection, answer_sdp);
-        } else if (g_str_equal(msg_type, "candidate")) {
-            JsonObject *candidate = json_object_get_object_member(msg, "candidate");
-
-            g_signal_emit(server,
-                          signals[SIGNAL_CANDIDATE],
-                          0,
-                          connection,
-                          json_object_get_int_member(candidate, "sdpMLineIndex"),
-                          json_object_get_string_member(candidate, "candidate"));
-        }
-    } else {
-        ALOGD("Error parsing message: %s", error->message);
-        g_clear_error(&error);
+    struct signaling_message_context ctx = {server, conn->id};
+    if (!signaling_codec_decode(conn->codec, msg_data, length, &signaling_server_handlers, &ctx)) {
+        ALOGD("Invalid signaling message from %s", conn->remote_host);
+        g_atomic_int_inc(&server->messages_invalid);
     }
-
-out:
-    g_object_unref(parser);
 }
 
 static void message_cb(SoupWebsocketConnection *connection, gint type, GBytes *message, gpointer user_data) {
-    ALOGD("Signaling server received a message");
+    struct signaling_connection *conn = user_data;
+    SignalingServer *server = conn->server;
 
     switch (type) {
         case SOUP_WEBSOCKET_DATA_BINARY: {
-            ALOGE("Received unknown binary message, ignoring\n");
+            ALOGE("Received unknown binary message from %s, ignoring", conn->remote_host);
             return;
         }
         case SOUP_WEBSOCKET_DATA_TEXT: {
-            signaling_server_handle_message(GWD_SIGNALING_SERVER(user_data), connection, message);
+            signaling_server_handle_message(server, conn, message);
         } break;
         default:
             g_assert_not_reached();
     }
 }
 
-static void signaling_server_remove_websocket_connection(SignalingServer *server, SoupWebsocketConnection *connection) {
-    ALOGD("Removed websocket connection");
+static void signaling_connection_free(gpointer data) {
+    struct signaling_connection *conn = data;
 
-    const ClientId client_id = g_object_get_data(G_OBJECT(connection), "client_id");
+    g_signal_handler_disconnect(conn->websocket, conn->message_handler_id);
+    g_signal_handler_disconnect(conn->websocket, conn->closed_handler_id);
+    signaling_candidate_batcher_free(conn->batcher);
+    signaling_codec_free(conn->codec);
+    g_object_unref(conn->websocket);
+    g_free(conn->remote_host);
+    g_free(conn);
+}
+
+/// Frees @p conn, then tells the users its ClientId is gone
+static void signaling_server_remove_websocket_connection(SignalingServer *server, struct signaling_connection *conn) {
+    ALOGD("Removed websocket connection from %s after %" G_GINT64_FORMAT " s, %u messages (%u bytes) in, "
+          "%u messages (%u bytes) out",
+          conn->remote_host,
+          (g_get_monotonic_time() - conn->connected_us) / G_USEC_PER_SEC,
+          conn->messages_received,
+          conn->bytes_received,
+          conn->messages_sent,
+          conn->bytes_sent);
 
-    server->websocket_connections = g_slist_remove(server->websocket_connections, client_id);
+    const ClientId client_id = conn->id;
+    g_hash_table_remove(server->connections, client_id);
 
     g_signal_emit(server, signals[SIGNAL_WS_CLIENT_DISCONNECTED], 0, client_id);
 }
 
 static void closed_cb(SoupWebsocketConnection *connection, gpointer user_data) {
+    struct signaling_connection *conn = user_data;
+
     ALOGD("Connection closed");
 
-    signaling_server_remove_websocket_connection(GWD_SIGNALING_SERVER(user_data), connection);
+    signaling_server_remove_websocket_connection(conn->server, conn);
+}
+
+/// Send an encoded message on an open websocket, called from the server's main context
+static void signaling_connection_send(gpointer user_data, const gchar *message) {
+    struct signaling_connection *conn = user_data;
+
+    if (soup_websocket_connection_get_state(conn->websocket) != SOUP_WEBSOCKET_STATE_OPEN) {
+        g_warning("Trying to send message using websocket that isn't open.");
+        return;
+    }
+
+    const gsize length = strlen(message);
+    soup_websocket_connection_send_text(conn->websocket, message);
+
+    conn->messages_sent++;
+    conn->bytes_sent += length;
+    g_atomic_int_inc(&conn->server->messages_sent);
+    g_atomic_int_add(&conn->server->bytes_sent, (gint)length);
 }
 
-static void signaling_server_add_websocket_connection(SignalingServer *server, SoupWebsocketConnection *connection) {
-    ALOGD("Added websocket connection");
+/// A parameter from the query of the websocket URI, e.g. the session the client asks to resume
+static gchar *signaling_connection_get_query_param(SoupWebsocketConnection *connection, const gchar *name) {
+#if !SOUP_CHECK_VERSION(3, 0, 0)
+    SoupURI *uri = soup_websocket_connection_get_uri(connection);
+    const char *query = uri ? soup_uri_get_query(uri) : NULL;
+#else
+    GUri *uri = soup_websocket_connection_get_uri(connection);
+    const char *query = uri ? g_uri_get_query(uri) : NULL;
+#endif
+    if (query == NULL) {
+        return NULL;
+    }
+
+    GHashTable *params = g_uri_parse_params(query, -1, "&", G_URI_PARAMS_NONE, NULL);
+    if (params == NULL) {
+        return NULL;
+    }
+    gchar *value = g_strdup(g_hash_table_lookup(params, name));
+    g_hash_table_unref(params);
 
-    g_object_ref(connection);
-    server->websocket_connections = g_slist_append(server->websocket_connections, connection);
-    g_object_set_data(G_OBJECT(connection), "client_id", connection);
+    return value;
+}
 
-    g_signal_connect(connection, "message", (GCallback)message_cb, server);
-    g_signal_connect(connection, "closed", (GCallback)closed_cb, server);
+static void signaling_server_add_websocket_connection(SignalingServer *server,
+                                                      SoupWebsocketConnection *connection,
+                                                      const gchar *remote_host) {
+    const gchar *protocol = soup_websocket_connection_get_protocol(connection);
+    const gboolean v2 = protocol != NULL && g_str_equal(protocol, SIGNALING_PROTOCOL_V2);
+
+    ALOGD("Added websocket connection from %s, signaling %s", remote_host, v2 ? "v2" : "v1");
+
+    struct signaling_connection *conn = g_new0(struct signaling_connection, 1);
+    conn->id = GSIZE_TO_POINTER(++server->last_client_id);
+    conn->websocket = g_object_ref(connection);
+    conn->remote_host = g_strdup(remote_host);
+    conn->connected_us = g_get_monotonic_time();
+    conn->server = server;
+    conn->codec = signaling_codec_new();
+    if (v2) {
+        conn->batcher = signaling_candidate_batcher_new(NULL, conn->codec, signaling_connection_send, conn);
+    }
+    conn->message_handler_id = g_signal_connect(connection, "message", (GCallback)message_cb, conn);
+    conn->closed_handler_id = g_signal_connect(connection, "closed", (GCallback)closed_cb, conn);
+
+    g_hash_table_insert(server->connections, conn->id, conn);
+    g_atomic_int_inc(&server->connections_total);
 
-    g_signal_emit(server, signals[SIGNAL_WS_CLIENT_CONNECTED], 0, connection);
+    gchar *resume_id = signaling_connection_get_query_param(connection, SIGNALING_SESSION_QUERY);
+    gchar *codecs = signaling_connection_get_query_param(connection, SIGNALING_CODECS_QUERY);
+    g_signal_emit(server, signals[SIGNAL_WS_CLIENT_CONNECTED], 0, conn->id, resume_id, codecs);
+    g_free(resume_id);
+    g_free(codecs);
 }
 
 #if !SOUP_CHECK_VERSION(3, 0, 0)
@@ -156,9 +491,9 @@ static void websocket_cb(SoupServer *server,
                          const char *path,
                          SoupClientContext *client,
                          gpointer user_data) {
-    ALOGD("New websocket connection from %s", soup_client_context_get_host(client));
-
-    signaling_server_add_websocket_connection(GWD_SIGNALING_SERVER(user_data), connection);
+    signaling_server_add_websocket_connection(GWD_SIGNALING_SERVER(user_data),
+                                              connection,
+                                              soup_client_context_get_host(client));
 }
 #else
 
@@ -167,66 +502,177 @@ static void websocket_cb(SoupServer *server,
                          const char *path,
                          SoupWebsocketConnection *connection,
                          gpointer user_data) {
-    ALOGD("New connection from somewhere");
-
-    signaling_server_add_websocket_connection(GWD_SIGNALING_SERVER(user_data), connection);
+    signaling_server_add_websocket_connection(GWD_SIGNALING_SERVER(user_data),
+                                              connection,
+                                              soup_server_message_get_remote_host(msg));
 }
 
 #endif
 
+static gpointer signaling_server_thread(gpointer data) {
+    SignalingServer *server = data;
+
+    g_main_context_push_thread_default(server->context);
+    g_main_loop_run(server->loop);
+    g_main_context_pop_thread_default(server->context);
+
+    return NULL;
+}
+
+static gboolean signaling_server_quit_cb(gpointer data) {
+    g_main_loop_quit(data);
+    return G_SOURCE_REMOVE;
+}
+
 static void signaling_server_init(SignalingServer *server) {
     GError *error = NULL;
 
+    g_mutex_init(&server->metrics_mutex);
+
+    server->connections = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, signaling_connection_free);
+
+    server->context = g_main_context_new();
+    server->loop = g_main_loop_new(server->context, FALSE);
+
+    // The server and its websockets attach their sources to the thread-default context at listen/accept time
+    g_main_context_push_thread_default(server->context);
+
     server->soup_server = soup_server_new(NULL, NULL);
     g_assert_no_error(error);
 
     soup_server_add_handler(server->soup_server, NULL, http_cb, server, NULL);
-    soup_server_add_websocket_handler(server->soup_server, "/ws", NULL, NULL, websocket_cb, server, NULL);
+    // Clients offering no subprotocol are accepted too, and stay on v1
+    static const char *protocols[] = {SIGNALING_PROTOCOL_V2, NULL};
+    soup_server_add_websocket_handler(server->soup_server,
+                                      "/ws",
+                                      NULL,
+                                      (char **)protocols,
+                                      websocket_cb,
+                                      server,
+                                      NULL);
 
     soup_server_listen_all(server->soup_server, 52356, 0, &error);
     g_assert_no_error(error);
+
+    g_main_context_pop_thread_default(server->context);
+
+    server->thread = g_thread_new("signaling", signaling_server_thread, server);
 }
 
-static void signaling_server_send_to_websocket_client(SignalingServer *server, ClientId client_id, JsonNode *msg) {
-    SoupWebsocketConnection *connection = client_id;
-    g_info("%s", __func__);
+static struct signaling_connection *signaling_server_lookup(SignalingServer *server, const ClientId client_id) {
+    struct signaling_connection *conn = g_hash_table_lookup(server->connections, client_id);
 
-    if (!g_slist_find(server->websocket_connections, connection)) {
-        g_warning("Unknown websocket connection.");
-        return;
+    // Expected for a send racing the connection's close, nothing else can have the same ID
+    if (conn == NULL) {
+        ALOGD("Dropping a message for closed connection %p", client_id);
     }
+    return conn;
+}
 
-    SoupWebsocketState socket_state = soup_websocket_connection_get_state(connection);
+enum signaling_send_kind {
+    SIGNALING_SEND_SDP_OFFER,
+    SIGNALING_SEND_CANDIDATE,
+    SIGNALING_SEND_END_OF_CANDIDATES,
+    SIGNALING_SEND_SESSION,
+    SIGNALING_SEND_SESSION_RESUMED,
+};
 
-    if (socket_state == SOUP_WEBSOCKET_STATE_OPEN) {
-        gchar *msg_str = json_to_string(msg, TRUE);
+/// A send queued from any thread to the signaling thread
+struct signaling_send_op {
+    SignalingServer *server;
+    ClientId client_id;
+    enum signaling_send_kind kind;
+    guint m_line_index;
+    gchar *str;
+    gint64 queued_us;
+};
 
-        soup_websocket_connection_send_text(connection, msg_str);
+static void signaling_send_op_free(gpointer data) {
+    struct signaling_send_op *op = data;
 
-        g_free(msg_str);
-    } else {
-        g_warning("Trying to send message using websocket that isn't open.");
-    }
+    g_free(op->str);
+    g_free(op);
 }
 
-void signaling_server_send_sdp_offer(SignalingServer *server, const ClientId client_id, const gchar *sdp) {
-    ALOGD("Send SDP offer: \n%s", sdp);
+static gboolean signaling_send_op_dispatch(gpointer data) {
+    const struct signaling_send_op *op = data;
+    SignalingServer *server = op->server;
 
-    JsonBuilder *builder = json_builder_new();
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "msg");
-    json_builder_add_string_value(builder, "offer");
+    const gint64 now_us = g_get_monotonic_time();
+    signaling_server_send_delay_rotate(server, now_us);
+    server->send_delay_max_us[0] = MAX(server->send_delay_max_us[0], now_us - op->queued_us);
 
-    json_builder_set_member_name(builder, "sdp");
-    json_builder_add_string_value(builder, sdp);
-    json_builder_end_object(builder);
+    struct signaling_connection *conn = signaling_server_lookup(server, op->client_id);
+    if (conn == NULL) {
+        return G_SOURCE_REMOVE;
+    }
+
+    gchar *msg_str = NULL;
+    switch (op->kind) {
+        case SIGNALING_SEND_SDP_OFFER:
+            msg_str = signaling_codec_encode_sdp(conn->codec, "offer", op->str);
+            break;
+        case SIGNALING_SEND_CANDIDATE:
+            if (conn->batcher != NULL) {
+                signaling_candidate_batcher_add(conn->batcher, op->m_line_index, op->str);
+            } else {
+                msg_str = signaling_codec_encode_candidate(conn->codec, op->m_line_index, op->str);
+            }
+            break;
+        case SIGNALING_SEND_END_OF_CANDIDATES:
+            // v1 has no way to say it
+            if (conn->batcher != NULL) {
+                signaling_candidate_batcher_end(conn->batcher);
+            }
+            break;
+        case SIGNALING_SEND_SESSION:
+        case SIGNALING_SEND_SESSION_RESUMED:
+            msg_str = signaling_codec_encode_session(conn->codec, op->str, op->kind == SIGNALING_SEND_SESSION_RESUMED);
+            break;
+    }
 
-    JsonNode *root = json_builder_get_root(builder);
+    if (msg_str != NULL) {
+        signaling_connection_send(conn, msg_str);
+        g_free(msg_str);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/*!
+ * Hand a send over to the signaling thread.
+ *
+ * Ops still queued when the server is disposed are freed with the context without running, so they do not need to
+ * hold a reference on the server.
+ */
+static void signaling_server_queue_send(SignalingServer *server,
+                                        const ClientId client_id,
+                                        const enum signaling_send_kind kind,
+                                        const guint m_line_index,
+                                        const gchar *str) {
+    if (client_id == NULL) {
+        return;
+    }
+
+    struct signaling_send_op *op = g_new0(struct signaling_send_op, 1);
+    op->server = server;
+    op->client_id = client_id;
+    op->kind = kind;
+    op->m_line_index = m_line_index;
+    op->str = g_strdup(str);
+    op->queued_us = g_get_monotonic_time();
+
+    g_main_context_invoke_full(server->context,
+                               G_PRIORITY_DEFAULT,
+                               signaling_send_op_dispatch,
+                               op,
+                               signaling_send_op_free);
+}
 
-    signaling_server_send_to_websocket_client(server, client_id, root);
+void signaling_server_send_sdp_offer(SignalingServer *server, const ClientId client_id, const gchar *sdp) {
+    ALOGD("Send SDP offer: \n%s", sdp);
 
-    json_node_unref(root);
-    g_object_unref(builder);
+    signaling_server_queue_send(server, client_id, SIGNALING_SEND_SDP_OFFER, 0, sdp);
 }
 
 void signaling_server_send_candidate(SignalingServer *server,
@@ -235,40 +681,74 @@ void signaling_server_send_candidate(SignalingServer *server,
                                      const gchar *candidate) {
     ALOGD("Send ICE candidate: %u %s", m_line_index, candidate);
 
-    JsonBuilder *builder = json_builder_new();
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "msg");
-    json_builder_add_string_value(builder, "candidate");
-
-    json_builder_set_member_name(builder, "candidate");
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "candidate");
-    json_builder_add_string_value(builder, candidate);
-    json_builder_set_member_name(builder, "sdpMLineIndex");
-    json_builder_add_int_value(builder, m_line_index);
-    json_builder_end_object(builder);
-    json_builder_end_object(builder);
+    signaling_server_queue_send(server, client_id, SIGNALING_SEND_CANDIDATE, m_line_index, candidate);
+}
 
-    JsonNode *root = json_builder_get_root(builder);
+void signaling_server_send_end_of_candidates(SignalingServer *server, const ClientId client_id) {
+    signaling_server_queue_send(server, client_id, SIGNALING_SEND_END_OF_CANDIDATES, 0, NULL);
+}
 
-    signaling_server_send_to_websocket_client(server, client_id, root);
+void signaling_server_send_session(SignalingServer *server,
+                                   const ClientId client_id,
+                                   const gchar *session_id,
+                                   const gboolean resumed) {
+    signaling_server_queue_send(server,
+                                client_id,
+                                resumed ? SIGNALING_SEND_SESSION_RESUMED : SIGNALING_SEND_SESSION,
+                                0,
+                                session_id);
+}
 
-    json_node_unref(root);
-    g_object_unref(builder);
+void signaling_server_set_metrics(SignalingServer *server, GBytes *metrics) {
+    g_mutex_lock(&server->metrics_mutex);
+    g_clear_pointer(&server->metrics, g_bytes_unref);
+    server->metrics = metrics ? g_bytes_ref(metrics) : NULL;
+    g_mutex_unlock(&server->metrics_mutex);
 }
 
 static void signaling_server_dispose(GObject *object) {
     SignalingServer *self = GWD_SIGNALING_SERVER(object);
 
-    soup_server_disconnect(self->soup_server);
+    // Must not run on the signaling thread itself. Quit from inside the loop, in case it has not started running yet.
+    if (self->thread) {
+        g_main_context_invoke(self->context, signaling_server_quit_cb, self->loop);
+        g_clear_pointer(&self->thread, g_thread_join);
+    }
+
+    // The thread is gone, so the context is ours now
+    g_main_context_push_thread_default(self->context);
+    if (self->soup_server) {
+        soup_server_disconnect(self->soup_server);
+    }
     g_clear_object(&self->soup_server);
+    g_clear_pointer(&self->connections, g_hash_table_unref);
+    g_main_context_pop_thread_default(self->context);
+
+    g_mutex_lock(&self->metrics_mutex);
+    g_clear_pointer(&self->metrics, g_bytes_unref);
+    g_mutex_unlock(&self->metrics_mutex);
+}
+
+static void signaling_server_finalize(GObject *object) {
+    SignalingServer *self = GWD_SIGNALING_SERVER(object);
+
+    g_mutex_clear(&self->metrics_mutex);
+
+    g_main_loop_unref(self->loop);
+    // Drops any send still queued
+    g_main_context_unref(self->context);
+
+    G_OBJECT_CLASS(signaling_server_parent_class)->finalize(object);
 }
 
 static void signaling_server_class_init(SignalingServerClass *klass) {
     GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
 
     gobject_class->dispose = signaling_server_dispose;
+    gobject_class->finalize = signaling_server_finalize;
 
+    /// Second argument is the session the client asks to resume, NULL for a new one. Third is the client's video
+    /// codecs in order of preference, NULL if it has none.
     signals[SIGNAL_WS_CLIENT_CONNECTED] = g_signal_new("ws-client-connected",
                                                        G_OBJECT_CLASS_TYPE(klass),
                                                        G_SIGNAL_RUN_LAST,
@@ -277,8 +757,10 @@ static void signaling_server_class_init(SignalingServerClass *klass) {
                                                        NULL,
                                                        NULL,
                                                        G_TYPE_NONE,
-                                                       1,
-                                                       G_TYPE_POINTER);
+                                                       3,
+                                                       G_TYPE_POINTER,
+                                                       G_TYPE_STRING,
+                                                       G_TYPE_STRING);
 
     signals[SIGNAL_WS_CLIENT_DISCONNECTED] = g_signal_new("ws-client-disconnected",
                                                           G_OBJECT_CLASS_TYPE(klass),
@@ -315,4 +797,38 @@ static void signaling_server_class_init(SignalingServerClass *klass) {
                                              G_TYPE_POINTER,
                                              G_TYPE_UINT,
                                              G_TYPE_STRING);
+
+    signals[SIGNAL_END_OF_CANDIDATES] = g_signal_new("end-of-candidates",
+                                                     G_OBJECT_CLASS_TYPE(klass),
+                                                     G_SIGNAL_RUN_LAST,
+                                                     0,
+                                                     NULL,
+                                                     NULL,
+                                                     NULL,
+                                                     G_TYPE_NONE,
+                                                     1,
+                                                     G_TYPE_POINTER);
+
+    signals[SIGNAL_RESTART_REQUESTED] = g_signal_new("restart-requested",
+                                                     G_OBJECT_CLASS_TYPE(klass),
+                                                     G_SIGNAL_RUN_LAST,
+                                                     0,
+                                                     NULL,
+                                                     NULL,
+                                                     NULL,
+                                                     G_TYPE_NONE,
+                                                     1,
+                                                     G_TYPE_POINTER);
+
+    /// Handler returns the path of the snapshot being written, or NULL if it cannot take one now
+    signals[SIGNAL_SNAPSHOT_REQUESTED] = g_signal_new("snapshot-requested",
+                                                      G_OBJECT_CLASS_TYPE(klass),
+                                                      G_SIGNAL_RUN_LAST,
+                                                      0,
+                                                      NULL,
+                                                      NULL,
+                                                      NULL,
+                                                      G_TYPE_STRING,
+                                                      1,
+                                                      G_TYPE_BOOLEAN);
 }
@@ -4,15 +4,58 @@
 
 #define TYPE_SIGNALING_SERVER signaling_server_get_type()
 
+/*!
+ * Websocket signaling server, plus the "/metrics" and "/debug/snapshot" HTTP endpoints.
+ *
+ * Threading: the server runs its own GMainContext on a dedicated "signaling" thread, which owns all websocket I/O and
+ * per-connection state. Its signals ("ws-client-connected", "ws-client-disconnected", "sdp-answer", "candidate",
+ * "end-of-candidates", "restart-requested", "snapshot-requested") are emitted on that thread, so handlers must return
+ * quickly and hand real work over to their own thread. The send functions may be called from any thread, they queue
+ * the message to the signaling thread and return right away.
+ *
+ * The last reference must not be dropped from the signaling thread, e.g. from a signal handler.
+ */
 G_DECLARE_FINAL_TYPE(SignalingServer, signaling_server, GWD, SIGNALING_SERVER, GObject)
 
+/*!
+ * Identifies a websocket connection. Never reused while the server runs, so a send addressed to a connection that is
+ * gone is dropped rather than reaching another client. NULL is no connection.
+ */
 typedef gpointer ClientId;
 
+/*!
+ * Start listening and spawn the signaling thread.
+ */
 SignalingServer *signaling_server_new();
 
+/*!
+ * The send functions drop the message if @p client_id is NULL or its connection has closed.
+ */
 void signaling_server_send_sdp_offer(SignalingServer *server, ClientId client_id, const gchar *sdp);
 
 void signaling_server_send_candidate(SignalingServer *server,
                                      ClientId client_id,
                                      guint m_line_index,
                                      const gchar *candidate);
+
+/*!
+ * Tell the client all local candidates have been sent. Only v2 clients get told, v1 has no such message.
+ */
+void signaling_server_send_end_of_candidates(SignalingServer *server, ClientId client_id);
+
+/*!
+ * Tell the client which session ID to reconnect with, and whether its websocket resumed an existing session. Must be
+ * sent before the first offer on the websocket.
+ */
+void signaling_server_send_session(SignalingServer *server,
+                                   ClientId client_id,
+                                   const gchar *session_id,
+                                   gboolean resumed);
+
+/*!
+ * Publish the pipeline-side metrics served on the "/metrics" HTTP endpoint, in Prometheus text format.
+ *
+ * The endpoint only ever serves the last published text (plus the signaling server's own counters), so scraping it
+ * never touches the pipeline. Thread-safe.
+ */
+void signaling_server_set_metrics(SignalingServer *server, GBytes *metrics);
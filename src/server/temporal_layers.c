@@ -0,0 +1,182 @@
+#include "temporal_layers.h"
+
+/// Enough for the fixed header, a few CSRCs, a small header extension and the payload descriptor
+#define TEMPORAL_LAYERS_HEADER_MAX 96
+
+gboolean temporal_layer_parse_vp8(GstBuffer *buffer, struct temporal_layer_info *out) {
+    guint8 data[TEMPORAL_LAYERS_HEADER_MAX];
+    const gsize size = gst_buffer_extract(buffer, 0, data, sizeof(data));
+
+    out->tid = -1;
+    out->sync = FALSE;
+    out->frame_start = FALSE;
+    out->key_frame = FALSE;
+
+    if (size < 12 || (data[0] >> 6) != 2) {
+        return FALSE;
+    }
+
+    gsize pos = 12 + 4 * (data[0] & 0x0f);
+    if (data[0] & 0x10) {
+        if (pos + 4 > size) {
+            return FALSE;
+        }
+        pos += 4 + 4 * ((data[pos + 2] << 8) | data[pos + 3]);
+    }
+    if (pos >= size) {
+        return FALSE;
+    }
+
+    // X|R|N|S|R|PID
+    const guint8 first = data[pos++];
+    gboolean has_tid = FALSE;
+
+    if (first & 0x80) {
+        if (pos >= size) {
+            return FALSE;
+        }
+        // I|L|T|K|RSV
+        const guint8 ext = data[pos++];
+        if (ext & 0x80) {
+            if (pos >= size) {
+                return FALSE;
+            }
+            pos += (data[pos] & 0x80) ? 2 : 1;
+        }
+        if (ext & 0x40) {
+            pos++;
+        }
+        if (ext & 0x30) {
+            if (pos >= size) {
+                return FALSE;
+            }
+            // TID|Y|KEYIDX
+            if (ext & 0x20) {
+                out->tid = data[pos] >> 6;
+                out->sync = (data[pos] & 0x20) != 0;
+                has_tid = TRUE;
+            }
+            pos++;
+        }
+    }
+
+    out->frame_start = (first & 0x10) && (first & 0x07) == 0;
+    // The inverse key frame flag of the VP8 payload header follows the descriptor
+    out->key_frame = out->frame_start && pos < size && (data[pos] & 0x01) == 0;
+    if (!has_tid) {
+        out->tid = -1;
+    }
+
+    return TRUE;
+}
+
+void temporal_layer_filter_init(struct temporal_layer_filter *filter, const guint n_layers) {
+    g_assert(n_layers > 0);
+
+    filter->n_layers = n_layers;
+    filter->target_tid = (gint)n_layers - 1;
+    filter->current_tid = (gint)n_layers - 1;
+    filter->seq_offset = 0;
+    filter->dropped_packets = 0;
+    filter->clean_intervals = 0;
+}
+
+/// @return FALSE if the packet is left out, *buffer is then still owned by the caller
+static gboolean temporal_layer_filter_packet(struct temporal_layer_filter *filter, GstBuffer **buffer) {
+    struct temporal_layer_info info;
+    if (temporal_layer_parse_vp8(*buffer, &info) && info.tid >= 0) {
+        const gint target = g_atomic_int_get(&filter->target_tid);
+        gint current = filter->current_tid;
+
+        if (info.frame_start && target != current) {
+            if (target < current || info.key_frame) {
+                current = target;
+            } else if (info.sync && info.tid == current + 1) {
+                current++;
+            }
+            g_atomic_int_set(&filter->current_tid, current);
+        }
+
+        if (info.tid > current) {
+            filter->seq_offset++;
+            g_atomic_int_inc(&filter->dropped_packets);
+            return FALSE;
+        }
+    }
+
+    if (filter->seq_offset != 0) {
+        guint8 seq_bytes[2];
+        if (gst_buffer_extract(*buffer, 2, seq_bytes, 2) == 2) {
+            const guint16 seq = (guint16)(((seq_bytes[0] << 8) | seq_bytes[1]) - filter->seq_offset);
+            seq_bytes[0] = seq >> 8;
+            seq_bytes[1] = seq & 0xff;
+
+            // Payloaders keep the header in its own memory, so only that is copied and the payload stays shared
+            *buffer = gst_buffer_make_writable(*buffer);
+            gst_buffer_fill(*buffer, 2, seq_bytes, 2);
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean temporal_layer_filter_list_item(GstBuffer **buffer, guint idx, gpointer user_data) {
+    if (!temporal_layer_filter_packet(user_data, buffer)) {
+        gst_buffer_unref(*buffer);
+        *buffer = NULL;
+    }
+    return TRUE;
+}
+
+GstPadProbeReturn temporal_layer_filter_probe(struct temporal_layer_filter *filter, GstPadProbeInfo *info) {
+    const gint top = (gint)filter->n_layers - 1;
+    if (filter->seq_offset == 0 && filter->current_tid == top && g_atomic_int_get(&filter->target_tid) == top) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        if (!temporal_layer_filter_packet(filter, &buffer)) {
+            return GST_PAD_PROBE_DROP;
+        }
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = gst_buffer_list_make_writable(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+        gst_buffer_list_foreach(list, temporal_layer_filter_list_item, filter);
+        GST_PAD_PROBE_INFO_DATA(info) = list;
+
+        if (gst_buffer_list_length(list) == 0) {
+            return GST_PAD_PROBE_DROP;
+        }
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+guint temporal_layer_filter_update(struct temporal_layer_filter *filter, const gdouble loss_percent) {
+    gint target = g_atomic_int_get(&filter->target_tid);
+
+    if (loss_percent > TEMPORAL_LAYERS_DROP_LOSS_PERCENT) {
+        filter->clean_intervals = 0;
+        target = MAX(target - 1, 0);
+    } else if (loss_percent < TEMPORAL_LAYERS_RAISE_LOSS_PERCENT) {
+        if (++filter->clean_intervals >= TEMPORAL_LAYERS_RAISE_INTERVALS && target < (gint)filter->n_layers - 1) {
+            filter->clean_intervals = 0;
+            target++;
+        }
+    } else {
+        filter->clean_intervals = 0;
+    }
+
+    g_atomic_int_set(&filter->target_tid, target);
+
+    return target + 1;
+}
+
+guint temporal_layer_filter_get_layers(struct temporal_layer_filter *filter) {
+    return g_atomic_int_get(&filter->current_tid) + 1;
+}
+
+guint temporal_layer_filter_get_dropped(struct temporal_layer_filter *filter) {
+    return g_atomic_int_get(&filter->dropped_packets);
+}
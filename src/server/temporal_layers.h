@@ -0,0 +1,95 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/// Leave a layer out once the receiver reports more loss than this over a stats interval
+#define TEMPORAL_LAYERS_DROP_LOSS_PERCENT 5.0
+/// Add a layer back after this many intervals in a row below TEMPORAL_LAYERS_RAISE_LOSS_PERCENT
+#define TEMPORAL_LAYERS_RAISE_INTERVALS 3
+#define TEMPORAL_LAYERS_RAISE_LOSS_PERCENT 1.0
+
+/*!
+ * What the VP8 payload descriptor of an RTP packet says about its frame (RFC 7741).
+ */
+struct temporal_layer_info {
+    /// Temporal layer ID, -1 if the packet does not carry one
+    gint tid;
+    /// The frame only references the base layer, so a receiver can start decoding the layer from it
+    gboolean sync;
+    /// First packet of a frame
+    gboolean frame_start;
+    /// First packet of a key frame
+    gboolean key_frame;
+};
+
+/*!
+ * Parse the RTP header and VP8 payload descriptor at the start of @p buffer, without mapping the payload.
+ *
+ * @return FALSE if this is not a VP8 RTP packet.
+ */
+gboolean temporal_layer_parse_vp8(GstBuffer *buffer, struct temporal_layer_info *out);
+
+/*!
+ * Forwards the temporal layers of a shared RTP stream up to a target, for one receiver.
+ *
+ * Higher layers are left out whole frames at a time, and the sequence numbers of what is forwarded are rewritten so
+ * the receiver sees no gap: a layer left out is not loss, so it is neither retransmitted nor concealed. Leaving a layer
+ * out takes effect at the next frame, adding one back waits for a frame of that layer marked as a sync point, or for a
+ * key frame.
+ *
+ * Embed it in the owning object and use @ref temporal_layer_filter_init. Packets go through it from a single
+ * streaming thread, the target may be changed from any other.
+ */
+struct temporal_layer_filter {
+    guint n_layers;
+    /// Highest layer wanted
+    gint target_tid;
+    /// Highest layer forwarded
+    gint current_tid;
+
+    /// Streaming thread only. Packets left out so far, subtracted from the sequence numbers.
+    guint16 seq_offset;
+    guint dropped_packets;
+
+    /// Controller state, see @ref temporal_layer_filter_update
+    guint clean_intervals;
+};
+
+/*!
+ * Start out forwarding all @p n_layers layers.
+ */
+void temporal_layer_filter_init(struct temporal_layer_filter *filter, guint n_layers);
+
+/*!
+ * Filter the buffer or buffer list of a pad probe, replacing the probe's data with the rewritten packets.
+ *
+ * Packets are only copied once something has been left out, the fast path of a receiver getting every layer does not
+ * even parse them.
+ *
+ * @return GST_PAD_PROBE_DROP if nothing is left to forward.
+ */
+GstPadProbeReturn temporal_layer_filter_probe(struct temporal_layer_filter *filter, GstPadProbeInfo *info);
+
+/*!
+ * Adapt the target to the receiver's loss over one stats interval: drop a layer as soon as it is congested, add one
+ * back once it has been clean for a while. The base layer is always forwarded.
+ *
+ * Only call it from one thread.
+ *
+ * @return The number of layers now targeted.
+ */
+guint temporal_layer_filter_update(struct temporal_layer_filter *filter, gdouble loss_percent);
+
+/*!
+ * Number of layers currently forwarded. May be called from any thread.
+ */
+guint temporal_layer_filter_get_layers(struct temporal_layer_filter *filter);
+
+/*!
+ * Packets left out so far. May be called from any thread.
+ */
+guint temporal_layer_filter_get_dropped(struct temporal_layer_filter *filter);
+
+G_END_DECLS
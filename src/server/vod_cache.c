@@ -0,0 +1,349 @@
+#include "vod_cache.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+/// Size of the fixed RTP header, the part rewritten when serving
+#define VOD_CACHE_RTP_HEADER_SIZE 12
+
+#define VOD_CACHE_ALIGN(size) (((size) + 7) & ~(gsize)7)
+
+struct vod_cache_header {
+    gchar magic[4];
+    guint32 version;
+    guint32 n_records;
+    guint32 n_key_frames;
+    guint64 duration_ns;
+    guint64 index_offset;
+    guint32 n_packets[VOD_CACHE_N_STREAMS];
+    guint32 clock_rate[VOD_CACHE_N_STREAMS];
+    guint8 reserved[16];
+};
+
+struct vod_cache_record {
+    guint64 time_ns;
+    guint32 size;
+    guint8 stream;
+    guint8 flags;
+    guint16 reserved;
+};
+
+struct vod_cache_key_frame {
+    guint64 time_ns;
+    guint64 offset;
+};
+
+G_STATIC_ASSERT(sizeof(struct vod_cache_header) == 64);
+G_STATIC_ASSERT(sizeof(struct vod_cache_record) == 16);
+G_STATIC_ASSERT(sizeof(struct vod_cache_key_frame) == 16);
+
+struct vod_cache {
+    GMappedFile *file;
+    const guint8 *data;
+    /// End of the records, where the index starts
+    gsize records_end;
+
+    GstClockTime duration;
+    guint32 n_packets[VOD_CACHE_N_STREAMS];
+    guint32 clock_rate[VOD_CACHE_N_STREAMS];
+
+    const struct vod_cache_key_frame *key_frames;
+    guint32 n_key_frames;
+};
+
+struct vod_cache *vod_cache_open(const gchar *path, GError **error) {
+    GMappedFile *file = g_mapped_file_new(path, FALSE, error);
+    if (file == NULL) {
+        return NULL;
+    }
+
+    const gsize size = g_mapped_file_get_length(file);
+    const guint8 *data = (const guint8 *)g_mapped_file_get_contents(file);
+    const struct vod_cache_header *header = (const struct vod_cache_header *)data;
+
+    if (size < sizeof(*header) || memcmp(header->magic, VOD_CACHE_MAGIC, 4) != 0 ||
+        GUINT32_FROM_LE(header->version) != VOD_CACHE_VERSION) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a version %d cache", path, VOD_CACHE_VERSION);
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+
+    const guint64 index_offset = GUINT64_FROM_LE(header->index_offset);
+    const guint32 n_key_frames = GUINT32_FROM_LE(header->n_key_frames);
+    if (index_offset < sizeof(*header) || index_offset % 8 != 0 || index_offset > size ||
+        (size - index_offset) / sizeof(struct vod_cache_key_frame) < n_key_frames) {
+        g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is truncated", path);
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+
+    struct vod_cache *cache = g_new0(struct vod_cache, 1);
+    cache->file = file;
+    cache->data = data;
+    cache->records_end = index_offset;
+    cache->duration = GUINT64_FROM_LE(header->duration_ns);
+    for (guint i = 0; i < VOD_CACHE_N_STREAMS; i++) {
+        cache->n_packets[i] = GUINT32_FROM_LE(header->n_packets[i]);
+        cache->clock_rate[i] = GUINT32_FROM_LE(header->clock_rate[i]);
+    }
+    cache->key_frames = (const struct vod_cache_key_frame *)(data + index_offset);
+    cache->n_key_frames = n_key_frames;
+
+    return cache;
+}
+
+void vod_cache_free(struct vod_cache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    g_mapped_file_unref(cache->file);
+    g_free(cache);
+}
+
+GstClockTime vod_cache_get_duration(struct vod_cache *cache) {
+    return cache->duration;
+}
+
+guint32 vod_cache_get_packets(struct vod_cache *cache, const enum vod_cache_stream stream) {
+    return cache->n_packets[stream];
+}
+
+guint32 vod_cache_get_clock_rate(struct vod_cache *cache, const enum vod_cache_stream stream) {
+    return cache->clock_rate[stream];
+}
+
+gsize vod_cache_seek(struct vod_cache *cache, const GstClockTime time) {
+    // Last key frame at or before time
+    guint32 lo = 0;
+    guint32 hi = cache->n_key_frames;
+    while (lo < hi) {
+        const guint32 mid = lo + (hi - lo) / 2;
+        if (GUINT64_FROM_LE(cache->key_frames[mid].time_ns) <= time) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return sizeof(struct vod_cache_header);
+    }
+
+    const guint64 offset = GUINT64_FROM_LE(cache->key_frames[lo - 1].offset);
+    return offset < cache->records_end ? offset : sizeof(struct vod_cache_header);
+}
+
+gboolean vod_cache_next(struct vod_cache *cache, gsize *offset, struct vod_cache_packet *out) {
+    if (*offset + sizeof(struct vod_cache_record) > cache->records_end) {
+        return FALSE;
+    }
+
+    const struct vod_cache_record *record = (const struct vod_cache_record *)(cache->data + *offset);
+    const gsize size = GUINT32_FROM_LE(record->size);
+    const gsize data_offset = *offset + sizeof(*record);
+
+    // A damaged record ends the cache early rather than reading past it
+    if (size < VOD_CACHE_RTP_HEADER_SIZE || size > cache->records_end - data_offset ||
+        record->stream >= VOD_CACHE_N_STREAMS) {
+        return FALSE;
+    }
+
+    out->time = GUINT64_FROM_LE(record->time_ns);
+    out->stream = record->stream;
+    out->key_frame = (record->flags & VOD_CACHE_FLAG_KEY_FRAME) != 0;
+    out->data = cache->data + data_offset;
+    out->size = size;
+
+    *offset = data_offset + VOD_CACHE_ALIGN(size);
+
+    return TRUE;
+}
+
+GstBuffer *vod_cache_packet_to_buffer(struct vod_cache *cache, const struct vod_cache_packet *packet) {
+    GstBuffer *buffer = gst_buffer_new_memdup(packet->data, VOD_CACHE_RTP_HEADER_SIZE);
+
+    if (packet->size > VOD_CACHE_RTP_HEADER_SIZE) {
+        GstMemory *payload = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+                                                    (gpointer)packet->data,
+                                                    packet->size,
+                                                    VOD_CACHE_RTP_HEADER_SIZE,
+                                                    packet->size - VOD_CACHE_RTP_HEADER_SIZE,
+                                                    g_mapped_file_ref(cache->file),
+                                                    (GDestroyNotify)g_mapped_file_unref);
+        gst_buffer_append_memory(buffer, payload);
+    }
+
+    return buffer;
+}
+
+struct vod_cache_entry {
+    guint64 time_ns;
+    guint8 stream;
+    guint8 flags;
+    /// Arrival order, keeping the packets of a frame in order when sorting
+    guint32 order;
+    GBytes *packet;
+};
+
+struct vod_cache_writer {
+    GMutex mutex;
+    GArray *entries;
+    guint32 n_packets[VOD_CACHE_N_STREAMS];
+    guint32 clock_rate[VOD_CACHE_N_STREAMS];
+
+    /// The last two video frame times, to tell how long the last frame lasts
+    guint64 last_frame_ns;
+    guint64 frame_interval_ns;
+};
+
+static void vod_cache_entry_clear(gpointer data) {
+    struct vod_cache_entry *entry = data;
+    g_bytes_unref(entry->packet);
+}
+
+struct vod_cache_writer *vod_cache_writer_new(void) {
+    struct vod_cache_writer *writer = g_new0(struct vod_cache_writer, 1);
+    g_mutex_init(&writer->mutex);
+    writer->entries = g_array_new(FALSE, FALSE, sizeof(struct vod_cache_entry));
+    g_array_set_clear_func(writer->entries, vod_cache_entry_clear);
+    return writer;
+}
+
+void vod_cache_writer_free(struct vod_cache_writer *writer) {
+    if (writer == NULL) {
+        return;
+    }
+
+    g_array_unref(writer->entries);
+    g_mutex_clear(&writer->mutex);
+    g_free(writer);
+}
+
+void vod_cache_writer_set_clock_rate(struct vod_cache_writer *writer,
+                                     const enum vod_cache_stream stream,
+                                     const guint32 rate) {
+    g_mutex_lock(&writer->mutex);
+    writer->clock_rate[stream] = rate;
+    g_mutex_unlock(&writer->mutex);
+}
+
+void vod_cache_writer_add(struct vod_cache_writer *writer,
+                          const enum vod_cache_stream stream,
+                          const GstClockTime time,
+                          const gboolean key_frame,
+                          GstBuffer *packet) {
+    gsize size;
+    gpointer data;
+    gst_buffer_extract_dup(packet, 0, gst_buffer_get_size(packet), &data, &size);
+
+    struct vod_cache_entry entry = {
+        .time_ns = time,
+        .stream = stream,
+        .flags = key_frame ? VOD_CACHE_FLAG_KEY_FRAME : 0,
+        .packet = g_bytes_new_take(data, size),
+    };
+
+    g_mutex_lock(&writer->mutex);
+    entry.order = writer->entries->len;
+    g_array_append_val(writer->entries, entry);
+    writer->n_packets[stream]++;
+    if (stream == VOD_CACHE_STREAM_VIDEO && time > writer->last_frame_ns) {
+        writer->frame_interval_ns = time - writer->last_frame_ns;
+        writer->last_frame_ns = time;
+    }
+    g_mutex_unlock(&writer->mutex);
+}
+
+static gint vod_cache_entry_compare(gconstpointer a, gconstpointer b) {
+    const struct vod_cache_entry *ea = a;
+    const struct vod_cache_entry *eb = b;
+
+    if (ea->time_ns != eb->time_ns) {
+        return ea->time_ns < eb->time_ns ? -1 : 1;
+    }
+    return ea->order < eb->order ? -1 : (ea->order > eb->order ? 1 : 0);
+}
+
+gboolean vod_cache_writer_write(struct vod_cache_writer *writer, const gchar *path, GError **error) {
+    g_mutex_lock(&writer->mutex);
+    g_array_sort(writer->entries, vod_cache_entry_compare);
+
+    // Lay the records out first, so the header and index are known before anything is written
+    GArray *key_frames = g_array_new(FALSE, FALSE, sizeof(struct vod_cache_key_frame));
+    guint64 offset = sizeof(struct vod_cache_header);
+    guint64 end_ns = 0;
+    for (guint i = 0; i < writer->entries->len; i++) {
+        const struct vod_cache_entry *entry = &g_array_index(writer->entries, struct vod_cache_entry, i);
+        if (entry->flags & VOD_CACHE_FLAG_KEY_FRAME) {
+            const struct vod_cache_key_frame key_frame = {GUINT64_TO_LE(entry->time_ns), GUINT64_TO_LE(offset)};
+            g_array_append_val(key_frames, key_frame);
+        }
+        offset += sizeof(struct vod_cache_record) + VOD_CACHE_ALIGN(g_bytes_get_size(entry->packet));
+        end_ns = MAX(end_ns, entry->time_ns);
+    }
+
+    struct vod_cache_header header = {0};
+    memcpy(header.magic, VOD_CACHE_MAGIC, 4);
+    header.version = GUINT32_TO_LE(VOD_CACHE_VERSION);
+    header.n_records = GUINT32_TO_LE(writer->entries->len);
+    header.n_key_frames = GUINT32_TO_LE(key_frames->len);
+    header.duration_ns = GUINT64_TO_LE(MAX(end_ns, writer->last_frame_ns + writer->frame_interval_ns));
+    header.index_offset = GUINT64_TO_LE(offset);
+    for (guint i = 0; i < VOD_CACHE_N_STREAMS; i++) {
+        header.n_packets[i] = GUINT32_TO_LE(writer->n_packets[i]);
+        header.clock_rate[i] = GUINT32_TO_LE(writer->clock_rate[i]);
+    }
+
+    GFile *file = g_file_new_for_path(path);
+    GOutputStream *out = G_OUTPUT_STREAM(g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error));
+    g_object_unref(file);
+
+    gboolean ok = out != NULL;
+    if (ok) {
+        GOutputStream *buffered = g_buffered_output_stream_new_sized(out, 1024 * 1024);
+        g_object_unref(out);
+        out = buffered;
+
+        ok = g_output_stream_write_all(out, &header, sizeof(header), NULL, NULL, error);
+
+        static const guint8 padding[8] = {0};
+        for (guint i = 0; ok && i < writer->entries->len; i++) {
+            const struct vod_cache_entry *entry = &g_array_index(writer->entries, struct vod_cache_entry, i);
+            gsize size;
+            const guint8 *data = g_bytes_get_data(entry->packet, &size);
+
+            const struct vod_cache_record record = {
+                .time_ns = GUINT64_TO_LE(entry->time_ns),
+                .size = GUINT32_TO_LE((guint32)size),
+                .stream = entry->stream,
+                .flags = entry->flags,
+            };
+            ok = g_output_stream_write_all(out, &record, sizeof(record), NULL, NULL, error) &&
+                 g_output_stream_write_all(out, data, size, NULL, NULL, error) &&
+                 g_output_stream_write_all(out, padding, VOD_CACHE_ALIGN(size) - size, NULL, NULL, error);
+        }
+
+        ok = ok &&
+             g_output_stream_write_all(out,
+                                       key_frames->data,
+                                       key_frames->len * sizeof(struct vod_cache_key_frame),
+                                       NULL,
+                                       NULL,
+                                       error) &&
+             g_output_stream_close(out, NULL, error);
+        if (!ok) {
+            // Closing cancelled drops the partial file and leaves the one at path alone
+            GCancellable *cancellable = g_cancellable_new();
+            g_cancellable_cancel(cancellable);
+            g_output_stream_close(out, cancellable, NULL);
+            g_object_unref(cancellable);
+        }
+        g_object_unref(out);
+    }
+
+    g_array_unref(key_frames);
+    g_mutex_unlock(&writer->mutex);
+
+    return ok;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/*!
+ * A media file encoded and packetized into RTP once, stored so that it can be served any number of times without
+ * encoding anything, see vod_packager.h and vod_source.h.
+ *
+ * All integers are little-endian. The file is a 64 byte header, the records sorted by time, then the key frame index:
+ *   header: "GWDV", u32 version, u32 record count, u32 key frame count, u64 duration in ns, u64 index offset,
+ *           u32 packet count of each stream, u32 RTP clock rate of each stream, 16 reserved bytes
+ *   record: u64 time in ns from the start, u32 packet size, u8 stream, u8 flags, u16 reserved, then the RTP packet
+ *           padded to a multiple of 8 bytes
+ *   index:  u64 time in ns, u64 file offset of the record, for every record starting a key frame
+ *
+ * Every record is 8 byte aligned, so a mapped cache is read in place.
+ */
+
+#define VOD_CACHE_MAGIC "GWDV"
+#define VOD_CACHE_VERSION 1
+/// Environment variable naming a cache for the server to play instead of test.mp4
+#define VOD_CACHE_ENV "GWD_VOD_CACHE"
+
+enum vod_cache_stream {
+    VOD_CACHE_STREAM_VIDEO = 0,
+    VOD_CACHE_STREAM_AUDIO = 1,
+    VOD_CACHE_N_STREAMS,
+};
+
+/// The record is the first packet of a key frame, which clients can start decoding from
+#define VOD_CACHE_FLAG_KEY_FRAME 0x01
+
+/*!
+ * One packet of a cache, pointing into its mapping.
+ */
+struct vod_cache_packet {
+    /// From the start of the cache
+    GstClockTime time;
+    enum vod_cache_stream stream;
+    gboolean key_frame;
+    const guint8 *data;
+    gsize size;
+};
+
+/*!
+ * A cache mapped for reading. Packets are read without copying and may be used from any thread.
+ */
+struct vod_cache;
+
+struct vod_cache *vod_cache_open(const gchar *path, GError **error);
+
+/*!
+ * Buffers made from the cache keep its mapping alive, they may outlive it.
+ */
+void vod_cache_free(struct vod_cache *cache);
+
+/*!
+ * Time from the first packet to the end of the last frame, i.e. where a second pass starts when looping.
+ */
+GstClockTime vod_cache_get_duration(struct vod_cache *cache);
+
+guint32 vod_cache_get_packets(struct vod_cache *cache, enum vod_cache_stream stream);
+
+guint32 vod_cache_get_clock_rate(struct vod_cache *cache, enum vod_cache_stream stream);
+
+/*!
+ * Where to read from to start playing at @p time: the last key frame at or before it, found in the index.
+ *
+ * @return An offset for @ref vod_cache_next.
+ */
+gsize vod_cache_seek(struct vod_cache *cache, GstClockTime time);
+
+/*!
+ * Read the packet at @p offset and move it to the next one.
+ *
+ * @return FALSE at the end of the records.
+ */
+gboolean vod_cache_next(struct vod_cache *cache, gsize *offset, struct vod_cache_packet *out);
+
+/*!
+ * The packet as a buffer of two memories: a writable copy of its 12 byte fixed RTP header, for the caller to rewrite,
+ * and the rest wrapped in place in the mapping.
+ */
+GstBuffer *vod_cache_packet_to_buffer(struct vod_cache *cache, const struct vod_cache_packet *packet);
+
+/*!
+ * Collects packets in memory while a file is packetized, then writes them out as a cache sorted by time.
+ */
+struct vod_cache_writer;
+
+struct vod_cache_writer *vod_cache_writer_new(void);
+
+void vod_cache_writer_free(struct vod_cache_writer *writer);
+
+/*!
+ * Must be called once for each stream before writing.
+ */
+void vod_cache_writer_set_clock_rate(struct vod_cache_writer *writer, enum vod_cache_stream stream, guint32 rate);
+
+/*!
+ * Copy one RTP packet in. Thread-safe, each stream may come from its own thread. Packets of a stream must arrive in
+ * order, those of different streams are interleaved by time when writing.
+ */
+void vod_cache_writer_add(struct vod_cache_writer *writer,
+                          enum vod_cache_stream stream,
+                          GstClockTime time,
+                          gboolean key_frame,
+                          GstBuffer *packet);
+
+/*!
+ * Write the cache out. @p path is only replaced once it is complete.
+ */
+gboolean vod_cache_writer_write(struct vod_cache_writer *writer, const gchar *path, GError **error);
+
+G_END_DECLS
@@ -0,0 +1,180 @@
+#include "vod_packager.h"
+
+#include <gst/app/app.h>
+#include <gst/gst.h>
+
+#include "../utils/logger.h"
+#include "passthrough.h"
+#include "vod_cache.h"
+
+/// Enough for the fixed header, a few CSRCs, a small header extension and the first NAL header bytes
+#define VOD_PACKAGER_HEADER_MAX 96
+
+/// Both paths end in a payloader feeding an appsink, which takes packets as fast as they come
+#define VOD_PACKAGER_AUDIO_DESCRIPTION                                                                                 \
+    "audioconvert ! audioresample ! opusenc perfect-timestamp=true ! rtpopuspay ! "                                    \
+    "appsink name=audio sync=false"
+#define VOD_PACKAGER_VIDEO_DESCRIPTION                                                                                 \
+    "h264parse config-interval=-1 ! video/x-h264,stream-format=byte-stream,alignment=au ! "                            \
+    "rtph264pay config-interval=-1 aggregate-mode=zero-latency ! appsink name=video sync=false"
+
+/// One appsink's packets, only touched from its streaming thread
+struct vod_packager_stream {
+    struct vod_cache_writer *writer;
+    enum vod_cache_stream stream;
+    gboolean has_clock_rate;
+    /// The previous packet ended a frame, so the next one starts one
+    gboolean frame_start;
+};
+
+/// Whether an H.264 RTP packet starting a frame starts a key frame: one beginning with an SPS, alone or aggregated, as
+/// h264parse inserts before every IDR, or directly with an IDR slice (RFC 6184)
+static gboolean rtp_h264_is_key_frame(const guint8 *data, const gsize size) {
+    gsize pos = 12 + 4 * (data[0] & 0x0f);
+    if (data[0] & 0x10) {
+        if (pos + 4 > size) {
+            return FALSE;
+        }
+        pos += 4 + 4 * ((data[pos + 2] << 8) | data[pos + 3]);
+    }
+    if (pos + 1 >= size) {
+        return FALSE;
+    }
+
+    switch (data[pos] & 0x1f) {
+        case 5:
+        case 7:
+            return TRUE;
+        case 24: {
+            // STAP-A: 16 bit size, then the first aggregated NAL
+            if (pos + 3 >= size) {
+                return FALSE;
+            }
+            const guint8 type = data[pos + 3] & 0x1f;
+            return type == 5 || type == 7;
+        }
+        case 28:
+            // FU-A: start bit and type of the fragmented NAL
+            return (data[pos + 1] & 0x80) && (data[pos + 1] & 0x1f) == 5;
+        default:
+            return FALSE;
+    }
+}
+
+static GstFlowReturn vod_packager_new_sample(GstAppSink *appsink, gpointer user_data) {
+    struct vod_packager_stream *stream = user_data;
+
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (sample == NULL) {
+        return GST_FLOW_EOS;
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+
+    if (!stream->has_clock_rate) {
+        gint rate = 0;
+        gst_structure_get_int(gst_caps_get_structure(gst_sample_get_caps(sample), 0), "clock-rate", &rate);
+        vod_cache_writer_set_clock_rate(stream->writer, stream->stream, rate);
+        stream->has_clock_rate = TRUE;
+    }
+
+    guint8 data[VOD_PACKAGER_HEADER_MAX];
+    const gsize size = gst_buffer_extract(buffer, 0, data, sizeof(data));
+
+    if (size >= 12 && (data[0] >> 6) == 2) {
+        gboolean key_frame = FALSE;
+        if (stream->stream == VOD_CACHE_STREAM_VIDEO) {
+            key_frame = stream->frame_start && rtp_h264_is_key_frame(data, size);
+            stream->frame_start = (data[1] & 0x80) != 0;
+        }
+
+        GstClockTime time =
+            gst_segment_to_running_time(gst_sample_get_segment(sample), GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+        if (!GST_CLOCK_TIME_IS_VALID(time)) {
+            time = 0;
+        }
+        vod_cache_writer_add(stream->writer, stream->stream, time, key_frame, buffer);
+    }
+
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+static void vod_packager_connect(GstElement *pipeline, const gchar *name, struct vod_packager_stream *stream) {
+    GstElement *appsink = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    GstAppSinkCallbacks callbacks = {.new_sample = vod_packager_new_sample};
+    gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, stream, NULL);
+    gst_object_unref(appsink);
+}
+
+gboolean vod_packager_run(const gchar *input, const gchar *output, GError **error) {
+    gst_init(NULL, NULL);
+
+    const gboolean passthrough = passthrough_probe(input, NULL);
+
+    // Offline, so the encoder trades speed for quality, unlike the live one
+    gchar *description;
+    if (passthrough) {
+        description = g_strdup("filesrc name=src ! qtdemux name=demux "
+                               "demux.audio_0 ! queue ! decodebin3 ! " VOD_PACKAGER_AUDIO_DESCRIPTION " "
+                               "demux.video_0 ! queue ! " VOD_PACKAGER_VIDEO_DESCRIPTION);
+    } else {
+        description = g_strdup_printf(
+            "filesrc name=src ! decodebin3 name=dec "
+            "dec. ! queue ! " VOD_PACKAGER_AUDIO_DESCRIPTION " "
+            "dec. ! queue ! videoconvert ! "
+            "encodebin2 profile=\"video/x-h264,profile=constrained-baseline|element-properties,"
+            "speed-preset=6,bframes=0,key-int-max=%d,bitrate=16000\" ! " VOD_PACKAGER_VIDEO_DESCRIPTION,
+            VOD_PACKAGER_KEY_FRAME_INTERVAL);
+    }
+
+    GstElement *pipeline = gst_parse_launch(description, error);
+    g_free(description);
+    if (pipeline == NULL) {
+        return FALSE;
+    }
+    g_clear_error(error);
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    g_object_set(src, "location", input, NULL);
+    gst_object_unref(src);
+
+    struct vod_cache_writer *writer = vod_cache_writer_new();
+    struct vod_packager_stream video = {writer, VOD_CACHE_STREAM_VIDEO, FALSE, TRUE};
+    struct vod_packager_stream audio = {writer, VOD_CACHE_STREAM_AUDIO, FALSE, TRUE};
+    vod_packager_connect(pipeline, "video", &video);
+    vod_packager_connect(pipeline, "audio", &audio);
+
+    ALOGI("Packaging %s, %s the video", input, passthrough ? "keeping" : "re-encoding");
+    const gint64 start_us = g_get_monotonic_time();
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    gst_object_unref(bus);
+
+    gboolean ok = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    if (!ok) {
+        gst_message_parse_error(message, error, NULL);
+    }
+    gst_message_unref(message);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    if (ok) {
+        ok = vod_cache_writer_write(writer, output, error);
+    }
+    if (ok) {
+        ALOGI("Packaged %s into %s in %" G_GINT64_FORMAT " ms",
+              input,
+              output,
+              (g_get_monotonic_time() - start_us) / 1000);
+    }
+
+    vod_cache_writer_free(writer);
+
+    return ok;
+}
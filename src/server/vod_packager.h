@@ -0,0 +1,19 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/// Key frame interval of re-encoded video, the longest a client joining the shared stream waits for a picture
+#define VOD_PACKAGER_KEY_FRAME_INTERVAL 60
+
+/*!
+ * Packetize a media file into a cache, see vod_cache.h, as fast as it can be read and encoded.
+ *
+ * The audio is encoded to Opus. The video is kept as is if it qualifies for passthrough, see passthrough.h, and encoded
+ * to constrained-baseline H.264 otherwise. The file must have both. Initializes GStreamer if needed, and blocks until
+ * done.
+ */
+gboolean vod_packager_run(const gchar *input, const gchar *output, GError **error);
+
+G_END_DECLS
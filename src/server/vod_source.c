@@ -0,0 +1,183 @@
+#include "vod_source.h"
+
+#include <gst/app/app.h>
+
+#include "../utils/logger.h"
+
+struct vod_source {
+    struct vod_cache *cache;
+    GstElement *pipeline;
+    GstElement *srcs[VOD_CACHE_N_STREAMS];
+    guint8 payloads[VOD_CACHE_N_STREAMS];
+    guint32 ssrcs[VOD_CACHE_N_STREAMS];
+
+    GstClockTime start;
+    GThread *thread;
+
+    /// Protects the two below, so that stopping never misses a wait about to start
+    GMutex mutex;
+    gboolean stopping;
+    GstClockID wait_id;
+
+    guint loops;
+};
+
+/// Per stream, added to the packets' own values, and grown by a whole pass at each loop
+struct vod_source_offsets {
+    guint16 seq;
+    guint32 rtp_time;
+};
+
+static void vod_source_rewrite(const struct vod_source *source,
+                               GstBuffer *buffer,
+                               const enum vod_cache_stream stream,
+                               const struct vod_source_offsets *offsets) {
+    guint8 header[12];
+    if (gst_buffer_extract(buffer, 0, header, sizeof(header)) != sizeof(header)) {
+        return;
+    }
+
+    header[1] = (header[1] & 0x80) | (source->payloads[stream] & 0x7f);
+    GST_WRITE_UINT16_BE(header + 2, GST_READ_UINT16_BE(header + 2) + offsets->seq);
+    GST_WRITE_UINT32_BE(header + 4, GST_READ_UINT32_BE(header + 4) + offsets->rtp_time);
+    GST_WRITE_UINT32_BE(header + 8, source->ssrcs[stream]);
+
+    // Only the header's own memory is mapped for writing, the payload stays in the cache's mapping
+    gst_buffer_fill(buffer, 0, header, sizeof(header));
+}
+
+/// Sleep until a running time, FALSE if woken up to stop
+static gboolean vod_source_wait(struct vod_source *source, GstClock *clock, const GstClockTime time) {
+    g_mutex_lock(&source->mutex);
+    if (source->stopping) {
+        g_mutex_unlock(&source->mutex);
+        return FALSE;
+    }
+    source->wait_id = gst_clock_new_single_shot_id(clock, time);
+    g_mutex_unlock(&source->mutex);
+
+    const GstClockReturn ret = gst_clock_id_wait(source->wait_id, NULL);
+
+    g_mutex_lock(&source->mutex);
+    gst_clock_id_unref(source->wait_id);
+    source->wait_id = NULL;
+    g_mutex_unlock(&source->mutex);
+
+    return ret != GST_CLOCK_UNSCHEDULED;
+}
+
+static gpointer vod_source_thread_func(gpointer data) {
+    struct vod_source *source = data;
+    struct vod_cache *cache = source->cache;
+
+    // The clock and base time are only settled once the pipeline is playing
+    gst_element_get_state(source->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+    GstClock *clock = gst_pipeline_get_clock(GST_PIPELINE(source->pipeline));
+    const GstClockTime base_time = gst_element_get_base_time(source->pipeline);
+
+    const GstClockTime duration = vod_cache_get_duration(cache);
+    gsize offset = vod_cache_seek(cache, source->start);
+    struct vod_cache_packet packet;
+    if (duration == 0 || !vod_cache_next(cache, &offset, &packet)) {
+        ALOGE("Nothing to play in the cache");
+        gst_object_unref(clock);
+        return NULL;
+    }
+
+    // Running time of the first packet played, from which the cache's own times count
+    GstClockTime origin = gst_clock_get_time(clock) - base_time - packet.time;
+    struct vod_source_offsets offsets[VOD_CACHE_N_STREAMS] = {0};
+    GstClockTime waited = GST_CLOCK_TIME_NONE;
+
+    ALOGI("Playing the cache from %" GST_TIME_FORMAT, GST_TIME_ARGS(packet.time));
+
+    while (TRUE) {
+        // Packets of a frame share their time, only wait for the first
+        const GstClockTime time = origin + packet.time;
+        if (time != waited) {
+            if (!vod_source_wait(source, clock, base_time + time)) {
+                break;
+            }
+            waited = time;
+        }
+
+        GstBuffer *buffer = vod_cache_packet_to_buffer(cache, &packet);
+        vod_source_rewrite(source, buffer, packet.stream, &offsets[packet.stream]);
+        GST_BUFFER_PTS(buffer) = time;
+        if (gst_app_src_push_buffer(GST_APP_SRC(source->srcs[packet.stream]), buffer) != GST_FLOW_OK) {
+            break;
+        }
+
+        if (vod_cache_next(cache, &offset, &packet)) {
+            continue;
+        }
+
+        // The next pass starts right after the end of this one, from the first key frame
+        origin += duration;
+        for (guint i = 0; i < VOD_CACHE_N_STREAMS; i++) {
+            offsets[i].seq += vod_cache_get_packets(cache, i);
+            offsets[i].rtp_time += gst_util_uint64_scale(duration, vod_cache_get_clock_rate(cache, i), GST_SECOND);
+        }
+        g_atomic_int_inc(&source->loops);
+
+        offset = vod_cache_seek(cache, 0);
+        if (!vod_cache_next(cache, &offset, &packet)) {
+            break;
+        }
+    }
+
+    gst_object_unref(clock);
+
+    return NULL;
+}
+
+struct vod_source *vod_source_new(struct vod_cache *cache,
+                                  GstElement *pipeline,
+                                  GstElement *const srcs[VOD_CACHE_N_STREAMS],
+                                  const guint payloads[VOD_CACHE_N_STREAMS],
+                                  const guint32 ssrcs[VOD_CACHE_N_STREAMS]) {
+    struct vod_source *source = g_new0(struct vod_source, 1);
+    source->cache = cache;
+    source->pipeline = gst_object_ref(pipeline);
+    for (guint i = 0; i < VOD_CACHE_N_STREAMS; i++) {
+        source->srcs[i] = gst_object_ref(srcs[i]);
+        source->payloads[i] = payloads[i];
+        source->ssrcs[i] = ssrcs[i];
+    }
+    g_mutex_init(&source->mutex);
+
+    return source;
+}
+
+void vod_source_start(struct vod_source *source, const GstClockTime start) {
+    g_assert_null(source->thread);
+
+    source->start = start;
+    source->thread = g_thread_new("vod-source", vod_source_thread_func, source);
+}
+
+void vod_source_free(struct vod_source *source) {
+    if (source == NULL) {
+        return;
+    }
+
+    g_mutex_lock(&source->mutex);
+    source->stopping = TRUE;
+    if (source->wait_id) {
+        gst_clock_id_unschedule(source->wait_id);
+    }
+    g_mutex_unlock(&source->mutex);
+
+    g_clear_pointer(&source->thread, g_thread_join);
+
+    for (guint i = 0; i < VOD_CACHE_N_STREAMS; i++) {
+        gst_object_unref(source->srcs[i]);
+    }
+    gst_object_unref(source->pipeline);
+    g_mutex_clear(&source->mutex);
+    g_free(source);
+}
+
+guint vod_source_get_loops(struct vod_source *source) {
+    return g_atomic_int_get(&source->loops);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include "vod_cache.h"
+
+G_BEGIN_DECLS
+
+/*!
+ * Plays a cache, see vod_cache.h, into two live appsrcs, one per stream, looping forever.
+ *
+ * A thread of its own waits on the pipeline clock for each packet's time and pushes it without copying its payload:
+ * only the fixed RTP header is copied, to stamp the server's payload type and SSRC, and to keep sequence numbers and
+ * RTP timestamps increasing from one loop to the next. Packets carry their running time as PTS.
+ */
+struct vod_source;
+
+/*!
+ * @param cache Must outlive the source.
+ * @param srcs The appsrc of each stream, indexed by enum vod_cache_stream, in @p pipeline.
+ * @param payloads The RTP payload type of each stream.
+ * @param ssrcs The RTP SSRC of each stream.
+ */
+struct vod_source *vod_source_new(struct vod_cache *cache,
+                                  GstElement *pipeline,
+                                  GstElement *const srcs[VOD_CACHE_N_STREAMS],
+                                  const guint payloads[VOD_CACHE_N_STREAMS],
+                                  const guint32 ssrcs[VOD_CACHE_N_STREAMS]);
+
+/*!
+ * Start playing from the last key frame at or before @p start, once the pipeline is playing.
+ */
+void vod_source_start(struct vod_source *source, GstClockTime start);
+
+/*!
+ * Stop the thread, if started, and free the source.
+ */
+void vod_source_free(struct vod_source *source);
+
+/*!
+ * Times the cache was played through so far. May be called from any thread.
+ */
+guint vod_source_get_loops(struct vod_source *source);
+
+G_END_DECLS
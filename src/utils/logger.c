@@ -0,0 +1,296 @@
+#include "logger.h"
+
+#ifndef __ANDROID__
+
+    #include <glib.h>
+    #include <stdarg.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+
+/// Bytes of records buffered per thread, a power of two. A thread logging faster than the writer drains drops records
+/// rather than blocking.
+    #define GWD_LOG_RING_BYTES (16 * 1024)
+/// Records start on this boundary, so that the padding at the end of the buffer always has room for a header
+    #define GWD_LOG_RECORD_ALIGN 32
+/// Longer messages (e.g. full SDP dumps) are truncated
+    #define GWD_LOG_MESSAGE_MAX 1000
+/// Messages a single call site may write per second before being rate limited
+    #define GWD_LOG_SITE_BURST 20
+/// How long the writer sleeps when nobody wakes it up
+    #define GWD_LOG_WRITER_PERIOD_US (20 * G_TIME_SPAN_MILLISECOND)
+
+/// Header of a record in the ring, followed by its NUL-terminated message
+struct gwd_log_record {
+    gint64 time_us;
+    /// -1 for the padding that skips the end of the buffer when a record does not fit there
+    int level;
+    /// Messages of the same call site suppressed before this one
+    int suppressed;
+    /// Bytes taken in the ring, header and alignment included
+    guint size;
+};
+
+G_STATIC_ASSERT(sizeof(struct gwd_log_record) <= GWD_LOG_RECORD_ALIGN);
+
+/// Single producer (the owning thread), single consumer (whoever holds writer_mutex)
+struct gwd_log_ring {
+    /// Variable-size records, so that short messages, the common case, do not each take GWD_LOG_MESSAGE_MAX bytes
+    union {
+        guint8 bytes[GWD_LOG_RING_BYTES];
+        gint64 align;
+    } data;
+    /// Byte offset of the next record to be written by the producer, wraps around
+    guint head;
+    /// Byte offset of the next record to be read by the consumer, wraps around
+    guint tail;
+    /// Records lost because the ring was full
+    guint dropped;
+    guint thread_index;
+    /// Set when the owning thread exits, the writer frees the ring once drained
+    gint abandoned;
+
+    struct gwd_log_ring *next;
+};
+
+int gwd_log_threshold = -1;
+
+static void gwd_log_ring_abandon(gpointer data);
+
+static GPrivate thread_ring = G_PRIVATE_INIT(gwd_log_ring_abandon);
+static gint thread_count;
+
+/// Guards the ring list and makes the writer thread and gwd_log_flush() a single consumer
+static GMutex writer_mutex;
+static GCond writer_cond;
+static struct gwd_log_ring *rings;
+static gint64 start_time_us;
+
+static const char level_chars[] = {'D', 'I', 'W', 'E'};
+
+static void gwd_log_ring_abandon(gpointer data) {
+    struct gwd_log_ring *ring = data;
+    g_atomic_int_set(&ring->abandoned, 1);
+}
+
+static void gwd_log_write_record(const struct gwd_log_ring *ring, const struct gwd_log_record *record) {
+    const char *message = (const char *)(record + 1);
+    const gint64 t = record->time_us - start_time_us;
+    const char level = level_chars[CLAMP(record->level, GWD_LOG_LEVEL_DEBUG, GWD_LOG_LEVEL_ERROR)];
+
+    if (record->suppressed > 0) {
+        fprintf(stdout,
+                "[%5d.%06d] %c T%u (%d similar messages suppressed)\n",
+                (int)(t / G_USEC_PER_SEC),
+                (int)(t % G_USEC_PER_SEC),
+                level,
+                ring->thread_index,
+                record->suppressed);
+    }
+
+    // Callers used to append their own newline with the old printf macros, avoid doubling it
+    const size_t len = strlen(message);
+    const int trim = len > 0 && message[len - 1] == '\n';
+
+    fprintf(stdout,
+            "[%5d.%06d] %c T%u %.*s\n",
+            (int)(t / G_USEC_PER_SEC),
+            (int)(t % G_USEC_PER_SEC),
+            level,
+            ring->thread_index,
+            (int)(len - trim),
+            message);
+}
+
+/// Must be called with writer_mutex held
+static void gwd_log_drain_locked(void) {
+    struct gwd_log_ring **link = &rings;
+
+    while (*link != NULL) {
+        struct gwd_log_ring *ring = *link;
+        // Read before draining, so a ring abandoned after this point still gets drained on the next pass
+        const gint abandoned = g_atomic_int_get(&ring->abandoned);
+
+        const guint head = (guint)g_atomic_int_get(&ring->head);
+        for (guint tail = ring->tail; tail != head;) {
+            const struct gwd_log_record *record =
+                (const struct gwd_log_record *)&ring->data.bytes[tail % GWD_LOG_RING_BYTES];
+            if (record->level >= 0) {
+                gwd_log_write_record(ring, record);
+            }
+            tail += record->size;
+        }
+        g_atomic_int_set(&ring->tail, head);
+
+        const guint dropped = (guint)g_atomic_int_exchange(&ring->dropped, 0);
+        if (dropped > 0) {
+            fprintf(stdout, "T%u: %u log messages dropped, ring full\n", ring->thread_index, dropped);
+        }
+
+        if (abandoned) {
+            *link = ring->next;
+            g_free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+
+    fflush(stdout);
+}
+
+static gpointer gwd_log_writer_thread(gpointer data) {
+    // Runs for the lifetime of the process, gwd_log_flush() takes care of what is left at exit
+    g_mutex_lock(&writer_mutex);
+    for (;;) {
+        gwd_log_drain_locked();
+        g_cond_wait_until(&writer_cond, &writer_mutex, g_get_monotonic_time() + GWD_LOG_WRITER_PERIOD_US);
+    }
+
+    return NULL;
+}
+
+static void gwd_log_init_once(void) {
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        start_time_us = g_get_monotonic_time();
+
+        g_thread_unref(g_thread_new("gwd_log_writer", gwd_log_writer_thread, NULL));
+        atexit(gwd_log_flush);
+
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+static struct gwd_log_ring *gwd_log_get_ring(void) {
+    struct gwd_log_ring *ring = g_private_get(&thread_ring);
+    if (G_LIKELY(ring != NULL)) {
+        return ring;
+    }
+
+    gwd_log_init_once();
+
+    ring = g_new0(struct gwd_log_ring, 1);
+    ring->thread_index = (guint)g_atomic_int_add(&thread_count, 1);
+    g_private_set(&thread_ring, ring);
+
+    g_mutex_lock(&writer_mutex);
+    ring->next = rings;
+    rings = ring;
+    g_mutex_unlock(&writer_mutex);
+
+    return ring;
+}
+
+static int gwd_log_parse_level(const char *str) {
+    if (str == NULL || *str == '\0') {
+        return GWD_LOG_LEVEL_DEBUG;
+    }
+    if (g_ascii_isdigit(*str)) {
+        return CLAMP(atoi(str), GWD_LOG_LEVEL_DEBUG, GWD_LOG_LEVEL_ERROR);
+    }
+
+    static const char *names[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < (int)G_N_ELEMENTS(names); i++) {
+        if (g_ascii_strncasecmp(str, names[i], strlen(names[i])) == 0) {
+            return i;
+        }
+    }
+    return GWD_LOG_LEVEL_DEBUG;
+}
+
+void gwd_log_set_level(const int level) {
+    g_atomic_int_set(&gwd_log_threshold, CLAMP(level, GWD_LOG_LEVEL_DEBUG, GWD_LOG_LEVEL_ERROR));
+}
+
+int gwd_log_level_enabled_slow(const int level) {
+    int threshold = g_atomic_int_get(&gwd_log_threshold);
+    if (threshold < 0) {
+        threshold = gwd_log_parse_level(g_getenv("GWD_LOG_LEVEL"));
+        // Keep a level set by gwd_log_set_level() in the meantime
+        g_atomic_int_compare_and_exchange(&gwd_log_threshold, -1, threshold);
+        threshold = g_atomic_int_get(&gwd_log_threshold);
+    }
+    return level >= threshold;
+}
+
+int gwd_log_site_allow(struct gwd_log_site *site) {
+    const int now_s = (int)(g_get_monotonic_time() / G_USEC_PER_SEC);
+
+    // Racing threads may both reset the window, which only lets a few extra messages through
+    if (g_atomic_int_get(&site->window_s) != now_s) {
+        g_atomic_int_set(&site->window_s, now_s);
+        g_atomic_int_set(&site->count, 0);
+    }
+
+    if (g_atomic_int_add(&site->count, 1) < GWD_LOG_SITE_BURST) {
+        return 1;
+    }
+
+    g_atomic_int_inc(&site->suppressed);
+    return 0;
+}
+
+void gwd_log_write(const int level, struct gwd_log_site *site, const char *format, ...) {
+    struct gwd_log_ring *ring = gwd_log_get_ring();
+    const gint64 time_us = g_get_monotonic_time();
+
+    // Formatted on the stack first, as the record size depends on the message length
+    char message[GWD_LOG_MESSAGE_MAX];
+    va_list args;
+    va_start(args, format);
+    int len = g_vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (len < 0) {
+        len = 0;
+        message[0] = '\0';
+    } else if (len >= (int)sizeof(message)) {
+        static const char ellipsis[] = "...";
+        memcpy(message + sizeof(message) - sizeof(ellipsis), ellipsis, sizeof(ellipsis));
+        len = sizeof(message) - 1;
+    }
+
+    const guint size = (sizeof(struct gwd_log_record) + len + 1 + GWD_LOG_RECORD_ALIGN - 1) &
+                       ~(guint)(GWD_LOG_RECORD_ALIGN - 1);
+
+    const guint head = ring->head;
+    const guint used = head - (guint)g_atomic_int_get(&ring->tail);
+    const guint offset = head % GWD_LOG_RING_BYTES;
+    // A record never wraps, skip the end of the buffer if it does not fit there
+    const guint padding = GWD_LOG_RING_BYTES - offset < size ? GWD_LOG_RING_BYTES - offset : 0;
+    if (used + padding + size > GWD_LOG_RING_BYTES) {
+        g_atomic_int_inc(&ring->dropped);
+        return;
+    }
+
+    if (padding > 0) {
+        struct gwd_log_record *pad = (struct gwd_log_record *)&ring->data.bytes[offset];
+        pad->level = -1;
+        pad->size = padding;
+    }
+
+    struct gwd_log_record *record = (struct gwd_log_record *)&ring->data.bytes[(head + padding) % GWD_LOG_RING_BYTES];
+    record->time_us = time_us;
+    record->level = level;
+    record->suppressed = site ? g_atomic_int_exchange(&site->suppressed, 0) : 0;
+    record->size = size;
+    memcpy(record + 1, message, len + 1);
+
+    // Publishes the record to the consumer
+    g_atomic_int_set(&ring->head, head + padding + size);
+
+    // Errors are often followed by an abort, get them out now. Also wake the writer before the ring fills up.
+    const guint half = GWD_LOG_RING_BYTES / 2;
+    if (level >= GWD_LOG_LEVEL_ERROR || (used < half && used + padding + size >= half)) {
+        g_cond_signal(&writer_cond);
+    }
+}
+
+void gwd_log_flush(void) {
+    g_mutex_lock(&writer_mutex);
+    gwd_log_drain_locked();
+    g_mutex_unlock(&writer_mutex);
+}
+
+#endif
@@ -2,27 +2,105 @@
 
 #define LOG_TAG "GstWebrtcDemo"
 
+#define GWD_LOG_LEVEL_DEBUG 0
+#define GWD_LOG_LEVEL_INFO 1
+#define GWD_LOG_LEVEL_WARN 2
+#define GWD_LOG_LEVEL_ERROR 3
+
+// Calls below this level are compiled out entirely, e.g. -DGWD_LOG_COMPILE_LEVEL=GWD_LOG_LEVEL_INFO
+#ifndef GWD_LOG_COMPILE_LEVEL
+    #define GWD_LOG_COMPILE_LEVEL GWD_LOG_LEVEL_DEBUG
+#endif
+
 #ifndef ALOGV
     #ifdef __ANDROID__
         #include <android/log.h>
 
-        #define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-        #define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-        #define ALOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
-        #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+        // logd already does the buffering, so only filter at compile time
+        #define GWD_ANDROID_LOG(level, prio, ...)                       \
+            do {                                                        \
+                if ((level) >= GWD_LOG_COMPILE_LEVEL) {                 \
+                    __android_log_print((prio), LOG_TAG, __VA_ARGS__); \
+                }                                                       \
+            } while (0)
+
+        #define ALOGD(...) GWD_ANDROID_LOG(GWD_LOG_LEVEL_DEBUG, ANDROID_LOG_DEBUG, __VA_ARGS__)
+        #define ALOGI(...) GWD_ANDROID_LOG(GWD_LOG_LEVEL_INFO, ANDROID_LOG_INFO, __VA_ARGS__)
+        #define ALOGW(...) GWD_ANDROID_LOG(GWD_LOG_LEVEL_WARN, ANDROID_LOG_WARN, __VA_ARGS__)
+        #define ALOGE(...) GWD_ANDROID_LOG(GWD_LOG_LEVEL_ERROR, ANDROID_LOG_ERROR, __VA_ARGS__)
     #else
-        #include <stdio.h>
-        #define ALOGD(...)       \
-            printf(__VA_ARGS__); \
-            printf("\n")
-        #define ALOGI(...)       \
-            printf(__VA_ARGS__); \
-            printf("\n")
-        #define ALOGW(...)       \
-            printf(__VA_ARGS__); \
-            printf("\n")
-        #define ALOGE(...)       \
-            printf(__VA_ARGS__); \
-            printf("\n")
+        #include <glib.h>
+
+        #if defined(__GNUC__) || defined(__clang__)
+            #define GWD_LOG_PRINTF_FORMAT(fmt_idx, arg_idx) __attribute__((format(printf, fmt_idx, arg_idx)))
+        #else
+            #define GWD_LOG_PRINTF_FORMAT(fmt_idx, arg_idx)
+        #endif
+
+        #ifdef __cplusplus
+extern "C" {
+        #endif
+
+/*!
+ * Per call site state of the rate limiter. One is declared static by every ALOG macro expansion.
+ */
+struct gwd_log_site {
+    int window_s;
+    int count;
+    int suppressed;
+};
+
+/// Runtime threshold, read from the GWD_LOG_LEVEL environment variable on first use
+extern int gwd_log_threshold;
+
+/*!
+ * Set the runtime threshold, overriding GWD_LOG_LEVEL.
+ */
+void gwd_log_set_level(int level);
+
+/*!
+ * Slow path of the runtime level check, only taken until the threshold has been read from the environment.
+ */
+int gwd_log_level_enabled_slow(int level);
+
+/*!
+ * Count a call against the site's per-second budget. ALOGE skips it, errors are never rate limited.
+ *
+ * @return Non-zero if the message should be written.
+ */
+int gwd_log_site_allow(struct gwd_log_site *site);
+
+/*!
+ * Format the message into the calling thread's ring, to be written out by the background writer. Never blocks.
+ */
+void gwd_log_write(int level, struct gwd_log_site *site, const char *format, ...) GWD_LOG_PRINTF_FORMAT(3, 4);
+
+/*!
+ * Synchronously write out everything logged so far. Called at exit.
+ */
+void gwd_log_flush(void);
+
+        #ifdef __cplusplus
+}
+        #endif
+
+        #define GWD_LOG(level, ...)                                                                   \
+            do {                                                                                      \
+                if ((level) >= GWD_LOG_COMPILE_LEVEL) {                                               \
+                    const int gwd_log_threshold_ = g_atomic_int_get(&gwd_log_threshold);              \
+                    if (gwd_log_threshold_ >= 0 ? (level) >= gwd_log_threshold_                       \
+                                                : gwd_log_level_enabled_slow(level)) {                \
+                        static struct gwd_log_site gwd_log_site_;                                     \
+                        if ((level) >= GWD_LOG_LEVEL_ERROR || gwd_log_site_allow(&gwd_log_site_)) {   \
+                            gwd_log_write((level), &gwd_log_site_, __VA_ARGS__);                      \
+                        }                                                                             \
+                    }                                                                                 \
+                }                                                                                     \
+            } while (0)
+
+        #define ALOGD(...) GWD_LOG(GWD_LOG_LEVEL_DEBUG, __VA_ARGS__)
+        #define ALOGI(...) GWD_LOG(GWD_LOG_LEVEL_INFO, __VA_ARGS__)
+        #define ALOGW(...) GWD_LOG(GWD_LOG_LEVEL_WARN, __VA_ARGS__)
+        #define ALOGE(...) GWD_LOG(GWD_LOG_LEVEL_ERROR, __VA_ARGS__)
     #endif
 #endif
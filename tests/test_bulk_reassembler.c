@@ -0,0 +1,293 @@
+#include <glib.h>
+#include <string.h>
+
+#include "../src/common/bulk_reassembler.h"
+
+#define MAX_SIZE (1024 * 1024)
+/// Payload bytes per chunk, as bulk_transfer sends them
+#define PAYLOAD_SIZE (16384 - BULK_CHUNK_HEADER_SIZE)
+/// Size of the transfer reassembled by the benchmark
+#define BENCH_SIZE (64 * 1024 * 1024)
+
+/// Build the chunk of transfer @p id carrying @p length bytes of @p data at @p offset
+static guint8 *make_chunk(const guint32 id,
+                          const guint32 total,
+                          const guint32 offset,
+                          const guint8 *data,
+                          const gsize length) {
+    const guint32 header[4] = {
+        GUINT32_TO_BE(BULK_CHUNK_MAGIC),
+        GUINT32_TO_BE(id),
+        GUINT32_TO_BE(total),
+        GUINT32_TO_BE(offset),
+    };
+    guint8 *chunk = g_malloc(BULK_CHUNK_HEADER_SIZE + length);
+    memcpy(chunk, header, BULK_CHUNK_HEADER_SIZE);
+    if (length > 0) {
+        memcpy(chunk + BULK_CHUNK_HEADER_SIZE, data + offset, length);
+    }
+    return chunk;
+}
+
+/// Push one chunk, and check which transfer it belonged to
+static GBytes *push(struct bulk_reassembler *r,
+                    const guint32 id,
+                    const guint32 total,
+                    const guint32 offset,
+                    const guint8 *data,
+                    const gsize length,
+                    const gint64 now_us,
+                    gint64 *out_start_us) {
+    guint8 *chunk = make_chunk(id, total, offset, data, length);
+    guint32 out_id = 0;
+    GBytes *complete = bulk_reassembler_push(r, chunk, BULK_CHUNK_HEADER_SIZE + length, now_us, &out_id, out_start_us);
+    g_assert_cmpuint(out_id, ==, id);
+    g_free(chunk);
+    return complete;
+}
+
+static guint8 *make_data(const gsize size) {
+    guint8 *data = g_malloc(size);
+    for (gsize i = 0; i < size; i++) {
+        data[i] = (guint8)(i * 31 + (i >> 8));
+    }
+    return data;
+}
+
+static void test_in_order(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    const guint32 total = 3 * PAYLOAD_SIZE + 100;
+    guint8 *data = make_data(total);
+
+    gint64 start_us = 0;
+    guint32 offset = 0;
+    GBytes *complete = NULL;
+    for (gint64 now_us = 1000; offset < total; now_us += 1000) {
+        const guint32 length = MIN(PAYLOAD_SIZE, total - offset);
+        g_assert_null(complete);
+        complete = push(r, 7, total, offset, data, length, now_us, &start_us);
+        offset += length;
+        if (complete == NULL) {
+            g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 1);
+            g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, offset);
+        }
+    }
+
+    g_assert_nonnull(complete);
+    g_assert_cmpint(start_us, ==, 1000);
+    gsize size;
+    const guint8 *out = g_bytes_get_data(complete, &size);
+    g_assert_cmpmem(out, size, data, total);
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    g_bytes_unref(complete);
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+/// Transfers to different IDs interleave, each completes on its own
+static void test_interleaved(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    const guint32 total = 2 * PAYLOAD_SIZE;
+    guint8 *data = make_data(total);
+    gint64 start_us;
+
+    g_assert_null(push(r, 1, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_null(push(r, 2, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 2 * PAYLOAD_SIZE);
+
+    GBytes *second = push(r, 2, total, PAYLOAD_SIZE, data, PAYLOAD_SIZE, 0, &start_us);
+    g_assert_nonnull(second);
+    g_assert_cmpuint(g_bytes_get_size(second), ==, total);
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 1);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, PAYLOAD_SIZE);
+
+    GBytes *first = push(r, 1, total, PAYLOAD_SIZE, data, PAYLOAD_SIZE, 0, &start_us);
+    g_assert_nonnull(first);
+    g_assert_true(g_bytes_equal(first, second));
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    g_bytes_unref(first);
+    g_bytes_unref(second);
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+static void test_empty(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    gint64 start_us;
+
+    GBytes *complete = push(r, 3, 0, 0, NULL, 0, 5, &start_us);
+    g_assert_nonnull(complete);
+    g_assert_cmpuint(g_bytes_get_size(complete), ==, 0);
+    g_assert_cmpint(start_us, ==, 5);
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+
+    g_bytes_unref(complete);
+    bulk_reassembler_free(r);
+}
+
+static void test_too_large(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    guint8 *data = make_data(PAYLOAD_SIZE);
+    gint64 start_us;
+
+    // Dropped from the first chunk, without holding anything
+    g_assert_null(push(r, 1, MAX_SIZE + 1, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    // A chunk running past the announced total drops the transfer
+    g_assert_null(push(r, 2, 100, 0, data, 60, 0, &start_us));
+    g_assert_null(push(r, 2, 100, 60, data, 60, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+static void test_out_of_order(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    const guint32 total = 3 * PAYLOAD_SIZE;
+    guint8 *data = make_data(total);
+    gint64 start_us;
+
+    // Missed the start
+    g_assert_null(push(r, 1, total, PAYLOAD_SIZE, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+
+    // A gap drops what was held
+    g_assert_null(push(r, 1, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_null(push(r, 1, total, 2 * PAYLOAD_SIZE, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    // So does a repeated chunk
+    g_assert_null(push(r, 1, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_null(push(r, 1, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+static void test_max_incoming(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    const guint32 total = 2 * PAYLOAD_SIZE;
+    guint8 *data = make_data(total);
+    gint64 start_us;
+
+    for (guint32 id = 0; id < BULK_REASSEMBLER_MAX_INCOMING; id++) {
+        g_assert_null(push(r, id, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    }
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, BULK_REASSEMBLER_MAX_INCOMING);
+
+    // One more is refused, and its next chunk does not start it either
+    const guint32 extra = BULK_REASSEMBLER_MAX_INCOMING;
+    g_assert_null(push(r, extra, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_null(push(r, extra, total, PAYLOAD_SIZE, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, BULK_REASSEMBLER_MAX_INCOMING);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, BULK_REASSEMBLER_MAX_INCOMING * PAYLOAD_SIZE);
+
+    // Once one completes there is room again
+    GBytes *complete = push(r, 0, total, PAYLOAD_SIZE, data, PAYLOAD_SIZE, 0, &start_us);
+    g_assert_nonnull(complete);
+    g_bytes_unref(complete);
+    g_assert_null(push(r, extra, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, BULK_REASSEMBLER_MAX_INCOMING);
+
+    bulk_reassembler_clear(r);
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 0);
+
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+static void test_expire(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(MAX_SIZE);
+    const guint32 total = 3 * PAYLOAD_SIZE;
+    guint8 *data = make_data(total);
+    gint64 start_us;
+
+    g_assert_null(push(r, 1, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    g_assert_null(push(r, 2, total, 0, data, PAYLOAD_SIZE, 0, &start_us));
+    // Transfer 2 keeps going, which keeps it alive
+    const gint64 later_us = BULK_REASSEMBLER_STALL_TIMEOUT_US / 2;
+    g_assert_null(push(r, 2, total, PAYLOAD_SIZE, data, PAYLOAD_SIZE, later_us, &start_us));
+
+    g_assert_cmpuint(bulk_reassembler_expire(r, BULK_REASSEMBLER_STALL_TIMEOUT_US - 1), ==, 0);
+    g_assert_cmpuint(bulk_reassembler_expire(r, BULK_REASSEMBLER_STALL_TIMEOUT_US), ==, 1);
+    g_assert_cmpuint(bulk_reassembler_get_incoming(r), ==, 1);
+    g_assert_cmpuint(bulk_reassembler_get_held_bytes(r), ==, 2 * PAYLOAD_SIZE);
+
+    GBytes *complete = push(r, 2, total, 2 * PAYLOAD_SIZE, data, PAYLOAD_SIZE, later_us, &start_us);
+    g_assert_nonnull(complete);
+    g_assert_cmpint(start_us, ==, 0);
+    g_bytes_unref(complete);
+
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+/// Reassembly alone, without SCTP underneath, so an upper bound for what a transfer can reach
+static void test_bench(void) {
+    struct bulk_reassembler *r = bulk_reassembler_new(BENCH_SIZE);
+    guint8 *data = make_data(BENCH_SIZE);
+
+    // The chunks are built up front, as they would arrive from the data channel
+    const guint n_chunks = (BENCH_SIZE + PAYLOAD_SIZE - 1) / PAYLOAD_SIZE;
+    guint8 **chunks = g_new(guint8 *, n_chunks);
+    gsize *sizes = g_new(gsize, n_chunks);
+    for (guint i = 0; i < n_chunks; i++) {
+        const guint32 offset = i * PAYLOAD_SIZE;
+        const gsize length = MIN(PAYLOAD_SIZE, BENCH_SIZE - offset);
+        chunks[i] = make_chunk(1, BENCH_SIZE, offset, data, length);
+        sizes[i] = BULK_CHUNK_HEADER_SIZE + length;
+    }
+
+    GBytes *complete = NULL;
+    guint32 id;
+    gint64 start_us;
+    const gint64 begin_us = g_get_monotonic_time();
+    for (guint i = 0; i < n_chunks; i++) {
+        complete = bulk_reassembler_push(r, chunks[i], sizes[i], 0, &id, &start_us);
+    }
+    const gint64 elapsed_us = g_get_monotonic_time() - begin_us;
+
+    g_assert_nonnull(complete);
+    g_assert_cmpuint(g_bytes_get_size(complete), ==, BENCH_SIZE);
+
+    const gdouble mb_per_s = (gdouble)BENCH_SIZE / (gdouble)MAX(elapsed_us, 1);
+    g_test_message("Reassembled %d MB in %u chunks: %.0f MB/s", BENCH_SIZE / (1024 * 1024), n_chunks, mb_per_s);
+    if (g_test_perf()) {
+        g_test_maximized_result(mb_per_s, "reassembly %.0f MB/s", mb_per_s);
+    }
+
+    g_bytes_unref(complete);
+    for (guint i = 0; i < n_chunks; i++) {
+        g_free(chunks[i]);
+    }
+    g_free(chunks);
+    g_free(sizes);
+    g_free(data);
+    bulk_reassembler_free(r);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bulk_reassembler/in_order", test_in_order);
+    g_test_add_func("/bulk_reassembler/interleaved", test_interleaved);
+    g_test_add_func("/bulk_reassembler/empty", test_empty);
+    g_test_add_func("/bulk_reassembler/too_large", test_too_large);
+    g_test_add_func("/bulk_reassembler/out_of_order", test_out_of_order);
+    g_test_add_func("/bulk_reassembler/max_incoming", test_max_incoming);
+    g_test_add_func("/bulk_reassembler/expire", test_expire);
+    g_test_add_func("/bulk_reassembler/bench", test_bench);
+
+    return g_test_run();
+}
@@ -0,0 +1,199 @@
+#include <glib.h>
+#include <string.h>
+
+#include "../src/server/frame_dedup.h"
+
+/// Sizes of the luma plane compared by the benchmark, a 1080p frame
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_FRAMES 200
+
+/// Row lengths around the 16 and 32 byte vectors and the block size, so every tail path runs
+static const gsize row_lengths[] = {1, 7, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 100, 127, 129, 1000, 1920, 1927};
+
+static guint8 *make_plane(GRand *rand, const gsize size) {
+    guint8 *plane = g_malloc(size);
+    for (gsize i = 0; i < size; i++) {
+        plane[i] = (guint8)g_rand_int(rand);
+    }
+    return plane;
+}
+
+/// Run @p sad and the C kernel over the same rows, starting from the same non zero sums, and compare every block
+static void check_against_c(frame_dedup_sad_func sad,
+                            const guint8 *a,
+                            const gsize stride_a,
+                            const guint8 *b,
+                            const gsize stride_b,
+                            const gsize row_bytes,
+                            const guint rows) {
+    frame_dedup_sad_func reference = frame_dedup_get_sad("C");
+    const gsize n_blocks = (row_bytes + FRAME_DEDUP_BLOCK_BYTES - 1) / FRAME_DEDUP_BLOCK_BYTES;
+
+    guint32 *expected = g_new(guint32, n_blocks);
+    guint32 *actual = g_new(guint32, n_blocks);
+    for (gsize i = 0; i < n_blocks; i++) {
+        expected[i] = actual[i] = (guint32)i * 3 + 1;
+    }
+
+    reference(a, stride_a, b, stride_b, row_bytes, rows, expected);
+    sad(a, stride_a, b, stride_b, row_bytes, rows, actual);
+
+    for (gsize i = 0; i < n_blocks; i++) {
+        if (actual[i] != expected[i]) {
+            g_test_message("row_bytes %" G_GSIZE_FORMAT " strides %" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT
+                           " rows %u block %" G_GSIZE_FORMAT,
+                           row_bytes,
+                           stride_a,
+                           stride_b,
+                           rows,
+                           i);
+        }
+        g_assert_cmpuint(actual[i], ==, expected[i]);
+    }
+
+    g_free(expected);
+    g_free(actual);
+}
+
+static void test_c_reference(void) {
+    frame_dedup_sad_func sad = frame_dedup_get_sad("C");
+    g_assert_nonnull(sad);
+    g_assert_null(frame_dedup_get_sad("MMX"));
+    g_assert_null(frame_dedup_get_sad(NULL));
+
+    // 70 bytes: a full block then a 6 byte one, over 2 rows with padding that must not count
+    guint8 a[2 * 80];
+    guint8 b[2 * 80];
+    memset(a, 10, sizeof(a));
+    memset(b, 10, sizeof(b));
+    b[0] = 13;
+    b[63] = 0;
+    b[64] = 255;
+    b[80 + 69] = 12;
+    b[80 + 70] = 200;
+    b[79] = 200;
+
+    guint32 sums[2] = {5, 0};
+    sad(a, 80, b, 80, 70, 2, sums);
+    g_assert_cmpuint(sums[0], ==, 5 + 3 + 10);
+    g_assert_cmpuint(sums[1], ==, 245 + 2);
+}
+
+/// Random planes with odd strides, unaligned starts and every row length, against the C kernel
+static void test_matches_c(gconstpointer data) {
+    const gchar *name = data;
+    frame_dedup_sad_func sad = frame_dedup_get_sad(name);
+    if (sad == NULL) {
+        g_test_skip("Not built in or not supported by this CPU");
+        return;
+    }
+
+    GRand *rand = g_rand_new_with_seed(46);
+    const gsize max_stride = 1927 + 61;
+    const guint max_rows = FRAME_DEDUP_BLOCK_ROWS + 1;
+    guint8 *a = make_plane(rand, max_stride * max_rows + 1);
+    guint8 *b = make_plane(rand, max_stride * max_rows + 1);
+
+    for (guint i = 0; i < G_N_ELEMENTS(row_lengths); i++) {
+        const gsize row_bytes = row_lengths[i];
+        for (guint rows = 1; rows <= max_rows; rows += 4) {
+            check_against_c(sad, a, row_bytes, b, row_bytes, row_bytes, rows);
+            check_against_c(sad, a + 1, row_bytes + 61, b, row_bytes + 3, row_bytes, rows);
+        }
+    }
+
+    g_free(a);
+    g_free(b);
+    g_rand_free(rand);
+}
+
+/// Bytes 0 against 255 everywhere, the largest sum a block can reach, to catch a narrow lane or a lost carry
+static void test_extremes(gconstpointer data) {
+    const gchar *name = data;
+    frame_dedup_sad_func sad = frame_dedup_get_sad(name);
+    if (sad == NULL) {
+        g_test_skip("Not built in or not supported by this CPU");
+        return;
+    }
+
+    const gsize row_bytes = 4 * FRAME_DEDUP_BLOCK_BYTES;
+    guint8 *a = g_malloc0(row_bytes * FRAME_DEDUP_BLOCK_ROWS);
+    guint8 *b = g_malloc(row_bytes * FRAME_DEDUP_BLOCK_ROWS);
+    memset(b, 255, row_bytes * FRAME_DEDUP_BLOCK_ROWS);
+
+    guint32 sums[4] = {0};
+    sad(a, row_bytes, b, row_bytes, row_bytes, FRAME_DEDUP_BLOCK_ROWS, sums);
+    for (guint i = 0; i < G_N_ELEMENTS(sums); i++) {
+        g_assert_cmpuint(sums[i], ==, 255 * FRAME_DEDUP_BLOCK_BYTES * FRAME_DEDUP_BLOCK_ROWS);
+    }
+
+    g_free(a);
+    g_free(b);
+}
+
+/// A whole 1080p luma plane per call, the worst case of a static frame where no block stops the comparison early
+static void test_bench(gconstpointer data) {
+    const gchar *name = data;
+    frame_dedup_sad_func sad = frame_dedup_get_sad(name);
+    if (sad == NULL) {
+        g_test_skip("Not built in or not supported by this CPU");
+        return;
+    }
+
+    GRand *rand = g_rand_new_with_seed(1080);
+    guint8 *a = make_plane(rand, BENCH_WIDTH * BENCH_HEIGHT);
+    guint8 *b = g_malloc(BENCH_WIDTH * BENCH_HEIGHT);
+    memcpy(b, a, BENCH_WIDTH * BENCH_HEIGHT);
+    guint32 sums[BENCH_WIDTH / FRAME_DEDUP_BLOCK_BYTES];
+
+    const gint64 begin_us = g_get_monotonic_time();
+    for (guint frame = 0; frame < BENCH_FRAMES; frame++) {
+        memset(sums, 0, sizeof(sums));
+        for (guint y = 0; y < BENCH_HEIGHT; y += FRAME_DEDUP_BLOCK_ROWS) {
+            sad(a + y * BENCH_WIDTH,
+                BENCH_WIDTH,
+                b + y * BENCH_WIDTH,
+                BENCH_WIDTH,
+                BENCH_WIDTH,
+                MIN(FRAME_DEDUP_BLOCK_ROWS, BENCH_HEIGHT - y),
+                sums);
+        }
+    }
+    const gint64 elapsed_us = g_get_monotonic_time() - begin_us;
+
+    g_assert_cmpuint(sums[0], ==, 0);
+
+    const gdouble us_per_frame = (gdouble)elapsed_us / BENCH_FRAMES;
+    g_test_message("%s: %.0f us per %dx%d plane", name, us_per_frame, BENCH_WIDTH, BENCH_HEIGHT);
+    if (g_test_perf()) {
+        g_test_minimized_result(us_per_frame, "%s %.0f us per frame", name, us_per_frame);
+    }
+
+    g_free(a);
+    g_free(b);
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    static const gchar *const kernels[] = {"C", "SSE2", "AVX2", "NEON"};
+
+    g_test_add_func("/frame_dedup/c_reference", test_c_reference);
+    for (guint i = 0; i < G_N_ELEMENTS(kernels); i++) {
+        gchar *path = g_strdup_printf("/frame_dedup/matches_c/%s", kernels[i]);
+        g_test_add_data_func(path, kernels[i], test_matches_c);
+        g_free(path);
+
+        path = g_strdup_printf("/frame_dedup/extremes/%s", kernels[i]);
+        g_test_add_data_func(path, kernels[i], test_extremes);
+        g_free(path);
+
+        path = g_strdup_printf("/frame_dedup/bench/%s", kernels[i]);
+        g_test_add_data_func(path, kernels[i], test_bench);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,277 @@
+#include <glib.h>
+
+#ifdef __linux__
+    #include <poll.h>
+    #include <stdlib.h>
+    #include <time.h>
+#endif
+
+#include "../src/client/frame_mailbox.h"
+
+/// Frames the producer publishes per run
+#define STRESS_FRAMES 200000
+/// Every word of a frame holds its sequence number, so a frame read while being written shows up as a mismatch
+#define FRAME_WORDS 16
+
+struct test_frame {
+    guint64 words[FRAME_WORDS];
+};
+
+enum consumer_mode {
+    /// Spin on my_frame_mailbox_take()
+    CONSUMER_POLL,
+    /// Also have the mailbox signal its eventfd on every publish
+    CONSUMER_POLL_FD,
+    /// Block in my_frame_mailbox_wait() between takes
+    CONSUMER_WAIT,
+};
+
+static gint frames_freed;
+
+static void test_frame_free(gpointer data) {
+    g_atomic_int_inc(&frames_freed);
+    g_free(data);
+}
+
+static gpointer producer_thread(gpointer user_data) {
+    struct my_frame_mailbox *mb = user_data;
+
+    for (guint64 seq = 1; seq <= STRESS_FRAMES; seq++) {
+        struct test_frame *frame = g_new(struct test_frame, 1);
+        for (guint i = 0; i < FRAME_WORDS; i++) {
+            frame->words[i] = seq;
+        }
+        const struct timespec decode_end = {.tv_sec = (time_t)seq};
+        my_frame_mailbox_publish(mb, frame, &decode_end);
+    }
+
+    return NULL;
+}
+
+static void test_stress(gconstpointer data) {
+    const enum consumer_mode mode = GPOINTER_TO_INT(data);
+
+    struct my_frame_mailbox mb;
+    my_frame_mailbox_init(&mb, test_frame_free);
+    g_atomic_int_set(&frames_freed, 0);
+
+    if (mode == CONSUMER_POLL_FD) {
+        g_assert_cmpint(my_frame_mailbox_get_fd(&mb), >=, 0);
+    }
+
+    GThread *producer = g_thread_new("producer", producer_thread, &mb);
+
+    // The producer's last frame is never replaced, so we always end up taking it
+    guint64 last_seq = 0;
+    guint taken = 0;
+    while (last_seq < STRESS_FRAMES) {
+        if (mode == CONSUMER_WAIT && !my_frame_mailbox_wait(&mb, 1000)) {
+            continue;
+        }
+
+        struct timespec decode_end;
+        struct test_frame *frame = my_frame_mailbox_take(&mb, &decode_end);
+        if (frame == NULL) {
+            continue;
+        }
+
+        const guint64 seq = frame->words[0];
+        for (guint i = 1; i < FRAME_WORDS; i++) {
+            g_assert_cmpuint(frame->words[i], ==, seq);
+        }
+        g_assert_cmpuint(seq, >, last_seq);
+        g_assert_cmpuint(decode_end.tv_sec, ==, seq);
+
+        last_seq = seq;
+        taken++;
+        test_frame_free(frame);
+    }
+
+    g_thread_join(producer);
+
+    struct my_frame_counters counters;
+    my_frame_mailbox_get_counters(&mb, &counters);
+    g_assert_cmpuint(counters.produced, ==, STRESS_FRAMES);
+    g_assert_cmpuint(counters.consumed, ==, taken);
+    g_assert_cmpuint(counters.consumed + counters.dropped, ==, counters.produced);
+    g_assert_null(my_frame_mailbox_take(&mb, NULL));
+
+    my_frame_mailbox_clear(&mb);
+    g_assert_cmpint(g_atomic_int_get(&frames_freed), ==, STRESS_FRAMES);
+}
+
+static void test_clear_frees_pending(void) {
+    struct my_frame_mailbox mb;
+    my_frame_mailbox_init(&mb, test_frame_free);
+    g_atomic_int_set(&frames_freed, 0);
+
+    my_frame_mailbox_publish(&mb, g_new0(struct test_frame, 1), NULL);
+    my_frame_mailbox_publish(&mb, g_new0(struct test_frame, 1), NULL);
+    g_assert_cmpint(g_atomic_int_get(&frames_freed), ==, 1);
+
+    my_frame_mailbox_clear(&mb);
+    g_assert_cmpint(g_atomic_int_get(&frames_freed), ==, 2);
+}
+
+#ifdef __linux__
+/// Frames published by the wakeup latency test, one every WAKEUP_PERIOD_US
+    #define WAKEUP_FRAMES 500
+    #define WAKEUP_PERIOD_US 2000
+/// How long the idle test sits on the fd with nothing published
+    #define IDLE_DURATION_US (300 * 1000)
+    #define IDLE_POLL_TIMEOUT_MS 50
+
+static gboolean fd_readable(const gint fd, const gint timeout_ms) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+static gint64 thread_cpu_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b) {
+    const gint64 x = *(const gint64 *)a;
+    const gint64 y = *(const gint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+/// The fd is level-triggered, a render loop polling it only sleeps if taking the frame drains it
+static void test_fd_drained_by_take(void) {
+    struct my_frame_mailbox mb;
+    my_frame_mailbox_init(&mb, test_frame_free);
+    const gint fd = my_frame_mailbox_get_fd(&mb);
+    g_assert_cmpint(fd, >=, 0);
+
+    g_assert_false(fd_readable(fd, 0));
+
+    my_frame_mailbox_publish(&mb, g_new0(struct test_frame, 1), NULL);
+    my_frame_mailbox_publish(&mb, g_new0(struct test_frame, 1), NULL);
+    g_assert_true(fd_readable(fd, 0));
+
+    g_free(my_frame_mailbox_take(&mb, NULL));
+    g_assert_false(fd_readable(fd, 0));
+
+    // Taking when there is nothing new still leaves it drained
+    g_assert_null(my_frame_mailbox_take(&mb, NULL));
+    g_assert_false(fd_readable(fd, 0));
+
+    my_frame_mailbox_clear(&mb);
+}
+
+/// A consumer blocked on the fd with nothing published must neither wake up nor burn CPU
+static void test_fd_idle(void) {
+    struct my_frame_mailbox mb;
+    my_frame_mailbox_init(&mb, test_frame_free);
+    const gint fd = my_frame_mailbox_get_fd(&mb);
+
+    // Leave a taken frame behind, as a render loop would
+    my_frame_mailbox_publish(&mb, g_new0(struct test_frame, 1), NULL);
+    g_free(my_frame_mailbox_take(&mb, NULL));
+
+    const gint64 cpu_start_us = thread_cpu_time_us();
+    const gint64 end_us = g_get_monotonic_time() + IDLE_DURATION_US;
+    guint wakeups = 0;
+    while (g_get_monotonic_time() < end_us) {
+        if (fd_readable(fd, IDLE_POLL_TIMEOUT_MS)) {
+            wakeups++;
+            g_free(my_frame_mailbox_take(&mb, NULL));
+        }
+    }
+    const gint64 cpu_us = thread_cpu_time_us() - cpu_start_us;
+
+    g_test_message("Idle for %d ms: %u wakeups, %" G_GINT64_FORMAT " us of CPU",
+                   IDLE_DURATION_US / 1000,
+                   wakeups,
+                   cpu_us);
+    g_assert_cmpuint(wakeups, ==, 0);
+    // A spinning loop would use the whole duration
+    g_assert_cmpint(cpu_us, <, IDLE_DURATION_US / 10);
+
+    my_frame_mailbox_clear(&mb);
+}
+
+static gpointer paced_producer_thread(gpointer user_data) {
+    struct my_frame_mailbox *mb = user_data;
+
+    for (guint i = 0; i < WAKEUP_FRAMES; i++) {
+        g_usleep(WAKEUP_PERIOD_US);
+        struct test_frame *frame = g_new0(struct test_frame, 1);
+        frame->words[0] = (guint64)g_get_monotonic_time();
+        my_frame_mailbox_publish(mb, frame, NULL);
+    }
+
+    return NULL;
+}
+
+/// Time from publishing a frame to a consumer blocked in poll() having it in hand
+static void test_fd_wakeup_latency(void) {
+    struct my_frame_mailbox mb;
+    my_frame_mailbox_init(&mb, test_frame_free);
+    const gint fd = my_frame_mailbox_get_fd(&mb);
+
+    GThread *producer = g_thread_new("producer", paced_producer_thread, &mb);
+
+    gint64 *latencies_us = g_new(gint64, WAKEUP_FRAMES);
+    guint n_latencies = 0;
+    // Frames replaced before we got to them are not counted, so stop once the last one is taken
+    for (;;) {
+        // Only a stuck wakeup would take this long
+        g_assert_true(fd_readable(fd, 1000));
+
+        struct test_frame *frame = my_frame_mailbox_take(&mb, NULL);
+        const gint64 now_us = g_get_monotonic_time();
+        if (frame == NULL) {
+            continue;
+        }
+        latencies_us[n_latencies++] = now_us - (gint64)frame->words[0];
+        g_free(frame);
+
+        struct my_frame_counters counters;
+        my_frame_mailbox_get_counters(&mb, &counters);
+        if (counters.produced == WAKEUP_FRAMES && !fd_readable(fd, 0)) {
+            break;
+        }
+    }
+
+    g_thread_join(producer);
+
+    qsort(latencies_us, n_latencies, sizeof(gint64), compare_gint64);
+    const gint64 median_us = latencies_us[n_latencies / 2];
+    const gint64 p99_us = latencies_us[n_latencies * 99 / 100];
+    g_test_message("Wakeup latency over %u frames: median %" G_GINT64_FORMAT " us, p99 %" G_GINT64_FORMAT
+                   " us, max %" G_GINT64_FORMAT " us",
+                   n_latencies,
+                   median_us,
+                   p99_us,
+                   latencies_us[n_latencies - 1]);
+    if (g_test_perf()) {
+        g_test_minimized_result((gdouble)median_us, "median wakeup latency %" G_GINT64_FORMAT " us", median_us);
+    }
+    // Loose enough for a loaded CI machine, a missed wakeup shows up as the 1 s poll timeout above
+    g_assert_cmpint(median_us, <, 10 * 1000);
+
+    g_free(latencies_us);
+    my_frame_mailbox_clear(&mb);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/frame_mailbox/stress/poll", GINT_TO_POINTER(CONSUMER_POLL), test_stress);
+#ifdef __linux__
+    g_test_add_data_func("/frame_mailbox/stress/poll_fd", GINT_TO_POINTER(CONSUMER_POLL_FD), test_stress);
+#endif
+    g_test_add_data_func("/frame_mailbox/stress/wait", GINT_TO_POINTER(CONSUMER_WAIT), test_stress);
+    g_test_add_func("/frame_mailbox/clear_frees_pending", test_clear_frees_pending);
+#ifdef __linux__
+    g_test_add_func("/frame_mailbox/fd/drained_by_take", test_fd_drained_by_take);
+    g_test_add_func("/frame_mailbox/fd/idle", test_fd_idle);
+    g_test_add_func("/frame_mailbox/fd/wakeup_latency", test_fd_wakeup_latency);
+#endif
+
+    return g_test_run();
+}
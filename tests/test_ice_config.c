@@ -0,0 +1,221 @@
+#include <gst/gst.h>
+
+#include "../src/server/ice_config.h"
+
+/// What main() puts in ICE_PORTS_ENV, which is only read once
+#define MIN_PORT 50000
+#define MAX_PORT 50999
+
+enum {
+    PROP_0,
+    PROP_MIN_RTP_PORT,
+    PROP_MAX_RTP_PORT,
+    PROP_ICE_TCP,
+};
+
+/*!
+ * Stands in for webrtcbin's ICE agent, with the properties of the libnice one and the same defaults.
+ */
+typedef struct {
+    GstObject parent;
+
+    guint min_rtp_port;
+    guint max_rtp_port;
+    gboolean ice_tcp;
+} FakeAgent;
+
+typedef struct {
+    GstObjectClass parent_class;
+} FakeAgentClass;
+
+G_DEFINE_TYPE(FakeAgent, fake_agent, GST_TYPE_OBJECT)
+
+static void fake_agent_set_property(GObject *object, const guint prop_id, const GValue *value, GParamSpec *pspec) {
+    FakeAgent *self = (FakeAgent *)object;
+
+    switch (prop_id) {
+        case PROP_MIN_RTP_PORT:
+            self->min_rtp_port = g_value_get_uint(value);
+            break;
+        case PROP_MAX_RTP_PORT:
+            self->max_rtp_port = g_value_get_uint(value);
+            break;
+        case PROP_ICE_TCP:
+            self->ice_tcp = g_value_get_boolean(value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+
+    // The libnice agent refuses a range that is upside down at any point
+    g_assert_cmpuint(self->min_rtp_port, <=, self->max_rtp_port);
+}
+
+static void fake_agent_get_property(GObject *object, const guint prop_id, GValue *value, GParamSpec *pspec) {
+    FakeAgent *self = (FakeAgent *)object;
+
+    switch (prop_id) {
+        case PROP_MIN_RTP_PORT:
+            g_value_set_uint(value, self->min_rtp_port);
+            break;
+        case PROP_MAX_RTP_PORT:
+            g_value_set_uint(value, self->max_rtp_port);
+            break;
+        case PROP_ICE_TCP:
+            g_value_set_boolean(value, self->ice_tcp);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void fake_agent_class_init(FakeAgentClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->set_property = fake_agent_set_property;
+    object_class->get_property = fake_agent_get_property;
+
+    g_object_class_install_property(
+        object_class,
+        PROP_MIN_RTP_PORT,
+        g_param_spec_uint("min-rtp-port", "", "", 0, 65535, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(
+        object_class,
+        PROP_MAX_RTP_PORT,
+        g_param_spec_uint("max-rtp-port", "", "", 0, 65535, 65535, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+    g_object_class_install_property(
+        object_class,
+        PROP_ICE_TCP,
+        g_param_spec_boolean("ice-tcp", "", "", TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void fake_agent_init(FakeAgent *self) {
+    self->max_rtp_port = 65535;
+    self->ice_tcp = TRUE;
+}
+
+enum {
+    PROP_ICE_AGENT = 1,
+};
+
+/*!
+ * Stands in for webrtcbin, only exposing its ICE agent.
+ */
+typedef struct {
+    GstBin parent;
+
+    FakeAgent *agent;
+} FakeWebrtcbin;
+
+typedef struct {
+    GstBinClass parent_class;
+} FakeWebrtcbinClass;
+
+G_DEFINE_TYPE(FakeWebrtcbin, fake_webrtcbin, GST_TYPE_BIN)
+
+static void fake_webrtcbin_get_property(GObject *object, const guint prop_id, GValue *value, GParamSpec *pspec) {
+    FakeWebrtcbin *self = (FakeWebrtcbin *)object;
+
+    switch (prop_id) {
+        case PROP_ICE_AGENT:
+            g_value_set_object(value, self->agent);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void fake_webrtcbin_finalize(GObject *object) {
+    FakeWebrtcbin *self = (FakeWebrtcbin *)object;
+
+    gst_object_unref(self->agent);
+
+    G_OBJECT_CLASS(fake_webrtcbin_parent_class)->finalize(object);
+}
+
+static void fake_webrtcbin_class_init(FakeWebrtcbinClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->get_property = fake_webrtcbin_get_property;
+    object_class->finalize = fake_webrtcbin_finalize;
+
+    g_object_class_install_property(
+        object_class,
+        PROP_ICE_AGENT,
+        g_param_spec_object("ice-agent", "", "", fake_agent_get_type(), G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+}
+
+static void fake_webrtcbin_init(FakeWebrtcbin *self) {
+    self->agent = gst_object_ref_sink(g_object_new(fake_agent_get_type(), NULL));
+}
+
+static void test_apply(void) {
+    GstElement *webrtcbin = gst_object_ref_sink(g_object_new(fake_webrtcbin_get_type(), NULL));
+    const FakeAgent *agent = ((FakeWebrtcbin *)webrtcbin)->agent;
+
+    g_setenv(ICE_TCP_ENV, "1", TRUE);
+    ice_config_apply(webrtcbin);
+    g_assert_cmpuint(agent->min_rtp_port, ==, MIN_PORT);
+    g_assert_cmpuint(agent->max_rtp_port, ==, MAX_PORT);
+    g_assert_true(agent->ice_tcp);
+
+    // Unlike the ports, this is read for each session
+    g_setenv(ICE_TCP_ENV, "0", TRUE);
+    ice_config_apply(webrtcbin);
+    g_assert_false(agent->ice_tcp);
+    g_unsetenv(ICE_TCP_ENV);
+
+    gst_object_unref(webrtcbin);
+}
+
+/// Elements without an agent, as webrtcbin before 1.22 may be, are left alone
+static void test_no_agent(void) {
+    GstElement *bin = gst_bin_new("no-agent");
+
+    ice_config_apply(bin);
+
+    gst_object_unref(bin);
+}
+
+/// The real agent's property names, where webrtcbin is installed
+static void test_webrtcbin(void) {
+    GstElement *webrtcbin = gst_element_factory_make("webrtcbin", NULL);
+    if (webrtcbin == NULL) {
+        g_test_skip("webrtcbin is not installed");
+        return;
+    }
+    gst_object_ref_sink(webrtcbin);
+
+    g_setenv(ICE_TCP_ENV, "0", TRUE);
+    ice_config_apply(webrtcbin);
+    g_unsetenv(ICE_TCP_ENV);
+
+    GObject *agent = NULL;
+    g_object_get(webrtcbin, "ice-agent", &agent, NULL);
+    g_assert_nonnull(agent);
+    guint min_port;
+    guint max_port;
+    gboolean ice_tcp;
+    g_object_get(agent, "min-rtp-port", &min_port, "max-rtp-port", &max_port, "ice-tcp", &ice_tcp, NULL);
+    g_assert_cmpuint(min_port, ==, MIN_PORT);
+    g_assert_cmpuint(max_port, ==, MAX_PORT);
+    g_assert_false(ice_tcp);
+
+    g_object_unref(agent);
+    gst_object_unref(webrtcbin);
+}
+
+int main(int argc, char *argv[]) {
+    g_setenv(ICE_PORTS_ENV, G_STRINGIFY(MIN_PORT) "-" G_STRINGIFY(MAX_PORT), TRUE);
+    g_test_init(&argc, &argv, NULL);
+    gst_init(&argc, &argv);
+
+    g_test_add_func("/ice_config/apply", test_apply);
+    g_test_add_func("/ice_config/no_agent", test_no_agent);
+    g_test_add_func("/ice_config/webrtcbin", test_webrtcbin);
+
+    return g_test_run();
+}
@@ -0,0 +1,178 @@
+#include <glib.h>
+#include <string.h>
+
+#include "../src/common/input_event.h"
+#include "../src/server/input_queue.h"
+
+#define STRESS_PRODUCERS 4
+#define STRESS_CONSUMERS 2
+/// Events each producer pushes
+#define STRESS_EVENTS 100000
+
+static void test_event_round_trip(void) {
+    struct input_event event = {
+        .type = 0x1234,
+        .flags = 0xfedc,
+        .seq = 0x89abcdef,
+        .sent_us = G_GINT64_CONSTANT(0x0123456789abcdef),
+    };
+    for (guint i = 0; i < INPUT_EVENT_DATA_SIZE; i++) {
+        event.data[i] = (guint8)(i * 7);
+    }
+
+    guint8 packed[INPUT_EVENT_SIZE];
+    input_event_pack(&event, packed);
+    // Big-endian on the wire
+    g_assert_cmphex(packed[0], ==, 0x12);
+    g_assert_cmphex(packed[4], ==, 0x89);
+    g_assert_cmphex(packed[8], ==, 0x01);
+
+    struct input_event unpacked;
+    g_assert_true(input_event_unpack(packed, sizeof(packed), &unpacked));
+    g_assert_cmpuint(unpacked.type, ==, event.type);
+    g_assert_cmpuint(unpacked.flags, ==, event.flags);
+    g_assert_cmpuint(unpacked.seq, ==, event.seq);
+    g_assert_cmpint(unpacked.sent_us, ==, event.sent_us);
+    g_assert_cmpmem(unpacked.data, INPUT_EVENT_DATA_SIZE, event.data, INPUT_EVENT_DATA_SIZE);
+
+    g_assert_false(input_event_unpack(packed, sizeof(packed) - 1, &unpacked));
+}
+
+/// Fills up, refuses the next push, and comes back out in order, over several laps of the ring
+static void test_full_and_fifo(void) {
+    struct input_queue *queue = input_queue_new();
+    struct input_queue_entry entry = {0};
+
+    for (guint lap = 0; lap < 3; lap++) {
+        for (guint i = 0; i < INPUT_QUEUE_CAPACITY; i++) {
+            entry.event.seq = lap * INPUT_QUEUE_CAPACITY + i;
+            g_assert_true(input_queue_push(queue, &entry));
+        }
+        g_assert_false(input_queue_push(queue, &entry));
+        g_assert_cmpuint(input_queue_get_dropped(queue), ==, lap + 1);
+
+        for (guint i = 0; i < INPUT_QUEUE_CAPACITY; i++) {
+            struct input_queue_entry out;
+            g_assert_true(input_queue_pop(queue, &out));
+            g_assert_cmpuint(out.event.seq, ==, lap * INPUT_QUEUE_CAPACITY + i);
+        }
+        struct input_queue_entry out;
+        g_assert_false(input_queue_pop(queue, &out));
+    }
+
+    input_queue_free(queue);
+}
+
+struct stress {
+    struct input_queue *queue;
+    gint producers_done;
+    /// Per producer, how many times each sequence number was popped
+    guint8 *seen[STRESS_PRODUCERS];
+    gint popped;
+};
+
+struct stress_producer {
+    struct stress *stress;
+    guint session;
+};
+
+static gpointer stress_producer_thread(gpointer data) {
+    const struct stress_producer *producer = data;
+    struct input_queue_entry entry = {.session = producer->session};
+
+    for (guint32 seq = 0; seq < STRESS_EVENTS; seq++) {
+        entry.event.seq = seq;
+        entry.received_us = seq;
+        // Full means the consumers are behind, try again rather than lose the event
+        while (!input_queue_push(producer->stress->queue, &entry)) {
+            g_thread_yield();
+        }
+    }
+
+    g_atomic_int_inc(&producer->stress->producers_done);
+    return NULL;
+}
+
+static gpointer stress_consumer_thread(gpointer data) {
+    struct stress *stress = data;
+    gint64 last_seq[STRESS_PRODUCERS];
+    for (guint i = 0; i < STRESS_PRODUCERS; i++) {
+        last_seq[i] = -1;
+    }
+
+    while (TRUE) {
+        // Read before popping, so that an empty queue after all producers finished really is the end
+        const gboolean done = g_atomic_int_get(&stress->producers_done) == STRESS_PRODUCERS;
+
+        struct input_queue_entry entry;
+        if (!input_queue_pop(stress->queue, &entry)) {
+            if (done) {
+                break;
+            }
+            g_thread_yield();
+            continue;
+        }
+
+        g_assert_cmpuint(entry.session, <, STRESS_PRODUCERS);
+        g_assert_cmpint(entry.received_us, ==, entry.event.seq);
+        // Each producer's events come out in the order it pushed them
+        g_assert_cmpint(entry.event.seq, >, last_seq[entry.session]);
+        last_seq[entry.session] = entry.event.seq;
+
+        // Distinct bytes per producer and sequence number, so no two consumers write the same one
+        stress->seen[entry.session][entry.event.seq]++;
+        g_atomic_int_inc(&stress->popped);
+    }
+
+    return NULL;
+}
+
+/// Several producers and consumers at once: every event comes out exactly once
+static void test_stress(void) {
+    struct stress stress = {.queue = input_queue_new()};
+    struct stress_producer producers[STRESS_PRODUCERS];
+    GThread *threads[STRESS_PRODUCERS + STRESS_CONSUMERS];
+
+    for (guint i = 0; i < STRESS_PRODUCERS; i++) {
+        stress.seen[i] = g_new0(guint8, STRESS_EVENTS);
+    }
+
+    const gint64 start_us = g_get_monotonic_time();
+    for (guint i = 0; i < STRESS_CONSUMERS; i++) {
+        threads[STRESS_PRODUCERS + i] = g_thread_new("consumer", stress_consumer_thread, &stress);
+    }
+    for (guint i = 0; i < STRESS_PRODUCERS; i++) {
+        producers[i] = (struct stress_producer){&stress, i};
+        threads[i] = g_thread_new("producer", stress_producer_thread, &producers[i]);
+    }
+    for (guint i = 0; i < G_N_ELEMENTS(threads); i++) {
+        g_thread_join(threads[i]);
+    }
+    const gint64 elapsed_us = g_get_monotonic_time() - start_us;
+
+    g_assert_cmpint(g_atomic_int_get(&stress.popped), ==, STRESS_PRODUCERS * STRESS_EVENTS);
+    for (guint i = 0; i < STRESS_PRODUCERS; i++) {
+        for (guint seq = 0; seq < STRESS_EVENTS; seq++) {
+            g_assert_cmpuint(stress.seen[i][seq], ==, 1);
+        }
+        g_free(stress.seen[i]);
+    }
+
+    g_test_message("%d producers, %d consumers: %.1f ns per event, %u pushes refused while full",
+                   STRESS_PRODUCERS,
+                   STRESS_CONSUMERS,
+                   (gdouble)elapsed_us * 1000.0 / (STRESS_PRODUCERS * STRESS_EVENTS),
+                   input_queue_get_dropped(stress.queue));
+
+    input_queue_free(stress.queue);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/input_queue/event_round_trip", test_event_round_trip);
+    g_test_add_func("/input_queue/full_and_fifo", test_full_and_fifo);
+    g_test_add_func("/input_queue/stress", test_stress);
+
+    return g_test_run();
+}
@@ -0,0 +1,255 @@
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/utils/logger.h"
+
+/// Messages per thread in the multi-threaded test
+#define THREAD_MESSAGES 5000
+#define THREADS 4
+/// Calls per measurement in the benchmark
+#define BENCH_CALLS (1 << 16)
+/// The benchmark flushes this often so that it measures enqueueing, not dropping
+#define BENCH_FLUSH_EVERY 64
+
+static int saved_stdout = -1;
+static FILE *capture;
+
+/// Send what the writer prints to a temporary file instead of stdout
+static void capture_begin(void) {
+    gwd_log_flush();
+    capture = tmpfile();
+    g_assert_nonnull(capture);
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(fileno(capture), STDOUT_FILENO);
+}
+
+/// Flush the logger and return everything it printed since capture_begin(), one line per element
+static gchar **capture_end(void) {
+    gwd_log_flush();
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    GString *out = g_string_new(NULL);
+    char buf[4096];
+    size_t n;
+    rewind(capture);
+    while ((n = fread(buf, 1, sizeof(buf), capture)) > 0) {
+        g_string_append_len(out, buf, (gssize)n);
+    }
+    fclose(capture);
+
+    gchar **lines = g_strsplit(out->str, "\n", -1);
+    g_string_free(out, TRUE);
+    return lines;
+}
+
+static guint count_lines_containing(gchar **lines, const char *needle) {
+    guint count = 0;
+    for (gchar **line = lines; *line != NULL; line++) {
+        if (strstr(*line, needle) != NULL) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void test_level(void) {
+    gwd_log_set_level(GWD_LOG_LEVEL_WARN);
+
+    capture_begin();
+    ALOGD("level-test debug");
+    ALOGI("level-test info");
+    ALOGW("level-test warn");
+    ALOGE("level-test error");
+    gchar **lines = capture_end();
+
+    g_assert_cmpuint(count_lines_containing(lines, "level-test debug"), ==, 0);
+    g_assert_cmpuint(count_lines_containing(lines, "level-test info"), ==, 0);
+    g_assert_cmpuint(count_lines_containing(lines, "] W T"), ==, 1);
+    g_assert_cmpuint(count_lines_containing(lines, "] E T"), ==, 1);
+
+    g_strfreev(lines);
+}
+
+static void test_rate_limit(void) {
+    gwd_log_set_level(GWD_LOG_LEVEL_DEBUG);
+
+    capture_begin();
+    for (int i = 0; i < 100; i++) {
+        ALOGW("rate-test warn %d", i);
+    }
+    for (int i = 0; i < 100; i++) {
+        ALOGE("rate-test error %d", i);
+    }
+    gchar **lines = capture_end();
+
+    // The budget is per second, the loop may straddle two
+    const guint warnings = count_lines_containing(lines, "rate-test warn");
+    g_assert_cmpuint(warnings, >=, 20);
+    g_assert_cmpuint(warnings, <=, 40);
+    g_assert_cmpuint(count_lines_containing(lines, "rate-test error"), ==, 100);
+
+    g_strfreev(lines);
+}
+
+static void test_truncate(void) {
+    gwd_log_set_level(GWD_LOG_LEVEL_DEBUG);
+
+    gchar *long_message = g_strnfill(3000, 'x');
+
+    capture_begin();
+    gwd_log_write(GWD_LOG_LEVEL_INFO, NULL, "truncate-test %s", long_message);
+    gchar **lines = capture_end();
+
+    gboolean found = FALSE;
+    for (gchar **line = lines; *line != NULL; line++) {
+        if (strstr(*line, "truncate-test") != NULL) {
+            found = TRUE;
+            g_assert_true(g_str_has_suffix(*line, "x..."));
+            g_assert_cmpuint(strlen(*line), <, 1100);
+        }
+    }
+    g_assert_true(found);
+
+    g_strfreev(lines);
+    g_free(long_message);
+}
+
+/// Records of varying sizes, so that they regularly need padding to skip the end of the ring
+static void test_ring_wrap(void) {
+    capture_begin();
+    for (int i = 0; i < 2000; i++) {
+        gchar *filler = g_strnfill(i % 300, 'y');
+        gwd_log_write(GWD_LOG_LEVEL_INFO, NULL, "wrap-test %d %s", i, filler);
+        g_free(filler);
+        if (i % 20 == 19) {
+            gwd_log_flush();
+        }
+    }
+    gchar **lines = capture_end();
+
+    int expected = 0;
+    for (gchar **line = lines; *line != NULL; line++) {
+        const char *found = strstr(*line, "wrap-test ");
+        if (found == NULL) {
+            continue;
+        }
+        g_assert_cmpint(atoi(found + strlen("wrap-test ")), ==, expected);
+        g_assert_cmpuint(strspn(strchr(found + strlen("wrap-test "), ' ') + 1, "y"), ==, expected % 300);
+        expected++;
+    }
+    g_assert_cmpint(expected, ==, 2000);
+    g_assert_cmpuint(count_lines_containing(lines, "dropped"), ==, 0);
+
+    g_strfreev(lines);
+}
+
+static gpointer logging_thread(gpointer data) {
+    const int index = GPOINTER_TO_INT(data);
+    for (int i = 0; i < THREAD_MESSAGES; i++) {
+        gwd_log_write(GWD_LOG_LEVEL_INFO, NULL, "thread-test %d %d end", index, i);
+    }
+    return NULL;
+}
+
+/// Producers racing the writer thread: every line is whole and in order, anything missing is reported as dropped
+static void test_threads(void) {
+    capture_begin();
+    GThread *threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        threads[i] = g_thread_new("logging", logging_thread, GINT_TO_POINTER(i));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        g_thread_join(threads[i]);
+    }
+    gchar **lines = capture_end();
+
+    int last[THREADS];
+    guint received = 0;
+    guint dropped = 0;
+    for (int i = 0; i < THREADS; i++) {
+        last[i] = -1;
+    }
+    for (gchar **line = lines; *line != NULL; line++) {
+        int index;
+        int seq;
+        guint count;
+        const char *found = strstr(*line, "thread-test ");
+        if (found != NULL) {
+            g_assert_cmpint(sscanf(found, "thread-test %d %d", &index, &seq), ==, 2);
+            g_assert_true(g_str_has_suffix(*line, " end"));
+            g_assert_cmpint(seq, >, last[index]);
+            last[index] = seq;
+            received++;
+        } else if ((found = strstr(*line, ": ")) != NULL && sscanf(found, ": %u log messages dropped", &count) == 1) {
+            dropped += count;
+        }
+    }
+    g_test_message("%u messages written, %u dropped", received, dropped);
+    g_assert_cmpuint(received + dropped, ==, THREADS * THREAD_MESSAGES);
+
+    g_strfreev(lines);
+}
+
+static gdouble ns_per_call(const gint64 elapsed_us) {
+    return (gdouble)elapsed_us * 1000.0 / BENCH_CALLS;
+}
+
+static void test_bench(void) {
+    capture_begin();
+
+    gwd_log_set_level(GWD_LOG_LEVEL_WARN);
+    gint64 start_us = g_get_monotonic_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        ALOGD("bench filtered %d", i);
+    }
+    const gint64 filtered_us = g_get_monotonic_time() - start_us;
+
+    // Past the first few, every call is suppressed by the site's budget
+    gwd_log_set_level(GWD_LOG_LEVEL_DEBUG);
+    start_us = g_get_monotonic_time();
+    for (int i = 0; i < BENCH_CALLS; i++) {
+        ALOGW("bench limited %d", i);
+    }
+    const gint64 limited_us = g_get_monotonic_time() - start_us;
+
+    gint64 enqueued_us = 0;
+    for (int i = 0; i < BENCH_CALLS; i += BENCH_FLUSH_EVERY) {
+        start_us = g_get_monotonic_time();
+        for (int j = i; j < i + BENCH_FLUSH_EVERY; j++) {
+            gwd_log_write(GWD_LOG_LEVEL_INFO, NULL, "bench enqueued sequence number %d pts %d", j, j * 16666);
+        }
+        enqueued_us += g_get_monotonic_time() - start_us;
+        gwd_log_flush();
+    }
+
+    gchar **lines = capture_end();
+    g_assert_cmpuint(count_lines_containing(lines, "bench filtered"), ==, 0);
+    g_assert_cmpuint(count_lines_containing(lines, "dropped"), ==, 0);
+    g_strfreev(lines);
+
+    g_test_message("Per call: filtered %.1f ns, rate limited %.1f ns, enqueued %.1f ns",
+                   ns_per_call(filtered_us),
+                   ns_per_call(limited_us),
+                   ns_per_call(enqueued_us));
+    if (g_test_perf()) {
+        g_test_minimized_result(ns_per_call(enqueued_us), "enqueue %.1f ns", ns_per_call(enqueued_us));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/logger/level", test_level);
+    g_test_add_func("/logger/rate_limit", test_rate_limit);
+    g_test_add_func("/logger/truncate", test_truncate);
+    g_test_add_func("/logger/ring_wrap", test_ring_wrap);
+    g_test_add_func("/logger/threads", test_threads);
+    g_test_add_func("/logger/bench", test_bench);
+
+    return g_test_run();
+}
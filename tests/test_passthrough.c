@@ -0,0 +1,406 @@
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#ifdef G_OS_UNIX
+    #include <sys/resource.h>
+#endif
+
+#include "../src/server/passthrough.h"
+
+/// Any pipeline taking longer than this fails the test
+#define TIMEOUT (60 * GST_SECOND)
+#define FRAME_RATE 30
+#define KEY_FRAME_INTERVAL 15
+/// Frames of the looped file, and how many times it is played
+#define LOOP_FRAMES 30
+#define LOOPS 3
+/// Frames of the file streamed by the benchmark, and their size, the server's usual 720p
+#define BENCH_FRAMES 150
+#define BENCH_WIDTH 1280
+#define BENCH_HEIGHT 720
+
+static gchar *tmp_dir;
+
+/// Elements generating the test files and reading them back
+static const gchar *const file_elements[] = {"videotestsrc", "x264enc", "mp4mux", "qtdemux", "h264parse", NULL};
+/// What the benchmark also needs for both modes
+static const gchar *const bench_elements[] = {"decodebin3", "videoconvert", "rtph264pay", NULL};
+
+/// Skip the test unless every element of @p names is installed
+static gboolean require_elements(const gchar *const *names) {
+    for (guint i = 0; names[i]; i++) {
+        GstElementFactory *factory = gst_element_factory_find(names[i]);
+        if (factory == NULL) {
+            gchar *message = g_strdup_printf("%s is not installed", names[i]);
+            g_test_skip(message);
+            g_free(message);
+            return FALSE;
+        }
+        gst_object_unref(factory);
+    }
+    return TRUE;
+}
+
+static GstElement *launch(const gchar *description) {
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+    if (error) {
+        g_test_message("%s: %s", description, error->message);
+        g_error_free(error);
+        gst_clear_object(&pipeline);
+    }
+    return pipeline;
+}
+
+/// Play @p pipeline as fast as it goes, FALSE if it fails
+static gboolean run_to_eos(GstElement *pipeline) {
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    const gboolean done = message != NULL && GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    if (message != NULL && !done) {
+        GError *error;
+        gst_message_parse_error(message, &error, NULL);
+        g_test_message("%s: %s", GST_OBJECT_NAME(GST_MESSAGE_SRC(message)), error->message);
+        g_error_free(error);
+    }
+
+    if (message) {
+        gst_message_unref(message);
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+
+    return done;
+}
+
+/// An MP4 file of H.264 video in @p profile, NULL if it could not be made
+static gchar *make_file(const gchar *name,
+                        const gchar *profile,
+                        const guint width,
+                        const guint height,
+                        const guint frames) {
+    gchar *path = g_build_filename(tmp_dir, name, NULL);
+    gchar *description = g_strdup_printf("videotestsrc num-buffers=%u ! "
+                                         "video/x-raw,width=%u,height=%u,framerate=%d/1 ! "
+                                         "x264enc speed-preset=ultrafast key-int-max=%d ! "
+                                         "video/x-h264,profile=%s ! "
+                                         "mp4mux ! "
+                                         "filesink location=\"%s\"",
+                                         frames,
+                                         width,
+                                         height,
+                                         FRAME_RATE,
+                                         KEY_FRAME_INTERVAL,
+                                         profile,
+                                         path);
+
+    GstElement *pipeline = launch(description);
+    const gboolean made = pipeline != NULL && run_to_eos(pipeline);
+    gst_clear_object(&pipeline);
+    g_free(description);
+
+    if (!made) {
+        g_remove(path);
+        g_free(path);
+        g_test_skip("Cannot make the test file");
+        return NULL;
+    }
+    return path;
+}
+
+static void test_probe_compatible(void) {
+    if (!require_elements(file_elements)) {
+        return;
+    }
+    gchar *path = make_file("constrained-baseline.mp4", "constrained-baseline", 320, 240, LOOP_FRAMES);
+    if (path == NULL) {
+        return;
+    }
+
+    gchar *profile;
+    g_assert_true(passthrough_probe(path, &profile));
+    g_assert_cmpstr(profile, ==, "constrained-baseline");
+    g_free(profile);
+
+    // Still probed without asking for the profile
+    g_assert_true(passthrough_probe(path, NULL));
+
+    g_remove(path);
+    g_free(path);
+}
+
+/// B-frames or any tool beyond baseline rule passthrough out, some clients would not decode it
+static void test_probe_incompatible(void) {
+    if (!require_elements(file_elements)) {
+        return;
+    }
+    gchar *path = make_file("high.mp4", "high", 320, 240, LOOP_FRAMES);
+    if (path == NULL) {
+        return;
+    }
+
+    gchar *profile;
+    g_assert_false(passthrough_probe(path, &profile));
+    g_assert_cmpstr(profile, ==, "high");
+    g_free(profile);
+
+    g_remove(path);
+    g_free(path);
+}
+
+static void test_probe_disabled(void) {
+    if (!require_elements(file_elements)) {
+        return;
+    }
+    gchar *path = make_file("disabled.mp4", "constrained-baseline", 320, 240, LOOP_FRAMES);
+    if (path == NULL) {
+        return;
+    }
+
+    g_setenv(PASSTHROUGH_ENV, "0", TRUE);
+    gchar *profile;
+    g_assert_false(passthrough_probe(path, &profile));
+    g_assert_null(profile);
+    g_unsetenv(PASSTHROUGH_ENV);
+
+    g_remove(path);
+    g_free(path);
+}
+
+/// Fails rather than hangs when there is nothing to demux
+static void test_probe_no_file(void) {
+    if (!require_elements(file_elements)) {
+        return;
+    }
+    gchar *path = g_build_filename(tmp_dir, "missing.mp4", NULL);
+
+    gchar *profile;
+    g_assert_false(passthrough_probe(path, &profile));
+    g_assert_null(profile);
+
+    g_free(path);
+}
+
+/*!
+ * What reached the sink while the file looped, from its streaming thread.
+ */
+struct loop_state {
+    GstSegment segment;
+    guint buffers;
+    GstClockTime last_pts;
+    GstClockTime last_running_time;
+    /// Times the timestamps went back to the start of the file
+    guint restarts;
+    gboolean restarts_on_key_frames;
+    gboolean running_time_increases;
+};
+
+static GstPadProbeReturn loop_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    struct loop_state *state = user_data;
+
+    if (info->type & (GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH)) {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT) {
+            gst_event_copy_segment(event, &state->segment);
+        } else if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP) {
+            // The frame prerolled before the first seek comes again
+            state->buffers = 0;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    const GstClockTime running_time = gst_segment_to_running_time(&state->segment, GST_FORMAT_TIME, pts);
+
+    if (state->buffers > 0) {
+        if (pts < state->last_pts) {
+            state->restarts++;
+            if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+                state->restarts_on_key_frames = FALSE;
+            }
+        }
+        if (running_time == GST_CLOCK_TIME_NONE || running_time <= state->last_running_time) {
+            state->running_time_increases = FALSE;
+        }
+    }
+
+    state->buffers++;
+    state->last_pts = pts;
+    state->last_running_time = running_time;
+
+    return GST_PAD_PROBE_OK;
+}
+
+/// Segment seeks from SEGMENT_DONE, as the server does, replay the file from a key frame with running times going on
+static void test_loop(void) {
+    if (!require_elements(file_elements)) {
+        return;
+    }
+    gchar *path = make_file("loop.mp4", "constrained-baseline", 320, 240, LOOP_FRAMES);
+    if (path == NULL) {
+        return;
+    }
+
+    gchar *description = g_strdup_printf(
+        "filesrc location=\"%s\" ! qtdemux name=demux demux.video_0 ! h264parse ! fakesink name=sink sync=false", path);
+    GstElement *pipeline = launch(description);
+    g_assert_nonnull(pipeline);
+
+    struct loop_state state = {.restarts_on_key_frames = TRUE, .running_time_increases = TRUE};
+    gst_segment_init(&state.segment, GST_FORMAT_TIME);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstPad *pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad,
+                      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+                      loop_probe,
+                      &state,
+                      NULL);
+    gst_object_unref(pad);
+    gst_object_unref(sink);
+
+    // The demuxer's pads are there once prerolled, which the server waits for with no-more-pads
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    g_assert_cmpint(gst_element_get_state(pipeline, NULL, NULL, TIMEOUT), ==, GST_STATE_CHANGE_SUCCESS);
+    GstElement *demuxer = gst_bin_get_by_name(GST_BIN(pipeline), "demux");
+    g_assert_true(passthrough_seek_start(demuxer, TRUE));
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    for (guint loop = 0; loop < LOOPS; loop++) {
+        GstMessage *message = gst_bus_timed_pop_filtered(
+            bus, TIMEOUT, GST_MESSAGE_SEGMENT_DONE | GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+        g_assert_nonnull(message);
+        g_assert_cmpint(GST_MESSAGE_TYPE(message), ==, GST_MESSAGE_SEGMENT_DONE);
+        gst_message_unref(message);
+
+        if (loop + 1 < LOOPS) {
+            g_assert_true(passthrough_seek_start(demuxer, FALSE));
+        }
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    g_assert_cmpuint(state.buffers, ==, LOOPS * LOOP_FRAMES);
+    g_assert_cmpuint(state.restarts, ==, LOOPS - 1);
+    g_assert_true(state.restarts_on_key_frames);
+    g_assert_true(state.running_time_increases);
+
+    gst_object_unref(bus);
+    gst_object_unref(demuxer);
+    gst_object_unref(pipeline);
+    g_free(description);
+    g_remove(path);
+    g_free(path);
+}
+
+#ifdef G_OS_UNIX
+static gint64 cpu_time_us(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (gint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec +
+           usage.ru_stime.tv_usec;
+}
+
+/// Stream the file as fast as it goes into RTP packets, returns the CPU time taken, or -1
+static gint64 bench_mode(const gchar *name, const gchar *description) {
+    GstElement *pipeline = launch(description);
+    if (pipeline == NULL) {
+        return -1;
+    }
+
+    const gint64 begin_us = g_get_monotonic_time();
+    const gint64 begin_cpu_us = cpu_time_us();
+    const gboolean done = run_to_eos(pipeline);
+    const gint64 cpu_us = cpu_time_us() - begin_cpu_us;
+    const gint64 elapsed_us = g_get_monotonic_time() - begin_us;
+    gst_object_unref(pipeline);
+    if (!done) {
+        return -1;
+    }
+
+    // CPU per second of video, so that 1000 ms would be a full core at the file's real time pace
+    const gdouble seconds = (gdouble)BENCH_FRAMES / FRAME_RATE;
+    const gdouble cpu_ms = cpu_us / 1000.0 / seconds;
+    g_test_message("%s: %.0f ms CPU per second of %dx%d video, %.0f ms wall in all",
+                   name,
+                   cpu_ms,
+                   BENCH_WIDTH,
+                   BENCH_HEIGHT,
+                   elapsed_us / 1000.0);
+    if (g_test_perf()) {
+        g_test_minimized_result(cpu_ms, "%s %.0f ms CPU per second of video", name, cpu_ms);
+    }
+
+    return cpu_us;
+}
+#endif
+
+/*!
+ * Both ways of turning the file into H.264 RTP packets, without pacing: passthrough as the server runs it, against
+ * decoding and re-encoding with the H264 branch's encoder settings. Audio, pacing and the preprocessing are left out.
+ */
+static void test_bench(void) {
+#ifdef G_OS_UNIX
+    if (!require_elements(file_elements) || !require_elements(bench_elements)) {
+        return;
+    }
+    gchar *path = make_file("bench.mp4", "constrained-baseline", BENCH_WIDTH, BENCH_HEIGHT, BENCH_FRAMES);
+    if (path == NULL) {
+        return;
+    }
+
+    gchar *passthrough = g_strdup_printf("filesrc location=\"%s\" ! qtdemux ! "
+                                         "h264parse config-interval=-1 ! "
+                                         "video/x-h264,stream-format=byte-stream,alignment=au ! "
+                                         "rtph264pay config-interval=-1 aggregate-mode=zero-latency ! "
+                                         "fakesink",
+                                         path);
+    gchar *transcode = g_strdup_printf("filesrc location=\"%s\" ! decodebin3 ! videoconvert ! "
+                                       "x264enc tune=zerolatency speed-preset=ultrafast bframes=0 key-int-max=120 "
+                                       "bitrate=16000 ! "
+                                       "rtph264pay config-interval=-1 aggregate-mode=zero-latency ! "
+                                       "fakesink",
+                                       path);
+
+    const gint64 passthrough_us = bench_mode("passthrough", passthrough);
+    const gint64 transcode_us = bench_mode("decode and re-encode", transcode);
+    if (passthrough_us < 0 || transcode_us < 0) {
+        g_test_skip("Cannot stream the file both ways, is an H.264 decoder installed?");
+    } else {
+        g_test_message("Passthrough takes %.1f%% of the CPU time", 100.0 * passthrough_us / MAX(transcode_us, 1));
+    }
+
+    g_free(passthrough);
+    g_free(transcode);
+    g_remove(path);
+    g_free(path);
+#else
+    g_test_skip("No process CPU time to compare");
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    gst_init(&argc, &argv);
+
+    GError *error = NULL;
+    tmp_dir = g_dir_make_tmp("gwd-passthrough-XXXXXX", &error);
+    g_assert_no_error(error);
+
+    g_test_add_func("/passthrough/probe/compatible", test_probe_compatible);
+    g_test_add_func("/passthrough/probe/incompatible", test_probe_incompatible);
+    g_test_add_func("/passthrough/probe/disabled", test_probe_disabled);
+    g_test_add_func("/passthrough/probe/no_file", test_probe_no_file);
+    g_test_add_func("/passthrough/loop", test_loop);
+    g_test_add_func("/passthrough/bench", test_bench);
+
+    const int ret = g_test_run();
+
+    g_rmdir(tmp_dir);
+    g_free(tmp_dir);
+
+    return ret;
+}
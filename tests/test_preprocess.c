@@ -0,0 +1,312 @@
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "../src/server/preprocess.h"
+
+/// Any frame or pipeline taking longer than this fails the test
+#define TIMEOUT (60 * GST_SECOND)
+/// Not a multiple of 16 or 32, nor are its chroma or halved widths, so that the SIMD kernels' tails run
+#define CONVERT_WIDTH 1000
+#define CONVERT_HEIGHT 564
+/// Limited range values the overlay draws with, see preprocess.c
+#define BLACK 16
+#define WHITE 235
+#define GREY 128
+
+/*!
+ * One conversion checked against a reference computed here, from the same random input frame.
+ */
+struct convert_case {
+    const gchar *in_format;
+    const gchar *out_format;
+    guint downscale;
+};
+
+static const struct convert_case convert_cases[] = {
+    {"I420", "NV12", 1},
+    {"NV12", "I420", 1},
+    {"I420", "I420", 2},
+    {"NV12", "NV12", 2},
+    {"I420", "NV12", 2},
+    {"NV12", "I420", 2},
+};
+
+/// One frame of @p info, random if @p rand is set, else @p fill everywhere
+static GstBuffer *make_frame(const GstVideoInfo *info, GRand *rand, const guint8 fill) {
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(info), NULL);
+    GstVideoFrame frame;
+    g_assert_true(gst_video_frame_map(&frame, info, buffer, GST_MAP_WRITE));
+
+    for (guint plane = 0; plane < GST_VIDEO_FRAME_N_PLANES(&frame); plane++) {
+        guint8 *data = GST_VIDEO_FRAME_PLANE_DATA(&frame, plane);
+        const gsize size = (gsize)GST_VIDEO_FRAME_PLANE_STRIDE(&frame, plane) *
+                           GST_VIDEO_FRAME_COMP_HEIGHT(&frame, plane == 0 ? 0 : 1);
+        for (gsize i = 0; i < size; i++) {
+            data[i] = rand ? (guint8)g_rand_int(rand) : fill;
+        }
+    }
+
+    gst_video_frame_unmap(&frame);
+    return buffer;
+}
+
+static GstElement *launch(const gchar *description) {
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+    g_assert_no_error(error);
+    return pipeline;
+}
+
+/// Push @p buffer through the pipeline's "src" appsrc, and take what its "sink" appsink got
+static GstSample *process(GstElement *pipeline, const GstVideoInfo *info, GstBuffer *buffer) {
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+
+    GstCaps *caps = gst_video_info_to_caps(info);
+    g_object_set(src, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+    gst_caps_unref(caps);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GST_BUFFER_PTS(buffer) = 0;
+    g_assert_cmpint(gst_app_src_push_buffer(GST_APP_SRC(src), gst_buffer_ref(buffer)), ==, GST_FLOW_OK);
+    GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(sink), TIMEOUT);
+    g_assert_nonnull(sample);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+
+    return sample;
+}
+
+static guint8 sample_at(const GstVideoFrame *frame, const guint comp, const guint x, const guint y) {
+    const guint8 *data = GST_VIDEO_FRAME_COMP_DATA(frame, comp);
+    const gsize offset =
+        (gsize)y * GST_VIDEO_FRAME_COMP_STRIDE(frame, comp) + (gsize)x * GST_VIDEO_FRAME_COMP_PSTRIDE(frame, comp);
+    return data[offset];
+}
+
+static guint8 average(const guint8 a, const guint8 b) {
+    return (a + b + 1) >> 1;
+}
+
+/// What the element must output for component @p comp at @p x, @p y: the input sample, or 2x2 averaged as it does
+static guint8 expected_at(const GstVideoFrame *in, const guint comp, const guint x, const guint y, const guint scale) {
+    if (scale == 1) {
+        return sample_at(in, comp, x, y);
+    }
+    const guint8 left = average(sample_at(in, comp, 2 * x, 2 * y), sample_at(in, comp, 2 * x, 2 * y + 1));
+    const guint8 right = average(sample_at(in, comp, 2 * x + 1, 2 * y), sample_at(in, comp, 2 * x + 1, 2 * y + 1));
+    return average(left, right);
+}
+
+/// Random frames converted and scaled, against every sample of the reference
+static void test_convert(gconstpointer data) {
+    const struct convert_case *c = data;
+
+    gchar *description = g_strdup_printf("appsrc name=src ! %s overlay=none downscale=%u ! video/x-raw,format=%s ! "
+                                         "appsink name=sink sync=false",
+                                         PREPROCESS_ELEMENT_NAME,
+                                         c->downscale,
+                                         c->out_format);
+    GstElement *pipeline = launch(description);
+
+    GstVideoInfo in_info;
+    g_assert_true(gst_video_info_set_format(
+        &in_info, gst_video_format_from_string(c->in_format), CONVERT_WIDTH, CONVERT_HEIGHT));
+    GRand *rand = g_rand_new_with_seed(47);
+    GstBuffer *buffer = make_frame(&in_info, rand, 0);
+
+    GstSample *sample = process(pipeline, &in_info, buffer);
+    GstVideoInfo out_info;
+    g_assert_true(gst_video_info_from_caps(&out_info, gst_sample_get_caps(sample)));
+    g_assert_cmpstr(GST_VIDEO_INFO_NAME(&out_info), ==, c->out_format);
+    g_assert_cmpint(GST_VIDEO_INFO_WIDTH(&out_info), ==, CONVERT_WIDTH / c->downscale);
+    g_assert_cmpint(GST_VIDEO_INFO_HEIGHT(&out_info), ==, CONVERT_HEIGHT / c->downscale);
+
+    GstVideoFrame in;
+    GstVideoFrame out;
+    g_assert_true(gst_video_frame_map(&in, &in_info, buffer, GST_MAP_READ));
+    g_assert_true(gst_video_frame_map(&out, &out_info, gst_sample_get_buffer(sample), GST_MAP_READ));
+    for (guint comp = 0; comp < 3; comp++) {
+        for (guint y = 0; y < (guint)GST_VIDEO_FRAME_COMP_HEIGHT(&out, comp); y++) {
+            for (guint x = 0; x < (guint)GST_VIDEO_FRAME_COMP_WIDTH(&out, comp); x++) {
+                const guint8 expected = expected_at(&in, comp, x, y, c->downscale);
+                const guint8 actual = sample_at(&out, comp, x, y);
+                if (actual != expected) {
+                    g_test_message("Component %u at %u,%u", comp, x, y);
+                }
+                g_assert_cmpuint(actual, ==, expected);
+            }
+        }
+    }
+    gst_video_frame_unmap(&in);
+    gst_video_frame_unmap(&out);
+
+    gst_sample_unref(sample);
+    gst_buffer_unref(buffer);
+    g_rand_free(rand);
+    gst_object_unref(pipeline);
+    g_free(description);
+}
+
+/// The frame counter's box and first glyph land where preprocess_draw_text() puts them, and nothing else changes
+static void test_overlay(void) {
+    GstElement *pipeline = launch("appsrc name=src ! " PREPROCESS_ELEMENT_NAME " overlay=frame-count ! "
+                                  "appsink name=sink sync=false");
+
+    GstVideoInfo info;
+    g_assert_true(gst_video_info_set_format(&info, GST_VIDEO_FORMAT_I420, 640, 480));
+    GstBuffer *buffer = make_frame(&info, NULL, 100);
+
+    GstSample *sample = process(pipeline, &info, buffer);
+    GstVideoInfo out_info;
+    g_assert_true(gst_video_info_from_caps(&out_info, gst_sample_get_caps(sample)));
+    GstVideoFrame out;
+    g_assert_true(gst_video_frame_map(&out, &out_info, gst_sample_get_buffer(sample), GST_MAP_READ));
+
+    // 480 rows scale the 5x7 font by 2: a margin of 4, glyphs of 12x14 with their gap, so "0" in a 20x22 box at 4,4
+    g_assert_cmpuint(sample_at(&out, 0, 4, 4), ==, BLACK);
+    g_assert_cmpuint(sample_at(&out, 0, 23, 25), ==, BLACK);
+    g_assert_cmpuint(sample_at(&out, 0, 24, 4), ==, 100);
+    g_assert_cmpuint(sample_at(&out, 0, 4, 26), ==, 100);
+    g_assert_cmpuint(sample_at(&out, 0, 3, 3), ==, 100);
+    // The top row of "0" is .###., each pixel 2 wide, from 8,8
+    g_assert_cmpuint(sample_at(&out, 0, 8, 8), ==, BLACK);
+    g_assert_cmpuint(sample_at(&out, 0, 10, 8), ==, WHITE);
+    g_assert_cmpuint(sample_at(&out, 0, 15, 9), ==, WHITE);
+    g_assert_cmpuint(sample_at(&out, 0, 16, 8), ==, BLACK);
+    // Chroma is neutral over the box only
+    g_assert_cmpuint(sample_at(&out, 1, 2, 2), ==, GREY);
+    g_assert_cmpuint(sample_at(&out, 2, 11, 12), ==, GREY);
+    g_assert_cmpuint(sample_at(&out, 1, 12, 2), ==, 100);
+    g_assert_cmpuint(sample_at(&out, 2, 2, 13), ==, 100);
+    g_assert_cmpuint(sample_at(&out, 0, 320, 240), ==, 100);
+
+    gst_video_frame_unmap(&out);
+    gst_sample_unref(sample);
+    gst_buffer_unref(buffer);
+    gst_object_unref(pipeline);
+}
+
+/*!
+ * The raw video path's work on each frame: I420 into NV12 for the encoder, and a timestamp drawn over it.
+ */
+struct bench_case {
+    guint width;
+    guint height;
+    guint fps;
+};
+
+static const struct bench_case bench_cases[] = {
+    {1920, 1080, 60},
+    {3840, 2160, 30},
+};
+
+/// Push one second of frames through @p chain as fast as it goes, returns the milliseconds per frame, or -1
+static gdouble bench_chain(const gchar *chain, const struct bench_case *c) {
+    gchar *description = g_strdup_printf("appsrc name=src ! %s ! fakesink sync=false", chain);
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(description, &error);
+    g_free(description);
+    if (error) {
+        g_test_message("%s: %s", chain, error->message);
+        g_error_free(error);
+        gst_clear_object(&pipeline);
+        return -1;
+    }
+
+    GstVideoInfo info;
+    g_assert_true(gst_video_info_set_format(&info, GST_VIDEO_FORMAT_I420, c->width, c->height));
+    GstBuffer *frame = make_frame(&info, NULL, 100);
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstCaps *caps = gst_video_info_to_caps(&info);
+    g_object_set(src, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+    gst_caps_unref(caps);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Copies share the frame's memory, which neither chain writes to
+    const gint64 begin_us = g_get_monotonic_time();
+    for (guint i = 0; i < c->fps; i++) {
+        GstBuffer *buffer = gst_buffer_copy(frame);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(i, GST_SECOND, c->fps);
+        GST_BUFFER_DURATION(buffer) = GST_SECOND / c->fps;
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, TIMEOUT, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    const gint64 elapsed_us = g_get_monotonic_time() - begin_us;
+    g_assert_nonnull(message);
+    g_assert_cmpint(GST_MESSAGE_TYPE(message), ==, GST_MESSAGE_EOS);
+    gst_message_unref(message);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(src);
+    gst_buffer_unref(frame);
+    gst_object_unref(pipeline);
+
+    return elapsed_us / 1000.0 / c->fps;
+}
+
+/// The element against the videoconvert ! timeoverlay chain it replaced, when that one is installed
+static void test_bench(gconstpointer data) {
+    const struct bench_case *c = data;
+    const gdouble budget_ms = 1000.0 / c->fps;
+
+    const gdouble fused_ms = bench_chain(PREPROCESS_ELEMENT_NAME " overlay=time ! video/x-raw,format=NV12", c);
+    g_assert_cmpfloat(fused_ms, >=, 0);
+    g_test_message("%ux%u: %s %.2f ms per frame, %.0f%% of the %u fps budget",
+                   c->width,
+                   c->height,
+                   PREPROCESS_ELEMENT_NAME,
+                   fused_ms,
+                   100 * fused_ms / budget_ms,
+                   c->fps);
+    if (g_test_perf()) {
+        g_test_minimized_result(fused_ms,
+                                "%ux%u %s %.2f ms per frame",
+                                c->width,
+                                c->height,
+                                PREPROCESS_ELEMENT_NAME,
+                                fused_ms);
+    }
+
+    const gdouble chain_ms = bench_chain("videoconvert ! video/x-raw,format=NV12 ! timeoverlay", c);
+    if (chain_ms < 0) {
+        g_test_message("videoconvert ! timeoverlay is not installed, nothing to compare with");
+        return;
+    }
+    g_test_message("%ux%u: videoconvert ! timeoverlay %.2f ms per frame, %.0f%% of the %u fps budget",
+                   c->width,
+                   c->height,
+                   chain_ms,
+                   100 * chain_ms / budget_ms,
+                   c->fps);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    gst_init(&argc, &argv);
+    g_assert_true(preprocess_register());
+
+    for (guint i = 0; i < G_N_ELEMENTS(convert_cases); i++) {
+        const struct convert_case *c = &convert_cases[i];
+        gchar *path = g_strdup_printf("/preprocess/convert/%s_%s_%u", c->in_format, c->out_format, c->downscale);
+        g_test_add_data_func(path, c, test_convert);
+        g_free(path);
+    }
+    g_test_add_func("/preprocess/overlay", test_overlay);
+    for (guint i = 0; i < G_N_ELEMENTS(bench_cases); i++) {
+        gchar *path = g_strdup_printf("/preprocess/bench/%up", bench_cases[i].height);
+        g_test_add_data_func(path, &bench_cases[i], test_bench);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
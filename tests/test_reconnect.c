@@ -0,0 +1,224 @@
+#include <gst/gst.h>
+#include <stdlib.h>
+
+/// Reconnects timed per case
+#define RECONNECTS 20
+/// Anything taking longer than this fails the test
+#define TIMEOUT_US (10 * G_USEC_PER_SEC)
+
+/*!
+ * One way of receiving a stream, timed from the moment a new sender shows up to the first frame leaving the chain.
+ *
+ * The sender stands in for each connection's webrtcbin. A new connection used to build the whole receive pipeline
+ * again around it, decodebin3 included, while the stream client now keeps the chain after it warm and only links the
+ * new sender to its input, see build_receive_chains() in stream_client.c.
+ */
+struct reconnect_case {
+    const gchar *name;
+    /// Elements the case needs, it is skipped without any of them
+    const gchar *const *elements;
+    /// Bin with a src ghost pad, as webrtcbin's pads are to the chain
+    const gchar *sender;
+    /// Built for every connection, as before
+    const gchar *chain_new;
+    /// Built once and kept across connections, its input named "video_in"
+    const gchar *chain_warm;
+};
+
+static const gchar *const h264_elements[] = {"videotestsrc",
+                                              "x264enc",
+                                              "rtph264pay",
+                                              "rtph264depay",
+                                              "h264parse",
+                                              "avdec_h264",
+                                              "decodebin3",
+                                              "videoconvert",
+                                              NULL};
+static const gchar *const core_elements[] = {"fakesrc", "queue", "identity", "fakesink", NULL};
+
+static const struct reconnect_case cases[] = {
+    {"h264",
+     h264_elements,
+     "videotestsrc is-live=true ! video/x-raw,width=1280,height=720,framerate=60/1 ! "
+     "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=30 ! rtph264pay config-interval=-1",
+     "queue ! rtph264depay ! decodebin3 ! videoconvert ! fakesink name=sink sync=false async=false",
+     "queue name=video_in ! rtph264depay ! h264parse ! avdec_h264 ! videoconvert ! "
+     "fakesink name=sink sync=false async=false"},
+    // No decoder, so only what building and starting the chain's elements costs
+    {"core",
+     core_elements,
+     "fakesrc sizetype=fixed sizemax=1200",
+     "queue ! identity ! queue ! fakesink name=sink sync=false async=false",
+     "queue name=video_in ! identity ! queue ! fakesink name=sink sync=false async=false"},
+};
+
+/*!
+ * When the current connection's first frame left the chain.
+ */
+struct first_frame {
+    GMutex mutex;
+    GCond cond;
+    gint64 time_us;
+};
+
+static void on_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, struct first_frame *first) {
+    g_mutex_lock(&first->mutex);
+    if (first->time_us == 0) {
+        first->time_us = g_get_monotonic_time();
+        g_cond_signal(&first->cond);
+    }
+    g_mutex_unlock(&first->mutex);
+}
+
+static void watch_sink(GstElement *bin, struct first_frame *first) {
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), "sink");
+    g_object_set(sink, "signal-handoffs", TRUE, NULL);
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_handoff), first);
+    gst_object_unref(sink);
+}
+
+/// Forget the previous connection's frames, once it stopped sending
+static void first_frame_reset(struct first_frame *first) {
+    g_mutex_lock(&first->mutex);
+    first->time_us = 0;
+    g_mutex_unlock(&first->mutex);
+}
+
+/// Time from @p start_us to the first frame, failing after TIMEOUT_US
+static gint64 wait_first_frame(struct first_frame *first, const gint64 start_us) {
+    g_mutex_lock(&first->mutex);
+    while (first->time_us == 0) {
+        g_assert_true(g_cond_wait_until(&first->cond, &first->mutex, start_us + TIMEOUT_US));
+    }
+    const gint64 elapsed_us = first->time_us - start_us;
+    g_mutex_unlock(&first->mutex);
+
+    return elapsed_us;
+}
+
+static gint compare_gint64(gconstpointer a, gconstpointer b) {
+    const gint64 x = *(const gint64 *)a;
+    const gint64 y = *(const gint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const gchar *name, const gchar *kind, gint64 *times_us) {
+    qsort(times_us, RECONNECTS, sizeof(*times_us), compare_gint64);
+    const gint64 median_us = times_us[RECONNECTS / 2];
+
+    g_test_message("%s, %s chain: first frame after median %" G_GINT64_FORMAT " us, min %" G_GINT64_FORMAT
+                   " us, max %" G_GINT64_FORMAT " us over %d reconnects",
+                   name,
+                   kind,
+                   median_us,
+                   times_us[0],
+                   times_us[RECONNECTS - 1],
+                   RECONNECTS);
+    if (g_test_perf()) {
+        g_test_minimized_result((gdouble)median_us, "%s %s %" G_GINT64_FORMAT " us", name, kind, median_us);
+    }
+}
+
+/// The whole pipeline built again on every connection
+static void run_new(const struct reconnect_case *c, struct first_frame *first, gint64 *times_us) {
+    gchar *description = g_strdup_printf("%s ! %s", c->sender, c->chain_new);
+
+    for (guint i = 0; i < RECONNECTS; i++) {
+        first_frame_reset(first);
+        const gint64 start_us = g_get_monotonic_time();
+        GError *error = NULL;
+        GstElement *pipeline = gst_parse_launch(description, &error);
+        g_assert_no_error(error);
+        watch_sink(pipeline, first);
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+        times_us[i] = wait_first_frame(first, start_us);
+
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+    }
+
+    g_free(description);
+}
+
+/// The chain kept playing, only a new sender linked to it on every connection
+static void run_warm(const struct reconnect_case *c, struct first_frame *first, gint64 *times_us) {
+    GError *error = NULL;
+    GstElement *pipeline = gst_parse_launch(c->chain_warm, &error);
+    g_assert_no_error(error);
+    watch_sink(pipeline, first);
+    GstElement *video_in = gst_bin_get_by_name(GST_BIN(pipeline), "video_in");
+    GstPad *sink_pad = gst_element_get_static_pad(video_in, "sink");
+    gst_object_unref(video_in);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    for (guint i = 0; i < RECONNECTS; i++) {
+        first_frame_reset(first);
+        const gint64 start_us = g_get_monotonic_time();
+        GstElement *sender = gst_parse_bin_from_description(c->sender, TRUE, &error);
+        g_assert_no_error(error);
+        gst_bin_add(GST_BIN(pipeline), sender);
+        GstPad *src_pad = gst_element_get_static_pad(sender, "src");
+        g_assert_cmpint(gst_pad_link(src_pad, sink_pad), ==, GST_PAD_LINK_OK);
+        gst_element_sync_state_with_parent(sender);
+
+        times_us[i] = wait_first_frame(first, start_us);
+
+        // The connection goes away, the chain stays. What the old sender left in its queues must not pass for the
+        // next one's first frame.
+        gst_element_set_state(sender, GST_STATE_NULL);
+        gst_pad_unlink(src_pad, sink_pad);
+        gst_object_unref(src_pad);
+        gst_bin_remove(GST_BIN(pipeline), sender);
+        gst_pad_send_event(sink_pad, gst_event_new_flush_start());
+        gst_pad_send_event(sink_pad, gst_event_new_flush_stop(TRUE));
+    }
+
+    gst_object_unref(sink_pad);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+}
+
+/// Time to first frame over many reconnects, building the receive chain anew each time, then keeping it warm
+static void test_first_frame(gconstpointer data) {
+    const struct reconnect_case *c = data;
+
+    for (const gchar *const *element = c->elements; *element != NULL; element++) {
+        GstElementFactory *factory = gst_element_factory_find(*element);
+        if (factory == NULL) {
+            gchar *message = g_strdup_printf("%s is not installed", *element);
+            g_test_skip(message);
+            g_free(message);
+            return;
+        }
+        gst_object_unref(factory);
+    }
+
+    struct first_frame first = {0};
+    g_mutex_init(&first.mutex);
+    g_cond_init(&first.cond);
+    gint64 new_us[RECONNECTS];
+    gint64 warm_us[RECONNECTS];
+
+    run_new(c, &first, new_us);
+    run_warm(c, &first, warm_us);
+
+    report(c->name, "new", new_us);
+    report(c->name, "warm", warm_us);
+
+    g_mutex_clear(&first.mutex);
+    g_cond_clear(&first.cond);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    gst_init(&argc, &argv);
+
+    for (guint i = 0; i < G_N_ELEMENTS(cases); i++) {
+        gchar *path = g_strdup_printf("/reconnect/first_frame/%s", cases[i].name);
+        g_test_add_data_func(path, &cases[i], test_first_frame);
+        g_free(path);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,632 @@
+#include <glib.h>
+#include <string.h>
+
+#include "../src/common/signaling_protocol.h"
+
+/// Candidates gathered by a typical join: host, server reflexive and relay, for a few interfaces
+#define JOIN_CANDIDATES 12
+/// Threads adding candidates at once in the thread test
+#define THREADS 4
+#define THREAD_CANDIDATES 100
+/// Messages encoded and decoded per measurement in the benchmark
+#define BENCH_MESSAGES 10000
+/// Joins signaled per protocol version in the join benchmark
+#define BENCH_JOINS 1000
+/// Nothing in here should take longer than this
+#define WAIT_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+static const gchar *test_candidate = "candidate:1 1 UDP 2122252543 192.168.1.2 50000 typ host";
+
+/// Shaped like webrtcbin's offers, one video and one audio section with the data channel bundled
+static const gchar *test_offer =
+    "v=0\r\no=- 4611731400430051336 0 IN IP4 0.0.0.0\r\ns=-\r\nt=0 0\r\na=ice-options:trickle\r\n"
+    "a=group:BUNDLE video0 audio1 application2\r\n"
+    "m=video 9 UDP/TLS/RTP/SAVPF 96 97\r\nc=IN IP4 0.0.0.0\r\na=setup:actpass\r\n"
+    "a=ice-ufrag:Yx3vQh2l4d0pJ9mK\r\na=ice-pwd:Zb8rT1cW5nE7aL2qS6uV0xY3oP9iK4jH\r\na=rtcp-mux\r\n"
+    "a=rtcp-rsize\r\na=sendonly\r\na=rtpmap:96 H264/90000\r\na=rtcp-fb:96 nack\r\na=rtcp-fb:96 nack pli\r\n"
+    "a=rtcp-fb:96 ccm fir\r\na=rtcp-fb:96 transport-cc\r\n"
+    "a=fmtp:96 packetization-mode=1;profile-level-id=42e01f;level-asymmetry-allowed=1\r\n"
+    "a=rtpmap:97 VP8/90000\r\na=rtcp-fb:97 nack\r\na=rtcp-fb:97 nack pli\r\n"
+    "a=ssrc:3484078954 msid:stream video\r\n"
+    "a=ssrc:3484078954 cname:user1829423719@host-5a2c\r\na=mid:video0\r\n"
+    "a=fingerprint:sha-256 "
+    "8F:2C:47:6A:91:0B:DE:33:5F:72:A8:C4:19:E6:0D:B3:4A:58:F1:27:9C:03:6E:D5:B2:84:1F:7A:C9:60:E2:4B\r\n"
+    "m=audio 9 UDP/TLS/RTP/SAVPF 111\r\nc=IN IP4 0.0.0.0\r\na=setup:actpass\r\n"
+    "a=ice-ufrag:Yx3vQh2l4d0pJ9mK\r\na=ice-pwd:Zb8rT1cW5nE7aL2qS6uV0xY3oP9iK4jH\r\na=rtcp-mux\r\n"
+    "a=sendonly\r\na=rtpmap:111 OPUS/48000/2\r\na=fmtp:111 minptime=10;useinbandfec=1\r\n"
+    "a=ssrc:3484078900 cname:user1829423719@host-5a2c\r\na=mid:audio1\r\n"
+    "m=application 9 UDP/DTLS/SCTP webrtc-datachannel\r\nc=IN IP4 0.0.0.0\r\na=setup:actpass\r\n"
+    "a=mid:application2\r\na=sctp-port:5000\r\n";
+
+/*!
+ * What the handlers were called with.
+ */
+struct received {
+    gchar *sdp_type;
+    gchar *sdp;
+    /// "<mline index> <candidate>"
+    GPtrArray *candidates;
+    guint ends;
+    gchar *session_id;
+    gboolean resumed;
+    guint restarts;
+};
+
+static void on_sdp(gpointer user_data, const gchar *type, const gchar *sdp) {
+    struct received *r = user_data;
+    g_free(r->sdp_type);
+    g_free(r->sdp);
+    r->sdp_type = g_strdup(type);
+    r->sdp = g_strdup(sdp);
+}
+
+static void on_candidate(gpointer user_data, const guint mline_index, const gchar *candidate) {
+    struct received *r = user_data;
+    g_ptr_array_add(r->candidates, g_strdup_printf("%u %s", mline_index, candidate));
+}
+
+static void on_end_of_candidates(gpointer user_data) {
+    struct received *r = user_data;
+    r->ends++;
+}
+
+static void on_session(gpointer user_data, const gchar *id, const gboolean resumed) {
+    struct received *r = user_data;
+    g_free(r->session_id);
+    r->session_id = g_strdup(id);
+    r->resumed = resumed;
+}
+
+static void on_restart(gpointer user_data) {
+    struct received *r = user_data;
+    r->restarts++;
+}
+
+static const struct signaling_handlers handlers = {
+    .sdp = on_sdp,
+    .candidate = on_candidate,
+    .end_of_candidates = on_end_of_candidates,
+    .session = on_session,
+    .restart = on_restart,
+};
+
+/// Only what every peer has to handle
+static const struct signaling_handlers minimal_handlers = {
+    .sdp = on_sdp,
+    .candidate = on_candidate,
+};
+
+static void received_init(struct received *r) {
+    memset(r, 0, sizeof(*r));
+    r->candidates = g_ptr_array_new_with_free_func(g_free);
+}
+
+static void received_clear(struct received *r) {
+    g_free(r->sdp_type);
+    g_free(r->sdp);
+    g_ptr_array_unref(r->candidates);
+    g_free(r->session_id);
+}
+
+static gboolean decode(struct signaling_codec *codec,
+                       const gchar *message,
+                       const struct signaling_handlers *h,
+                       struct received *r) {
+    return signaling_codec_decode(codec, message, strlen(message), h, r);
+}
+
+static void test_round_trip(void) {
+    struct signaling_codec *codec = signaling_codec_new();
+    struct received r;
+    received_init(&r);
+
+    // Line breaks and quotes survive, and the output is compact
+    const gchar *sdp = "v=0\r\no=- 1 2 IN IP4 127.0.0.1\r\ns=\"quoted\"\r\n";
+    gchar *message = signaling_codec_encode_sdp(codec, "offer", sdp);
+    g_assert_null(strchr(message, '\n'));
+    g_assert_true(decode(codec, message, &handlers, &r));
+    g_assert_cmpstr(r.sdp_type, ==, "offer");
+    g_assert_cmpstr(r.sdp, ==, sdp);
+    g_free(message);
+
+    message = signaling_codec_encode_sdp(codec, "answer", "v=0\r\n");
+    g_assert_true(decode(codec, message, &handlers, &r));
+    g_assert_cmpstr(r.sdp_type, ==, "answer");
+    g_free(message);
+
+    message = signaling_codec_encode_candidate(codec, 1, test_candidate);
+    g_assert_true(decode(codec, message, &handlers, &r));
+    g_assert_cmpuint(r.candidates->len, ==, 1);
+    g_assert_true(g_str_has_prefix(g_ptr_array_index(r.candidates, 0), "1 candidate:1 1 UDP"));
+    g_free(message);
+
+    message = signaling_codec_encode_session(codec, "abc-123", TRUE);
+    g_assert_true(decode(codec, message, &handlers, &r));
+    g_assert_cmpstr(r.session_id, ==, "abc-123");
+    g_assert_true(r.resumed);
+    g_free(message);
+
+    message = signaling_codec_encode_restart(codec);
+    g_assert_true(decode(codec, message, &handlers, &r));
+    g_assert_cmpuint(r.restarts, ==, 1);
+    // Older peers ignore it
+    g_assert_true(decode(codec, message, &minimal_handlers, &r));
+    g_assert_cmpuint(r.restarts, ==, 1);
+    g_free(message);
+
+    g_assert_cmpuint(r.ends, ==, 0);
+
+    received_clear(&r);
+    signaling_codec_free(codec);
+}
+
+/// What a v1 peer sends, pretty-printed as it used to be
+static void test_decode_v1(void) {
+    struct signaling_codec *codec = signaling_codec_new();
+    struct received r;
+    received_init(&r);
+
+    g_assert_true(decode(codec,
+                         "{\n  \"msg\" : \"candidate\",\n  \"candidate\" : {\n    \"candidate\" : \"candidate:2\",\n"
+                         "    \"sdpMLineIndex\" : 3\n  }\n}",
+                         &minimal_handlers,
+                         &r));
+    g_assert_cmpuint(r.candidates->len, ==, 1);
+    g_assert_cmpstr(g_ptr_array_index(r.candidates, 0), ==, "3 candidate:2");
+
+    // A missing index means the first m-line
+    g_assert_true(
+        decode(codec, "{\"msg\":\"candidate\",\"candidate\":{\"candidate\":\"candidate:3\"}}", &handlers, &r));
+    g_assert_cmpstr(g_ptr_array_index(r.candidates, 1), ==, "0 candidate:3");
+
+    received_clear(&r);
+    signaling_codec_free(codec);
+}
+
+static void test_decode_v2_batch(void) {
+    struct signaling_codec *codec = signaling_codec_new();
+    struct received r;
+    received_init(&r);
+
+    g_assert_true(decode(codec,
+                         "{\"msg\":\"candidates\",\"candidates\":[{\"candidate\":\"candidate:1\",\"sdpMLineIndex\":0},"
+                         "{\"candidate\":\"candidate:2\",\"sdpMLineIndex\":1}]}",
+                         &handlers,
+                         &r));
+    g_assert_cmpuint(r.candidates->len, ==, 2);
+    g_assert_cmpstr(g_ptr_array_index(r.candidates, 0), ==, "0 candidate:1");
+    g_assert_cmpstr(g_ptr_array_index(r.candidates, 1), ==, "1 candidate:2");
+    g_assert_cmpuint(r.ends, ==, 0);
+
+    // Malformed entries are skipped, the rest of the batch still counts
+    g_assert_true(decode(codec,
+                         "{\"msg\":\"candidates\",\"candidates\":[42,{\"sdpMLineIndex\":0},"
+                         "{\"candidate\":\"candidate:3\",\"sdpMLineIndex\":0}],\"end\":true}",
+                         &handlers,
+                         &r));
+    g_assert_cmpuint(r.candidates->len, ==, 3);
+    g_assert_cmpstr(g_ptr_array_index(r.candidates, 2), ==, "0 candidate:3");
+    g_assert_cmpuint(r.ends, ==, 1);
+
+    // An empty batch only ends, and peers without the handler ignore that
+    g_assert_true(decode(codec, "{\"msg\":\"candidates\",\"candidates\":[],\"end\":true}", &handlers, &r));
+    g_assert_cmpuint(r.ends, ==, 2);
+    g_assert_true(decode(codec, "{\"msg\":\"candidates\",\"candidates\":[],\"end\":true}", &minimal_handlers, &r));
+    g_assert_cmpuint(r.ends, ==, 2);
+    g_assert_cmpuint(r.candidates->len, ==, 3);
+
+    // So does one without the array
+    g_assert_true(decode(codec, "{\"msg\":\"candidates\",\"end\":true}", &handlers, &r));
+    g_assert_true(decode(codec, "{\"msg\":\"candidates\",\"candidates\":{},\"end\":true}", &handlers, &r));
+    g_assert_cmpuint(r.ends, ==, 4);
+    g_assert_cmpuint(r.candidates->len, ==, 3);
+
+    received_clear(&r);
+    signaling_codec_free(codec);
+}
+
+static void test_decode_invalid(void) {
+    static const gchar *invalid[] = {
+        "",
+        "not json",
+        "{\"msg\":",
+        "[]",
+        "\"offer\"",
+        "{}",
+        "{\"msg\":42}",
+        "{\"msg\":\"bogus\"}",
+        "{\"msg\":\"offer\"}",
+        "{\"msg\":\"candidate\"}",
+        "{\"msg\":\"candidate\",\"candidate\":\"candidate:1\"}",
+        "{\"msg\":\"session\",\"resumed\":true}",
+    };
+
+    struct signaling_codec *codec = signaling_codec_new();
+    struct received r;
+    received_init(&r);
+
+    for (guint i = 0; i < G_N_ELEMENTS(invalid); i++) {
+        g_assert_false(decode(codec, invalid[i], &handlers, &r));
+    }
+    g_assert_null(r.sdp);
+    g_assert_cmpuint(r.candidates->len, ==, 0);
+    g_assert_null(r.session_id);
+
+    // The parser is reused, a failure leaves nothing behind
+    gchar *message = signaling_codec_encode_sdp(codec, "offer", "v=0\r\n");
+    g_assert_true(decode(codec, message, &handlers, &r));
+    g_free(message);
+
+    received_clear(&r);
+    signaling_codec_free(codec);
+}
+
+/*!
+ * Collects what a batcher sends. Flushes run on the test's own main context, which only this thread iterates.
+ */
+struct sink {
+    GMainContext *context;
+    struct signaling_codec *codec;
+    struct signaling_candidate_batcher *batcher;
+    GPtrArray *messages;
+    gsize bytes;
+};
+
+static void sink_send(gpointer user_data, const gchar *message) {
+    struct sink *sink = user_data;
+    g_ptr_array_add(sink->messages, g_strdup(message));
+    sink->bytes += strlen(message);
+}
+
+static void sink_init(struct sink *sink) {
+    sink->context = g_main_context_new();
+    sink->codec = signaling_codec_new();
+    sink->batcher = signaling_candidate_batcher_new(sink->context, sink->codec, sink_send, sink);
+    sink->messages = g_ptr_array_new_with_free_func(g_free);
+    sink->bytes = 0;
+}
+
+static void sink_clear(struct sink *sink) {
+    signaling_candidate_batcher_free(sink->batcher);
+    // Run anything the batcher left on the context, it must not send
+    const guint sent = sink->messages->len;
+    while (g_main_context_iteration(sink->context, FALSE)) {
+    }
+    g_assert_cmpuint(sink->messages->len, ==, sent);
+
+    g_ptr_array_unref(sink->messages);
+    signaling_codec_free(sink->codec);
+    g_main_context_unref(sink->context);
+}
+
+/// Iterate the sink's context until it has received @p n messages in total
+static void sink_wait(struct sink *sink, const guint n) {
+    const gint64 deadline_us = g_get_monotonic_time() + WAIT_TIMEOUT_US;
+    while (sink->messages->len < n) {
+        g_assert_cmpint(g_get_monotonic_time(), <, deadline_us);
+        g_main_context_iteration(sink->context, TRUE);
+    }
+}
+
+/// Decode message @p index of the sink into @p r
+static void sink_decode(struct sink *sink, const guint index, struct received *r) {
+    g_assert_cmpuint(index, <, sink->messages->len);
+    g_assert_true(decode(sink->codec, g_ptr_array_index(sink->messages, index), &handlers, r));
+}
+
+static void test_batcher_window(void) {
+    struct sink sink;
+    sink_init(&sink);
+    struct received r;
+    received_init(&r);
+
+    const gint64 start_us = g_get_monotonic_time();
+    for (guint i = 0; i < 3; i++) {
+        signaling_candidate_batcher_add(sink.batcher, i, test_candidate);
+    }
+    // Nothing goes out before the window closes, unless we were descheduled for that long
+    g_main_context_iteration(sink.context, FALSE);
+    if (g_get_monotonic_time() - start_us < SIGNALING_CANDIDATE_BATCH_MS * 1000) {
+        g_assert_cmpuint(sink.messages->len, ==, 0);
+    }
+
+    sink_wait(&sink, 1);
+    sink_decode(&sink, 0, &r);
+    g_assert_cmpuint(r.candidates->len, ==, 3);
+    g_assert_cmpuint(r.ends, ==, 0);
+    g_assert_true(g_str_has_prefix(g_ptr_array_index(r.candidates, 2), "2 "));
+
+    received_clear(&r);
+    sink_clear(&sink);
+}
+
+static void test_batcher_max(void) {
+    struct sink sink;
+    sink_init(&sink);
+    struct received r;
+    received_init(&r);
+
+    for (guint i = 0; i < SIGNALING_CANDIDATE_BATCH_MAX; i++) {
+        signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+    }
+    // A full batch goes out on the next iteration, without waiting for the window
+    g_main_context_iteration(sink.context, FALSE);
+    g_assert_cmpuint(sink.messages->len, ==, 1);
+
+    sink_decode(&sink, 0, &r);
+    g_assert_cmpuint(r.candidates->len, ==, SIGNALING_CANDIDATE_BATCH_MAX);
+
+    // The next one opens a new window
+    signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+    sink_wait(&sink, 2);
+    sink_decode(&sink, 1, &r);
+    g_assert_cmpuint(r.candidates->len, ==, SIGNALING_CANDIDATE_BATCH_MAX + 1);
+
+    received_clear(&r);
+    sink_clear(&sink);
+}
+
+static void test_batcher_end(void) {
+    struct sink sink;
+    sink_init(&sink);
+    struct received r;
+    received_init(&r);
+
+    signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+    signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+    signaling_candidate_batcher_end(sink.batcher);
+    sink_wait(&sink, 1);
+    sink_decode(&sink, 0, &r);
+    g_assert_cmpuint(r.candidates->len, ==, 2);
+    g_assert_cmpuint(r.ends, ==, 1);
+
+    // An ICE restart gathers again: a new round, not marked as ended
+    signaling_candidate_batcher_add(sink.batcher, 1, test_candidate);
+    sink_wait(&sink, 2);
+    sink_decode(&sink, 1, &r);
+    g_assert_cmpuint(r.candidates->len, ==, 3);
+    g_assert_cmpuint(r.ends, ==, 1);
+
+    // Ending with nothing pending still tells the remote
+    signaling_candidate_batcher_end(sink.batcher);
+    sink_wait(&sink, 3);
+    sink_decode(&sink, 2, &r);
+    g_assert_cmpuint(r.candidates->len, ==, 3);
+    g_assert_cmpuint(r.ends, ==, 2);
+
+    // Nothing more is sent
+    g_main_context_iteration(sink.context, FALSE);
+    g_assert_cmpuint(sink.messages->len, ==, 3);
+
+    received_clear(&r);
+    sink_clear(&sink);
+}
+
+static void test_batcher_free_drops_pending(void) {
+    struct sink sink;
+    sink_init(&sink);
+
+    signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+    signaling_candidate_batcher_end(sink.batcher);
+    // sink_clear() frees the batcher before the context runs, and checks that nothing was sent
+    sink_clear(&sink);
+}
+
+static gint adders_done;
+
+static gpointer adding_thread(gpointer data) {
+    struct sink *sink = data;
+    for (guint i = 0; i < THREAD_CANDIDATES; i++) {
+        signaling_candidate_batcher_add(sink->batcher, 0, test_candidate);
+    }
+    g_atomic_int_inc(&adders_done);
+    return NULL;
+}
+
+/// Candidates come from webrtcbin's threads while the context flushes
+static void test_batcher_threads(void) {
+    struct sink sink;
+    sink_init(&sink);
+    struct received r;
+    received_init(&r);
+
+    g_atomic_int_set(&adders_done, 0);
+    GThread *threads[THREADS];
+    for (guint i = 0; i < THREADS; i++) {
+        threads[i] = g_thread_new("adding", adding_thread, &sink);
+    }
+    // Flush while they are adding
+    while (g_atomic_int_get(&adders_done) < THREADS) {
+        g_main_context_iteration(sink.context, FALSE);
+    }
+    for (guint i = 0; i < THREADS; i++) {
+        g_thread_join(threads[i]);
+    }
+    signaling_candidate_batcher_end(sink.batcher);
+
+    guint decoded = 0;
+    while (r.ends == 0) {
+        sink_wait(&sink, decoded + 1);
+        sink_decode(&sink, decoded++, &r);
+    }
+    g_assert_cmpuint(r.candidates->len, ==, THREADS * THREAD_CANDIDATES);
+    g_assert_cmpuint(r.ends, ==, 1);
+    g_test_message("%u candidates from %u threads in %u messages",
+                   THREADS * THREAD_CANDIDATES,
+                   THREADS,
+                   sink.messages->len);
+
+    received_clear(&r);
+    sink_clear(&sink);
+}
+
+/// Messages and bytes one join's candidates take on the wire, v1 against v2
+static void test_join_cost(void) {
+    struct sink sink;
+    sink_init(&sink);
+
+    gsize v1_bytes = 0;
+    for (guint i = 0; i < JOIN_CANDIDATES; i++) {
+        gchar *message = signaling_codec_encode_candidate(sink.codec, 0, test_candidate);
+        v1_bytes += strlen(message);
+        g_free(message);
+    }
+
+    for (guint i = 0; i < JOIN_CANDIDATES; i++) {
+        signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+    }
+    signaling_candidate_batcher_end(sink.batcher);
+    sink_wait(&sink, 1);
+
+    g_test_message("%d candidates: v1 %d messages, %" G_GSIZE_FORMAT " bytes; v2 %u messages, %" G_GSIZE_FORMAT
+                   " bytes",
+                   JOIN_CANDIDATES,
+                   JOIN_CANDIDATES,
+                   v1_bytes,
+                   sink.messages->len,
+                   sink.bytes);
+    g_assert_cmpuint(sink.messages->len, ==, 1);
+    g_assert_cmpuint(sink.bytes, <, v1_bytes);
+
+    sink_clear(&sink);
+}
+
+/// The client's order wins, over the order the peer lists its own codecs in
+static void test_codecs_choose(void) {
+    static const gchar *const supported[] = {"H264", "VP8", NULL, "AV1"};
+    const guint n = G_N_ELEMENTS(supported);
+
+    g_assert_cmpint(signaling_codecs_choose("H264,VP8", supported, n), ==, 0);
+    g_assert_cmpint(signaling_codecs_choose("VP8,H264", supported, n), ==, 1);
+    g_assert_cmpint(signaling_codecs_choose(" vp8 , h264", supported, n), ==, 1);
+    g_assert_cmpint(signaling_codecs_choose("VP9,AV1,H264", supported, n), ==, 3);
+    // Unknown, or known but without an entry
+    g_assert_cmpint(signaling_codecs_choose("H265,VP9", supported, n), ==, -1);
+    g_assert_cmpint(signaling_codecs_choose("", supported, n), ==, -1);
+    g_assert_cmpint(signaling_codecs_choose(NULL, supported, n), ==, -1);
+}
+
+static void count_candidate(gpointer user_data, const guint mline_index, const gchar *candidate) {
+    guint *count = user_data;
+    (*count)++;
+}
+
+/// Encode a join's session, offer and answer on one side and decode them on the other
+static void join_sdp(struct signaling_codec *codec, struct received *r) {
+    gchar *message = signaling_codec_encode_session(codec, "abc-123", FALSE);
+    g_assert_true(decode(codec, message, &handlers, r));
+    g_free(message);
+    message = signaling_codec_encode_sdp(codec, "offer", test_offer);
+    g_assert_true(decode(codec, message, &handlers, r));
+    g_free(message);
+    message = signaling_codec_encode_sdp(codec, "answer", test_offer);
+    g_assert_true(decode(codec, message, &handlers, r));
+    g_free(message);
+}
+
+/// Everything signaled for a join, encoded and decoded: session, offer, answer and candidates, v1 against v2
+static void test_join_bench(void) {
+    struct sink sink;
+    sink_init(&sink);
+    struct received r;
+
+    // v1: one message per candidate
+    gint64 start_us = g_get_monotonic_time();
+    for (guint i = 0; i < BENCH_JOINS; i++) {
+        received_init(&r);
+        join_sdp(sink.codec, &r);
+        for (guint j = 0; j < JOIN_CANDIDATES; j++) {
+            gchar *message = signaling_codec_encode_candidate(sink.codec, 0, test_candidate);
+            g_assert_true(decode(sink.codec, message, &handlers, &r));
+            g_free(message);
+        }
+        g_assert_cmpuint(r.candidates->len, ==, JOIN_CANDIDATES);
+        received_clear(&r);
+    }
+    const gint64 v1_us = g_get_monotonic_time() - start_us;
+
+    // v2: the batcher's single message, flushed at once by the end of candidates, so no window is waited for
+    start_us = g_get_monotonic_time();
+    for (guint i = 0; i < BENCH_JOINS; i++) {
+        received_init(&r);
+        join_sdp(sink.codec, &r);
+        for (guint j = 0; j < JOIN_CANDIDATES; j++) {
+            signaling_candidate_batcher_add(sink.batcher, 0, test_candidate);
+        }
+        signaling_candidate_batcher_end(sink.batcher);
+        sink_wait(&sink, i + 1);
+        sink_decode(&sink, i, &r);
+        g_assert_cmpuint(r.candidates->len, ==, JOIN_CANDIDATES);
+        g_assert_cmpuint(r.ends, ==, 1);
+        received_clear(&r);
+    }
+    const gint64 v2_us = g_get_monotonic_time() - start_us;
+
+    // One thread that never sleeps, so this is CPU time too
+    const gdouble v1_join_us = (gdouble)v1_us / BENCH_JOINS;
+    const gdouble v2_join_us = (gdouble)v2_us / BENCH_JOINS;
+    g_test_message("Per join with %d candidates, encoded and decoded: v1 %.1f us, v2 %.1f us",
+                   JOIN_CANDIDATES,
+                   v1_join_us,
+                   v2_join_us);
+    if (g_test_perf()) {
+        g_test_minimized_result(v2_join_us, "v2 join %.1f us", v2_join_us);
+    }
+
+    sink_clear(&sink);
+}
+
+/// Encoding and decoding with the reused builder, generator and parser
+static void test_bench(void) {
+    static const struct signaling_handlers counting_handlers = {.sdp = NULL, .candidate = count_candidate};
+
+    struct signaling_codec *codec = signaling_codec_new();
+    gchar **messages = g_new(gchar *, BENCH_MESSAGES);
+
+    gint64 start_us = g_get_monotonic_time();
+    for (guint i = 0; i < BENCH_MESSAGES; i++) {
+        messages[i] = signaling_codec_encode_candidate(codec, 0, test_candidate);
+    }
+    const gint64 encode_us = g_get_monotonic_time() - start_us;
+
+    guint decoded = 0;
+    start_us = g_get_monotonic_time();
+    for (guint i = 0; i < BENCH_MESSAGES; i++) {
+        g_assert_true(signaling_codec_decode(codec, messages[i], strlen(messages[i]), &counting_handlers, &decoded));
+    }
+    const gint64 decode_us = g_get_monotonic_time() - start_us;
+    g_assert_cmpuint(decoded, ==, BENCH_MESSAGES);
+
+    const gdouble encode_ns = (gdouble)encode_us * 1000.0 / BENCH_MESSAGES;
+    const gdouble decode_ns = (gdouble)decode_us * 1000.0 / BENCH_MESSAGES;
+    g_test_message("Per candidate message: encode %.0f ns, decode %.0f ns", encode_ns, decode_ns);
+    if (g_test_perf()) {
+        g_test_minimized_result(encode_ns + decode_ns, "encode and decode %.0f ns", encode_ns + decode_ns);
+    }
+
+    for (guint i = 0; i < BENCH_MESSAGES; i++) {
+        g_free(messages[i]);
+    }
+    g_free(messages);
+    signaling_codec_free(codec);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/signaling_protocol/round_trip", test_round_trip);
+    g_test_add_func("/signaling_protocol/decode_v1", test_decode_v1);
+    g_test_add_func("/signaling_protocol/decode_v2_batch", test_decode_v2_batch);
+    g_test_add_func("/signaling_protocol/decode_invalid", test_decode_invalid);
+    g_test_add_func("/signaling_protocol/batcher/window", test_batcher_window);
+    g_test_add_func("/signaling_protocol/batcher/max", test_batcher_max);
+    g_test_add_func("/signaling_protocol/batcher/end", test_batcher_end);
+    g_test_add_func("/signaling_protocol/batcher/free_drops_pending", test_batcher_free_drops_pending);
+    g_test_add_func("/signaling_protocol/batcher/threads", test_batcher_threads);
+    g_test_add_func("/signaling_protocol/codecs_choose", test_codecs_choose);
+    g_test_add_func("/signaling_protocol/join_cost", test_join_cost);
+    g_test_add_func("/signaling_protocol/join_bench", test_join_bench);
+    g_test_add_func("/signaling_protocol/bench", test_bench);
+
+    return g_test_run();
+}
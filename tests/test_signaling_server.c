@@ -0,0 +1,412 @@
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <stdlib.h>
+
+#ifdef G_OS_UNIX
+    #include <sys/resource.h>
+#endif
+
+#include "../src/common/signaling_protocol.h"
+#include "../src/server/signaling_server.h"
+
+/// Where signaling_server_new() listens
+#define BENCH_URI "ws://127.0.0.1:52356/ws"
+/// Messages each client sends, and receives, per measurement
+#define BENCH_ROUNDS 20
+/// Any phase taking longer than this fails the test
+#define BENCH_TIMEOUT_US (60 * G_USEC_PER_SEC)
+/// Round trips timed by the latency test, and the clients loading the server meanwhile
+#define ROUND_TRIP_PINGS 200
+#define ROUND_TRIP_LOAD_CLIENTS 100
+/// The load clients get an offer of this size this often, about what webrtcbin produces with audio, video and data
+#define ROUND_TRIP_OFFER_BYTES 4096
+#define ROUND_TRIP_OFFER_INTERVAL_US (50 * 1000)
+/// Candidates sent by the round trip probe start with this, the load clients' ones do not
+#define ROUND_TRIP_PROBE "candidate:probe"
+
+static SignalingServer *server;
+
+/*!
+ * In-process fake clients, all driven from the default main context while the server runs its own thread.
+ */
+struct bench {
+    guint n_clients;
+    SoupSession *session;
+    /// Client side of each connection
+    GPtrArray *websockets;
+    guint connect_failures;
+    /// Messages received by all clients, default main context only
+    guint replies;
+    /// Client measuring round trips, and the replies it got, default main context only. NULL for the throughput bench.
+    SoupWebsocketConnection *probe;
+    guint pongs;
+    /// ClientIds of the probe's candidates, answered from another thread as the pipeline would
+    GAsyncQueue *echo_queue;
+    /// Server side of the probe, known from its first answer
+    ClientId probe_id;
+
+    /// Server side, written from the signaling thread
+    GMutex mutex;
+    GPtrArray *client_ids;
+    gint candidates;
+    gint disconnected;
+};
+
+static struct bench *current;
+
+static void on_client_connected(SignalingServer *signaling_server,
+                                ClientId client_id,
+                                const gchar *resume_id,
+                                const gchar *codecs,
+                                gpointer user_data) {
+    g_mutex_lock(&current->mutex);
+    g_ptr_array_add(current->client_ids, client_id);
+    g_mutex_unlock(&current->mutex);
+    g_main_context_wakeup(NULL);
+}
+
+static void on_client_disconnected(SignalingServer *signaling_server, ClientId client_id, gpointer user_data) {
+    g_atomic_int_inc(&current->disconnected);
+    g_main_context_wakeup(NULL);
+}
+
+static void on_candidate(SignalingServer *signaling_server,
+                         ClientId client_id,
+                         guint mline_index,
+                         const gchar *candidate,
+                         gpointer user_data) {
+    if (current->echo_queue && g_str_has_prefix(candidate, ROUND_TRIP_PROBE)) {
+        g_async_queue_push(current->echo_queue, client_id);
+        return;
+    }
+    g_atomic_int_inc(&current->candidates);
+    g_main_context_wakeup(NULL);
+}
+
+static void on_websocket_message(SoupWebsocketConnection *websocket, gint type, GBytes *message, gpointer user_data) {
+    if (websocket == current->probe) {
+        current->pongs++;
+    } else {
+        current->replies++;
+    }
+}
+
+static void on_websocket_connected(GObject *session, GAsyncResult *res, gpointer user_data) {
+    GError *error = NULL;
+    SoupWebsocketConnection *websocket = soup_session_websocket_connect_finish(SOUP_SESSION(session), res, &error);
+    if (error != NULL) {
+        g_test_message("Connection failed: %s", error->message);
+        g_clear_error(&error);
+        current->connect_failures++;
+        return;
+    }
+
+    g_assert_cmpstr(soup_websocket_connection_get_protocol(websocket), ==, SIGNALING_PROTOCOL_V2);
+    g_signal_connect(websocket, "message", G_CALLBACK(on_websocket_message), NULL);
+    g_ptr_array_add(current->websockets, websocket);
+}
+
+static guint bench_server_connected(struct bench *b) {
+    g_mutex_lock(&b->mutex);
+    const guint connected = b->client_ids->len;
+    g_mutex_unlock(&b->mutex);
+    return connected;
+}
+
+/// Run the default main context until @p done, failing after BENCH_TIMEOUT_US. The server's signal handlers wake it up.
+#define BENCH_WAIT(done)                                                       \
+    do {                                                                       \
+        const gint64 deadline_us_ = g_get_monotonic_time() + BENCH_TIMEOUT_US; \
+        while (!(done)) {                                                      \
+            g_assert_cmpint(g_get_monotonic_time(), <, deadline_us_);          \
+            g_main_context_iteration(NULL, TRUE);                              \
+        }                                                                      \
+    } while (0)
+
+static void bench_connect(struct bench *b) {
+    static const char *protocols[] = {SIGNALING_PROTOCOL_V2, NULL};
+
+    for (guint i = 0; i < b->n_clients; i++) {
+#if SOUP_MAJOR_VERSION == 2
+        soup_session_websocket_connect_async(b->session,
+                                             soup_message_new(SOUP_METHOD_GET, BENCH_URI),
+                                             NULL,
+                                             (char **)protocols,
+                                             NULL,
+                                             on_websocket_connected,
+                                             b);
+#else
+        soup_session_websocket_connect_async(b->session,
+                                             soup_message_new(SOUP_METHOD_GET, BENCH_URI),
+                                             NULL,
+                                             (char **)protocols,
+                                             0,
+                                             NULL,
+                                             on_websocket_connected,
+                                             b);
+#endif
+    }
+
+    BENCH_WAIT(b->websockets->len + b->connect_failures == b->n_clients && bench_server_connected(b) == b->n_clients);
+    g_assert_cmpuint(b->connect_failures, ==, 0);
+}
+
+/// Every client sends one candidate per round, done when the server has emitted all of them
+static void bench_client_to_server(struct bench *b) {
+    struct signaling_codec *codec = signaling_codec_new();
+    gchar *message =
+        signaling_codec_encode_candidate(codec, 0, "candidate:1 1 UDP 2122252543 192.168.1.2 50000 typ host");
+
+    for (guint round = 0; round < BENCH_ROUNDS; round++) {
+        for (guint i = 0; i < b->websockets->len; i++) {
+            soup_websocket_connection_send_text(g_ptr_array_index(b->websockets, i), message);
+        }
+        BENCH_WAIT((guint)g_atomic_int_get(&b->candidates) == (round + 1) * b->n_clients);
+    }
+
+    g_free(message);
+    signaling_codec_free(codec);
+}
+
+/// The server sends one message per round to every client, through the same queue the pipeline uses
+static void bench_server_to_client(struct bench *b) {
+    for (guint round = 0; round < BENCH_ROUNDS; round++) {
+        for (guint i = 0; i < b->client_ids->len; i++) {
+            signaling_server_send_session(server, g_ptr_array_index(b->client_ids, i), "bench", FALSE);
+        }
+        BENCH_WAIT(b->replies == (round + 1) * b->n_clients);
+    }
+}
+
+static gboolean bench_raise_fd_limit(const guint n_clients) {
+#ifdef G_OS_UNIX
+    // Both ends of every connection live in this process
+    const rlim_t needed = 2 * n_clients + 64;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return FALSE;
+    }
+    if (limit.rlim_cur < needed && limit.rlim_max >= needed) {
+        limit.rlim_cur = needed;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return limit.rlim_cur >= needed;
+#else
+    return TRUE;
+#endif
+}
+
+static void test_bench(gconstpointer data) {
+    const guint n_clients = GPOINTER_TO_UINT(data);
+
+    if (!bench_raise_fd_limit(n_clients)) {
+        g_test_skip("Not enough file descriptors for both ends of every connection");
+        return;
+    }
+
+    struct bench b = {.n_clients = n_clients};
+    g_mutex_init(&b.mutex);
+    b.client_ids = g_ptr_array_new();
+    b.websockets = g_ptr_array_new_with_free_func(g_object_unref);
+    b.session = g_object_new(SOUP_TYPE_SESSION, "max-conns", n_clients, "max-conns-per-host", n_clients, NULL);
+    current = &b;
+
+    const gint64 start_us = g_get_monotonic_time();
+    bench_connect(&b);
+    const gint64 connected_us = g_get_monotonic_time();
+    bench_client_to_server(&b);
+    const gint64 received_us = g_get_monotonic_time();
+    bench_server_to_client(&b);
+    const gint64 sent_us = g_get_monotonic_time();
+
+    // Every connection got its own ID
+    GHashTable *ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (guint i = 0; i < b.client_ids->len; i++) {
+        g_assert_nonnull(g_ptr_array_index(b.client_ids, i));
+        g_hash_table_add(ids, g_ptr_array_index(b.client_ids, i));
+    }
+    g_assert_cmpuint(g_hash_table_size(ids), ==, n_clients);
+    g_hash_table_unref(ids);
+
+    const gdouble messages = (gdouble)n_clients * BENCH_ROUNDS;
+    const gdouble connect_ms = (gdouble)(connected_us - start_us) / 1000.0;
+    const gdouble inbound_us = (gdouble)(received_us - connected_us) / messages;
+    const gdouble outbound_us = (gdouble)(sent_us - received_us) / messages;
+    g_test_message("%u clients: connected in %.1f ms, client to server %.2f us/message, server to client %.2f "
+                   "us/message",
+                   n_clients,
+                   connect_ms,
+                   inbound_us,
+                   outbound_us);
+    if (g_test_perf()) {
+        g_test_minimized_result(outbound_us, "%u clients, server to client %.2f us/message", n_clients, outbound_us);
+    }
+
+    for (guint i = 0; i < b.websockets->len; i++) {
+        soup_websocket_connection_close(g_ptr_array_index(b.websockets, i), SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    }
+    BENCH_WAIT((guint)g_atomic_int_get(&b.disconnected) == n_clients);
+
+    g_ptr_array_unref(b.websockets);
+    g_object_unref(b.session);
+    // Nothing of this client set is left on the signaling thread
+    current = NULL;
+    g_ptr_array_unref(b.client_ids);
+    g_mutex_clear(&b.mutex);
+}
+
+/*!
+ * Pipeline side of the round trip test: answers the probe from its own thread, through the public send functions, and
+ * meanwhile keeps queuing offers to the load clients, the way a burst of negotiations would.
+ */
+struct round_trip_control {
+    /// Every client but the probe
+    GPtrArray *load_ids;
+    gint stop;
+};
+
+static gpointer round_trip_echo_thread(gpointer data) {
+    struct bench *b = data;
+
+    for (;;) {
+        const ClientId client_id = g_async_queue_pop(b->echo_queue);
+        if (client_id == b) {
+            return NULL;
+        }
+        g_atomic_pointer_set(&b->probe_id, client_id);
+        signaling_server_send_session(server, client_id, "pong", FALSE);
+    }
+}
+
+static gpointer round_trip_burst_thread(gpointer data) {
+    struct round_trip_control *control = data;
+
+    gchar *offer = g_strnfill(ROUND_TRIP_OFFER_BYTES, 'a');
+    while (!g_atomic_int_get(&control->stop)) {
+        for (guint i = 0; i < control->load_ids->len; i++) {
+            signaling_server_send_sdp_offer(server, g_ptr_array_index(control->load_ids, i), offer);
+        }
+        g_usleep(ROUND_TRIP_OFFER_INTERVAL_US);
+    }
+    g_free(offer);
+
+    return NULL;
+}
+
+static gint round_trip_compare(gconstpointer a, gconstpointer b) {
+    const gint64 x = *(const gint64 *)a;
+    const gint64 y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+/// One probe client times candidate to answer round trips while the others send candidates and receive offers
+static void test_round_trip(void) {
+    const guint n_clients = ROUND_TRIP_LOAD_CLIENTS + 1;
+
+    if (!bench_raise_fd_limit(n_clients)) {
+        g_test_skip("Not enough file descriptors for both ends of every connection");
+        return;
+    }
+
+    struct bench b = {.n_clients = n_clients};
+    g_mutex_init(&b.mutex);
+    b.client_ids = g_ptr_array_new();
+    b.websockets = g_ptr_array_new_with_free_func(g_object_unref);
+    b.session = g_object_new(SOUP_TYPE_SESSION, "max-conns", n_clients, "max-conns-per-host", n_clients, NULL);
+    b.echo_queue = g_async_queue_new();
+    current = &b;
+
+    bench_connect(&b);
+    b.probe = g_ptr_array_index(b.websockets, 0);
+    GThread *echo = g_thread_new("echo", round_trip_echo_thread, &b);
+
+    struct signaling_codec *codec = signaling_codec_new();
+    gchar *ping =
+        signaling_codec_encode_candidate(codec, 0, ROUND_TRIP_PROBE " 1 UDP 2122252543 192.168.1.2 50001 typ host");
+    gchar *load = signaling_codec_encode_candidate(codec, 0, "candidate:1 1 UDP 2122252543 192.168.1.2 50000 typ host");
+
+    // A first round trip finds out which ClientId the probe has, so that the load leaves it alone
+    soup_websocket_connection_send_text(b.probe, ping);
+    BENCH_WAIT(b.pongs == 1);
+
+    struct round_trip_control control = {.load_ids = g_ptr_array_new()};
+    const ClientId probe_id = g_atomic_pointer_get(&b.probe_id);
+    g_mutex_lock(&b.mutex);
+    for (guint i = 0; i < b.client_ids->len; i++) {
+        if (g_ptr_array_index(b.client_ids, i) != probe_id) {
+            g_ptr_array_add(control.load_ids, g_ptr_array_index(b.client_ids, i));
+        }
+    }
+    g_mutex_unlock(&b.mutex);
+    GThread *burst = g_thread_new("burst", round_trip_burst_thread, &control);
+
+    gint64 *rtts_us = g_new(gint64, ROUND_TRIP_PINGS);
+    for (guint i = 0; i < ROUND_TRIP_PINGS; i++) {
+        for (guint j = 1; j < b.websockets->len; j++) {
+            soup_websocket_connection_send_text(g_ptr_array_index(b.websockets, j), load);
+        }
+        const gint64 sent_us = g_get_monotonic_time();
+        soup_websocket_connection_send_text(b.probe, ping);
+        BENCH_WAIT(b.pongs == i + 2);
+        rtts_us[i] = g_get_monotonic_time() - sent_us;
+    }
+
+    g_atomic_int_set(&control.stop, TRUE);
+    g_thread_join(burst);
+    g_async_queue_push(b.echo_queue, &b);
+    g_thread_join(echo);
+
+    qsort(rtts_us, ROUND_TRIP_PINGS, sizeof(*rtts_us), round_trip_compare);
+    const gdouble median_ms = rtts_us[ROUND_TRIP_PINGS / 2] / 1000.0;
+    const gdouble p99_ms = rtts_us[ROUND_TRIP_PINGS * 99 / 100] / 1000.0;
+    const gdouble max_ms = rtts_us[ROUND_TRIP_PINGS - 1] / 1000.0;
+    g_test_message("Round trip with %u loading clients: median %.2f ms, p99 %.2f ms, max %.2f ms, %u offers received",
+                   ROUND_TRIP_LOAD_CLIENTS,
+                   median_ms,
+                   p99_ms,
+                   max_ms,
+                   b.replies);
+    if (g_test_perf()) {
+        g_test_minimized_result(p99_ms, "round trip p99 %.2f ms", p99_ms);
+    }
+
+    g_free(rtts_us);
+    g_ptr_array_unref(control.load_ids);
+    g_free(ping);
+    g_free(load);
+    signaling_codec_free(codec);
+
+    b.probe = NULL;
+    for (guint i = 0; i < b.websockets->len; i++) {
+        soup_websocket_connection_close(g_ptr_array_index(b.websockets, i), SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    }
+    BENCH_WAIT((guint)g_atomic_int_get(&b.disconnected) == n_clients);
+
+    g_ptr_array_unref(b.websockets);
+    g_object_unref(b.session);
+    current = NULL;
+    g_async_queue_unref(b.echo_queue);
+    g_ptr_array_unref(b.client_ids);
+    g_mutex_clear(&b.mutex);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+
+    server = signaling_server_new();
+    g_signal_connect(server, "ws-client-connected", G_CALLBACK(on_client_connected), NULL);
+    g_signal_connect(server, "ws-client-disconnected", G_CALLBACK(on_client_disconnected), NULL);
+    g_signal_connect(server, "candidate", G_CALLBACK(on_candidate), NULL);
+
+    g_test_add_data_func("/signaling_server/bench/10", GUINT_TO_POINTER(10), test_bench);
+    g_test_add_data_func("/signaling_server/bench/100", GUINT_TO_POINTER(100), test_bench);
+    g_test_add_data_func("/signaling_server/bench/1000", GUINT_TO_POINTER(1000), test_bench);
+    g_test_add_func("/signaling_server/round_trip", test_round_trip);
+
+    const int ret = g_test_run();
+
+    g_object_unref(server);
+
+    return ret;
+}
@@ -0,0 +1,382 @@
+#include <gst/gst.h>
+#include <string.h>
+
+#include "../src/server/temporal_layers.h"
+
+#define PACKET_MAX 128
+/// Temporal layer of each frame in the usual three layer pattern
+static const gint layer_pattern[] = {0, 2, 1, 2};
+
+/*!
+ * One VP8 RTP packet as a payloader with temporal layers would send it.
+ */
+struct vp8_packet {
+    guint16 seq;
+    /// -1 to leave out the TID, the TID/Y/KEYIDX byte is then only there for the key index
+    gint tid;
+    gboolean sync;
+    gboolean frame_start;
+    gboolean key_frame;
+    guint n_csrcs;
+    /// 32-bit words of RTP header extension, 0 for none
+    guint extension_words;
+    /// Also carry a 15-bit picture ID and a TL0PICIDX, ahead of the TID
+    gboolean picture_ids;
+};
+
+static gsize build_packet(const struct vp8_packet *p, guint8 out[PACKET_MAX]) {
+    gsize pos = 0;
+
+    memset(out, 0, PACKET_MAX);
+    out[pos++] = 0x80 | (p->extension_words > 0 ? 0x10 : 0) | p->n_csrcs;
+    out[pos++] = 96;
+    out[pos++] = p->seq >> 8;
+    out[pos++] = p->seq & 0xff;
+    // Timestamp and SSRC
+    pos += 8;
+    pos += 4 * p->n_csrcs;
+    if (p->extension_words > 0) {
+        out[pos] = 0xbe;
+        out[pos + 1] = 0xde;
+        out[pos + 3] = p->extension_words;
+        pos += 4 + 4 * p->extension_words;
+    }
+
+    // X|R|N|S|R|PID, partition 0
+    out[pos++] = 0x80 | (p->frame_start ? 0x10 : 0);
+    // I|L|T|K
+    out[pos++] = (p->picture_ids ? 0xc0 : 0) | (p->tid >= 0 ? 0x20 : 0x10);
+    if (p->picture_ids) {
+        out[pos++] = 0x80 | 0x12;
+        out[pos++] = 0x34;
+        out[pos++] = 7;
+    }
+    // TID|Y|KEYIDX
+    out[pos++] = (p->tid >= 0 ? p->tid << 6 : 0) | (p->sync ? 0x20 : 0) | 3;
+
+    // VP8 payload header, starting with the inverse key frame flag, and some payload
+    out[pos++] = p->key_frame ? 0x00 : 0x01;
+    memset(out + pos, 0xaa, 8);
+    pos += 8;
+
+    g_assert_cmpuint(pos, <=, PACKET_MAX);
+    return pos;
+}
+
+static GstBuffer *make_buffer(const guint8 *data, const gsize size) {
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    gst_buffer_fill(buffer, 0, data, size);
+    return buffer;
+}
+
+static GstBuffer *make_packet(const struct vp8_packet *p) {
+    guint8 data[PACKET_MAX];
+    return make_buffer(data, build_packet(p, data));
+}
+
+static guint16 buffer_seq(GstBuffer *buffer) {
+    guint8 seq[2];
+    g_assert_cmpuint(gst_buffer_extract(buffer, 2, seq, 2), ==, 2);
+    return (guint16)((seq[0] << 8) | seq[1]);
+}
+
+static void check_parse(const struct vp8_packet *p) {
+    GstBuffer *buffer = make_packet(p);
+    struct temporal_layer_info info;
+
+    g_assert_true(temporal_layer_parse_vp8(buffer, &info));
+    g_assert_cmpint(info.tid, ==, p->tid);
+    g_assert_cmpint(info.sync, ==, p->tid >= 0 && p->sync);
+    g_assert_cmpint(info.frame_start, ==, p->frame_start);
+    g_assert_cmpint(info.key_frame, ==, p->frame_start && p->key_frame);
+
+    gst_buffer_unref(buffer);
+}
+
+static void test_parse(void) {
+    for (gint tid = 0; tid < 4; tid++) {
+        check_parse(&(struct vp8_packet){.tid = tid, .frame_start = TRUE});
+        check_parse(&(struct vp8_packet){.tid = tid, .sync = TRUE, .frame_start = TRUE});
+    }
+    check_parse(&(struct vp8_packet){.tid = 0, .frame_start = TRUE, .key_frame = TRUE});
+    // Only the first packet of a frame says whether it is a key frame
+    check_parse(&(struct vp8_packet){.tid = 0, .key_frame = TRUE});
+    check_parse(&(struct vp8_packet){.tid = 1, .sync = TRUE, .picture_ids = TRUE, .frame_start = TRUE});
+    check_parse(&(struct vp8_packet){.tid = 2, .n_csrcs = 3, .extension_words = 2, .frame_start = TRUE});
+    check_parse(&(struct vp8_packet){.tid = -1, .frame_start = TRUE, .key_frame = TRUE});
+}
+
+static void test_parse_invalid(void) {
+    struct temporal_layer_info info;
+
+    // Not RTP version 2
+    guint8 data[PACKET_MAX];
+    const gsize size = build_packet(&(struct vp8_packet){.tid = 1, .frame_start = TRUE}, data);
+    data[0] = 0x40 | (data[0] & 0x3f);
+    GstBuffer *buffer = make_buffer(data, size);
+    g_assert_false(temporal_layer_parse_vp8(buffer, &info));
+    g_assert_cmpint(info.tid, ==, -1);
+    gst_buffer_unref(buffer);
+
+    // No extended control bits, no TID
+    build_packet(&(struct vp8_packet){.tid = 1, .frame_start = TRUE}, data);
+    data[12] &= 0x7f;
+    buffer = make_buffer(data, size);
+    g_assert_true(temporal_layer_parse_vp8(buffer, &info));
+    g_assert_cmpint(info.tid, ==, -1);
+    gst_buffer_unref(buffer);
+
+    // Cut anywhere before the TID, including inside the header extension
+    const struct vp8_packet p = {.tid = 2, .n_csrcs = 1, .extension_words = 1, .picture_ids = TRUE};
+    build_packet(&p, data);
+    const gsize tid_pos = 12 + 4 + 8 + 2 + 3;
+    for (gsize cut = 0; cut <= tid_pos; cut++) {
+        buffer = make_buffer(data, cut);
+        g_assert_false(temporal_layer_parse_vp8(buffer, &info));
+        gst_buffer_unref(buffer);
+    }
+    buffer = make_buffer(data, tid_pos + 1);
+    g_assert_true(temporal_layer_parse_vp8(buffer, &info));
+    g_assert_cmpint(info.tid, ==, 2);
+    gst_buffer_unref(buffer);
+}
+
+/*!
+ * Feeds frames of the three layer pattern through a filter, two packets each, as a pad probe would see them.
+ */
+struct stream {
+    struct temporal_layer_filter filter;
+    guint frame;
+    /// Sequence number of the next packet in
+    guint16 seq_in;
+    /// Sequence number the next forwarded packet must have
+    guint16 seq_out;
+    guint forwarded;
+    guint left_out;
+};
+
+static void stream_init(struct stream *s, const guint16 first_seq) {
+    memset(s, 0, sizeof(*s));
+    temporal_layer_filter_init(&s->filter, 3);
+    s->seq_in = first_seq;
+    s->seq_out = first_seq;
+}
+
+/// @return Whether the packet was forwarded
+static gboolean stream_probe(struct stream *s, GstBuffer *buffer) {
+    GstPadProbeInfo info = {.type = GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_PUSH, .data = buffer};
+
+    if (temporal_layer_filter_probe(&s->filter, &info) == GST_PAD_PROBE_DROP) {
+        gst_buffer_unref(GST_PAD_PROBE_INFO_BUFFER(&info));
+        s->left_out++;
+        return FALSE;
+    }
+
+    // No gap for the receiver to see
+    GstBuffer *out = GST_PAD_PROBE_INFO_BUFFER(&info);
+    g_assert_cmpuint(buffer_seq(out), ==, s->seq_out);
+    s->seq_out++;
+    s->forwarded++;
+    gst_buffer_unref(out);
+    return TRUE;
+}
+
+/// Send the next frame of the pattern, @return the number of its packets forwarded
+static guint stream_frame(struct stream *s, const gboolean sync, const gboolean key_frame) {
+    const gint tid = key_frame ? 0 : layer_pattern[s->frame % G_N_ELEMENTS(layer_pattern)];
+    guint forwarded = 0;
+
+    for (guint i = 0; i < 2; i++) {
+        const struct vp8_packet p = {
+            .seq = s->seq_in++,
+            .tid = tid,
+            .sync = sync,
+            .frame_start = i == 0,
+            .key_frame = key_frame,
+        };
+        forwarded += stream_probe(s, make_packet(&p));
+    }
+
+    s->frame++;
+    return forwarded;
+}
+
+/// Frames until the next one of layer @p tid
+static void stream_skip_to(struct stream *s, const gint tid) {
+    while (layer_pattern[s->frame % G_N_ELEMENTS(layer_pattern)] != tid) {
+        stream_frame(s, FALSE, FALSE);
+    }
+}
+
+static void test_filter_all_layers(void) {
+    struct stream s;
+    stream_init(&s, 100);
+
+    // Everything goes through untouched, the probe does not even look at it
+    GstBuffer *buffer = make_packet(&(struct vp8_packet){.seq = 100, .tid = 2, .frame_start = TRUE});
+    GstPadProbeInfo info = {.type = GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_PUSH, .data = buffer};
+    g_assert_cmpint(temporal_layer_filter_probe(&s.filter, &info), ==, GST_PAD_PROBE_OK);
+    g_assert_true(GST_PAD_PROBE_INFO_BUFFER(&info) == buffer);
+    gst_buffer_unref(buffer);
+    s.seq_in++;
+    s.seq_out++;
+
+    for (guint i = 0; i < 8; i++) {
+        g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, 2);
+    }
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 3);
+    g_assert_cmpuint(temporal_layer_filter_get_dropped(&s.filter), ==, 0);
+}
+
+/// Layers are left out at frame boundaries, and come back at sync points or key frames
+static void test_filter_drop_and_raise(void) {
+    struct stream s;
+    // Rewritten sequence numbers wrap around on the way
+    stream_init(&s, 65500);
+
+    stream_skip_to(&s, 0);
+    g_assert_cmpuint(temporal_layer_filter_update(&s.filter, 20.0), ==, 2);
+    // Takes effect at the next frame, the next layer 2 frame is left out whole
+    g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, 2);
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 2);
+    stream_skip_to(&s, 2);
+    g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, 0);
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 2);
+    for (guint i = 0; i < 8; i++) {
+        const gint tid = layer_pattern[s.frame % G_N_ELEMENTS(layer_pattern)];
+        g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, tid <= 1 ? 2 : 0);
+    }
+
+    // Down to the base layer, which is never left out
+    g_assert_cmpuint(temporal_layer_filter_update(&s.filter, 20.0), ==, 1);
+    g_assert_cmpuint(temporal_layer_filter_update(&s.filter, 20.0), ==, 1);
+    for (guint i = 0; i < 8; i++) {
+        const gint tid = layer_pattern[s.frame % G_N_ELEMENTS(layer_pattern)];
+        g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, tid == 0 ? 2 : 0);
+    }
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 1);
+
+    // Back up to two layers once clean, but layer 1 only resumes at a sync point
+    g_assert_cmpuint(temporal_layer_filter_update(&s.filter, 0.0), ==, 1);
+    g_assert_cmpuint(temporal_layer_filter_update(&s.filter, 0.0), ==, 1);
+    g_assert_cmpuint(temporal_layer_filter_update(&s.filter, 0.0), ==, 2);
+    stream_skip_to(&s, 1);
+    g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, 0);
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 1);
+    stream_skip_to(&s, 1);
+    g_assert_cmpuint(stream_frame(&s, TRUE, FALSE), ==, 2);
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 2);
+
+    // A key frame brings back everything targeted at once
+    for (guint i = 0; i < TEMPORAL_LAYERS_RAISE_INTERVALS; i++) {
+        temporal_layer_filter_update(&s.filter, 0.0);
+    }
+    stream_skip_to(&s, 0);
+    g_assert_cmpuint(stream_frame(&s, FALSE, TRUE), ==, 2);
+    g_assert_cmpuint(temporal_layer_filter_get_layers(&s.filter), ==, 3);
+    for (guint i = 0; i < 4; i++) {
+        g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, 2);
+    }
+
+    g_assert_cmpuint(temporal_layer_filter_get_dropped(&s.filter), ==, s.left_out);
+    g_test_message("%u packets forwarded, %u left out", s.forwarded, s.left_out);
+}
+
+/// Packets without a TID, e.g. from an encoder without temporal layers, are always forwarded
+static void test_filter_no_tid(void) {
+    struct stream s;
+    stream_init(&s, 0);
+
+    temporal_layer_filter_update(&s.filter, 20.0);
+    temporal_layer_filter_update(&s.filter, 20.0);
+    stream_skip_to(&s, 2);
+    g_assert_cmpuint(stream_frame(&s, FALSE, FALSE), ==, 0);
+
+    // Still renumbered after the gap
+    const struct vp8_packet p = {.seq = s.seq_in++, .tid = -1, .frame_start = TRUE};
+    g_assert_true(stream_probe(&s, make_packet(&p)));
+    guint8 junk[4] = {0};
+    GstBuffer *not_rtp = make_buffer(junk, sizeof(junk));
+    GstPadProbeInfo info = {.type = GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_PUSH, .data = not_rtp};
+    g_assert_cmpint(temporal_layer_filter_probe(&s.filter, &info), ==, GST_PAD_PROBE_OK);
+    gst_buffer_unref(GST_PAD_PROBE_INFO_BUFFER(&info));
+}
+
+static void test_filter_buffer_list(void) {
+    struct temporal_layer_filter filter;
+    temporal_layer_filter_init(&filter, 3);
+    temporal_layer_filter_update(&filter, 20.0);
+    temporal_layer_filter_update(&filter, 20.0);
+
+    // A base layer frame and a layer 2 frame, two packets each
+    GstBufferList *list = gst_buffer_list_new();
+    for (guint i = 0; i < 4; i++) {
+        const struct vp8_packet p = {.seq = i, .tid = i < 2 ? 0 : 2, .frame_start = i % 2 == 0};
+        gst_buffer_list_add(list, make_packet(&p));
+    }
+
+    GstPadProbeInfo info = {.type = GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_PUSH, .data = list};
+    g_assert_cmpint(temporal_layer_filter_probe(&filter, &info), ==, GST_PAD_PROBE_OK);
+    list = GST_PAD_PROBE_INFO_BUFFER_LIST(&info);
+    g_assert_cmpuint(gst_buffer_list_length(list), ==, 2);
+    g_assert_cmpuint(buffer_seq(gst_buffer_list_get(list, 0)), ==, 0);
+    g_assert_cmpuint(buffer_seq(gst_buffer_list_get(list, 1)), ==, 1);
+    gst_buffer_list_unref(list);
+
+    // Nothing left: the whole list is dropped
+    list = gst_buffer_list_new();
+    for (guint i = 0; i < 2; i++) {
+        const struct vp8_packet p = {.seq = 4 + i, .tid = 1, .frame_start = i == 0};
+        gst_buffer_list_add(list, make_packet(&p));
+    }
+    info.data = list;
+    g_assert_cmpint(temporal_layer_filter_probe(&filter, &info), ==, GST_PAD_PROBE_DROP);
+    gst_buffer_list_unref(GST_PAD_PROBE_INFO_BUFFER_LIST(&info));
+
+    g_assert_cmpuint(temporal_layer_filter_get_dropped(&filter), ==, 4);
+}
+
+static void test_update(void) {
+    struct temporal_layer_filter filter;
+    temporal_layer_filter_init(&filter, 3);
+
+    // Clean from the start, nothing to add
+    for (guint i = 0; i < 2 * TEMPORAL_LAYERS_RAISE_INTERVALS; i++) {
+        g_assert_cmpuint(temporal_layer_filter_update(&filter, 0.0), ==, 3);
+    }
+
+    // One layer per congested interval, down to the base layer
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, TEMPORAL_LAYERS_DROP_LOSS_PERCENT + 0.1), ==, 2);
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, TEMPORAL_LAYERS_DROP_LOSS_PERCENT + 0.1), ==, 1);
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, 100.0), ==, 1);
+    // Neither congested nor clean holds
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, TEMPORAL_LAYERS_DROP_LOSS_PERCENT), ==, 1);
+
+    // Raising needs the intervals in a row, a middling one starts the count over
+    for (guint i = 0; i < TEMPORAL_LAYERS_RAISE_INTERVALS - 1; i++) {
+        g_assert_cmpuint(temporal_layer_filter_update(&filter, 0.0), ==, 1);
+    }
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, TEMPORAL_LAYERS_RAISE_LOSS_PERCENT), ==, 1);
+    for (guint i = 0; i < TEMPORAL_LAYERS_RAISE_INTERVALS - 1; i++) {
+        g_assert_cmpuint(temporal_layer_filter_update(&filter, 0.0), ==, 1);
+    }
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, 0.0), ==, 2);
+
+    // Congestion right after raising drops it again
+    g_assert_cmpuint(temporal_layer_filter_update(&filter, 50.0), ==, 1);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    gst_init(&argc, &argv);
+
+    g_test_add_func("/temporal_layers/parse", test_parse);
+    g_test_add_func("/temporal_layers/parse_invalid", test_parse_invalid);
+    g_test_add_func("/temporal_layers/filter/all_layers", test_filter_all_layers);
+    g_test_add_func("/temporal_layers/filter/drop_and_raise", test_filter_drop_and_raise);
+    g_test_add_func("/temporal_layers/filter/no_tid", test_filter_no_tid);
+    g_test_add_func("/temporal_layers/filter/buffer_list", test_filter_buffer_list);
+    g_test_add_func("/temporal_layers/update", test_update);
+
+    return g_test_run();
+}
@@ -0,0 +1,390 @@
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <string.h>
+
+#include "../src/server/vod_cache.h"
+
+#define VIDEO_FRAMES 60
+#define VIDEO_FRAME_NS (GST_SECOND / 30)
+#define VIDEO_PACKETS_PER_FRAME 3
+#define KEY_FRAME_INTERVAL 10
+#define AUDIO_PACKETS 100
+#define AUDIO_PACKET_NS (20 * GST_MSECOND)
+/// Passes over the whole cache in the benchmark
+#define BENCH_PASSES 200
+
+static gchar *tmp_dir;
+
+/*!
+ * Bytes of a fake RTP packet: the stream in the payload type, a per-stream counter in the sequence number, and a
+ * payload whose size varies, down to none at all.
+ */
+static GstBuffer *make_packet(const enum vod_cache_stream stream, const guint16 seq) {
+    const gsize size = 12 + (seq * 37) % 1200;
+    guint8 *data = g_malloc0(size);
+    data[0] = 0x80;
+    data[1] = 96 + stream;
+    data[2] = seq >> 8;
+    data[3] = seq & 0xff;
+    for (gsize i = 12; i < size; i++) {
+        data[i] = (guint8)(seq + i);
+    }
+    return gst_buffer_new_wrapped(data, size);
+}
+
+static void check_packet(const struct vod_cache_packet *packet, const enum vod_cache_stream stream, const guint16 seq) {
+    GstBuffer *expected = make_packet(stream, seq);
+    GstMapInfo map;
+    gst_buffer_map(expected, &map, GST_MAP_READ);
+    g_assert_cmpmem(packet->data, packet->size, map.data, map.size);
+    gst_buffer_unmap(expected, &map);
+    gst_buffer_unref(expected);
+}
+
+static guint16 packet_seq(const struct vod_cache_packet *packet) {
+    return (guint16)((packet->data[2] << 8) | packet->data[3]);
+}
+
+static GstClockTime key_frame_time(const guint key_frame) {
+    return key_frame * KEY_FRAME_INTERVAL * VIDEO_FRAME_NS;
+}
+
+static void add_video(struct vod_cache_writer *writer) {
+    guint16 seq = 0;
+    for (guint frame = 0; frame < VIDEO_FRAMES; frame++) {
+        for (guint i = 0; i < VIDEO_PACKETS_PER_FRAME; i++) {
+            GstBuffer *packet = make_packet(VOD_CACHE_STREAM_VIDEO, seq++);
+            const gboolean key_frame = frame % KEY_FRAME_INTERVAL == 0 && i == 0;
+            vod_cache_writer_add(writer, VOD_CACHE_STREAM_VIDEO, frame * VIDEO_FRAME_NS, key_frame, packet);
+            gst_buffer_unref(packet);
+        }
+    }
+}
+
+static void add_audio(struct vod_cache_writer *writer) {
+    for (guint16 seq = 0; seq < AUDIO_PACKETS; seq++) {
+        GstBuffer *packet = make_packet(VOD_CACHE_STREAM_AUDIO, seq);
+        vod_cache_writer_add(writer, VOD_CACHE_STREAM_AUDIO, seq * AUDIO_PACKET_NS, FALSE, packet);
+        gst_buffer_unref(packet);
+    }
+}
+
+static gpointer add_video_thread(gpointer writer) {
+    add_video(writer);
+    return NULL;
+}
+
+static gpointer add_audio_thread(gpointer writer) {
+    add_audio(writer);
+    return NULL;
+}
+
+/// Video, then audio, which the writer has to interleave
+static gchar *write_cache(const gchar *name) {
+    struct vod_cache_writer *writer = vod_cache_writer_new();
+    vod_cache_writer_set_clock_rate(writer, VOD_CACHE_STREAM_VIDEO, 90000);
+    vod_cache_writer_set_clock_rate(writer, VOD_CACHE_STREAM_AUDIO, 48000);
+    add_video(writer);
+    add_audio(writer);
+
+    gchar *path = g_build_filename(tmp_dir, name, NULL);
+    GError *error = NULL;
+    g_assert_true(vod_cache_writer_write(writer, path, &error));
+    g_assert_no_error(error);
+    vod_cache_writer_free(writer);
+
+    return path;
+}
+
+static struct vod_cache *open_cache(const gchar *path) {
+    GError *error = NULL;
+    struct vod_cache *cache = vod_cache_open(path, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(cache);
+    return cache;
+}
+
+static void test_round_trip(void) {
+    gchar *path = write_cache("round_trip.gwdv");
+    struct vod_cache *cache = open_cache(path);
+
+    g_assert_cmpuint(vod_cache_get_packets(cache, VOD_CACHE_STREAM_VIDEO), ==, VIDEO_FRAMES * VIDEO_PACKETS_PER_FRAME);
+    g_assert_cmpuint(vod_cache_get_packets(cache, VOD_CACHE_STREAM_AUDIO), ==, AUDIO_PACKETS);
+    g_assert_cmpuint(vod_cache_get_clock_rate(cache, VOD_CACHE_STREAM_VIDEO), ==, 90000);
+    g_assert_cmpuint(vod_cache_get_clock_rate(cache, VOD_CACHE_STREAM_AUDIO), ==, 48000);
+    // The last frame lasts as long as the one before it
+    g_assert_cmpuint(vod_cache_get_duration(cache), ==, VIDEO_FRAMES * VIDEO_FRAME_NS);
+
+    // Sorted by time, each stream in the order it was added, packets of a frame together
+    guint n[VOD_CACHE_N_STREAMS] = {0};
+    GstClockTime last_time = 0;
+    gsize offset = vod_cache_seek(cache, 0);
+    struct vod_cache_packet packet;
+    while (vod_cache_next(cache, &offset, &packet)) {
+        g_assert_cmpuint(offset % 8, ==, 0);
+        g_assert_cmpuint(packet.time, >=, last_time);
+        last_time = packet.time;
+
+        g_assert_cmpuint(packet_seq(&packet), ==, n[packet.stream]);
+        check_packet(&packet, packet.stream, n[packet.stream]);
+        if (packet.stream == VOD_CACHE_STREAM_VIDEO) {
+            const guint frame = n[packet.stream] / VIDEO_PACKETS_PER_FRAME;
+            g_assert_cmpuint(packet.time, ==, frame * VIDEO_FRAME_NS);
+            g_assert_cmpint(packet.key_frame,
+                            ==,
+                            frame % KEY_FRAME_INTERVAL == 0 && n[packet.stream] % VIDEO_PACKETS_PER_FRAME == 0);
+        } else {
+            g_assert_cmpuint(packet.time, ==, n[packet.stream] * AUDIO_PACKET_NS);
+            g_assert_false(packet.key_frame);
+        }
+        n[packet.stream]++;
+    }
+    g_assert_cmpuint(n[VOD_CACHE_STREAM_VIDEO], ==, VIDEO_FRAMES * VIDEO_PACKETS_PER_FRAME);
+    g_assert_cmpuint(n[VOD_CACHE_STREAM_AUDIO], ==, AUDIO_PACKETS);
+
+    vod_cache_free(cache);
+    g_remove(path);
+    g_free(path);
+}
+
+/// Every seek lands on the first packet of the last key frame at or before the time
+static void test_seek(void) {
+    gchar *path = write_cache("seek.gwdv");
+    struct vod_cache *cache = open_cache(path);
+    const guint n_key_frames = VIDEO_FRAMES / KEY_FRAME_INTERVAL;
+
+    for (guint k = 0; k < n_key_frames; k++) {
+        const GstClockTime times[] = {key_frame_time(k), key_frame_time(k) + 1, key_frame_time(k + 1) - 1};
+        for (guint i = 0; i < G_N_ELEMENTS(times); i++) {
+            gsize offset = vod_cache_seek(cache, times[i]);
+            struct vod_cache_packet packet;
+            g_assert_true(vod_cache_next(cache, &offset, &packet));
+            g_assert_cmpint(packet.stream, ==, VOD_CACHE_STREAM_VIDEO);
+            g_assert_true(packet.key_frame);
+            g_assert_cmpuint(packet.time, ==, key_frame_time(k));
+        }
+    }
+
+    // Past the end, the last key frame
+    gsize offset = vod_cache_seek(cache, G_MAXUINT64);
+    struct vod_cache_packet packet;
+    g_assert_true(vod_cache_next(cache, &offset, &packet));
+    g_assert_cmpuint(packet.time, ==, key_frame_time(n_key_frames - 1));
+
+    vod_cache_free(cache);
+    g_remove(path);
+    g_free(path);
+}
+
+/// Without any key frame, playing always starts from the beginning
+static void test_seek_no_key_frames(void) {
+    struct vod_cache_writer *writer = vod_cache_writer_new();
+    add_audio(writer);
+    gchar *path = g_build_filename(tmp_dir, "audio.gwdv", NULL);
+    g_assert_true(vod_cache_writer_write(writer, path, NULL));
+    vod_cache_writer_free(writer);
+
+    struct vod_cache *cache = open_cache(path);
+    gsize offset = vod_cache_seek(cache, AUDIO_PACKETS / 2 * AUDIO_PACKET_NS);
+    struct vod_cache_packet packet;
+    g_assert_true(vod_cache_next(cache, &offset, &packet));
+    g_assert_cmpuint(packet.time, ==, 0);
+
+    vod_cache_free(cache);
+    g_remove(path);
+    g_free(path);
+}
+
+static void test_writer_threads(void) {
+    struct vod_cache_writer *writer = vod_cache_writer_new();
+    GThread *video = g_thread_new("video", add_video_thread, writer);
+    GThread *audio = g_thread_new("audio", add_audio_thread, writer);
+    g_thread_join(video);
+    g_thread_join(audio);
+
+    gchar *path = g_build_filename(tmp_dir, "threads.gwdv", NULL);
+    g_assert_true(vod_cache_writer_write(writer, path, NULL));
+    vod_cache_writer_free(writer);
+
+    struct vod_cache *cache = open_cache(path);
+    guint n[VOD_CACHE_N_STREAMS] = {0};
+    gsize offset = vod_cache_seek(cache, 0);
+    struct vod_cache_packet packet;
+    while (vod_cache_next(cache, &offset, &packet)) {
+        g_assert_cmpuint(packet_seq(&packet), ==, n[packet.stream]);
+        n[packet.stream]++;
+    }
+    g_assert_cmpuint(n[VOD_CACHE_STREAM_VIDEO], ==, VIDEO_FRAMES * VIDEO_PACKETS_PER_FRAME);
+    g_assert_cmpuint(n[VOD_CACHE_STREAM_AUDIO], ==, AUDIO_PACKETS);
+
+    vod_cache_free(cache);
+    g_remove(path);
+    g_free(path);
+}
+
+static void test_packet_to_buffer(void) {
+    gchar *path = write_cache("buffer.gwdv");
+    struct vod_cache *cache = open_cache(path);
+
+    gsize offset = vod_cache_seek(cache, 0);
+    struct vod_cache_packet packet;
+    GstBuffer *with_payload = NULL;
+    struct vod_cache_packet with_payload_packet;
+    GstBuffer *header_only = NULL;
+    while ((with_payload == NULL || header_only == NULL) && vod_cache_next(cache, &offset, &packet)) {
+        GstBuffer *buffer = vod_cache_packet_to_buffer(cache, &packet);
+        g_assert_cmpuint(gst_buffer_get_size(buffer), ==, packet.size);
+
+        if (packet.size == 12 && header_only == NULL) {
+            header_only = buffer;
+        } else if (packet.size > 12 && with_payload == NULL) {
+            with_payload = buffer;
+            with_payload_packet = packet;
+        } else {
+            gst_buffer_unref(buffer);
+        }
+    }
+    g_assert_nonnull(with_payload);
+    g_assert_nonnull(header_only);
+    g_assert_cmpuint(gst_buffer_n_memory(header_only), ==, 1);
+
+    // The header is a copy, the payload is read in place
+    g_assert_cmpuint(gst_buffer_n_memory(with_payload), ==, 2);
+    GstMemory *header = gst_buffer_peek_memory(with_payload, 0);
+    GstMemory *payload = gst_buffer_peek_memory(with_payload, 1);
+    g_assert_false(GST_MEMORY_IS_READONLY(header));
+    g_assert_true(GST_MEMORY_IS_READONLY(payload));
+    GstMapInfo map;
+    g_assert_true(gst_memory_map(payload, &map, GST_MAP_READ));
+    g_assert_true(map.data == with_payload_packet.data + 12);
+    gst_memory_unmap(payload, &map);
+
+    // Rewriting the header leaves the cache alone
+    const guint8 ssrc[4] = {1, 2, 3, 4};
+    guint8 ssrc_before[4];
+    memcpy(ssrc_before, with_payload_packet.data + 8, sizeof(ssrc_before));
+    gst_buffer_fill(with_payload, 8, ssrc, sizeof(ssrc));
+    g_assert_true(gst_memory_map(header, &map, GST_MAP_READ));
+    g_assert_cmpmem(map.data + 8, 4, ssrc, 4);
+    gst_memory_unmap(header, &map);
+    g_assert_cmpmem(with_payload_packet.data + 8, 4, ssrc_before, 4);
+
+    // The buffers keep the mapping alive
+    vod_cache_free(cache);
+    g_assert_true(gst_buffer_map(with_payload, &map, GST_MAP_READ));
+    g_assert_cmpuint(map.data[12], ==, (guint8)(map.data[2] * 256 + map.data[3] + 12));
+    gst_buffer_unmap(with_payload, &map);
+
+    gst_buffer_unref(with_payload);
+    gst_buffer_unref(header_only);
+    g_remove(path);
+    g_free(path);
+}
+
+static void expect_open_error(const gchar *path, const gint code) {
+    GError *error = NULL;
+    g_assert_null(vod_cache_open(path, &error));
+    g_assert_error(error, G_FILE_ERROR, code);
+    g_clear_error(&error);
+}
+
+static void test_invalid(void) {
+    gchar *path = g_build_filename(tmp_dir, "invalid.gwdv", NULL);
+
+    expect_open_error(path, G_FILE_ERROR_NOENT);
+
+    g_assert_true(g_file_set_contents(path, "not a cache", -1, NULL));
+    expect_open_error(path, G_FILE_ERROR_INVAL);
+
+    // Another version
+    gchar *valid = write_cache("valid.gwdv");
+    gchar *contents;
+    gsize size;
+    g_assert_true(g_file_get_contents(valid, &contents, &size, NULL));
+    contents[4] = VOD_CACHE_VERSION + 1;
+    g_assert_true(g_file_set_contents(path, contents, (gssize)size, NULL));
+    expect_open_error(path, G_FILE_ERROR_INVAL);
+    contents[4] = VOD_CACHE_VERSION;
+
+    // Index cut short
+    g_assert_true(g_file_set_contents(path, contents, (gssize)size - 8, NULL));
+    expect_open_error(path, G_FILE_ERROR_INVAL);
+
+    // A damaged record ends the cache there. The first record is right after the 64 byte header, its size at +8.
+    const guint32 huge = GUINT32_TO_LE(G_MAXUINT32);
+    memcpy(contents + 64 + 8, &huge, sizeof(huge));
+    g_assert_true(g_file_set_contents(path, contents, (gssize)size, NULL));
+    struct vod_cache *cache = open_cache(path);
+    gsize offset = vod_cache_seek(cache, 0);
+    struct vod_cache_packet packet;
+    g_assert_false(vod_cache_next(cache, &offset, &packet));
+    vod_cache_free(cache);
+
+    // So does one of an unknown stream
+    g_free(contents);
+    g_assert_true(g_file_get_contents(valid, &contents, &size, NULL));
+    contents[64 + 12] = VOD_CACHE_N_STREAMS;
+    g_assert_true(g_file_set_contents(path, contents, (gssize)size, NULL));
+    cache = open_cache(path);
+    offset = vod_cache_seek(cache, 0);
+    g_assert_false(vod_cache_next(cache, &offset, &packet));
+    vod_cache_free(cache);
+
+    g_free(contents);
+    g_remove(valid);
+    g_free(valid);
+    g_remove(path);
+    g_free(path);
+}
+
+/// What serving costs per packet: reading it and making the buffer, without any pacing or pipeline
+static void test_bench(void) {
+    gchar *path = write_cache("bench.gwdv");
+    struct vod_cache *cache = open_cache(path);
+
+    guint n_packets = 0;
+    const gint64 start_us = g_get_monotonic_time();
+    for (guint pass = 0; pass < BENCH_PASSES; pass++) {
+        gsize offset = vod_cache_seek(cache, 0);
+        struct vod_cache_packet packet;
+        while (vod_cache_next(cache, &offset, &packet)) {
+            gst_buffer_unref(vod_cache_packet_to_buffer(cache, &packet));
+            n_packets++;
+        }
+    }
+    const gint64 elapsed_us = g_get_monotonic_time() - start_us;
+
+    const gdouble ns_per_packet = (gdouble)elapsed_us * 1000.0 / n_packets;
+    g_test_message("%u packets read and wrapped: %.0f ns per packet", n_packets, ns_per_packet);
+    if (g_test_perf()) {
+        g_test_minimized_result(ns_per_packet, "%.0f ns per packet", ns_per_packet);
+    }
+
+    vod_cache_free(cache);
+    g_remove(path);
+    g_free(path);
+}
+
+int main(int argc, char *argv[]) {
+    g_test_init(&argc, &argv, NULL);
+    gst_init(&argc, &argv);
+
+    GError *error = NULL;
+    tmp_dir = g_dir_make_tmp("gwd-vod-cache-XXXXXX", &error);
+    g_assert_no_error(error);
+
+    g_test_add_func("/vod_cache/round_trip", test_round_trip);
+    g_test_add_func("/vod_cache/seek", test_seek);
+    g_test_add_func("/vod_cache/seek_no_key_frames", test_seek_no_key_frames);
+    g_test_add_func("/vod_cache/writer_threads", test_writer_threads);
+    g_test_add_func("/vod_cache/packet_to_buffer", test_packet_to_buffer);
+    g_test_add_func("/vod_cache/invalid", test_invalid);
+    g_test_add_func("/vod_cache/bench", test_bench);
+
+    const int ret = g_test_run();
+
+    g_rmdir(tmp_dir);
+    g_free(tmp_dir);
+
+    return ret;
+}